@@ -4,6 +4,7 @@
 /* flags we export */
 int ceph_arch_neon = 0;
 int ceph_arch_aarch64_crc32 = 0;
+int ceph_arch_aarch64_pmull = 0;
 
 #include <stdio.h>
 
@@ -49,6 +50,9 @@ int ceph_arch_arm_probe(void)
 # if defined(HAVE_ARMV8_CRC) && defined(HWCAP_CRC32)
 	ceph_arch_aarch64_crc32 = (get_hwcap() & HWCAP_CRC32) == HWCAP_CRC32;
 # endif
+# if defined(HAVE_ARMV8_CRYPTO) && defined(HWCAP_PMULL)
+	ceph_arch_aarch64_pmull = (get_hwcap() & HWCAP_PMULL) == HWCAP_PMULL;
+# endif
 #else
 	if (0)
 		get_hwcap();  // make compiler shut up
@@ -7,6 +7,7 @@ extern "C" {
 
 extern int ceph_arch_neon;  /* true if we have ARM NEON or ASIMD abilities */
 extern int ceph_arch_aarch64_crc32;  /* true if we have AArch64 CRC32/CRC32C abilities */
+extern int ceph_arch_aarch64_pmull;  /* true if we have AArch64 PMULL (64-bit) abilities */
 
 extern int ceph_arch_arm_probe(void);
 
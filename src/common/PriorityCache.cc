@@ -0,0 +1,105 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2018 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "PriorityCache.h"
+
+namespace PriorityCache {
+  int64_t get_chunk(uint64_t usage, uint64_t chunk_bytes) {
+    if (chunk_bytes == 0) {
+      return usage;
+    }
+    // add a chunk of headroom and round up to the nearest chunk
+    uint64_t val = usage + chunk_bytes;
+    uint64_t r = val % chunk_bytes;
+    if (r > 0) {
+      val = val + chunk_bytes - r;
+    }
+    return val;
+  }
+
+  PriCache::~PriCache() {
+  }
+
+  static void balance_pri(int64_t *mem_avail, uint64_t chunk_bytes,
+			  const std::list<PriCache *>& caches, Priority pri)
+  {
+    std::list<PriCache *> tmp_caches;
+    for (auto c : caches) {
+      if (c->request_cache_bytes(pri, chunk_bytes) > 0) {
+	tmp_caches.push_back(c);
+      }
+    }
+
+    // hand out fair shares (by ratio) until every request is met or we
+    // run out of memory; caches that need less than their share return
+    // the rest
+    while (!tmp_caches.empty() && *mem_avail > 0) {
+      double cur_ratios = 0;
+      for (auto c : tmp_caches) {
+	cur_ratios += c->get_cache_ratio();
+      }
+      int64_t total_assigned = 0;
+      int64_t avail = *mem_avail;
+      for (auto it = tmp_caches.begin(); it != tmp_caches.end(); ) {
+	PriCache *c = *it;
+	double ratio = cur_ratios > 0 ?
+	  c->get_cache_ratio() / cur_ratios : 1.0 / tmp_caches.size();
+	int64_t fair_share = avail * ratio;
+	int64_t wanted = c->request_cache_bytes(pri, chunk_bytes);
+	if (wanted <= fair_share) {
+	  c->add_cache_bytes(pri, wanted);
+	  total_assigned += wanted;
+	  it = tmp_caches.erase(it);
+	} else {
+	  c->add_cache_bytes(pri, fair_share);
+	  total_assigned += fair_share;
+	  ++it;
+	}
+      }
+      *mem_avail -= total_assigned;
+      if (total_assigned == 0) {
+	break;
+      }
+    }
+  }
+
+  void balance(int64_t mem_avail, uint64_t chunk_bytes,
+	       const std::list<PriCache *>& caches)
+  {
+    // assign memory to each priority level, most important first
+    for (int i = 0; i < LAST; i++) {
+      Priority pri = static_cast<Priority>(i);
+      for (auto c : caches) {
+	c->set_cache_bytes(pri, 0);
+      }
+      balance_pri(&mem_avail, chunk_bytes, caches, pri);
+    }
+
+    // split whatever is left over by the configured ratios
+    for (auto c : caches) {
+      c->set_cache_bytes(LAST, 0);
+    }
+    if (mem_avail > 0 && !caches.empty()) {
+      double total_ratio = 0;
+      for (auto c : caches) {
+	total_ratio += c->get_cache_ratio();
+      }
+      for (auto c : caches) {
+	double ratio = total_ratio > 0 ?
+	  c->get_cache_ratio() / total_ratio : 1.0 / caches.size();
+	c->add_cache_bytes(LAST, mem_avail * ratio);
+      }
+    }
+  }
+}
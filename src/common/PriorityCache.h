@@ -0,0 +1,121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2018 Red Hat
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PRIORITY_CACHE_H
+#define CEPH_PRIORITY_CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <string>
+
+/**
+ * PriorityCache
+ *
+ * Interface implemented by caches that share a single memory budget.  A
+ * balancer asks every cache how many bytes it wants at each priority level,
+ * hands out the available memory from the most important level down, and
+ * finally tells each cache to commit to its new size.
+ */
+namespace PriorityCache {
+  enum Priority {
+    PRI0,  ///< must keep: pinned or otherwise unevictable data
+    PRI1,  ///< expensive to miss (e.g., onodes)
+    PRI2,  ///< cheaper to miss (e.g., kv blocks, object data)
+    PRI3,  ///< speculative growth, split by configured ratio
+    LAST = PRI3,
+  };
+
+  /// round usage up to the next chunk, leaving at least a chunk of headroom
+  int64_t get_chunk(uint64_t usage, uint64_t chunk_bytes);
+
+  struct PriCache {
+    virtual ~PriCache();
+
+    /// bytes wanted at priority pri, on top of what lower levels assigned
+    virtual int64_t request_cache_bytes(
+      PriorityCache::Priority pri, uint64_t chunk_bytes) const = 0;
+
+    /// bytes assigned at a given priority
+    virtual int64_t get_cache_bytes(PriorityCache::Priority pri) const = 0;
+
+    /// bytes assigned across all priorities
+    virtual int64_t get_cache_bytes() const = 0;
+
+    virtual void set_cache_bytes(PriorityCache::Priority pri,
+				 int64_t bytes) = 0;
+    virtual void add_cache_bytes(PriorityCache::Priority pri,
+				 int64_t bytes) = 0;
+
+    /// apply the assigned bytes to the cache; returns the committed size
+    virtual int64_t commit_cache_size(uint64_t total_cache) = 0;
+    virtual int64_t get_committed_size() const = 0;
+
+    /// relative share of memory left over once all requests are met
+    virtual double get_cache_ratio() const = 0;
+    virtual void set_cache_ratio(double ratio) = 0;
+
+    virtual std::string get_cache_name() const = 0;
+  };
+
+  /**
+   * Simple bookkeeping shared by most PriCache implementations.  Subclasses
+   * only need to provide request_cache_bytes, commit_cache_size and a name.
+   */
+  class BasePriCache : public PriCache {
+  protected:
+    int64_t cache_bytes[LAST + 1] = {0};
+    int64_t committed_bytes = 0;
+    double cache_ratio = 0;
+
+  public:
+    int64_t get_cache_bytes(PriorityCache::Priority pri) const override {
+      return cache_bytes[pri];
+    }
+    int64_t get_cache_bytes() const override {
+      int64_t total = 0;
+      for (int i = 0; i <= LAST; i++) {
+	total += cache_bytes[i];
+      }
+      return total;
+    }
+    void set_cache_bytes(PriorityCache::Priority pri, int64_t bytes) override {
+      cache_bytes[pri] = bytes;
+    }
+    void add_cache_bytes(PriorityCache::Priority pri, int64_t bytes) override {
+      cache_bytes[pri] += bytes;
+    }
+    int64_t get_committed_size() const override {
+      return committed_bytes;
+    }
+    double get_cache_ratio() const override {
+      return cache_ratio;
+    }
+    void set_cache_ratio(double ratio) override {
+      cache_ratio = ratio;
+    }
+  };
+
+  /**
+   * Assign mem_avail bytes to caches, most important priority first.  At
+   * each level every cache gets what it requests if there is enough;
+   * otherwise the remaining memory is split by cache ratio, with caches
+   * that need less than their share handing the rest to the others.
+   * Whatever is left after PRI2 is split by ratio at LAST.  The caches
+   * still have to commit_cache_size() for the new sizes to take effect.
+   */
+  void balance(int64_t mem_avail, uint64_t chunk_bytes,
+	       const std::list<PriCache *>& caches);
+}
+
+#endif
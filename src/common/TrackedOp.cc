@@ -10,7 +10,10 @@
  * Copyright 2013 Inktank
  */
 
+#include <limits>
+
 #include "TrackedOp.h"
+#include "common/Cycles.h"
 
 #define dout_context cct
 #define dout_subsys ceph_subsys_optracker
@@ -22,6 +25,34 @@ static ostream& _prefix(std::ostream* _dout)
   return *_dout << "-- op tracker -- ";
 }
 
+/*
+ * Event stamps are kept in ticks: CPU cycles when Cycles could be
+ * calibrated, nanoseconds of the wall clock otherwise.
+ */
+struct TickClock {
+  bool cycles;
+  double per_sec;
+};
+
+static const TickClock& tick_clock()
+{
+  static const TickClock clock = [] {
+    Cycles::init();
+    double per_sec = Cycles::per_second();
+    if (per_sec > 0)
+      return TickClock{true, per_sec};
+    return TickClock{false, 1000000000.0};
+  }();
+  return clock;
+}
+
+static int64_t now_ticks()
+{
+  if (tick_clock().cycles)
+    return Cycles::rdtsc();
+  return ceph_clock_now().to_nsec();
+}
+
 void OpHistory::on_shutdown()
 {
   Mutex::Locker history_lock(ops_history_lock);
@@ -139,7 +170,9 @@ OpTracker::OpTracker(CephContext *cct_, bool tracking, uint32_t num_shards):
   num_optracker_shards(num_shards),
   complaint_time(0), log_threshold(0),
   tracking_enabled(tracking),
-  lock("OpTracker::lock"), cct(cct_) {
+  cct(cct_) {
+    // calibrate the event clock now rather than on the first op
+    tick_clock();
     for (uint32_t i = 0; i < num_optracker_shards; i++) {
       char lock_name[32] = {0};
       snprintf(lock_name, sizeof(lock_name), "%s:%d", "OpTracker::ShardedLock", i);
@@ -161,7 +194,6 @@ bool OpTracker::dump_historic_ops(Formatter *f, bool by_duration, set<string> fi
   if (!tracking_enabled)
     return false;
 
-  RWLock::RLocker l(lock);
   utime_t now = ceph_clock_now();
   if (by_duration) {
     history.dump_ops_by_duration(now, f, filters);
@@ -200,7 +232,6 @@ bool OpTracker::dump_historic_slow_ops(Formatter *f, set<string> filters)
   if (!tracking_enabled)
     return false;
 
-  RWLock::RLocker l(lock);
   utime_t now = ceph_clock_now();
   history.dump_slow_ops(now, f, filters);
   return true;
@@ -211,7 +242,6 @@ bool OpTracker::dump_ops_in_flight(Formatter *f, bool print_only_blocked, set<st
   if (!tracking_enabled)
     return false;
 
-  RWLock::RLocker l(lock);
   f->open_object_section("ops_in_flight"); // overall dump
   uint64_t total_ops_in_flight = 0;
   f->open_array_section("ops"); // list of TrackedOps
@@ -246,7 +276,6 @@ bool OpTracker::register_inflight_op(TrackedOp *i)
   if (!tracking_enabled)
     return false;
 
-  RWLock::RLocker l(lock);
   uint64_t current_seq = ++seq;
   uint32_t shard_index = current_seq % num_optracker_shards;
   ShardedTrackingData* sdata = sharded_in_flight_list[shard_index];
@@ -277,7 +306,6 @@ void OpTracker::unregister_inflight_op(TrackedOp *i)
   if (!tracking_enabled)
     delete i;
   else {
-    RWLock::RLocker l(lock);
     i->state = TrackedOp::STATE_HISTORY;
     utime_t now = ceph_clock_now();
     history.insert(now, TrackedOpRef(i));
@@ -294,7 +322,6 @@ bool OpTracker::visit_ops_in_flight(utime_t* oldest_secs,
   utime_t oldest_op = now;
   uint64_t total_ops_in_flight = 0;
 
-  RWLock::RLocker l(lock);
   for (const auto sdata : sharded_in_flight_list) {
     assert(sdata);
     Mutex::Locker locker(sdata->ops_in_flight_lock_sharded);
@@ -381,10 +408,11 @@ bool OpTracker::check_ops_in_flight(std::string* summary,
   auto warn_on_slow_op = [&](TrackedOp& op) {
     stringstream ss;
     utime_t age = now - op.get_initiated();
+    const char *current = op.current;
     ss << "slow request " << age << " seconds old, received at "
        << op.get_initiated() << ": " << op.get_desc()
        << " currently "
-        << (op.current ? op.current : op.state_string());
+        << (current ? current : op.state_string());
     warnings.push_back(ss.str());
     // only those that have been shown will backoff
     op.warn_interval_multiplier *= 2;
@@ -427,18 +455,124 @@ void OpTracker::get_age_ms_histogram(pow2_hist_t *h)
 #undef dout_context
 #define dout_context tracker->cct
 
+TrackedOp::TrackedOp(OpTracker *_tracker, const utime_t& initiated) :
+  tracker(_tracker),
+  initiated_at(initiated),
+  base_stamp(ceph_clock_now()),
+  base_ticks(now_ticks())
+{
+}
+
+int64_t TrackedOp::stamp_to_ticks(utime_t stamp) const
+{
+  // keep unset stamps unset
+  if (stamp.is_zero())
+    return std::numeric_limits<int64_t>::min();
+  return ((double)stamp - (double)base_stamp) * tick_clock().per_sec;
+}
+
+utime_t TrackedOp::ticks_to_stamp(int64_t ticks) const
+{
+  if (ticks == std::numeric_limits<int64_t>::min())
+    return utime_t();
+  utime_t stamp = base_stamp;
+  double d = (double)ticks / tick_clock().per_sec;
+  if (d >= 0)
+    stamp += d;
+  else
+    stamp -= -d;
+  return stamp;
+}
+
+void TrackedOp::record_event(const char *event, int64_t ticks)
+{
+  uint64_t n = num_events++;
+  EventSlot &slot = event_ring[n % OPTRACKER_EVENT_RING_SIZE];
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.str.store(event, std::memory_order_relaxed);
+  slot.ticks.store(ticks, std::memory_order_relaxed);
+  slot.seq.store(n + 1, std::memory_order_release);
+  current = event;
+}
+
+bool TrackedOp::read_event(uint64_t n, Event *e) const
+{
+  const EventSlot &slot = event_ring[n % OPTRACKER_EVENT_RING_SIZE];
+  if (slot.seq.load(std::memory_order_acquire) != n + 1)
+    return false;  // not written yet, or already overwritten
+  const char *str = slot.str.load(std::memory_order_relaxed);
+  int64_t ticks = slot.ticks.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.seq.load(std::memory_order_relaxed) != n + 1)
+    return false;
+  *e = Event(ticks_to_stamp(ticks), str);
+  return true;
+}
+
+void TrackedOp::get_events(vector<Event> *events) const
+{
+  uint64_t end = num_events.load();
+  uint64_t n = end > OPTRACKER_EVENT_RING_SIZE ?
+    end - OPTRACKER_EVENT_RING_SIZE : 0;
+  events->reserve(end - n);
+  Event e(utime_t(), nullptr);
+  for (; n < end; ++n) {
+    if (read_event(n, &e))
+      events->push_back(e);
+  }
+}
+
+void TrackedOp::dump_events(Formatter *f) const
+{
+  vector<Event> events;
+  get_events(&events);
+  f->open_array_section("events");
+  for (auto& i : events) {
+    f->dump_object("event", i);
+  }
+  f->close_section();
+}
+
+double TrackedOp::get_duration() const
+{
+  uint64_t end = num_events.load();
+  Event e(utime_t(), nullptr);
+  if (end && read_event(end - 1, &e) && e.compare("done") == 0)
+    return e.stamp - get_initiated();
+  else
+    return ceph_clock_now() - get_initiated();
+}
+
+const char *TrackedOp::keep_event_string(const string &event)
+{
+  Mutex::Locker l(lock);
+  event_strings.push_back(event);
+  return event_strings.back().c_str();
+}
+
+void TrackedOp::mark_event_string(const string &event)
+{
+  if (!state)
+    return;
+  mark_event(keep_event_string(event));
+}
+
 void TrackedOp::mark_event_string(const string &event, utime_t stamp)
 {
   if (!state)
     return;
+  mark_event(keep_event_string(event), stamp);
+}
 
-  {
-    Mutex::Locker l(lock);
-    events.push_back(Event(stamp, event));
-    current = events.back().c_str();
-  }
+void TrackedOp::mark_event(const char *event)
+{
+  if (!state)
+    return;
+
+  record_event(event, now_ticks() - base_ticks);
   dout(6) << " seq: " << seq
-	  << ", time: " << stamp
+	  << ", time: " << ceph_clock_now()
 	  << ", event: " << event
 	  << ", op: " << get_desc()
 	  << dendl;
@@ -450,11 +584,7 @@ void TrackedOp::mark_event(const char *event, utime_t stamp)
   if (!state)
     return;
 
-  {
-    Mutex::Locker l(lock);
-    events.push_back(Event(stamp, event));
-    current = event;
-  }
+  record_event(event, stamp_to_ticks(stamp));
   dout(6) << " seq: " << seq
 	  << ", time: " << stamp
 	  << ", event: " << event
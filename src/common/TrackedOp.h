@@ -17,9 +17,8 @@
 #include <atomic>
 #include "common/histogram.h"
 #include "msg/Message.h"
-#include "common/RWLock.h"
 
-#define OPTRACKER_PREALLOC_EVENTS 20
+#define OPTRACKER_EVENT_RING_SIZE 32
 
 class TrackedOp;
 typedef boost::intrusive_ptr<TrackedOp> TrackedOpRef;
@@ -70,7 +69,6 @@ class OpTracker {
   float complaint_time;
   int log_threshold;
   std::atomic<bool> tracking_enabled;
-  RWLock       lock;
 
 public:
   CephContext *cct;
@@ -188,26 +186,19 @@ protected:
 
   utime_t initiated_at;
 
+  /// an event as read back from the ring
   struct Event {
     utime_t stamp;
-    string str;
-    const char *cstr = nullptr;
+    const char *str;
 
-    Event(utime_t t, const string& s) : stamp(t), str(s) {}
-    Event(utime_t t, const char *s) : stamp(t), cstr(s) {}
+    Event(utime_t t, const char *s) : stamp(t), str(s) {}
 
     int compare(const char *s) const {
-      if (cstr)
-	return strcmp(cstr, s);
-      else
-	return str.compare(s);
+      return strcmp(str, s);
     }
 
     const char *c_str() const {
-      if (cstr)
-	return cstr;
-      else
-	return str.c_str();
+      return str;
     }
 
     void dump(Formatter *f) const {
@@ -216,9 +207,35 @@ protected:
     }
   };
 
-  vector<Event> events;    ///< list of events and their times
-  mutable Mutex lock = {"TrackedOp::lock"}; ///< to protect the events list
-  const char *current = 0; ///< the current state the event is in
+private:
+  /**
+   * Events are recorded without a lock into a fixed ring holding the
+   * last OPTRACKER_EVENT_RING_SIZE of them.  An event is a pointer to
+   * its name, which must outlive the op (a literal, or a string kept in
+   * event_strings), and a stamp in ticks since base_stamp.  The n-th
+   * event goes to slot n % OPTRACKER_EVENT_RING_SIZE, and that slot is
+   * readable while its seq is n + 1.
+   */
+  struct EventSlot {
+    std::atomic<uint64_t> seq = {0};
+    std::atomic<const char*> str = {nullptr};
+    std::atomic<int64_t> ticks = {0};
+  };
+  EventSlot event_ring[OPTRACKER_EVENT_RING_SIZE];
+  std::atomic<uint64_t> num_events = {0};
+  utime_t base_stamp;       ///< wall clock time at base_ticks
+  int64_t base_ticks;
+  list<string> event_strings; ///< names given to mark_event_string()
+
+  const char *keep_event_string(const string &event);
+  void record_event(const char *event, int64_t ticks);
+  bool read_event(uint64_t n, Event *e) const;
+  int64_t stamp_to_ticks(utime_t stamp) const;
+  utime_t ticks_to_stamp(int64_t ticks) const;
+
+protected:
+  mutable Mutex lock = {"TrackedOp::lock"}; ///< protects desc_str and event_strings
+  std::atomic<const char *> current = {nullptr}; ///< the last event marked
   uint64_t seq = 0;        ///< a unique value set by the OpTracker
 
   uint32_t warn_interval_multiplier = 1; //< limits output of a given op warning
@@ -234,12 +251,12 @@ protected:
   mutable const char *desc = nullptr;  ///< readable without lock
   mutable atomic<bool> want_new_desc = {false};
 
-  TrackedOp(OpTracker *_tracker, const utime_t& initiated) :
-    tracker(_tracker),
-    initiated_at(initiated)
-  {
-    events.reserve(OPTRACKER_PREALLOC_EVENTS);
-  }
+  TrackedOp(OpTracker *_tracker, const utime_t& initiated);
+
+  /// the events still in the ring, oldest first
+  void get_events(vector<Event> *events) const;
+  /// dump the events still in the ring as an "events" array
+  void dump_events(Formatter *f) const;
 
   /// output any type-specific data you want to get when dump() is called
   virtual void _dump(Formatter *f) const {}
@@ -310,29 +327,23 @@ public:
     return initiated_at;
   }
 
-  double get_duration() const {
-    Mutex::Locker l(lock);
-    if (!events.empty() && events.rbegin()->compare("done") == 0)
-      return events.rbegin()->stamp - get_initiated();
-    else
-      return ceph_clock_now() - get_initiated();
-  }
+  double get_duration() const;
 
-  void mark_event_string(const string &event,
-			 utime_t stamp=ceph_clock_now());
-  void mark_event(const char *event,
-		  utime_t stamp=ceph_clock_now());
+  void mark_event_string(const string &event);
+  void mark_event_string(const string &event, utime_t stamp);
+  /// @param event must outlive the op, e.g. a string literal
+  void mark_event(const char *event);
+  void mark_event(const char *event, utime_t stamp);
 
   virtual const char *state_string() const {
-    Mutex::Locker l(lock);
-    return events.rbegin()->c_str();
+    return current;
   }
 
   void dump(utime_t now, Formatter *f) const;
 
   void tracking_start() {
     if (tracker->register_inflight_op(this)) {
-      events.push_back(Event(initiated_at, "initiated"));
+      record_event("initiated", stamp_to_ticks(initiated_at));
       state = STATE_LIVE;
     }
   }
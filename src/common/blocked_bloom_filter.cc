@@ -0,0 +1,155 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <cmath>
+
+#include "common/blocked_bloom_filter.h"
+#include "common/Formatter.h"
+
+blocked_bloom_filter::blocked_bloom_filter(uint64_t target_element_count,
+					   double false_positive_probability,
+					   uint64_t seed)
+  : seed(seed),
+    target_element_count(target_element_count)
+{
+  double fpp = false_positive_probability;
+  if (fpp <= 0 || fpp >= 1)
+    fpp = .01;
+  // each element sets one bit in each of the eight words of a block.
+  // this ignores the uneven load across blocks, which roughly doubles
+  // the rate; size for half of it to make up for that.
+  double bits = -8.0 * std::max<uint64_t>(target_element_count, 1) /
+    std::log(1.0 - std::pow(fpp / 2, 1.0 / 8));
+  uint64_t n = std::max<uint64_t>(std::ceil(bits / 256), 1);
+  // round the count up to a multiple of the largest power of two no
+  // more than a 16th of it (or to a power of two if small), costing at
+  // most a 16th more memory but letting compress() fold all the way
+  // down to 16-32 blocks
+  if (n > 16) {
+    uint64_t g = 1;
+    while (g * 32 <= n)
+      g <<= 1;
+    n = (n + g - 1) / g * g;
+  } else {
+    uint64_t p = 1;
+    while (p < n)
+      p <<= 1;
+    n = p;
+  }
+  blocks.resize(n, block_t());
+}
+
+double blocked_bloom_filter::density() const
+{
+  if (blocks.empty())
+    return 0;
+  uint64_t bits = 0;
+  for (auto& b : blocks) {
+    for (unsigned j = 0; j < 8; ++j)
+      bits += __builtin_popcount(b.word[j]);
+  }
+  return (double)bits / (blocks.size() * 256.0);
+}
+
+uint64_t blocked_bloom_filter::approx_unique_element_count() const
+{
+  // every element lands in one of the 32 bits of each word of its block,
+  // so the fraction of clear bits is about exp(-n / (32 * num_blocks))
+  double clear = 1.0 - density();
+  if (clear <= 0)
+    return insert_count;
+  uint64_t n = std::llround(-32.0 * blocks.size() * std::log(clear));
+  return std::min(n, insert_count);
+}
+
+void blocked_bloom_filter::compress(double max_density)
+{
+  while (blocks.size() % 2 == 0) {
+    size_t half = blocks.size() / 2;
+    uint64_t folded_bits = 0;
+    for (size_t i = 0; i < half; ++i) {
+      for (unsigned j = 0; j < 8; ++j) {
+	folded_bits += __builtin_popcount(blocks[2 * i].word[j] |
+					  blocks[2 * i + 1].word[j]);
+      }
+    }
+    if ((double)folded_bits / (half * 256.0) > max_density)
+      break;
+    for (size_t i = 0; i < half; ++i) {
+      block_t b;
+      for (unsigned j = 0; j < 8; ++j)
+	b.word[j] = blocks[2 * i].word[j] | blocks[2 * i + 1].word[j];
+      blocks[i] = b;
+    }
+    blocks.resize(half);
+    blocks.shrink_to_fit();
+  }
+}
+
+void blocked_bloom_filter::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  encode(seed, bl);
+  encode(insert_count, bl);
+  encode(target_element_count, bl);
+  encode((uint32_t)blocks.size(), bl);
+  bufferptr bp(size());
+  ceph_le32 *out = reinterpret_cast<ceph_le32*>(bp.c_str());
+  for (auto& b : blocks) {
+    for (unsigned j = 0; j < 8; ++j)
+      *out++ = b.word[j];
+  }
+  encode(bp, bl);
+  ENCODE_FINISH(bl);
+}
+
+void blocked_bloom_filter::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  decode(seed, p);
+  decode(insert_count, p);
+  decode(target_element_count, p);
+  uint32_t n;
+  decode(n, p);
+  bufferlist t;
+  decode(t, p);
+  if (t.length() != n * sizeof(block_t))
+    throw buffer::malformed_input("blocked_bloom_filter table size mismatch");
+  const ceph_le32 *in = reinterpret_cast<const ceph_le32*>(t.c_str());
+  blocks.resize(n);
+  blocks.shrink_to_fit();
+  for (auto& b : blocks) {
+    for (unsigned j = 0; j < 8; ++j)
+      b.word[j] = *in++;
+  }
+  DECODE_FINISH(p);
+}
+
+void blocked_bloom_filter::dump(Formatter *f) const
+{
+  f->dump_unsigned("seed", seed);
+  f->dump_unsigned("insert_count", insert_count);
+  f->dump_unsigned("target_element_count", target_element_count);
+  f->dump_unsigned("num_blocks", blocks.size());
+  f->open_array_section("bit_table");
+  for (auto& b : blocks) {
+    for (unsigned j = 0; j < 8; ++j)
+      f->dump_unsigned("word", b.word[j]);
+  }
+  f->close_section();
+}
+
+void blocked_bloom_filter::generate_test_instances(
+  std::list<blocked_bloom_filter*>& ls)
+{
+  ls.push_back(new blocked_bloom_filter);
+  ls.push_back(new blocked_bloom_filter(10, .5, 1));
+  ls.back()->insert(1);
+  ls.back()->insert(2);
+  ls.push_back(new blocked_bloom_filter(50, .01, 1));
+  ls.back()->insert(1);
+  ls.back()->insert(2);
+  ls.back()->insert(3);
+  ls.back()->insert(4);
+  ls.back()->insert(5);
+}
@@ -1136,7 +1136,6 @@ public:
   {
     if (this != &other) {
       bl = other.bl;
-      ls = other.ls;
       off = other.off;
       p = other.p;
       p_off = other.p_off;
@@ -1146,7 +1145,7 @@ public:
 
   template<bool is_const>
   buffer::list::iterator_impl<is_const>::iterator_impl(bl_t *l, unsigned o)
-    : bl(l), ls(&bl->_buffers), off(0), p(ls->begin()), p_off(0)
+    : bl(l), off(0), p(0), p_off(0)
   {
     advance(o);
   }
@@ -1162,11 +1161,11 @@ public:
     if (o > 0) {
       p_off += o;
       while (p_off > 0) {
-	if (p == ls->end())
+	if (p == bl->_buffers.size())
 	  throw end_of_buffer();
-	if (p_off >= p->length()) {
+	if (p_off >= bl->_buffers[p].length()) {
 	  // skip this buffer
-	  p_off -= p->length();
+	  p_off -= bl->_buffers[p].length();
 	  p++;
 	} else {
 	  // somewhere in this buffer!
@@ -1185,9 +1184,9 @@ public:
 	off -= d;
 	o += d;
       } else if (off > 0) {
-	assert(p != ls->begin());
+	assert(p > 0);
 	p--;
-	p_off = p->length();
+	p_off = bl->_buffers[p].length();
       } else {
 	throw end_of_buffer();
       }
@@ -1197,7 +1196,7 @@ public:
   template<bool is_const>
   void buffer::list::iterator_impl<is_const>::seek(unsigned o)
   {
-    p = ls->begin();
+    p = 0;
     off = p_off = 0;
     advance(o);
   }
@@ -1205,16 +1204,16 @@ public:
   template<bool is_const>
   char buffer::list::iterator_impl<is_const>::operator*() const
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       throw end_of_buffer();
-    return (*p)[p_off];
+    return bl->_buffers[p][p_off];
   }
 
   template<bool is_const>
   buffer::list::iterator_impl<is_const>&
   buffer::list::iterator_impl<is_const>::operator++()
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       throw end_of_buffer();
     advance(1);
     return *this;
@@ -1223,9 +1222,9 @@ public:
   template<bool is_const>
   buffer::ptr buffer::list::iterator_impl<is_const>::get_current_ptr() const
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       throw end_of_buffer();
-    return ptr(*p, p_off, p->length() - p_off);
+    return ptr(bl->_buffers[p], p_off, bl->_buffers[p].length() - p_off);
   }
 
   // copy data out.
@@ -1233,15 +1232,15 @@ public:
   template<bool is_const>
   void buffer::list::iterator_impl<is_const>::copy(unsigned len, char *dest)
   {
-    if (p == ls->end()) seek(off);
+    if (p == bl->_buffers.size()) seek(off);
     while (len > 0) {
-      if (p == ls->end())
+      if (p == bl->_buffers.size())
 	throw end_of_buffer();
-      assert(p->length() > 0);
+      assert(bl->_buffers[p].length() > 0);
 
-      unsigned howmuch = p->length() - p_off;
+      unsigned howmuch = bl->_buffers[p].length() - p_off;
       if (len < howmuch) howmuch = len;
-      p->copy_out(p_off, howmuch, dest);
+      bl->_buffers[p].copy_out(p_off, howmuch, dest);
       dest += howmuch;
 
       len -= howmuch;
@@ -1261,9 +1260,9 @@ public:
     if (!len) {
       return;
     }
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       throw end_of_buffer();
-    assert(p->length() > 0);
+    assert(bl->_buffers[p].length() > 0);
     dest = create(len);
     copy(len, dest.c_str());
   }
@@ -1274,15 +1273,15 @@ public:
     if (!len) {
       return;
     }
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       throw end_of_buffer();
-    assert(p->length() > 0);
-    unsigned howmuch = p->length() - p_off;
+    assert(bl->_buffers[p].length() > 0);
+    unsigned howmuch = bl->_buffers[p].length() - p_off;
     if (howmuch < len) {
       dest = create(len);
       copy(len, dest.c_str());
     } else {
-      dest = ptr(*p, p_off, len);
+      dest = ptr(bl->_buffers[p], p_off, len);
       advance(len);
     }
   }
@@ -1290,16 +1289,16 @@ public:
   template<bool is_const>
   void buffer::list::iterator_impl<is_const>::copy(unsigned len, list &dest)
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       seek(off);
     while (len > 0) {
-      if (p == ls->end())
+      if (p == bl->_buffers.size())
 	throw end_of_buffer();
 
-      unsigned howmuch = p->length() - p_off;
+      unsigned howmuch = bl->_buffers[p].length() - p_off;
       if (len < howmuch)
 	howmuch = len;
-      dest.append(*p, p_off, howmuch);
+      dest.append(bl->_buffers[p], p_off, howmuch);
 
       len -= howmuch;
       advance(howmuch);
@@ -1309,14 +1308,14 @@ public:
   template<bool is_const>
   void buffer::list::iterator_impl<is_const>::copy(unsigned len, std::string &dest)
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       seek(off);
     while (len > 0) {
-      if (p == ls->end())
+      if (p == bl->_buffers.size())
 	throw end_of_buffer();
 
-      unsigned howmuch = p->length() - p_off;
-      const char *c_str = p->c_str();
+      unsigned howmuch = bl->_buffers[p].length() - p_off;
+      const char *c_str = bl->_buffers[p].c_str();
       if (len < howmuch)
 	howmuch = len;
       dest.append(c_str + p_off, howmuch);
@@ -1329,15 +1328,15 @@ public:
   template<bool is_const>
   void buffer::list::iterator_impl<is_const>::copy_all(list &dest)
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       seek(off);
     while (1) {
-      if (p == ls->end())
+      if (p == bl->_buffers.size())
 	return;
-      assert(p->length() > 0);
+      assert(bl->_buffers[p].length() > 0);
 
-      unsigned howmuch = p->length() - p_off;
-      const char *c_str = p->c_str();
+      unsigned howmuch = bl->_buffers[p].length() - p_off;
+      const char *c_str = bl->_buffers[p].c_str();
       dest.append(c_str + p_off, howmuch);
 
       advance(howmuch);
@@ -1348,16 +1347,16 @@ public:
   size_t buffer::list::iterator_impl<is_const>::get_ptr_and_advance(
     size_t want, const char **data)
   {
-    if (p == ls->end()) {
+    if (p == bl->_buffers.size()) {
       seek(off);
-      if (p == ls->end()) {
+      if (p == bl->_buffers.size()) {
 	return 0;
       }
     }
-    *data = p->c_str() + p_off;
-    size_t l = std::min<size_t>(p->length() - p_off, want);
+    *data = bl->_buffers[p].c_str() + p_off;
+    size_t l = std::min<size_t>(bl->_buffers[p].length() - p_off, want);
     p_off += l;
-    if (p_off == p->length()) {
+    if (p_off == bl->_buffers[p].length()) {
       ++p;
       p_off = 0;
     }
@@ -1389,7 +1388,7 @@ public:
     : iterator_impl(l, o)
   {}
 
-  buffer::list::iterator::iterator(bl_t *l, unsigned o, list_iter_t ip, unsigned po)
+  buffer::list::iterator::iterator(bl_t *l, unsigned o, unsigned ip, unsigned po)
     : iterator_impl(l, o, ip, po)
   {}
 
@@ -1405,10 +1404,10 @@ public:
 
   char buffer::list::iterator::operator*()
   {
-    if (p == ls->end()) {
+    if (p == bl->_buffers.size()) {
       throw end_of_buffer();
     }
-    return (*p)[p_off];
+    return bl->_buffers[p][p_off];
   }
 
   buffer::list::iterator& buffer::list::iterator::operator++()
@@ -1419,10 +1418,10 @@ public:
 
   buffer::ptr buffer::list::iterator::get_current_ptr()
   {
-    if (p == ls->end()) {
+    if (p == bl->_buffers.size()) {
       throw end_of_buffer();
     }
-    return ptr(*p, p_off, p->length() - p_off);
+    return ptr(bl->_buffers[p], p_off, bl->_buffers[p].length() - p_off);
   }
 
   void buffer::list::iterator::copy(unsigned len, char *dest)
@@ -1469,16 +1468,16 @@ public:
   void buffer::list::iterator::copy_in(unsigned len, const char *src, bool crc_reset)
   {
     // copy
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       seek(off);
     while (len > 0) {
-      if (p == ls->end())
+      if (p == bl->_buffers.size())
 	throw end_of_buffer();
       
-      unsigned howmuch = p->length() - p_off;
+      unsigned howmuch = bl->_buffers[p].length() - p_off;
       if (len < howmuch)
 	howmuch = len;
-      p->copy_in(p_off, howmuch, src, crc_reset);
+      bl->_buffers[p].copy_in(p_off, howmuch, src, crc_reset);
 	
       src += howmuch;
       len -= howmuch;
@@ -1488,16 +1487,14 @@ public:
   
   void buffer::list::iterator::copy_in(unsigned len, const list& otherl)
   {
-    if (p == ls->end())
+    if (p == bl->_buffers.size())
       seek(off);
     unsigned left = len;
-    for (std::list<ptr>::const_iterator i = otherl._buffers.begin();
-	 i != otherl._buffers.end();
-	 ++i) {
-      unsigned l = (*i).length();
+    for (const auto& i : otherl._buffers) {
+      unsigned l = i.length();
       if (left < l)
 	l = left;
-      copy_in(l, i->c_str());
+      copy_in(l, i.c_str());
       left -= l;
       if (left == 0)
 	break;
@@ -1538,8 +1535,8 @@ public:
 
     // buffer-wise comparison
     if (true) {
-      std::list<ptr>::const_iterator a = _buffers.begin();
-      std::list<ptr>::const_iterator b = other._buffers.begin();
+      buffers_t::const_iterator a = _buffers.begin();
+      buffers_t::const_iterator b = other._buffers.begin();
       unsigned aoff = 0, boff = 0;
       while (a != _buffers.end()) {
 	unsigned len = a->length() - aoff;
@@ -1578,7 +1575,7 @@ public:
 
   bool buffer::list::can_zero_copy() const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it)
       if (!it->can_zero_copy())
@@ -1595,7 +1592,7 @@ public:
 
   bool buffer::list::is_aligned(unsigned align) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) 
       if (!it->is_aligned(align))
@@ -1605,7 +1602,7 @@ public:
 
   bool buffer::list::is_n_align_sized(unsigned align) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) 
       if (!it->is_n_align_sized(align))
@@ -1616,7 +1613,7 @@ public:
   bool buffer::list::is_aligned_size_and_memory(unsigned align_size,
 						  unsigned align_memory) const
   {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (!it->is_aligned(align_memory) || !it->is_n_align_sized(align_size))
@@ -1626,7 +1623,7 @@ public:
   }
 
   bool buffer::list::is_zero() const {
-    for (std::list<ptr>::const_iterator it = _buffers.begin();
+    for (buffers_t::const_iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (!it->is_zero()) {
@@ -1638,7 +1635,7 @@ public:
 
   void buffer::list::zero()
   {
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it)
       it->zero();
@@ -1648,7 +1645,7 @@ public:
   {
     assert(o+l <= _len);
     unsigned p = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       if (p + it->length() > o) {
@@ -1678,7 +1675,7 @@ public:
 
   bool buffer::list::is_contiguous() const
   {
-    return &(*_buffers.begin()) == &(*_buffers.rbegin());
+    return _buffers.size() <= 1;
   }
 
   bool buffer::list::is_n_page_sized() const
@@ -1736,7 +1733,7 @@ public:
   void buffer::list::rebuild(ptr& nb)
   {
     unsigned pos = 0;
-    for (std::list<ptr>::iterator it = _buffers.begin();
+    for (buffers_t::iterator it = _buffers.begin();
 	 it != _buffers.end();
 	 ++it) {
       nb.copy_in(pos, it->length(), it->c_str(), false);
@@ -1765,7 +1762,7 @@ public:
 	&& _len > (max_buffers * align_size)) {
       align_size = round_up_to(round_up_to(_len, max_buffers) / max_buffers, align_size);
     }
-    std::list<ptr>::iterator p = _buffers.begin();
+    buffers_t::iterator p = _buffers.begin();
     while (p != _buffers.end()) {
       // keep anything that's already align and sized aligned
       if (p->is_aligned(align_memory) && p->is_n_align_sized(align_size)) {
@@ -1781,6 +1778,7 @@ public:
       // consolidate unaligned items, until we get something that is sized+aligned
       list unaligned;
       unsigned offset = 0;
+      buffers_t::iterator first = p;
       do {
         /*cout << " segment " << (void*)p->c_str()
                << " offset " << ((unsigned long)p->c_str() & (align - 1))
@@ -1790,7 +1788,7 @@ public:
         */
         offset += p->length();
         unaligned.push_back(*p);
-        _buffers.erase(p++);
+        ++p;
       } while (p != _buffers.end() &&
   	     (!p->is_aligned(align_memory) ||
   	      !p->is_n_align_sized(align_size) ||
@@ -1800,7 +1798,9 @@ public:
         unaligned.rebuild(nb);
         _memcopy_count += unaligned._len;
       }
-      _buffers.insert(p, unaligned._buffers.front());
+      p = _buffers.erase(first, p);
+      p = _buffers.insert(p, std::move(unaligned._buffers.front()));
+      ++p;
     }
     last_p = begin();
 
@@ -1834,7 +1834,14 @@ public:
     _len += bl._len;
     if (!(flags & CLAIM_ALLOW_NONSHAREABLE))
       bl.make_shareable();
-    _buffers.splice(_buffers.end(), bl._buffers );
+    if (_buffers.empty()) {
+      _buffers = std::move(bl._buffers);
+    } else {
+      _buffers.insert(_buffers.end(),
+		      std::make_move_iterator(bl._buffers.begin()),
+		      std::make_move_iterator(bl._buffers.end()));
+    }
+    bl._buffers.clear();
     bl._len = 0;
     bl.last_p = bl.begin();
   }
@@ -1845,7 +1852,10 @@ public:
     _len += bl._len;
     if (!(flags & CLAIM_ALLOW_NONSHAREABLE))
       bl.make_shareable();
-    _buffers.splice(_buffers.begin(), bl._buffers );
+    _buffers.insert(_buffers.begin(),
+		    std::make_move_iterator(bl._buffers.begin()),
+		    std::make_move_iterator(bl._buffers.end()));
+    bl._buffers.clear();
     bl._len = 0;
     bl.last_p = bl.begin();
     // we modified _buffers
@@ -1855,7 +1865,7 @@ public:
   void buffer::list::claim_append_piecewise(list& bl)
   {
     // steal the other guy's buffers
-    for (std::list<buffer::ptr>::const_iterator i = bl.buffers().begin();
+    for (buffers_t::const_iterator i = bl.buffers().begin();
         i != bl.buffers().end(); i++) {
       append(*i, 0, i->length());
     }
@@ -1980,10 +1990,7 @@ public:
   void buffer::list::append(const list& bl)
   {
     _len += bl._len;
-    for (std::list<ptr>::const_iterator p = bl._buffers.begin();
-	 p != bl._buffers.end();
-	 ++p) 
-      _buffers.push_back(*p);
+    _buffers.insert(_buffers.end(), bl._buffers.begin(), bl._buffers.end());
   }
 
   void buffer::list::append(std::istream& in)
@@ -2002,7 +2009,8 @@ public:
     ptr bp(len);
     bp.zero(false);
     _len += len;
-    _buffers.emplace_front(std::move(bp));
+    _buffers.emplace(_buffers.begin(), std::move(bp));
+    last_p = begin();
   }
   
   void buffer::list::append_zero(unsigned len)
@@ -2021,7 +2029,7 @@ public:
     if (n >= _len)
       throw end_of_buffer();
     
-    for (std::list<ptr>::const_iterator p = _buffers.begin();
+    for (buffers_t::const_iterator p = _buffers.begin();
 	 p != _buffers.end();
 	 ++p) {
       if (n >= p->length()) {
@@ -2041,7 +2049,7 @@ public:
     if (_buffers.empty())
       return 0;                         // no buffers
 
-    std::list<ptr>::const_iterator iter = _buffers.begin();
+    buffers_t::const_iterator iter = _buffers.begin();
     ++iter;
 
     if (iter != _buffers.end())
@@ -2052,7 +2060,7 @@ public:
   string buffer::list::to_str() const {
     string s;
     s.reserve(length());
-    for (std::list<ptr>::const_iterator p = _buffers.begin();
+    for (buffers_t::const_iterator p = _buffers.begin();
 	 p != _buffers.end();
 	 ++p) {
       if (p->length()) {
@@ -2072,7 +2080,7 @@ public:
     }
 
     unsigned off = orig_off;
-    std::list<ptr>::iterator curbuf = _buffers.begin();
+    buffers_t::iterator curbuf = _buffers.begin();
     while (off > 0 && off >= curbuf->length()) {
       off -= curbuf->length();
       ++curbuf;
@@ -2096,6 +2104,7 @@ public:
 
       tmp.rebuild();
       _buffers.insert(curbuf, tmp._buffers.front());
+      last_p = begin();
       return tmp.c_str() + off;
     }
 
@@ -2112,7 +2121,7 @@ public:
     clear();
 
     // skip off
-    std::list<ptr>::const_iterator curbuf = other._buffers.begin();
+    buffers_t::const_iterator curbuf = other._buffers.begin();
     while (off > 0 &&
 	   off >= curbuf->length()) {
       // skip this buffer
@@ -2155,7 +2164,7 @@ public:
     //cout << "splice off " << off << " len " << len << " ... mylen = " << length() << std::endl;
       
     // skip off
-    std::list<ptr>::iterator curbuf = _buffers.begin();
+    buffers_t::iterator curbuf = _buffers.begin();
     while (off > 0) {
       assert(curbuf != _buffers.end());
       if (off >= (*curbuf).length()) {
@@ -2174,7 +2183,8 @@ public:
       // add a reference to the front bit
       //  insert it before curbuf (which we'll hose)
       //cout << "keeping front " << off << " of " << *curbuf << std::endl;
-      _buffers.insert( curbuf, ptr( *curbuf, 0, off ) );
+      curbuf = _buffers.insert( curbuf, ptr( *curbuf, 0, off ) );
+      ++curbuf;
       _len += off;
     }
     
@@ -2197,7 +2207,7 @@ public:
       if (claim_by) 
 	claim_by->append( *curbuf, off, howmuch );
       _len -= (*curbuf).length();
-      _buffers.erase( curbuf++ );
+      curbuf = _buffers.erase( curbuf );
       len -= howmuch;
       off = 0;
     }
@@ -2211,7 +2221,7 @@ public:
   {
     list s;
     s.substr_of(*this, off, len);
-    for (std::list<ptr>::const_iterator it = s._buffers.begin(); 
+    for (buffers_t::const_iterator it = s._buffers.begin(); 
 	 it != s._buffers.end(); 
 	 ++it)
       if (it->length())
@@ -2403,7 +2413,7 @@ int buffer::list::write_fd(int fd) const
   int iovlen = 0;
   ssize_t bytes = 0;
 
-  std::list<ptr>::const_iterator p = _buffers.begin();
+  buffers_t::const_iterator p = _buffers.begin();
   while (p != _buffers.end()) {
     if (p->length() > 0) {
       iov[iovlen].iov_base = (void *)p->c_str();
@@ -2452,7 +2462,7 @@ int buffer::list::write_fd(int fd, uint64_t offset) const
 {
   iovec iov[IOV_MAX];
 
-  std::list<ptr>::const_iterator p = _buffers.begin();
+  buffers_t::const_iterator p = _buffers.begin();
   uint64_t left_pbrs = _buffers.size();
   while (left_pbrs) {
     ssize_t bytes = 0;
@@ -2489,7 +2499,7 @@ int buffer::list::write_fd_zero_copy(int fd) const
     return -errno;
   if (errno == ESPIPE)
     off_p = NULL;
-  for (std::list<ptr>::const_iterator it = _buffers.begin();
+  for (buffers_t::const_iterator it = _buffers.begin();
        it != _buffers.end(); ++it) {
     int r = it->zero_copy_to_fd(fd, off_p);
     if (r < 0)
@@ -2506,12 +2516,23 @@ __u32 buffer::list::crc32c(__u32 crc) const
   int cache_hits = 0;
   int cache_adjusts = 0;
 
-  for (std::list<ptr>::const_iterator it = _buffers.begin();
+  for (buffers_t::const_iterator it = _buffers.begin();
        it != _buffers.end();
        ++it) {
     if (it->length()) {
       raw *r = it->get_raw();
-      pair<size_t, size_t> ofs(it->offset(), it->offset() + it->length());
+      pair<size_t, size_t> ofs(it->offset(), it->end());
+      // a run of ptrs that are adjacent in the same raw, as a series of
+      // small appends leaves them, is contiguous: checksum it as one
+      // span so that it fits the raw's single cache slot
+      const char *data = it->c_str();
+      while (it + 1 != _buffers.end() &&
+	     (it + 1)->get_raw() == r &&
+	     (it + 1)->offset() == ofs.second) {
+	++it;
+	ofs.second = it->end();
+      }
+      size_t len = ofs.second - ofs.first;
       pair<uint32_t, uint32_t> ccrc;
       if (r->get_crc(ofs, &ccrc)) {
 	if (ccrc.first == crc) {
@@ -2527,13 +2548,13 @@ __u32 buffer::list::crc32c(__u32 crc) const
 	   * http://crcutil.googlecode.com/files/crc-doc.1.0.pdf
 	   * note, u for our crc32c implementation is 0
 	   */
-	  crc = ccrc.second ^ ceph_crc32c(ccrc.first ^ crc, NULL, it->length());
+	  crc = ccrc.second ^ ceph_crc32c(ccrc.first ^ crc, NULL, len);
 	  cache_adjusts++;
 	}
       } else {
 	cache_misses++;
 	uint32_t base = crc;
-	crc = ceph_crc32c(crc, (unsigned char*)it->c_str(), it->length());
+	crc = ceph_crc32c(crc, (unsigned char*)data, len);
 	r->set_crc(ofs, make_pair(base, crc));
       }
     }
@@ -2553,7 +2574,7 @@ __u32 buffer::list::crc32c(__u32 crc) const
 
 void buffer::list::invalidate_crc()
 {
-  for (std::list<ptr>::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
+  for (buffers_t::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
     raw *r = p->get_raw();
     if (r) {
       r->invalidate_crc();
@@ -2566,7 +2587,7 @@ void buffer::list::invalidate_crc()
  */
 void buffer::list::write_stream(std::ostream &out) const
 {
-  for (std::list<ptr>::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
+  for (buffers_t::const_iterator p = _buffers.begin(); p != _buffers.end(); ++p) {
     if (p->length() > 0) {
       out.write(p->c_str(), p->length());
     }
@@ -2684,7 +2705,7 @@ std::ostream& buffer::operator<<(std::ostream& out, const buffer::ptr& bp) {
 std::ostream& buffer::operator<<(std::ostream& out, const buffer::list& bl) {
   out << "buffer::list(len=" << bl.length() << "," << std::endl;
 
-  std::list<buffer::ptr>::const_iterator it = bl.buffers().begin();
+  buffer::list::buffers_t::const_iterator it = bl.buffers().begin();
   while (it != bl.buffers().end()) {
     out << "\t" << *it;
     if (++it == bl.buffers().end()) break;
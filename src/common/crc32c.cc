@@ -8,6 +8,7 @@
 #include "arch/ppc.h"
 #include "common/sctp_crc32.h"
 #include "common/crc32c_intel_fast.h"
+#include "common/crc32c_intel_zeros.h"
 #include "common/crc32c_aarch64.h"
 #include "common/crc32c_ppc.h"
 
@@ -211,7 +212,7 @@ static uint32_t crc_turbo_table[32][32] =
      0x00010000, 0x00020000, 0x00040000, 0x00080000, 0x00100000, 0x00200000, 0x00400000, 0x00800000}
 };
 
-uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned len)
+static uint32_t ceph_crc32c_zeros_turbo(uint32_t crc, unsigned len)
 {
   int range = 0;
   unsigned remainder = len & 15;
@@ -236,3 +237,31 @@ uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned len)
     crc = ceph_crc32c(crc, nullptr, remainder);
   return crc;
 }
+
+typedef uint32_t (*ceph_crc32c_zeros_func_t)(uint32_t crc, unsigned length);
+
+static ceph_crc32c_zeros_func_t ceph_choose_crc32c_zeros(void)
+{
+  ceph_arch_probe();
+
+#if defined(__i386__) || defined(__x86_64__)
+  if (ceph_arch_intel_pclmul && ceph_arch_intel_sse42 &&
+      ceph_crc32c_zeros_intel_exists()) {
+    return ceph_crc32c_zeros_intel;
+  }
+#elif defined(__arm__) || defined(__aarch64__)
+  if (ceph_arch_aarch64_crc32 && ceph_arch_aarch64_pmull &&
+      ceph_crc32c_zeros_aarch64_exists()) {
+    return ceph_crc32c_zeros_aarch64;
+  }
+#endif
+  return ceph_crc32c_zeros_turbo;
+}
+
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned len)
+{
+  // chosen on first use rather than at static init, so that it is safe
+  // to call from other static initializers
+  static const ceph_crc32c_zeros_func_t func = ceph_choose_crc32c_zeros();
+  return func(crc, len);
+}
@@ -267,3 +267,47 @@ uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned
 	}
 	return crc;
 }
+
+#if defined(HAVE_ARMV8_CRYPTO) && defined(HAVE_ARMV8_CRC_CRYPTO_INTRINSICS)
+
+#include "common/crc32c_zeros_table.h"
+
+/*
+ * a * b * x^33 mod P, bit-reflected; see crc32c_intel_zeros.c.
+ */
+static inline uint32_t crc32c_mul_x33(uint32_t a, uint32_t b)
+{
+	return __crc32cd(0, (uint64_t)vmull_p64(a, b));
+}
+
+uint32_t ceph_crc32c_zeros_aarch64(uint32_t crc, unsigned len)
+{
+	if (len & 4)
+		CRC32CW(crc, 0);
+	if (len & 2)
+		CRC32CH(crc, 0);
+	if (len & 1)
+		CRC32CB(crc, 0);
+	for (len >>= 3; len; len &= len - 1)
+		crc = crc32c_mul_x33(crc, crc32c_zeros_k[__builtin_ctz(len)]);
+	return crc;
+}
+
+int ceph_crc32c_zeros_aarch64_exists(void)
+{
+	return 1;
+}
+
+#else
+
+int ceph_crc32c_zeros_aarch64_exists(void)
+{
+	return 0;
+}
+
+uint32_t ceph_crc32c_zeros_aarch64(uint32_t crc, unsigned len)
+{
+	return 0;
+}
+
+#endif
@@ -12,6 +12,11 @@ extern "C" {
 
 extern uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned len);
 
+/* is the PMULL version compiled in */
+extern int ceph_crc32c_zeros_aarch64_exists(void);
+
+extern uint32_t ceph_crc32c_zeros_aarch64(uint32_t crc, unsigned len);
+
 #else
 
 static inline uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned len)
@@ -19,6 +24,16 @@ static inline uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *bu
 	return 0;
 }
 
+static inline int ceph_crc32c_zeros_aarch64_exists(void)
+{
+	return 0;
+}
+
+static inline uint32_t ceph_crc32c_zeros_aarch64(uint32_t crc, unsigned len)
+{
+	return 0;
+}
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,58 @@
+#include "common/crc32c_intel_zeros.h"
+
+#if defined(__x86_64__) && defined(__SSE4_2__) && defined(__PCLMUL__)
+
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+
+#include "common/crc32c_zeros_table.h"
+
+/*
+ * a * b * x^33 mod P, in the bit-reflected form the crc32 instruction
+ * uses.  The carry-less product of two reflected 32-bit values is the
+ * reflected 64-bit product times x, and crc32 of a 64-bit word from a
+ * zero crc multiplies it by x^32 and reduces it.
+ */
+static inline uint32_t crc32c_mul_x33(uint32_t a, uint32_t b)
+{
+	__m128i p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(a),
+					 _mm_cvtsi32_si128(b), 0);
+	return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(p));
+}
+
+/*
+ * crc32c over len zero bytes is crc * x^(8 * len) mod P.  Shift by the
+ * odd bytes with the crc32 instruction, then multiply by x^(64 * 2^i)
+ * for each bit i set in len / 8.
+ */
+uint32_t ceph_crc32c_zeros_intel(uint32_t crc, unsigned len)
+{
+	if (len & 4)
+		crc = _mm_crc32_u32(crc, 0);
+	if (len & 2)
+		crc = _mm_crc32_u16(crc, 0);
+	if (len & 1)
+		crc = _mm_crc32_u8(crc, 0);
+	for (len >>= 3; len; len &= len - 1)
+		crc = crc32c_mul_x33(crc, crc32c_zeros_k[__builtin_ctz(len)]);
+	return crc;
+}
+
+int ceph_crc32c_zeros_intel_exists(void)
+{
+	return 1;
+}
+
+#else
+
+int ceph_crc32c_zeros_intel_exists(void)
+{
+	return 0;
+}
+
+uint32_t ceph_crc32c_zeros_intel(uint32_t crc, unsigned len)
+{
+	return 0;
+}
+
+#endif
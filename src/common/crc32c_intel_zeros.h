@@ -0,0 +1,19 @@
+#ifndef CEPH_COMMON_CRC32C_INTEL_ZEROS_H
+#define CEPH_COMMON_CRC32C_INTEL_ZEROS_H
+
+#include "include/int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* is the PCLMUL version compiled in */
+extern int ceph_crc32c_zeros_intel_exists(void);
+
+extern uint32_t ceph_crc32c_zeros_intel(uint32_t crc, unsigned len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
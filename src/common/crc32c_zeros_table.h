@@ -0,0 +1,22 @@
+#ifndef CEPH_COMMON_CRC32C_ZEROS_TABLE_H
+#define CEPH_COMMON_CRC32C_ZEROS_TABLE_H
+
+#include "include/int_types.h"
+
+/*
+ * Constants for shifting a crc32c by 8 * 2^i zero bytes with a single
+ * carry-less multiply whose result is reduced by the crc32 instruction,
+ * as the PCLMUL and PMULL versions of ceph_crc32c_zeros do.  Entry i is
+ * x^(64 * 2^i - 33) mod P, bit-reflected; the x^-33 cancels the x^33
+ * that the multiply and reduction add.  Entry 0 is x^31, and each
+ * following entry is the previous one multiplied by itself that way.
+ */
+static const uint32_t crc32c_zeros_k[29] = {
+	0x00000001, 0x493c7d27, 0xba4fc28e, 0x9e4addf8, 0x0d3b6092, 0xb9e02b86,
+	0xdd7e3b0c, 0x170076fa, 0xa51b6135, 0x82f89c77, 0x54a86326, 0x1dc403cc,
+	0x5ae703ab, 0xc5013a36, 0xac2ac6dd, 0x9b4615a9, 0x688d1c61, 0xf6af14e6,
+	0xb6ffe386, 0xb717425b, 0x478b0d30, 0x54cc62e5, 0x7b2102ee, 0x8a99adef,
+	0xa7568c8f, 0xd610d67e, 0x6b086b3f, 0xd94f3c0b, 0xbf818109
+};
+
+#endif
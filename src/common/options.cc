@@ -642,6 +642,11 @@ std::vector<Option> get_global_options() {
     .set_default(4_K)
     .set_description(""),
 
+    Option("ms_tcp_zerocopy_threshold", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Send at least this many bytes at a time with MSG_ZEROCOPY (0 to disable)")
+    .set_long_description("The posix network stack then lets the kernel transmit message data straight out of the message buffers instead of copying it, and keeps the buffers until the kernel reports that it is done with them.  This saves CPU on large messages such as object reads and recovery pushes, but pinning the pages and collecting the completions costs more than copying a small message.  Needs Linux 4.14 or later; connections closed with zero-copy data still in flight are reset rather than drained."),
+
     Option("ms_initial_backoff", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.2)
     .set_description(""),
@@ -776,11 +781,19 @@ std::vector<Option> get_global_options() {
 
     Option("ms_async_set_affinity", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
-    .set_description(""),
+    .set_description("Pin async messenger worker threads to the CPUs given by ms_async_affinity_cores or ms_async_affinity_numa_node"),
 
     Option("ms_async_affinity_cores", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("")
-    .set_description(""),
+    .set_description("CPUs to pin async messenger worker threads to, one each")
+    .set_long_description("A list of CPUs such as 0-3,8.  Worker i runs on the i-th CPU in the list, wrapping around if there are more workers than CPUs.  Only the posix stack uses this.")
+    .add_see_also("ms_async_set_affinity"),
+
+    Option("ms_async_affinity_numa_node", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(-1)
+    .set_description("NUMA node whose CPUs the async messenger worker threads run on (-1 for any)")
+    .set_long_description("If ms_async_affinity_cores is empty, all workers may run on any of the CPUs of this node, typically the one the network card is attached to.  Only the posix stack uses this.")
+    .add_see_also("ms_async_set_affinity"),
 
     Option("ms_async_rdma_device_name", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("")
@@ -923,6 +936,12 @@ std::vector<Option> get_global_options() {
     .set_default(4096)
     .set_description(""),
 
+    Option("mon_osd_mapping_incremental", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Recalculate only the PGs an OSDMap epoch may have moved")
+    .set_long_description("When the epochs since the last mapping only change pg_temp, primary_temp, pg_upmap or pools, the monitor updates its cached PG mapping for the affected PGs instead of recalculating every PG.  Changes to the CRUSH map or to OSD state, weight or primary affinity always recalculate everything.")
+    .add_see_also("mon_osd_mapping_pgs_per_chunk"),
+
     Option("mon_osd_max_creating_pgs", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(1024)
     .set_description(""),
@@ -1899,7 +1918,7 @@ std::vector<Option> get_global_options() {
 
     Option("osd_tier_default_cache_hit_set_type", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("bloom")
-    .set_enum_allowed({"bloom", "explicit_hash", "explicit_object"})
+    .set_enum_allowed({"bloom", "blocked_bloom", "explicit_hash", "explicit_object"})
     .set_description(""),
 
     Option("osd_tier_default_cache_min_read_recency_for_promote", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
@@ -1938,6 +1957,12 @@ std::vector<Option> get_global_options() {
     .set_default(40)
     .set_description(""),
 
+    Option("osd_map_decode_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_description("Number of threads decoding received OSDMaps ahead of the thread applying them")
+    .set_long_description("When a message carries several epochs, as it does while an OSD catches up at boot, the full and incremental maps are decoded on this many helper threads while the OSD applies and stores the earlier epochs in order.  0 decodes them all in line.")
+    .add_see_also("osd_map_message_max"),
+
     Option("osd_pg_epoch_max_lag_factor", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(2.0)
     .set_description("Max multiple of the map cache that PGs can lag before we throttle map injest")
@@ -2025,6 +2050,13 @@ std::vector<Option> get_global_options() {
     .set_long_description("the threshold between high priority ops that use strict priority ordering and low priority ops that use a fairness algorithm that may or may not incorporate priority")
     .add_see_also("osd_op_queue"),
 
+    Option("osd_op_queue_work_stealing", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("let idle op shard threads process queued work of busier shards")
+    .set_long_description("Each PG is hashed to one op shard, so a few hot PGs can keep one shard's queue backed up while the other shards idle. With this enabled, a shard thread with nothing queued takes the next item from another shard's queue, and a shard that already has a backlog wakes a thread of another shard when it is given more work. Ops of a PG still run in order. Only read at startup.")
+    .add_see_also("osd_op_num_shards")
+    .add_see_also("osd_op_num_threads_per_shard"),
+
     Option("osd_op_queue_mclock_client_op_res", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(1000.0)
     .set_description("mclock reservation of client operator requests")
@@ -2489,6 +2521,23 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("osd_ec_stripe_cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_description("bytes of recently read-modify-written stripes each PG of an erasure coded pool with overwrites keeps on the primary")
+    .set_long_description("A partial write to an erasure coded object must first read the rest of the stripe from the shards. Stripes kept here are not read again by the next partial write to them. 0 disables the cache.")
+    .add_see_also("osd_pool_erasure_code_stripe_unit"),
+
+    Option("osd_ec_parallel_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_description("threads shared by all PGs to erasure code the stripes of large reads and writes")
+    .set_long_description("Encoding a large write or decoding a large recovery or degraded read is split into runs of stripes coded by these threads alongside the op thread. 0 codes every stripe on the op thread. Read when the pool is first used.")
+    .add_see_also("osd_ec_parallel_min_bytes"),
+
+    Option("osd_ec_parallel_min_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_description("smallest erasure coded read or write whose stripes are coded in parallel")
+    .add_see_also("osd_ec_parallel_threads"),
+
     Option("osd_recover_clone_overlap_limit", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_description(""),
@@ -2657,6 +2706,20 @@ std::vector<Option> get_global_options() {
     .set_default(8_M)
     .set_description(""),
 
+    Option("osd_recovery_batch_max_objects", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(16)
+    .set_min(1)
+    .set_description("Maximum number of small objects recovered for the cost of one recovery op")
+    .set_long_description("Objects smaller than osd_recovery_batch_max_bytes count as a fraction of an op against osd_recovery_max_active and osd_recovery_max_single_start, so that many of them are pushed together in one message and applied in one transaction on the peer.  1 counts every object as a full op.  Only read at startup.")
+    .add_see_also("osd_recovery_batch_max_bytes")
+    .add_see_also("osd_recovery_max_active"),
+
+    Option("osd_recovery_batch_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_description("Total size of the small objects recovered for the cost of one recovery op")
+    .set_long_description("An object of this size or larger, or one with omap, counts as a full recovery op.")
+    .add_see_also("osd_recovery_batch_max_objects"),
+
     Option("osd_recovery_max_omap_entries_per_chunk", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(8096)
     .set_description(""),
@@ -2762,6 +2825,24 @@ std::vector<Option> get_global_options() {
     .set_default(5)
     .set_description("Set the maximum number of times we will preempt a deep scrub due to a client operation before blocking client IO to complete the scrub"),
 
+    Option("osd_scrub_max_bytes_per_sec", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Maximum rate at which deep scrub reads data and omap from this OSD (0 for no limit)")
+    .set_long_description("All PGs scrubbing on the OSD share this budget.  Scrub reads a whole chunk on credit and sleeps off the bytes it has read before starting the next one, so a single chunk (osd_scrub_chunk_max objects) may exceed it briefly.  Replicas charge their reads too, which slows the scrubs this OSD is primary for.")
+    .add_see_also("osd_scrub_min_bytes_per_sec")
+    .add_see_also("osd_scrub_client_latency_target"),
+
+    Option("osd_scrub_min_bytes_per_sec", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .set_description("Rate below which deep scrub is never slowed for client latency")
+    .add_see_also("osd_scrub_max_bytes_per_sec"),
+
+    Option("osd_scrub_client_latency_target", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Client op latency (seconds) that deep scrub should not push the 99th percentile above (0 to not adapt)")
+    .set_long_description("Once a second the OSD checks whether more than 1% of client ops took longer than this.  If so the scrub rate is halved (down to osd_scrub_min_bytes_per_sec); otherwise it grows back by a tenth of osd_scrub_max_bytes_per_sec.  Only effective when osd_scrub_max_bytes_per_sec is set.")
+    .add_see_also("osd_scrub_max_bytes_per_sec"),
+
     Option("osd_deep_scrub_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(7_day)
     .set_description("Deep scrub each PG (i.e., verify data checksums) at least this often"),
@@ -2780,6 +2861,12 @@ std::vector<Option> get_global_options() {
     .set_default(1024)
     .set_description("Number of keys to read from an object at a time during deep scrub"),
 
+    Option("osd_deep_scrub_resume", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Resume an interrupted deep scrub from where it stopped")
+    .set_long_description("The primary records how far a deep scrub has got after each chunk.  If the scrub is interrupted (e.g., by peering), the next deep scrub of the PG on this OSD starts from that point, provided it is within the deep scrub interval.  Inconsistencies already found are still counted, but list-inconsistent-obj only reports those found after the resume.")
+    .add_see_also("osd_deep_scrub_interval"),
+
     Option("osd_deep_scrub_update_digest_min_age", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(2_hr)
     .set_description("Update overall object digest only if object was last modified longer ago than this"),
@@ -3020,6 +3107,32 @@ std::vector<Option> get_global_options() {
     .set_default(64)
     .set_description(""),
 
+    Option("osd_memory_target", Option::TYPE_UINT, Option::LEVEL_BASIC)
+    .set_default(4_G)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("When cache autotuning is enabled, try to keep this many bytes resident in memory.")
+    .set_long_description("The process RSS is sampled periodically and the BlueStore caches are grown or shrunk so that the OSD approaches this target."),
+
+    Option("osd_memory_base", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(768_M)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("When autotuning caches, assume the OSD needs at least this many bytes for non-cache memory."),
+
+    Option("osd_memory_expected_fragmentation", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(0.15)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("When autotuning caches, assume this fraction of the memory target is lost to allocator fragmentation."),
+
+    Option("osd_memory_cache_min", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(128_M)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("When autotuning caches, never shrink the total cache size below this many bytes."),
+
+    Option("osd_memory_cache_resize_interval", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(1)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("When autotuning caches, wait this many seconds between resizing the total cache size."),
+
     Option("osd_tracing", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description(""),
@@ -3374,6 +3487,23 @@ std::vector<Option> get_global_options() {
     .set_default(16)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Enable Linux io_uring API instead of libaio")
+    .set_long_description("Requires a kernel with io_uring support; falls back to libaio if the ring cannot be set up."),
+
+    Option("bdev_ioring_hipri", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .add_see_also("bdev_ioring")
+    .set_description("Enable io_uring polling mode for completions")
+    .set_long_description("The completion thread busy-polls the device instead of sleeping; requires a device with polled queues."),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .add_see_also("bdev_ioring")
+    .set_description("Enable io_uring submission queue polling mode")
+    .set_long_description("A kernel thread polls the submission ring, so submitting io usually needs no system call at all."),
+
     Option("bdev_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4_K)
     .set_description(""),
@@ -3440,7 +3570,16 @@ std::vector<Option> get_global_options() {
 
     Option("bluefs_preextend_wal_files", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
-    .set_description(""),
+    .set_description("Preallocate space for rocksdb WAL files and mark it as written")
+    .set_long_description("With this, WAL appends and syncs rarely need a bluefs metadata log update, so an fsync is just the data write and a device flush that concurrent syncs share.  It is off by default because rocksdb must then recycle its log files (recycle_log_file_num in bluestore_rocksdb_options) to tell stale records in the preallocated space from new ones; do not enable it if that was removed from the rocksdb options.  Device flushes are grouped either way, but without it most WAL syncs also write the metadata log.")
+    .add_see_also("bluefs_wal_prealloc_size")
+    .add_see_also("bluestore_rocksdb_options"),
+
+    Option("bluefs_wal_prealloc_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(16_M)
+    .set_description("Minimum space to allocate at a time for preextended WAL files")
+    .set_long_description("With bluefs_preextend_wal_files, WAL files are extended in chunks of at least this size, so that (combined with rocksdb log recycling) WAL appends and syncs rarely need a bluefs metadata log update.")
+    .add_see_also("bluefs_preextend_wal_files"),
 
     Option("bluestore_bluefs", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(true)
@@ -3650,6 +3789,41 @@ std::vector<Option> get_global_options() {
     .set_safe()
     .set_description(""),
 
+    Option("bluestore_defrag", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Rewrite fragmented blobs in the background while the store is idle")
+    .add_see_also("bluestore_defrag_threshold"),
+
+    Option("bluestore_defrag_threshold", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.5)
+    .set_min_max(0.0, 1.0)
+    .set_description("Free space fragmentation score above which background defragmentation kicks in")
+    .set_long_description("The score is 0 when all free space is one contiguous extent and approaches 1 as free space splinters into allocation-unit sized pieces.")
+    .add_see_also("bluestore_defrag"),
+
+    Option("bluestore_defrag_interval", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(60)
+    .set_description("Seconds between free space fragmentation samples and defragmentation passes while bluestore_defrag is enabled"),
+
+    Option("bluestore_free_stats_interval", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(600)
+    .set_description("Seconds between free space fragmentation samples while bluestore_defrag is disabled")
+    .set_long_description("The samples update the fragmentation, free_extents and free_max_extent perf counters.")
+    .add_see_also("bluestore_defrag_interval"),
+
+    Option("bluestore_defrag_idle_txc", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(16)
+    .set_description("Consider the store idle if it committed no more than this many client transactions in the last interval")
+    .add_see_also("bluestore_defrag_interval"),
+
+    Option("bluestore_defrag_min_pextents", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(4)
+    .set_description("Rewrite blobs whose data is scattered over at least this many physical extents"),
+
+    Option("bluestore_defrag_max_bytes", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(64_M)
+    .set_description("Maximum amount of data rewritten per defragmentation pass"),
+
     Option("bluestore_max_blob_size", Option::TYPE_UINT, Option::LEVEL_DEV)
     .set_default(0)
     .set_safe()
@@ -3740,6 +3914,22 @@ std::vector<Option> get_global_options() {
       "and bluestore_cache_kv_ratio instead of calculating these ratios using "
       "bluestore_cache_size_* and bluestore_cache_kv_max."),
 
+    Option("bluestore_cache_autotune", Option::TYPE_BOOL, Option::LEVEL_DEV)
+    .set_default(true)
+    .add_see_also("osd_memory_target")
+    .set_description("Automatically tune the ratio of caches while respecting min values.")
+    .set_long_description("When enabled, bluestore_cache_size is ignored and the total cache size follows osd_memory_target. The onode, buffer and kv caches are sized by priority; the cache ratios only decide how memory left over after that is split."),
+
+    Option("bluestore_cache_autotune_chunk_size", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(33554432)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("The chunk size in bytes to allocate to caches when cache autotune is enabled."),
+
+    Option("bluestore_cache_autotune_interval", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(5)
+    .add_see_also("bluestore_cache_autotune")
+    .set_description("The number of seconds to wait between rebalances when cache autotune is enabled."),
+
     Option("bluestore_kvbackend", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("rocksdb")
     .add_tag("mkfs")
@@ -3747,8 +3937,25 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_allocator", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("stupid")
-    .set_enum_allowed({"bitmap", "stupid"})
-    .set_description("Allocator policy"),
+    .set_enum_allowed({"bitmap", "stupid", "hybrid"})
+    .set_description("Allocator policy")
+    .set_long_description("'hybrid' keeps large free extents in a range tree and small fragments in a sparse bitmap, bounding memory use on fragmented devices."),
+
+    Option("bluestore_hybrid_alloc_mem_cap", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(64_M)
+    .set_description("Maximum memory used by the hybrid allocator range tree")
+    .set_long_description("Once the range tree grows past this, its smallest extents are moved into the bitmap.")
+    .add_see_also("bluestore_allocator"),
+
+    Option("bluestore_hybrid_alloc_bitmap_max_blocks", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(16)
+    .set_description("Free extents shorter than this many blocks are tracked in the hybrid allocator bitmap")
+    .add_see_also("bluestore_allocator"),
+
+    Option("bluestore_hybrid_alloc_ff_max_search", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(100)
+    .set_description("Number of extents the hybrid allocator examines first-fit before falling back to best-fit")
+    .add_see_also("bluestore_allocator"),
 
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
@@ -3771,12 +3978,17 @@ std::vector<Option> get_global_options() {
     .set_description("Rocksdb options"),
 
     Option("bluestore_rocksdb_cf", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
-    .set_default(false)
-    .set_description("Enable use of rocksdb column families for bluestore metadata"),
+    .set_default(true)
+    .set_description("Enable use of rocksdb column families for bluestore metadata")
+    .set_long_description("Column families are only created at mkfs time; an existing OSD keeps whatever layout it was created with.  Unless bluestore_rocksdb_options sets db_write_buffer_size or max_total_wal_size, the memtables of all column families together are limited to write_buffer_size * max_write_buffer_number, as with a single one, and column families holding up the WAL are flushed once it grows that large.")
+    .add_see_also("bluestore_rocksdb_cfs")
+    .add_see_also("bluestore_rocksdb_options"),
 
     Option("bluestore_rocksdb_cfs", Option::TYPE_STR, Option::LEVEL_DEV)
-    .set_default("M= P= L=")
-    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options"),
+    .set_default("M=cache_ratio=0.2 P= L= O=cache_ratio=0.3 X= B= b=")
+    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options")
+    .set_long_description("Each CF name is a bluestore key prefix: M (omap), P (pgmeta omap), L (deferred), O (onodes), X (shared blobs), B and b (freelist).  Prefixes not listed stay in the default column family.  The value is a ';' separated list of rocksdb column family options; in addition, cache_ratio=<f> gives the CF a dedicated block cache of that fraction of the rocksdb block cache, so that omap scans cannot evict onode blocks.  The dedicated caches are carved out of the rocksdb block cache, never taking more than half of it, and are resized and accounted for along with it by the bluestore cache autotuner.")
+    .add_see_also("bluestore_rocksdb_cf"),
 
     Option("bluestore_fsck_on_mount", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
@@ -3802,6 +4014,18 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("Run deep fsck after mkfs"),
 
+    Option("bluestore_kv_sync_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min_max(1, 16)
+    .set_description("Number of parallel kv commit pipelines")
+    .set_long_description("Each collection's transactions are submitted, synced and finalized by one of this many kv sync/finalize thread pairs, which preserves per-collection ordering while letting small writes to different collections commit in parallel.  With more than one, rocksdb pipelined writes are enabled as well.  Takes effect on mount."),
+
+    Option("bluestore_fsck_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min(1)
+    .set_description("Number of threads checking objects during fsck")
+    .set_long_description("The object keyspace is still walked in order by one thread, but loading and checking each object's extents and blobs, and reading its data in deep mode, is spread across this many threads."),
+
     Option("bluestore_sync_submit_transaction", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description("Try to submit metadata transaction to rocksdb in queuing thread context"),
@@ -3847,6 +4071,32 @@ std::vector<Option> get_global_options() {
     .set_safe()
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media"),
 
+    Option("bluestore_deferred_batch_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_safe()
+    .set_description("Max bytes of queued deferred writes before we flush the deferred write queue")
+    .set_long_description("Pending deferred writes of all collections are flushed together, sorted by device offset, once this many bytes are queued.  0 means use the _hdd or _ssd default."),
+
+    Option("bluestore_deferred_batch_bytes_hdd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4_M)
+    .set_safe()
+    .set_description("Default bluestore_deferred_batch_bytes for rotational media"),
+
+    Option("bluestore_deferred_batch_bytes_ssd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_safe()
+    .set_description("Default bluestore_deferred_batch_bytes for non-rotational (solid state) media (0 to disable)"),
+
+    Option("bluestore_deferred_max_age", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1.0)
+    .set_description("Max seconds a deferred write may wait in the queue before we flush it")
+    .set_long_description("0 means deferred writes only go out when the queue is full (see bluestore_deferred_batch_ops and bluestore_deferred_batch_bytes) or when something needs them."),
+
+    Option("bluestore_deferred_max_inflight_ios", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Hold back non-urgent deferred write flushes while this many deferred ios are in flight (0 for no limit)")
+    .set_long_description("Waiting for the device queue to drain lets more deferred writes accumulate and be merged into the next, larger, offset ordered submission."),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -0,0 +1,625 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph distributed storage system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+
+#include "common/debug.h"
+#include "erasure-code/ErasureCodePlugin.h"
+#include "include/buffer.h"
+#include "include/intarith.h"
+#include "include/stringify.h"
+
+#include "ErasureCodeClay.h"
+
+// re-include our assert to clobber boost's
+#include "include/assert.h"
+
+#define dout_context g_ceph_context
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix _prefix(_dout)
+
+#define MAX_SUB_CHUNK_NO 65536
+
+using namespace std;
+
+static ostream& _prefix(std::ostream* _dout)
+{
+  return *_dout << "ErasureCodeClay: ";
+}
+
+int ErasureCodeClay::init(ErasureCodeProfile &profile, ostream *ss)
+{
+  int r = parse(profile, ss);
+  if (r)
+    return r;
+
+  ErasureCodePluginRegistry &registry = ErasureCodePluginRegistry::instance();
+  r = registry.factory(mds.profile["plugin"],
+		       directory,
+		       mds.profile,
+		       &mds.erasure_code,
+		       ss);
+  if (r)
+    return r;
+  r = registry.factory(pft.profile["plugin"],
+		       directory,
+		       pft.profile,
+		       &pft.erasure_code,
+		       ss);
+  if (r)
+    return r;
+  return ErasureCode::init(profile, ss);
+}
+
+int ErasureCodeClay::parse(ErasureCodeProfile &profile, ostream *ss)
+{
+  int err = ErasureCode::parse(profile, ss);
+  err |= to_int("k", profile, &k, DEFAULT_K, ss);
+  err |= to_int("m", profile, &m, DEFAULT_M, ss);
+  err |= sanity_check_k(k, ss);
+  err |= to_int("d", profile, &d, stringify(k + m - 1), ss);
+
+  string scalar_mds;
+  err |= to_string("scalar_mds", profile, &scalar_mds, "jerasure", ss);
+  string technique;
+  err |= to_string("technique", profile, &technique, "reed_sol_van", ss);
+  if (err)
+    return err;
+
+  if (chunk_mapping.size() > 0) {
+    *ss << "mapping " << profile.find("mapping")->second
+	<< " is not supported by the clay plugin" << std::endl;
+    chunk_mapping.clear();
+    return -EINVAL;
+  }
+
+  if (scalar_mds == "jerasure") {
+    if (technique != "reed_sol_van" &&
+	technique != "reed_sol_r6_op" &&
+	technique != "cauchy_orig" &&
+	technique != "cauchy_good" &&
+	technique != "liber8tion") {
+      *ss << "technique=" << technique << " is not a valid coding technique"
+	  << " for scalar_mds=jerasure: choose one of reed_sol_van,"
+	  << " reed_sol_r6_op, cauchy_orig, cauchy_good, liber8tion"
+	  << std::endl;
+      return -EINVAL;
+    }
+  } else if (scalar_mds == "isa") {
+    if (technique != "reed_sol_van" && technique != "cauchy") {
+      *ss << "technique=" << technique << " is not a valid coding technique"
+	  << " for scalar_mds=isa: choose one of reed_sol_van, cauchy"
+	  << std::endl;
+      return -EINVAL;
+    }
+  } else {
+    *ss << "scalar_mds=" << scalar_mds << " is not supported, use one of"
+	<< " jerasure, isa" << std::endl;
+    return -EINVAL;
+  }
+
+  if (d < k + 1 || d > k + m - 1) {
+    *ss << "d=" << d << " must be within [k+1, k+m-1] = ["
+	<< k + 1 << ", " << k + m - 1 << "]" << std::endl;
+    return -EINVAL;
+  }
+
+  q = d - k + 1;
+  nu = (k + m) % q ? q - (k + m) % q : 0;
+  t = (k + m + nu) / q;
+  sub_chunk_no = 1;
+  for (int i = 0; i < t; i++) {
+    sub_chunk_no *= q;
+    if (sub_chunk_no > MAX_SUB_CHUNK_NO) {
+      *ss << "k=" << k << " m=" << m << " d=" << d << " would split each"
+	  << " chunk in more than " << MAX_SUB_CHUNK_NO << " sub-chunks"
+	  << std::endl;
+      return -EINVAL;
+    }
+  }
+  dout(10) << __func__ << " k=" << k << " m=" << m << " d=" << d
+	   << " q=" << q << " t=" << t << " nu=" << nu
+	   << " sub_chunk_no=" << sub_chunk_no << dendl;
+
+  mds.profile["plugin"] = scalar_mds;
+  mds.profile["technique"] = technique;
+  mds.profile["k"] = stringify(k + nu);
+  mds.profile["m"] = stringify(m);
+  pft.profile["plugin"] = scalar_mds;
+  pft.profile["technique"] = technique;
+  pft.profile["k"] = "2";
+  pft.profile["m"] = "2";
+  if (scalar_mds == "jerasure") {
+    mds.profile["w"] = DEFAULT_W;
+    pft.profile["w"] = DEFAULT_W;
+  }
+  return 0;
+}
+
+unsigned int ErasureCodeClay::get_chunk_size(unsigned int object_size) const
+{
+  // each sub-chunk is coded on its own by the scalar codes and must be
+  // properly aligned for them
+  unsigned alignment = sub_chunk_no * k * pft.erasure_code->get_chunk_size(1);
+  return round_up_to(object_size, alignment) / k;
+}
+
+int ErasureCodeClay::pow_int(int a, int x) const
+{
+  int power = 1;
+  while (x--)
+    power *= a;
+  return power;
+}
+
+void ErasureCodeClay::get_plane_vector(int z, int *z_vec) const
+{
+  for (int i = t - 1; i >= 0; i--) {
+    z_vec[i] = z % q;
+    z /= q;
+  }
+}
+
+bool ErasureCodeClay::is_repair(const set<int> &want_to_read,
+				const set<int> &available_chunks) const
+{
+  if (includes(available_chunks.begin(), available_chunks.end(),
+	       want_to_read.begin(), want_to_read.end()))
+    return false;
+  if (want_to_read.size() != 1)
+    return false;
+  int lost = *want_to_read.begin();
+  int y = chunk_to_node(lost) / q;
+  // every real node in the lost node's column has to help
+  for (int x = 0; x < q; x++) {
+    int chunk = node_to_chunk(y * q + x);
+    if (chunk >= 0 && chunk != lost && !available_chunks.count(chunk))
+      return false;
+  }
+  return available_chunks.size() >= (unsigned)d;
+}
+
+void ErasureCodeClay::get_repair_subchunks(
+  int lost,
+  vector<pair<int, int>> *subchunks) const
+{
+  // the planes where the lost node is unpaired: digit y of the plane
+  // index equals x, which gives q^y runs of q^(t-1-y) planes
+  int node = chunk_to_node(lost);
+  int x = node % q;
+  int y = node / q;
+  int seq = pow_int(q, t - 1 - y);
+  int runs = pow_int(q, y);
+  for (int i = 0; i < runs; i++) {
+    subchunks->push_back(make_pair(i * q * seq + x * seq, seq));
+  }
+}
+
+int ErasureCodeClay::minimum_to_decode(
+  const set<int> &want_to_read,
+  const set<int> &available,
+  map<int, vector<pair<int, int>>> *minimum)
+{
+  if (is_repair(want_to_read, available)) {
+    return minimum_to_repair(want_to_read, available, minimum);
+  }
+  return ErasureCode::minimum_to_decode(want_to_read, available, minimum);
+}
+
+int ErasureCodeClay::minimum_to_repair(
+  const set<int> &want_to_read,
+  const set<int> &available_chunks,
+  map<int, vector<pair<int, int>>> *minimum)
+{
+  int lost = *want_to_read.begin();
+  vector<pair<int, int>> subchunks;
+  get_repair_subchunks(lost, &subchunks);
+
+  int y = chunk_to_node(lost) / q;
+  for (int x = 0; x < q; x++) {
+    int chunk = node_to_chunk(y * q + x);
+    if (chunk >= 0 && chunk != lost)
+      minimum->insert(make_pair(chunk, subchunks));
+  }
+  for (auto chunk : available_chunks) {
+    if (minimum->size() >= (unsigned)d)
+      break;
+    minimum->insert(make_pair(chunk, subchunks));
+  }
+  assert(minimum->size() == (unsigned)d);
+  return 0;
+}
+
+int ErasureCodeClay::decode(const set<int> &want_to_read,
+			    const map<int, bufferlist> &chunks,
+			    map<int, bufferlist> *decoded, int chunk_size)
+{
+  set<int> available;
+  for (auto& i : chunks)
+    available.insert(i.first);
+  if (is_repair(want_to_read, available) &&
+      (unsigned)chunk_size > chunks.begin()->second.length()) {
+    return repair(want_to_read, chunks, decoded, chunk_size);
+  }
+  return ErasureCode::_decode(want_to_read, chunks, decoded);
+}
+
+int ErasureCodeClay::encode_chunks(const set<int> &want_to_encode,
+				   map<int, bufferlist> *encoded)
+{
+  unsigned size = encoded->begin()->second.length();
+  // encoding is decoding with all the parity nodes erased
+  set<int> parity;
+  for (int i = k; i < k + m; i++)
+    parity.insert(chunk_to_node(i));
+
+  bufferptr zeros;
+  if (nu) {
+    zeros = buffer::create_aligned(size, SIMD_ALIGN);
+    zeros.zero();
+  }
+  vector<char*> coupled(q * t);
+  for (int node = 0; node < q * t; node++) {
+    int chunk = node_to_chunk(node);
+    coupled[node] = chunk < 0 ? zeros.c_str() : (*encoded)[chunk].c_str();
+  }
+  return decode_layered(parity, coupled, size);
+}
+
+int ErasureCodeClay::decode_chunks(const set<int> &want_to_read,
+				   const map<int, bufferlist> &chunks,
+				   map<int, bufferlist> *decoded)
+{
+  unsigned size = decoded->begin()->second.length();
+  set<int> erased;
+  for (int i = 0; i < k + m; i++) {
+    if (!chunks.count(i))
+      erased.insert(chunk_to_node(i));
+  }
+  if (erased.size() > (unsigned)m)
+    return -EIO;
+
+  bufferptr zeros;
+  if (nu) {
+    zeros = buffer::create_aligned(size, SIMD_ALIGN);
+    zeros.zero();
+  }
+  vector<char*> coupled(q * t);
+  for (int node = 0; node < q * t; node++) {
+    int chunk = node_to_chunk(node);
+    coupled[node] = chunk < 0 ? zeros.c_str() : (*decoded)[chunk].c_str();
+  }
+  return decode_layered(erased, coupled, size);
+}
+
+int ErasureCodeClay::pft_transform(char *subchunks[4],
+				   const set<int> &known,
+				   unsigned sc_size)
+{
+  map<int, bufferlist> known_map, all;
+  set<int> want;
+  for (int i = 0; i < 4; i++) {
+    all[i].push_back(buffer::create_static(sc_size, subchunks[i]));
+    if (known.count(i))
+      known_map[i] = all[i];
+    else
+      want.insert(i);
+  }
+  return pft.erasure_code->decode_chunks(want, known_map, &all);
+}
+
+int ErasureCodeClay::mds_decode(const set<int> &erased_nodes,
+				vector<char*> &uncoupled,
+				unsigned sc_size)
+{
+  map<int, bufferlist> known, all;
+  for (int i = 0; i < q * t; i++) {
+    all[i].push_back(buffer::create_static(sc_size, uncoupled[i]));
+    if (!erased_nodes.count(i))
+      known[i] = all[i];
+  }
+  return mds.erasure_code->decode_chunks(erased_nodes, known, &all);
+}
+
+/*
+ * The four sub-chunks of a coupled pair are a pft codeword: the
+ * coupled sub-chunk of the node with the larger x at index 0, the
+ * other's at 1, and their uncoupled counterparts at 2 and 3.
+ */
+#define PFT_C(first) ((first) ? 0 : 1)
+#define PFT_U(first) ((first) ? 2 : 3)
+
+int ErasureCodeClay::decode_layered(const set<int> &erased_nodes,
+				    vector<char*> &coupled,
+				    unsigned size)
+{
+  assert(size % sub_chunk_no == 0);
+  assert(erased_nodes.size() <= (unsigned)m);
+  unsigned sc_size = size / sub_chunk_no;
+  int nodes = q * t;
+
+  vector<bufferptr> U_buf(nodes);
+  vector<char*> uncoupled(nodes);
+  for (int i = 0; i < nodes; i++) {
+    U_buf[i] = buffer::create_aligned(size, SIMD_ALIGN);
+    uncoupled[i] = U_buf[i].c_str();
+  }
+
+  // a plane is decoded after the planes with fewer erased unpaired
+  // nodes: those hold the pairs it needs from outside itself.
+  vector<int> z_vec(t);
+  vector<int> order(sub_chunk_no);
+  int max_score = 0;
+  for (int z = 0; z < sub_chunk_no; z++) {
+    get_plane_vector(z, z_vec.data());
+    int score = 0;
+    for (auto node : erased_nodes) {
+      if (z_vec[node / q] == node % q)
+	score++;
+    }
+    order[z] = score;
+    max_score = std::max(max_score, score);
+  }
+
+  auto pair_subchunks = [&](char *sub[4], int node, int z, int partner,
+			    int z_sw, bool first) {
+    sub[PFT_C(first)] = coupled[node] + z * sc_size;
+    sub[PFT_U(first)] = uncoupled[node] + z * sc_size;
+    sub[PFT_C(!first)] = coupled[partner] + z_sw * sc_size;
+    sub[PFT_U(!first)] = uncoupled[partner] + z_sw * sc_size;
+  };
+
+  vector<char*> plane(nodes);
+  for (int score = 0; score <= max_score; score++) {
+    // uncoupled sub-chunks of the surviving nodes in every plane of
+    // this score ...
+    for (int z = 0; z < sub_chunk_no; z++) {
+      if (order[z] != score)
+	continue;
+      get_plane_vector(z, z_vec.data());
+      for (int node = 0; node < nodes; node++) {
+	if (erased_nodes.count(node))
+	  continue;
+	int x = node % q;
+	int y = node / q;
+	int zy = z_vec[y];
+	if (zy == x) {
+	  memcpy(uncoupled[node] + z * sc_size, coupled[node] + z * sc_size,
+		 sc_size);
+	  continue;
+	}
+	int partner = y * q + zy;
+	int z_sw = get_pair_plane(z, x, zy, y);
+	// an erased partner's coupled sub-chunk was recovered with plane
+	// z_sw, whose score is one less.  A surviving pair is transformed
+	// once, from whichever of its planes comes first.
+	if (erased_nodes.count(partner) ||
+	    order[z_sw] > score ||
+	    (order[z_sw] == score && x > zy)) {
+	  char *sub[4];
+	  pair_subchunks(sub, node, z, partner, z_sw, x > zy);
+	  int r = pft_transform(sub, {PFT_C(true), PFT_C(false)}, sc_size);
+	  if (r < 0)
+	    return r;
+	}
+      }
+    }
+
+    // ... then those of the erased nodes from the MDS code ...
+    for (int z = 0; z < sub_chunk_no; z++) {
+      if (order[z] != score)
+	continue;
+      for (int node = 0; node < nodes; node++)
+	plane[node] = uncoupled[node] + z * sc_size;
+      int r = mds_decode(erased_nodes, plane, sc_size);
+      if (r < 0)
+	return r;
+    }
+
+    // ... and back to coupled sub-chunks for the erased nodes
+    for (int z = 0; z < sub_chunk_no; z++) {
+      if (order[z] != score)
+	continue;
+      get_plane_vector(z, z_vec.data());
+      for (auto node : erased_nodes) {
+	int x = node % q;
+	int y = node / q;
+	int zy = z_vec[y];
+	if (zy == x) {
+	  memcpy(coupled[node] + z * sc_size, uncoupled[node] + z * sc_size,
+		 sc_size);
+	  continue;
+	}
+	int partner = y * q + zy;
+	int z_sw = get_pair_plane(z, x, zy, y);
+	char *sub[4];
+	int r = 0;
+	if (!erased_nodes.count(partner)) {
+	  pair_subchunks(sub, node, z, partner, z_sw, x > zy);
+	  r = pft_transform(sub, {PFT_U(x > zy), PFT_C(x <= zy)}, sc_size);
+	} else if (x > zy) {
+	  // both erased: plane z_sw has the same score and is decoded too
+	  pair_subchunks(sub, node, z, partner, z_sw, true);
+	  r = pft_transform(sub, {PFT_U(true), PFT_U(false)}, sc_size);
+	}
+	if (r < 0)
+	  return r;
+      }
+    }
+  }
+  return 0;
+}
+
+int ErasureCodeClay::repair(const set<int> &want_to_read,
+			    const map<int, bufferlist> &chunks,
+			    map<int, bufferlist> *repaired,
+			    int chunk_size)
+{
+  int lost = *want_to_read.begin();
+  int lost_node = chunk_to_node(lost);
+  int x0 = lost_node % q;
+  int y0 = lost_node / q;
+  int nodes = q * t;
+  assert(chunk_size % sub_chunk_no == 0);
+  unsigned sc_size = chunk_size / sub_chunk_no;
+
+  // the helpers sent the repair planes back to back: map each of them
+  // to its position
+  vector<pair<int, int>> subchunks;
+  get_repair_subchunks(lost, &subchunks);
+  vector<int> index(sub_chunk_no, -1);
+  vector<int> repair_planes;
+  for (auto& r : subchunks) {
+    for (int z = r.first; z < r.first + r.second; z++) {
+      index[z] = repair_planes.size();
+      repair_planes.push_back(z);
+    }
+  }
+  int planes = repair_planes.size();
+  unsigned repair_size = planes * sc_size;
+
+  map<int, bufferlist> helpers(chunks);
+  bufferptr zeros(buffer::create_aligned(repair_size, SIMD_ALIGN));
+  zeros.zero();
+  vector<char*> coupled(nodes, nullptr);
+  set<int> aloof;   // neither lost nor helping
+  for (int node = 0; node < nodes; node++) {
+    if (node == lost_node)
+      continue;
+    int chunk = node_to_chunk(node);
+    if (chunk < 0) {
+      coupled[node] = zeros.c_str();
+    } else if (helpers.count(chunk)) {
+      if (helpers[chunk].length() != repair_size) {
+	dout(0) << __func__ << " chunk " << chunk << " has "
+		<< helpers[chunk].length() << " bytes, expected "
+		<< repair_size << dendl;
+	return -EINVAL;
+      }
+      coupled[node] = helpers[chunk].c_str();
+    } else {
+      aloof.insert(node);
+    }
+  }
+
+  // in every repair plane the lost node's column is unknown (its
+  // uncoupled sub-chunks pair with the lost node outside the repair
+  // planes), and so are the aloof nodes.
+  set<int> erased(aloof);
+  for (int x = 0; x < q; x++)
+    erased.insert(y0 * q + x);
+  if (erased.size() > (unsigned)m)
+    return -EIO;
+
+  vector<bufferptr> U_buf(nodes);
+  vector<char*> uncoupled(nodes);
+  for (int i = 0; i < nodes; i++) {
+    U_buf[i] = buffer::create_aligned(repair_size, SIMD_ALIGN);
+    uncoupled[i] = U_buf[i].c_str();
+  }
+  bufferptr scratch(buffer::create_aligned(sc_size, SIMD_ALIGN));
+  bufferptr out(buffer::create_aligned(chunk_size, SIMD_ALIGN));
+
+  // the uncoupled sub-chunk of a helper paired with an aloof node comes
+  // from the plane where the aloof node is not the unpaired one: decode
+  // planes by increasing number of unpaired aloof nodes.
+  vector<int> z_vec(t);
+  vector<int> order(planes);
+  int max_score = 0;
+  for (int i = 0; i < planes; i++) {
+    get_plane_vector(repair_planes[i], z_vec.data());
+    int score = 0;
+    for (auto node : aloof) {
+      if (z_vec[node / q] == node % q)
+	score++;
+    }
+    order[i] = score;
+    max_score = std::max(max_score, score);
+  }
+
+  vector<char*> plane(nodes);
+  for (int score = 0; score <= max_score; score++) {
+    for (int i = 0; i < planes; i++) {
+      if (order[i] != score)
+	continue;
+      int z = repair_planes[i];
+      get_plane_vector(z, z_vec.data());
+      for (int node = 0; node < nodes; node++) {
+	if (erased.count(node))
+	  continue;
+	int x = node % q;
+	int y = node / q;
+	int zy = z_vec[y];
+	if (zy == x) {
+	  memcpy(uncoupled[node] + i * sc_size, coupled[node] + i * sc_size,
+		 sc_size);
+	  continue;
+	}
+	// y != y0, so the partner's plane is a repair plane too
+	int partner = y * q + zy;
+	int j = index[get_pair_plane(z, x, zy, y)];
+	bool first = x > zy;
+	char *sub[4];
+	sub[PFT_C(first)] = coupled[node] + i * sc_size;
+	sub[PFT_U(first)] = uncoupled[node] + i * sc_size;
+	sub[PFT_U(!first)] = uncoupled[partner] + j * sc_size;
+	int r = 0;
+	if (aloof.count(partner)) {
+	  sub[PFT_C(!first)] = scratch.c_str();
+	  r = pft_transform(sub, {PFT_C(first), PFT_U(!first)}, sc_size);
+	} else if (order[j] > score || (order[j] == score && first)) {
+	  sub[PFT_C(!first)] = coupled[partner] + j * sc_size;
+	  r = pft_transform(sub, {PFT_C(true), PFT_C(false)}, sc_size);
+	}
+	if (r < 0)
+	  return r;
+      }
+    }
+    for (int i = 0; i < planes; i++) {
+      if (order[i] != score)
+	continue;
+      for (int node = 0; node < nodes; node++)
+	plane[node] = uncoupled[node] + i * sc_size;
+      int r = mds_decode(erased, plane, sc_size);
+      if (r < 0)
+	return r;
+    }
+  }
+
+  // the lost node is unpaired in the repair planes; in the others it is
+  // paired with one of its column, whose coupled and uncoupled
+  // sub-chunks in the repair plane are now both known.
+  for (int i = 0; i < planes; i++) {
+    int z = repair_planes[i];
+    memcpy(out.c_str() + z * sc_size, uncoupled[lost_node] + i * sc_size,
+	   sc_size);
+    for (int x = 0; x < q; x++) {
+      if (x == x0)
+	continue;
+      int node = y0 * q + x;
+      bool first = x > x0;
+      char *sub[4];
+      sub[PFT_C(first)] = coupled[node] + i * sc_size;
+      sub[PFT_U(first)] = uncoupled[node] + i * sc_size;
+      sub[PFT_C(!first)] = out.c_str() + get_pair_plane(z, x, x0, y0) * sc_size;
+      sub[PFT_U(!first)] = scratch.c_str();
+      int r = pft_transform(sub, {PFT_C(first), PFT_U(first)}, sc_size);
+      if (r < 0)
+	return r;
+    }
+  }
+  (*repaired)[lost].push_back(std::move(out));
+  return 0;
+}
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph distributed storage system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef CEPH_ERASURE_CODE_CLAY_H
+#define CEPH_ERASURE_CODE_CLAY_H
+
+#include "include/err.h"
+#include "include/buffer_fwd.h"
+#include "erasure-code/ErasureCode.h"
+
+/**
+ * Coupled-layer (Clay) code: an MSR (minimum storage regenerating)
+ * array code built on top of a scalar MDS code.
+ *
+ * Each chunk is split into sub_chunk_no = q^t sub-chunks.  The k + m
+ * chunks (plus nu virtual, all-zero chunks so that q divides the node
+ * count) are laid out on a q x t grid; node (x, y) is chunk y * q + x.
+ * Sub-chunk z of every node belongs to "plane" z.  Within a plane the
+ * *uncoupled* sub-chunks form a codeword of the scalar (k + nu, m)
+ * MDS code.  What is stored are the *coupled* sub-chunks: for node
+ * (x, y) in plane z, let z_y be the y-th base-q digit of z; if z_y == x
+ * the stored value is the uncoupled one, otherwise it is paired with
+ * node (z_y, y) in the plane where digit y is x, and the four values
+ * of the pair are a codeword of a (2, 2) MDS code (the "pairwise
+ * coupling transform").
+ *
+ * Encoding and decoding of up to m erasures proceed plane by plane.
+ * A single lost chunk, however, can be repaired from d helpers that
+ * each send only the 1/q of their sub-chunks lying in the planes where
+ * the lost node is unpaired, instead of k whole chunks.
+ */
+class ErasureCodeClay final : public ErasureCode {
+public:
+  std::string DEFAULT_K{"4"};
+  std::string DEFAULT_M{"2"};
+  std::string DEFAULT_W{"8"};
+  int k = 0, m = 0, d = 0, w = 8;
+  int q = 0, t = 0, nu = 0;
+  int sub_chunk_no = 0;
+
+  struct ScalarMDS {
+    ceph::ErasureCodeInterfaceRef erasure_code;
+    ceph::ErasureCodeProfile profile;
+  };
+  ScalarMDS mds;  ///< (k + nu, m) code within each plane
+  ScalarMDS pft;  ///< (2, 2) code coupling the sub-chunks of a node pair
+
+  const std::string directory;
+
+  explicit ErasureCodeClay(const std::string& dir)
+    : directory(dir)
+  {}
+
+  ~ErasureCodeClay() override {}
+
+  unsigned int get_chunk_count() const override {
+    return k + m;
+  }
+
+  unsigned int get_data_chunk_count() const override {
+    return k;
+  }
+
+  int get_sub_chunk_count() override {
+    return sub_chunk_no;
+  }
+
+  unsigned int get_chunk_size(unsigned int object_size) const override;
+
+  int minimum_to_decode(const std::set<int> &want_to_read,
+			const std::set<int> &available,
+			std::map<int, std::vector<std::pair<int, int>>> *minimum) override;
+
+  int decode(const std::set<int> &want_to_read,
+	     const std::map<int, bufferlist> &chunks,
+	     std::map<int, bufferlist> *decoded, int chunk_size) override;
+
+  int encode_chunks(const std::set<int> &want_to_encode,
+		    std::map<int, bufferlist> *encoded) override;
+
+  int decode_chunks(const std::set<int> &want_to_read,
+		    const std::map<int, bufferlist> &chunks,
+		    std::map<int, bufferlist> *decoded) override;
+
+  int init(ErasureCodeProfile &profile, std::ostream *ss) override;
+
+  /// true if the single chunk in want_to_read can be repaired from
+  /// sub-chunks of d of the available chunks
+  bool is_repair(const std::set<int> &want_to_read,
+		 const std::set<int> &available_chunks) const;
+
+  /// the sub-chunk ranges a helper must send to repair chunk lost
+  void get_repair_subchunks(int lost,
+			    std::vector<std::pair<int, int>> *subchunks) const;
+
+protected:
+  virtual int parse(ErasureCodeProfile &profile, std::ostream *ss);
+
+private:
+  int minimum_to_repair(const std::set<int> &want_to_read,
+			const std::set<int> &available_chunks,
+			std::map<int, std::vector<std::pair<int, int>>> *minimum);
+
+  int repair(const std::set<int> &want_to_read,
+	     const std::map<int, bufferlist> &chunks,
+	     std::map<int, bufferlist> *repaired, int chunk_size);
+
+  int decode_layered(const std::set<int> &erased_nodes,
+		     std::vector<char*> &coupled, unsigned size);
+
+  void get_plane_vector(int z, int *z_vec) const;
+  int pow_int(int a, int x) const;
+  /// the plane holding the partner of node (x, y) in plane z, whose
+  /// y-th digit is zy
+  int get_pair_plane(int z, int x, int zy, int y) const {
+    return z + (x - zy) * pow_int(q, t - 1 - y);
+  }
+
+  int chunk_to_node(int chunk) const {
+    return chunk < k ? chunk : chunk + nu;
+  }
+  /// -1 for the virtual nodes
+  int node_to_chunk(int node) const {
+    return node < k ? node : (node < k + nu ? -1 : node - nu);
+  }
+
+  int pft_transform(char *subchunks[4], const std::set<int> &known,
+		    unsigned sc_size);
+  int mds_decode(const std::set<int> &erased_nodes,
+		 std::vector<char*> &uncoupled, unsigned sc_size);
+};
+
+#endif
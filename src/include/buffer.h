@@ -45,6 +45,9 @@
 #include <string>
 #include <exception>
 #include <type_traits>
+#include <iterator>
+#include <algorithm>
+#include <new>
 
 #include "page.h"
 #include "crc32c.h"
@@ -73,6 +76,12 @@ class deleter;
 namespace ceph {
 
 namespace buffer CEPH_BUFFER_API {
+/*
+ * the layout of list changed (buffers_t) in v13_0_1; the inline
+ * namespace keeps code built against the old one from linking to it.
+ */
+inline namespace v13_0_1 {
+
   /*
    * exceptions
    */
@@ -349,8 +358,237 @@ namespace buffer CEPH_BUFFER_API {
    */
 
   class CEPH_BUFFER_API list {
+  public:
+    /**
+     * the segments of a list.
+     *
+     * a vector of ptrs whose first two slots are stored inline, so that
+     * short lists, by far the most common, need no allocation beyond
+     * their buffers.  it keeps the accessors of the std::list<ptr> it
+     * replaced (begin/end, front/back, size, empty) for the callers of
+     * buffers().
+     */
+    class buffers_t {
+    public:
+      typedef ptr value_type;
+      typedef ptr& reference;
+      typedef const ptr& const_reference;
+      typedef ptr* iterator;
+      typedef const ptr* const_iterator;
+      typedef std::reverse_iterator<iterator> reverse_iterator;
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+      typedef unsigned size_type;
+
+    private:
+      static constexpr unsigned inline_slots = 2;
+
+      ptr *_data;
+      unsigned _size;
+      unsigned _cap;
+      std::aligned_storage<sizeof(ptr), alignof(ptr)>::type
+	_inline[inline_slots];
+
+      ptr *inline_data() {
+	return reinterpret_cast<ptr*>(&_inline[0]);
+      }
+      bool is_inline() const {
+	return _data == reinterpret_cast<const ptr*>(&_inline[0]);
+      }
+      void grow(unsigned want) {
+	unsigned cap = std::max(want, _cap * 2);
+	ptr *data = static_cast<ptr*>(::operator new(cap * sizeof(ptr)));
+	for (unsigned i = 0; i < _size; ++i) {
+	  new (&data[i]) ptr(std::move(_data[i]));
+	  _data[i].~ptr();
+	}
+	if (!is_inline()) {
+	  ::operator delete(_data);
+	}
+	_data = data;
+	_cap = cap;
+      }
+      /// move [i, _size) up by n slots, leaving [i, i+n) to be assigned
+      /// (or, past the old end, constructed) by the caller
+      void open_gap(unsigned i, unsigned n) {
+	if (_size + n > _cap) {
+	  grow(_size + n);
+	}
+	for (unsigned j = _size; j-- > i; ) {
+	  if (j + n >= _size) {
+	    new (&_data[j + n]) ptr(std::move(_data[j]));
+	  } else {
+	    _data[j + n] = std::move(_data[j]);
+	  }
+	}
+      }
+      template <typename T>
+      void fill_gap(unsigned i, unsigned old_size, T&& v) {
+	if (i < old_size) {
+	  _data[i] = std::forward<T>(v);
+	} else {
+	  new (&_data[i]) ptr(std::forward<T>(v));
+	}
+      }
+      void steal(buffers_t& other) {
+	if (other.is_inline()) {
+	  _data = inline_data();
+	  _cap = inline_slots;
+	  for (unsigned i = 0; i < other._size; ++i) {
+	    new (&_data[i]) ptr(std::move(other._data[i]));
+	  }
+	  _size = other._size;
+	  other.clear();
+	} else {
+	  _data = other._data;
+	  _size = other._size;
+	  _cap = other._cap;
+	  other._data = other.inline_data();
+	  other._size = 0;
+	  other._cap = inline_slots;
+	}
+      }
+      void release() {
+	clear();
+	if (!is_inline()) {
+	  ::operator delete(_data);
+	  _data = inline_data();
+	  _cap = inline_slots;
+	}
+      }
+
+    public:
+      buffers_t() : _data(inline_data()), _size(0), _cap(inline_slots) {}
+      buffers_t(const buffers_t& other)
+	: _data(inline_data()), _size(0), _cap(inline_slots) {
+	insert(end(), other.begin(), other.end());
+      }
+      buffers_t(buffers_t&& other) noexcept
+	: _data(inline_data()), _size(0), _cap(inline_slots) {
+	steal(other);
+      }
+      ~buffers_t() {
+	release();
+      }
+      buffers_t& operator=(const buffers_t& other) {
+	if (this != &other) {
+	  clear();
+	  insert(end(), other.begin(), other.end());
+	}
+	return *this;
+      }
+      buffers_t& operator=(buffers_t&& other) noexcept {
+	if (this != &other) {
+	  release();
+	  steal(other);
+	}
+	return *this;
+      }
+      void swap(buffers_t& other) {
+	buffers_t tmp(std::move(other));
+	other = std::move(*this);
+	*this = std::move(tmp);
+      }
+
+      iterator begin() { return _data; }
+      iterator end() { return _data + _size; }
+      const_iterator begin() const { return _data; }
+      const_iterator end() const { return _data + _size; }
+      const_iterator cbegin() const { return begin(); }
+      const_iterator cend() const { return end(); }
+      reverse_iterator rbegin() { return reverse_iterator(end()); }
+      reverse_iterator rend() { return reverse_iterator(begin()); }
+      const_reverse_iterator rbegin() const {
+	return const_reverse_iterator(end());
+      }
+      const_reverse_iterator rend() const {
+	return const_reverse_iterator(begin());
+      }
+
+      unsigned size() const { return _size; }
+      bool empty() const { return _size == 0; }
+      ptr& operator[](unsigned i) { return _data[i]; }
+      const ptr& operator[](unsigned i) const { return _data[i]; }
+      ptr& front() { return _data[0]; }
+      const ptr& front() const { return _data[0]; }
+      ptr& back() { return _data[_size - 1]; }
+      const ptr& back() const { return _data[_size - 1]; }
+
+      void reserve(unsigned n) {
+	if (n > _cap) {
+	  grow(n);
+	}
+      }
+      void clear() {
+	for (unsigned i = 0; i < _size; ++i) {
+	  _data[i].~ptr();
+	}
+	_size = 0;
+      }
+      template <typename... Args>
+      void emplace_back(Args&&... args) {
+	if (_size == _cap) {
+	  // construct first: args may refer to one of our own ptrs
+	  ptr v(std::forward<Args>(args)...);
+	  grow(_size + 1);
+	  new (&_data[_size]) ptr(std::move(v));
+	} else {
+	  new (&_data[_size]) ptr(std::forward<Args>(args)...);
+	}
+	++_size;
+      }
+      void push_back(const ptr& v) { emplace_back(v); }
+      void push_back(ptr&& v) { emplace_back(std::move(v)); }
+
+      template <typename... Args>
+      iterator emplace(const_iterator pos, Args&&... args) {
+	unsigned i = pos - _data;
+	ptr v(std::forward<Args>(args)...);
+	open_gap(i, 1);
+	fill_gap(i, _size, std::move(v));
+	++_size;
+	return _data + i;
+      }
+      iterator insert(const_iterator pos, const ptr& v) {
+	return emplace(pos, v);
+      }
+      iterator insert(const_iterator pos, ptr&& v) {
+	return emplace(pos, std::move(v));
+      }
+      /// [first, last) must not point into this vector
+      template <typename It>
+      iterator insert(const_iterator pos, It first, It last) {
+	unsigned i = pos - _data;
+	unsigned n = std::distance(first, last);
+	open_gap(i, n);
+	for (unsigned j = i; first != last; ++first, ++j) {
+	  fill_gap(j, _size, *first);
+	}
+	_size += n;
+	return _data + i;
+      }
+      iterator erase(const_iterator first, const_iterator last) {
+	unsigned i = first - _data;
+	unsigned n = last - first;
+	if (n == 0) {
+	  return _data + i;
+	}
+	for (unsigned j = i + n; j < _size; ++j) {
+	  _data[j - n] = std::move(_data[j]);
+	}
+	for (unsigned j = _size - n; j < _size; ++j) {
+	  _data[j].~ptr();
+	}
+	_size -= n;
+	return _data + i;
+      }
+      iterator erase(const_iterator pos) {
+	return erase(pos, pos + 1);
+      }
+    };
+
+  private:
     // my private bits
-    std::list<ptr> _buffers;
+    buffers_t _buffers;
     unsigned _len;
     unsigned _memcopy_count; //the total of memcopy using rebuild().
     ptr append_buffer;  // where i put small appends.
@@ -366,26 +604,21 @@ namespace buffer CEPH_BUFFER_API {
       typedef typename std::conditional<is_const,
 					const list,
 					list>::type bl_t;
-      typedef typename std::conditional<is_const,
-					const std::list<ptr>,
-					std::list<ptr> >::type list_t;
-      typedef typename std::conditional<is_const,
-					typename std::list<ptr>::const_iterator,
-					typename std::list<ptr>::iterator>::type list_iter_t;
       bl_t* bl;
-      list_t* ls;  // meh.. just here to avoid an extra pointer dereference..
       unsigned off; // in bl
-      list_iter_t p;
-      unsigned p_off;   // in *p
+      // index of the current buffer in bl->_buffers, rather than an
+      // iterator, so that appending to the list does not invalidate it
+      unsigned p;
+      unsigned p_off;   // in bl->_buffers[p]
       friend class iterator_impl<true>;
 
     public:
       // constructor.  position.
       iterator_impl()
-	: bl(0), ls(0), off(0), p_off(0) {}
+	: bl(0), off(0), p(0), p_off(0) {}
       iterator_impl(bl_t *l, unsigned o=0);
-      iterator_impl(bl_t *l, unsigned o, list_iter_t ip, unsigned po)
-	: bl(l), ls(&bl->_buffers), off(o), p(ip), p_off(po) {}
+      iterator_impl(bl_t *l, unsigned o, unsigned ip, unsigned po)
+	: bl(l), off(o), p(ip), p_off(po) {}
       iterator_impl(const list::iterator& i);
 
       /// get current iterator offset in buffer::list
@@ -396,7 +629,7 @@ namespace buffer CEPH_BUFFER_API {
 
       /// true if iterator is at the end of the buffer::list
       bool end() const {
-	return p == ls->end();
+	return p == bl->_buffers.size();
 	//return off == bl->length();
       }
 
@@ -444,7 +677,7 @@ namespace buffer CEPH_BUFFER_API {
     public:
       iterator() = default;
       iterator(bl_t *l, unsigned o=0);
-      iterator(bl_t *l, unsigned o, list_iter_t ip, unsigned po);
+      iterator(bl_t *l, unsigned o, unsigned ip, unsigned po);
 
       void advance(int o);
       void seek(unsigned o);
@@ -704,16 +937,14 @@ namespace buffer CEPH_BUFFER_API {
     }
 
     unsigned get_memcopy_count() const {return _memcopy_count; }
-    const std::list<ptr>& buffers() const { return _buffers; }
+    const buffers_t& buffers() const { return _buffers; }
     void swap(list& other);
     unsigned length() const {
 #if 0
       // DEBUG: verify _len
       unsigned len = 0;
-      for (std::list<ptr>::const_iterator it = _buffers.begin();
-	   it != _buffers.end();
-	   it++) {
-	len += (*it).length();
+      for (const auto& p : _buffers) {
+	len += p.length();
       }
       assert(len == _len);
 #endif
@@ -745,14 +976,16 @@ namespace buffer CEPH_BUFFER_API {
     void push_front(ptr& bp) {
       if (bp.length() == 0)
 	return;
-      _buffers.push_front(bp);
+      _buffers.insert(_buffers.begin(), bp);
       _len += bp.length();
+      last_p = begin();
     }
     void push_front(ptr&& bp) {
       if (bp.length() == 0)
 	return;
       _len += bp.length();
-      _buffers.push_front(std::move(bp));
+      _buffers.insert(_buffers.begin(), std::move(bp));
+      last_p = begin();
     }
     void push_front(raw *r) {
       push_front(ptr(r));
@@ -801,9 +1034,8 @@ namespace buffer CEPH_BUFFER_API {
 
     // clone non-shareable buffers (make shareable)
     void make_shareable() {
-      std::list<buffer::ptr>::iterator pb;
-      for (pb = _buffers.begin(); pb != _buffers.end(); ++pb) {
-        (void) pb->make_shareable();
+      for (auto& p : _buffers) {
+        (void) p.make_shareable();
       }
     }
 
@@ -812,9 +1044,8 @@ namespace buffer CEPH_BUFFER_API {
     {
       if (this != &bl) {
         clear();
-        std::list<buffer::ptr>::const_iterator pb;
-        for (pb = bl._buffers.begin(); pb != bl._buffers.end(); ++pb) {
-          push_back(*pb);
+        for (const auto& p : bl._buffers) {
+          push_back(p);
         }
       }
     }
@@ -823,14 +1054,14 @@ namespace buffer CEPH_BUFFER_API {
       return iterator(this, 0);
     }
     iterator end() {
-      return iterator(this, _len, _buffers.end(), 0);
+      return iterator(this, _len, _buffers.size(), 0);
     }
 
     const_iterator begin() const {
       return const_iterator(this, 0);
     }
     const_iterator end() const {
-      return const_iterator(this, _len, _buffers.end(), 0);
+      return const_iterator(this, _len, _buffers.size(), 0);
     }
 
     // crope lookalikes.
@@ -976,7 +1207,8 @@ inline bufferhash& operator<<(bufferhash& l, const bufferlist &r) {
   return l;
 }
 
-}
+} // inline namespace v13_0_1
+} // namespace buffer
 
 #if defined(HAVE_XIO)
 xio_reg_mem* get_xio_mp(const buffer::ptr& bp);
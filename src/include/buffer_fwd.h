@@ -3,9 +3,11 @@
 
 namespace ceph {
   namespace buffer {
-    class ptr;
-    class list;
-    class hash;
+    inline namespace v13_0_1 {
+      class ptr;
+      class list;
+      class hash;
+    }
   }
 
   using bufferptr = buffer::ptr;
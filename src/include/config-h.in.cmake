@@ -93,6 +93,9 @@
 /* Defined if you have libaio */
 #cmakedefine HAVE_LIBAIO
 
+/* Defined if you have linux io_uring (5.4 or later headers) */
+#cmakedefine HAVE_IO_URING
+
 /* Defined if OpenLDAP enabled */
 #cmakedefine HAVE_OPENLDAP
 
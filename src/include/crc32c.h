@@ -23,7 +23,8 @@ extern ceph_crc32c_func_t ceph_choose_crc32(void);
  * Note: works the same as ceph_crc32c_func for data == nullptr, 
  * but faster than the optimized assembly on certain architectures.
  * This is faster than intel optimized assembly, but not as fast as 
- * ppc64le optimized assembly.  
+ * ppc64le optimized assembly.  With PCLMUL (x86_64) or PMULL (aarch64)
+ * it takes O(log length) carry-less multiplies.
  *
  * @param crc initial value
  * @param length length of buffer
@@ -50,6 +51,28 @@ static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsi
   return ceph_crc32c_func(crc, data, length);
 }
 
+/**
+ * combine the crc32c values of two adjacent buffers
+ *
+ * Given crc_a = ceph_crc32c(seed, a, length_a) and
+ * crc_b = ceph_crc32c(0, b, length_b), return the crc32c of a followed
+ * by b from the given seed, without looking at the data again.  This
+ * costs O(log length_b), so crcs computed over pieces separately (or
+ * cached with them) can be composed instead of recomputed.
+ *
+ * @param crc_a crc of the first buffer, from any initial value
+ * @param crc_b crc of the second buffer, from an initial value of 0
+ * @param length_b length of the second buffer
+ */
+static inline uint32_t ceph_crc32c_combine(uint32_t crc_a, uint32_t crc_b,
+					   unsigned length_b)
+{
+  /* with no pre- or post-conditioning, crc32c is linear in its input:
+   * running crc_a over b gives crc_a shifted by length_b zero bytes,
+   * xor the crc of b itself. */
+  return ceph_crc32c_zeros(crc_a, length_b) ^ crc_b;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,4 +24,15 @@
 # endif
 #endif
 
+/*
+ * MSG_ZEROCOPY needs Linux 4.14 and headers that know about it.
+ */
+#ifdef __linux__
+# include <sys/socket.h>
+# include <linux/errqueue.h>
+# if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#  define CEPH_HAVE_MSG_ZEROCOPY
+# endif
+#endif
+
 #endif
@@ -268,7 +268,7 @@ public:
   };
   typedef ceph::shared_ptr< WholeSpaceIteratorImpl > WholeSpaceIterator;
 
-private:
+protected:
   // This class filters a WholeSpaceIterator by a prefix.
   class PrefixIteratorImpl : public IteratorImpl {
     const std::string prefix;
@@ -358,6 +358,25 @@ public:
     return -EOPNOTSUPP;
   }
 
+  /// resize the block cache at runtime (after open)
+  virtual int set_cache_capacity(int64_t capacity) {
+    return -EOPNOTSUPP;
+  }
+
+  virtual int64_t get_cache_capacity() {
+    return -EOPNOTSUPP;
+  }
+
+  /// bytes currently held by the block cache
+  virtual int64_t get_cache_usage() const {
+    return -EOPNOTSUPP;
+  }
+
+  /// bytes held by the block cache that cannot be evicted
+  virtual int64_t get_cache_pinned_usage() const {
+    return -EOPNOTSUPP;
+  }
+
   virtual ~KeyValueDB() {}
 
   /// compact the underlying store
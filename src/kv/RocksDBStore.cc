@@ -21,6 +21,7 @@
 using std::string;
 #include "common/perf_counters.h"
 #include "common/debug.h"
+#include "common/strtol.h"
 #include "include/str_list.h"
 #include "include/stringify.h"
 #include "include/str_map.h"
@@ -309,6 +310,113 @@ int RocksDBStore::install_cf_mergeop(
   return 0;
 }
 
+std::shared_ptr<rocksdb::Cache> RocksDBStore::create_block_cache(uint64_t size)
+{
+  if (g_conf->rocksdb_cache_type == "lru") {
+    return rocksdb::NewLRUCache(size, g_conf->rocksdb_cache_shard_bits);
+  } else if (g_conf->rocksdb_cache_type == "clock") {
+    return rocksdb::NewClockCache(size, g_conf->rocksdb_cache_shard_bits);
+  }
+  return nullptr;
+}
+
+void RocksDBStore::set_block_cache_sizes(uint64_t total)
+{
+  // the dedicated CF caches come out of the total, scaled down if need
+  // be so that at least half of it stays shared
+  double ratio = 0;
+  for (auto& c : cf_block_caches) {
+    ratio += c.first;
+  }
+  double scale = ratio > .5 ? .5 / ratio : 1;
+  uint64_t shared = total;
+  for (auto& c : cf_block_caches) {
+    if (!c.second) {
+      continue;
+    }
+    uint64_t bytes = total * c.first * scale;
+    c.second->SetCapacity(bytes);
+    shared -= bytes;
+  }
+  bbt_opts.block_cache->SetCapacity(shared);
+  dout(10) << __func__ << " total " << prettybyte_t(total)
+	   << ", shared block_cache size " << prettybyte_t(shared) << dendl;
+}
+
+void RocksDBStore::limit_cf_write_buffers(rocksdb::Options& opt)
+{
+  // every column family gets write_buffer_size * max_write_buffer_number
+  // of memtables, and one that is rarely written pins the oldest WAL
+  // file until its memtable fills up.  unless told otherwise, keep the
+  // memtables of all of them within what a single one may use, and
+  // flush whichever hold up the WAL once it grows that large too.
+  uint64_t budget = opt.write_buffer_size * opt.max_write_buffer_number;
+  if (opt.db_write_buffer_size == 0) {
+    opt.db_write_buffer_size = budget;
+  }
+  if (opt.max_total_wal_size == 0) {
+    opt.max_total_wal_size = budget;
+  }
+  dout(10) << __func__ << " db_write_buffer_size "
+	   << prettybyte_t(opt.db_write_buffer_size)
+	   << " max_total_wal_size " << prettybyte_t(opt.max_total_wal_size)
+	   << dendl;
+}
+
+int RocksDBStore::update_cf_options(
+  const ColumnFamily& cf,
+  rocksdb::ColumnFamilyOptions *cf_opt)
+{
+  // "cache_ratio=<f>" is not a rocksdb option: it gives this CF a block
+  // cache of its own, carved out of the shared one, so that a scan-heavy
+  // CF (omap) cannot evict the blocks of another (onodes).  It is sized
+  // along with the shared cache by set_block_cache_sizes().
+  list<string> items;
+  get_str_list(cf.option, ";", items);
+  string rocksdb_opts;
+  double cache_ratio = 0;
+  for (auto& i : items) {
+    if (i.compare(0, 12, "cache_ratio=") == 0) {
+      string err;
+      cache_ratio = strict_strtod(i.c_str() + 12, &err);
+      if (!err.empty() || cache_ratio < 0 || cache_ratio >= 1) {
+	derr << __func__ << " invalid cache_ratio for CF '" << cf.name
+	     << "': " << i << dendl;
+	return -EINVAL;
+      }
+      continue;
+    }
+    if (!rocksdb_opts.empty()) {
+      rocksdb_opts += ';';
+    }
+    rocksdb_opts += i;
+  }
+
+  rocksdb::Status status = rocksdb::GetColumnFamilyOptionsFromString(
+    *cf_opt, rocksdb_opts, cf_opt);
+  if (!status.ok()) {
+    derr << __func__ << " invalid db column family options for CF '"
+	 << cf.name << "': " << cf.option << dendl;
+    return -EINVAL;
+  }
+
+  if (cache_ratio > 0 && bbt_opts.block_cache) {
+    uint64_t bytes = bbt_opts.block_cache->GetCapacity() * cache_ratio;
+    rocksdb::BlockBasedTableOptions cf_bbt_opts(bbt_opts);
+    cf_bbt_opts.block_cache = create_block_cache(bytes);
+    if (!cf_bbt_opts.block_cache) {
+      derr << __func__ << " unable to create a block cache for CF '"
+	   << cf.name << "'" << dendl;
+      return -EINVAL;
+    }
+    cf_opt->table_factory.reset(rocksdb::NewBlockBasedTableFactory(cf_bbt_opts));
+    cf_block_caches.emplace_back(cache_ratio, cf_bbt_opts.block_cache);
+    dout(10) << __func__ << " CF '" << cf.name << "' block_cache size "
+	     << prettybyte_t(bytes) << dendl;
+  }
+  return 0;
+}
+
 int RocksDBStore::create_and_open(ostream &out,
 				  const vector<ColumnFamily>& cfs)
 {
@@ -398,15 +506,8 @@ int RocksDBStore::load_rocksdb_options(bool create_if_missing, rocksdb::Options&
              << ", setting no_block_cache " << dendl;
     bbt_opts.no_block_cache = true;
   } else {
-    if (g_conf->rocksdb_cache_type == "lru") {
-      bbt_opts.block_cache = rocksdb::NewLRUCache(
-        block_cache_size,
-        g_conf->rocksdb_cache_shard_bits);
-    } else if (g_conf->rocksdb_cache_type == "clock") {
-      bbt_opts.block_cache = rocksdb::NewClockCache(
-        block_cache_size,
-        g_conf->rocksdb_cache_shard_bits);
-    } else {
+    bbt_opts.block_cache = create_block_cache(block_cache_size);
+    if (!bbt_opts.block_cache) {
       derr << "unrecognized rocksdb_cache_type '" << g_conf->rocksdb_cache_type
         << "'" << dendl;
       return -EINVAL;
@@ -471,6 +572,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
   }
   rocksdb::Status status;
   if (create_if_missing) {
+    if (cfs && !cfs->empty()) {
+      limit_cf_write_buffers(opt);
+    }
     status = rocksdb::DB::Open(opt, path, &db);
     if (!status.ok()) {
       derr << status.ToString() << dendl;
@@ -483,12 +587,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
 	// the base for new CF
 	rocksdb::ColumnFamilyOptions cf_opt(opt);
 	// user input options will override the base options
-	status = rocksdb::GetColumnFamilyOptionsFromString(
-	  cf_opt, p.option, &cf_opt);
-	if (!status.ok()) {
-	  derr << __func__ << " invalid db column family option string for CF: "
-	       << p.name << dendl;
-	  return -EINVAL;
+	r = update_cf_options(p, &cf_opt);
+	if (r < 0) {
+	  return r;
 	}
 	install_cf_mergeop(p.name, &cf_opt);
 	rocksdb::ColumnFamilyHandle *cf;
@@ -519,6 +620,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
       }
       default_cf = db->DefaultColumnFamily();
     } else {
+      if (existing_cfs.size() > 1) {
+	limit_cf_write_buffers(opt);
+      }
       // we cannot change column families for a created database.  so, map
       // what options we are given to whatever cf's already exist.
       std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
@@ -531,12 +635,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
 	  for (auto& i : *cfs) {
 	    if (i.name == n) {
 	      found = true;
-	      status = rocksdb::GetColumnFamilyOptionsFromString(
-		cf_opt, i.option, &cf_opt);
-	      if (!status.ok()) {
-		derr << __func__ << " invalid db column family options for CF '"
-		     << i.name << "': " << i.option << dendl;
-		return -EINVAL;
+	      r = update_cf_options(i, &cf_opt);
+	      if (r < 0) {
+		return r;
 	      }
 	    }
 	  }
@@ -568,6 +669,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
     }
   }
   assert(default_cf != nullptr);
+  if (!cf_block_caches.empty() && bbt_opts.block_cache) {
+    set_block_cache_sizes(bbt_opts.block_cache->GetCapacity());
+  }
   
   PerfCountersBuilder plb(g_ceph_context, "rocksdb", l_rocksdb_first, l_rocksdb_last);
   plb.add_u64_counter(l_rocksdb_gets, "get", "Gets");
@@ -715,10 +819,10 @@ void RocksDBStore::get_statistics(Formatter *f)
   }
   if (g_conf->rocksdb_collect_memory_stats) {
     f->open_object_section("rocksdb_memtable_statistics");
-    std::string str(stringify(bbt_opts.block_cache->GetUsage()));
+    std::string str(stringify(get_cache_usage()));
     f->dump_string("block_cache_usage", str.data());
     str.clear();
-    str.append(stringify(bbt_opts.block_cache->GetPinnedUsage()));
+    str.append(stringify(get_cache_pinned_usage()));
     f->dump_string("block_cache_pinned_blocks_usage", str);
     str.clear();
     db->GetProperty("rocksdb.cur-size-all-mem-tables", &str);
@@ -730,6 +834,55 @@ void RocksDBStore::get_statistics(Formatter *f)
   }
 }
 
+int RocksDBStore::set_cache_capacity(int64_t capacity)
+{
+  if (!bbt_opts.block_cache) {
+    return -EOPNOTSUPP;
+  }
+  dout(20) << __func__ << " " << capacity << dendl;
+  set_block_cache_sizes(capacity);
+  return 0;
+}
+
+// the capacity and usage below cover the dedicated CF caches too, so
+// that the cache autotuner accounts for all of them as one
+
+int64_t RocksDBStore::get_cache_capacity()
+{
+  if (!bbt_opts.block_cache) {
+    return -EOPNOTSUPP;
+  }
+  int64_t capacity = bbt_opts.block_cache->GetCapacity();
+  for (auto& c : cf_block_caches) {
+    capacity += c.second->GetCapacity();
+  }
+  return capacity;
+}
+
+int64_t RocksDBStore::get_cache_usage() const
+{
+  if (!bbt_opts.block_cache) {
+    return -EOPNOTSUPP;
+  }
+  int64_t usage = bbt_opts.block_cache->GetUsage();
+  for (auto& c : cf_block_caches) {
+    usage += c.second->GetUsage();
+  }
+  return usage;
+}
+
+int64_t RocksDBStore::get_cache_pinned_usage() const
+{
+  if (!bbt_opts.block_cache) {
+    return -EOPNOTSUPP;
+  }
+  int64_t usage = bbt_opts.block_cache->GetPinnedUsage();
+  for (auto& c : cf_block_caches) {
+    usage += c.second->GetPinnedUsage();
+  }
+  return usage;
+}
+
 int RocksDBStore::submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t) 
 {
   // enable rocksdb breakdown
@@ -1232,6 +1385,29 @@ bool RocksDBStore::check_omap_dir(string &omap_dir)
 void RocksDBStore::compact_range(const string& start, const string& end)
 {
   rocksdb::CompactRangeOptions options;
+  // start and end are either combine_strings(prefix, key) or (for
+  // compact_prefix) the bare prefix and past_prefix(prefix).  a prefix
+  // living in its own CF keeps only the key part there.
+  string prefix = start.substr(0, start.find('\0'));
+  rocksdb::ColumnFamilyHandle *cf = get_cf_handle(prefix);
+  if (cf) {
+    string kstart, kend;
+    rocksdb::Slice cstart, cend;
+    rocksdb::Slice *pstart = nullptr, *pend = nullptr;
+    if (start.size() > prefix.size()) {
+      kstart = start.substr(prefix.size() + 1);
+      cstart = rocksdb::Slice(kstart);
+      pstart = &cstart;
+    }
+    if (end.size() > prefix.size() &&
+	end.compare(0, prefix.size() + 1, prefix + '\0') == 0) {
+      kend = end.substr(prefix.size() + 1);
+      cend = rocksdb::Slice(kend);
+      pend = &cend;
+    }
+    db->CompactRange(options, cf, pstart, pend);
+    return;
+  }
   rocksdb::Slice cstart(start);
   rocksdb::Slice cend(end);
   db->CompactRange(options, &cstart, &cend);
@@ -1366,10 +1542,219 @@ string RocksDBStore::past_prefix(const string &prefix)
   return limit;
 }
 
+/**
+ * Presents the default CF and every prefix CF as the single keyspace a
+ * db without column families would have, ordered by (prefix, key).  Each
+ * prefix lives entirely in one CF, so the shards never hold equal keys
+ * and a plain merge of their iterators is enough.
+ */
+class WholeMergeIteratorImpl : public KeyValueDB::WholeSpaceIteratorImpl {
+  struct Shard {
+    string prefix;   ///< empty for the default CF (keys carry the prefix)
+    rocksdb::Iterator *dbiter;
+  };
+  vector<Shard> shards;
+  int cur = -1;        ///< shard holding the current key, -1 if invalid
+  bool forward = true; ///< whether the other shards sit past cur or before
+
+  pair<string,string> shard_key(const Shard& s) {
+    if (s.prefix.empty()) {
+      string prefix, key;
+      RocksDBStore::split_key(s.dbiter->key(), &prefix, &key);
+      return make_pair(prefix, key);
+    }
+    return make_pair(s.prefix, s.dbiter->key().ToString());
+  }
+  void invalidate(Shard& s) {
+    s.dbiter->SeekToLast();
+    if (s.dbiter->Valid()) {
+      s.dbiter->Next();
+    }
+  }
+  /// position s at the first key >= (prefix, key)
+  void seek_ge(Shard& s, const string& prefix, const string& key) {
+    if (s.prefix.empty()) {
+      s.dbiter->Seek(RocksDBStore::combine_strings(prefix, key));
+    } else if (s.prefix < prefix) {
+      invalidate(s);
+    } else if (s.prefix == prefix) {
+      s.dbiter->Seek(key);
+    } else {
+      s.dbiter->SeekToFirst();
+    }
+  }
+  /// position s at the last key < (prefix, key)
+  void seek_lt(Shard& s, const string& prefix, const string& key) {
+    seek_ge(s, prefix, key);
+    if (s.dbiter->Valid()) {
+      s.dbiter->Prev();
+    } else if (s.prefix.empty() || s.prefix <= prefix) {
+      s.dbiter->SeekToLast();
+    }
+  }
+  void pick(bool fwd) {
+    cur = -1;
+    pair<string,string> best;
+    for (unsigned i = 0; i < shards.size(); ++i) {
+      if (!shards[i].dbiter->Valid()) {
+	continue;
+      }
+      auto k = shard_key(shards[i]);
+      if (cur < 0 || (fwd ? k < best : k > best)) {
+	cur = i;
+	best = std::move(k);
+      }
+    }
+    forward = fwd;
+  }
+
+public:
+  explicit WholeMergeIteratorImpl(rocksdb::Iterator *default_iter) {
+    shards.push_back(Shard{string(), default_iter});
+  }
+  ~WholeMergeIteratorImpl() override {
+    for (auto& s : shards) {
+      delete s.dbiter;
+    }
+  }
+  void add_cf(const string& prefix, rocksdb::Iterator *iter) {
+    shards.push_back(Shard{prefix, iter});
+  }
+
+  int seek_to_first() override {
+    for (auto& s : shards) {
+      s.dbiter->SeekToFirst();
+    }
+    pick(true);
+    return status();
+  }
+  int seek_to_first(const string &prefix) override {
+    return lower_bound(prefix, string());
+  }
+  int seek_to_last() override {
+    for (auto& s : shards) {
+      s.dbiter->SeekToLast();
+    }
+    pick(false);
+    return status();
+  }
+  int seek_to_last(const string &prefix) override {
+    string limit = RocksDBStore::past_prefix(prefix);
+    for (auto& s : shards) {
+      seek_lt(s, limit, string());
+    }
+    pick(false);
+    return status();
+  }
+  int upper_bound(const string &prefix, const string &after) override {
+    lower_bound(prefix, after);
+    if (valid()) {
+      pair<string,string> key = raw_key();
+      if (key.first == prefix && key.second == after)
+	next();
+    }
+    return status();
+  }
+  int lower_bound(const string &prefix, const string &to) override {
+    for (auto& s : shards) {
+      seek_ge(s, prefix, to);
+    }
+    pick(true);
+    return status();
+  }
+  bool valid() override {
+    return cur >= 0 && shards[cur].dbiter->Valid();
+  }
+  int next() override {
+    if (valid()) {
+      if (!forward) {
+	pair<string,string> key = raw_key();
+	for (unsigned i = 0; i < shards.size(); ++i) {
+	  if ((int)i != cur) {
+	    seek_ge(shards[i], key.first, key.second);
+	  }
+	}
+      }
+      shards[cur].dbiter->Next();
+      pick(true);
+    }
+    assert(status() == 0);
+    return status();
+  }
+  int prev() override {
+    if (valid()) {
+      if (forward) {
+	pair<string,string> key = raw_key();
+	for (unsigned i = 0; i < shards.size(); ++i) {
+	  if ((int)i != cur) {
+	    seek_lt(shards[i], key.first, key.second);
+	  }
+	}
+      }
+      shards[cur].dbiter->Prev();
+      pick(false);
+    }
+    assert(status() == 0);
+    return status();
+  }
+  string key() override {
+    return raw_key().second;
+  }
+  pair<string,string> raw_key() override {
+    return shard_key(shards[cur]);
+  }
+  bool raw_key_is_prefixed(const string &prefix) override {
+    const Shard& s = shards[cur];
+    if (!s.prefix.empty()) {
+      return s.prefix == prefix;
+    }
+    rocksdb::Slice key = s.dbiter->key();
+    if ((key.size() > prefix.length()) && (key[prefix.length()] == '\0')) {
+      return memcmp(key.data(), prefix.c_str(), prefix.length()) == 0;
+    } else {
+      return false;
+    }
+  }
+  bufferlist value() override {
+    return to_bufferlist(shards[cur].dbiter->value());
+  }
+  bufferptr value_as_ptr() override {
+    rocksdb::Slice val = shards[cur].dbiter->value();
+    return bufferptr(val.data(), val.size());
+  }
+  int status() override {
+    for (auto& s : shards) {
+      if (!s.dbiter->status().ok()) {
+	return -1;
+      }
+    }
+    return 0;
+  }
+  size_t key_size() override {
+    // report the size the key would have in a single keyspace
+    const Shard& s = shards[cur];
+    size_t size = s.dbiter->key().size();
+    return s.prefix.empty() ? size : s.prefix.size() + 1 + size;
+  }
+  size_t value_size() override {
+    return shards[cur].dbiter->value().size();
+  }
+};
+
 RocksDBStore::WholeSpaceIterator RocksDBStore::get_wholespace_iterator()
 {
-  return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+  if (cf_handles.empty()) {
+    return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+      db->NewIterator(rocksdb::ReadOptions(), default_cf));
+  }
+  auto it = std::make_shared<WholeMergeIteratorImpl>(
     db->NewIterator(rocksdb::ReadOptions(), default_cf));
+  for (auto& p : cf_handles) {
+    it->add_cf(p.first, db->NewIterator(
+      rocksdb::ReadOptions(),
+      static_cast<rocksdb::ColumnFamilyHandle*>(p.second)));
+  }
+  return it;
 }
 
 class CFIteratorImpl : public KeyValueDB::IteratorImpl {
@@ -1446,6 +1831,10 @@ KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix)
       prefix,
       db->NewIterator(rocksdb::ReadOptions(), cf_handle));
   } else {
-    return KeyValueDB::get_iterator(prefix);
+    // the prefix is in the default CF; no need to merge in the others
+    return std::make_shared<PrefixIteratorImpl>(
+      prefix,
+      std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+	db->NewIterator(rocksdb::ReadOptions(), default_cf)));
   }
 }
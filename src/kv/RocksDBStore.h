@@ -60,6 +60,7 @@ namespace rocksdb{
   struct BlockBasedTableOptions;
   struct DBOptions;
   struct ColumnFamilyOptions;
+  class Cache;
 }
 
 extern rocksdb::Logger *create_rocksdb_ceph_logger();
@@ -80,12 +81,18 @@ class RocksDBStore : public KeyValueDB {
 
   uint64_t cache_size = 0;
   bool set_cache_flag = false;
+  /// (cache_ratio, block cache) of the CFs with a dedicated block cache
+  std::vector<std::pair<double, std::shared_ptr<rocksdb::Cache>>> cf_block_caches;
 
   bool must_close_default_cf = false;
   rocksdb::ColumnFamilyHandle *default_cf = nullptr;
 
   int submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t);
   int install_cf_mergeop(const string &cf_name, rocksdb::ColumnFamilyOptions *cf_opt);
+  int update_cf_options(const ColumnFamily& cf, rocksdb::ColumnFamilyOptions *cf_opt);
+  std::shared_ptr<rocksdb::Cache> create_block_cache(uint64_t size);
+  void set_block_cache_sizes(uint64_t total);
+  void limit_cf_write_buffers(rocksdb::Options& opt);
   int create_db_dir();
   int do_open(ostream &out, bool create_if_missing,
 	      const vector<ColumnFamily>* cfs = nullptr);
@@ -473,6 +480,11 @@ err:
     return 0;
   }
 
+  int set_cache_capacity(int64_t capacity) override;
+  int64_t get_cache_capacity() override;
+  int64_t get_cache_usage() const override;
+  int64_t get_cache_pinned_usage() const override;
+
   WholeSpaceIterator get_wholespace_iterator() override;
 };
 
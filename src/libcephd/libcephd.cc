@@ -15,6 +15,7 @@
 #include "erasure-code/jerasure/ErasureCodePluginJerasure.h"
 #include "erasure-code/jerasure/jerasure_init.h"
 #include "erasure-code/lrc/ErasureCodePluginLrc.h"
+#include "erasure-code/clay/ErasureCodePluginClay.h"
 #include "erasure-code/shec/ErasureCodePluginShec.h"
 #include "include/cephd/libcephd.h"
 #include "global/global_context.h"
@@ -132,6 +133,13 @@ void cephd_preload_embedded_plugins()
     }
     assert(r == 0);
 
+    plugin = new ErasureCodePluginClay();
+    r = reg.add("clay", plugin);
+    if (r == -EEXIST) {
+      delete plugin;
+    }
+    assert(r == 0);
+
     plugin = new ErasureCodePluginShec();
     r = reg.add("shec", plugin);
     if (r == -EEXIST) {
@@ -64,10 +64,8 @@ private:
 	mdata_hook(&mp);
 
       if (free_data)  {
-	const std::list<buffer::ptr>& buffers = data.buffers();
-	list<bufferptr>::const_iterator pb;
-	for (pb = buffers.begin(); pb != buffers.end(); ++pb) {
-	  free((void*) pb->c_str());
+	for (const auto& bp : data.buffers()) {
+	  free((void*) bp.c_str());
 	}
       }
     }
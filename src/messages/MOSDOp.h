@@ -251,11 +251,34 @@ public:
     retry_attempt = a;
   }
 
+  /**
+   * Set data_off so that the receiver lays the data out in memory with
+   * the payload of the largest write at the same offset within a page
+   * as it has within the object.  The OSD passes that payload to the
+   * objectstore as is, and block-aligned pieces of it can then go to
+   * the device without being copied to meet O_DIRECT alignment.
+   */
+  void set_data_alignment() {
+    uint64_t pos = 0, largest = 0;
+    for (auto& op : ops) {
+      uint64_t len = op.indata.length();
+      if ((op.op.op == CEPH_OSD_OP_WRITE ||
+	   op.op.op == CEPH_OSD_OP_WRITEFULL) &&
+	  len > largest) {
+	largest = len;
+	// only the offset within a page matters; let it wrap
+	header.data_off = (uint32_t)(op.op.extent.offset - pos);
+      }
+      pos += len;
+    }
+  }
+
   // marshalling
   void encode_payload(uint64_t features) override {
     using ceph::encode;
     if( false == bdata_encode ) {
       OSDOp::merge_osd_op_vector_in_data(ops, data);
+      set_data_alignment();
       bdata_encode = true;
     }
 
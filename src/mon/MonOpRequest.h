@@ -105,12 +105,7 @@ private:
 
   void _dump(Formatter *f) const override {
     {
-      f->open_array_section("events");
-      Mutex::Locker l(lock);
-      for (auto& i : events) {
-	f->dump_object("event", i);
-      }
-      f->close_section();
+      dump_events(f);
       f->open_object_section("info");
       f->dump_int("seq", seq);
       f->dump_bool("src_is_mon", is_src_mon());
@@ -348,6 +348,8 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
     dout(7) << __func__ << " loading latest full map e" << latest_full << dendl;
     osdmap = OSDMap();
     osdmap.decode(latest_bl);
+    remapped_since = 0;
+    remapped_pgs.clear();
   }
 
   bufferlist bl;
@@ -375,6 +377,11 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
     dout(7) << "update_from_paxos  applying incremental " << osdmap.epoch+1
 	    << dendl;
     OSDMap::Incremental inc(inc_bl);
+    if (remapped_since &&
+	!osdmap.get_pgs_remapped_by(inc, &remapped_pgs)) {
+      remapped_since = 0;
+      remapped_pgs.clear();
+    }
     err = osdmap.apply_incremental(inc);
     assert(err == 0);
 
@@ -410,6 +417,8 @@ void OSDMonitor::update_from_paxos(bool *need_bootstrap)
 	     << dendl;
 	osdmap = OSDMap();
 	osdmap.decode(orig_full_bl);
+	remapped_since = 0;
+	remapped_pgs.clear();
       }
     } else {
       assert(!inc.have_crc);
@@ -491,15 +500,28 @@ void OSDMonitor::start_mapping()
   }
   if (!osdmap.get_pools().empty()) {
     auto fin = new C_UpdateCreatingPGs(this, osdmap.get_epoch());
-    mapping_job = mapping.start_update(osdmap, mapper,
-				       g_conf->mon_osd_mapping_pgs_per_chunk);
-    dout(10) << __func__ << " started mapping job " << mapping_job.get()
-	     << " at " << fin->start << dendl;
+    if (remapped_since && remapped_since == mapping.get_epoch() &&
+	g_conf->get_val<bool>("mon_osd_mapping_incremental")) {
+      // only the pgs touched since the last complete mapping
+      mapping_job = mapping.start_update(osdmap, mapper,
+					 g_conf->mon_osd_mapping_pgs_per_chunk,
+					 remapped_pgs);
+      dout(10) << __func__ << " started mapping job " << mapping_job.get()
+	       << " for " << remapped_pgs.size() << " pgs remapped since e"
+	       << remapped_since << " at " << fin->start << dendl;
+    } else {
+      mapping_job = mapping.start_update(osdmap, mapper,
+					 g_conf->mon_osd_mapping_pgs_per_chunk);
+      dout(10) << __func__ << " started mapping job " << mapping_job.get()
+	       << " at " << fin->start << dendl;
+    }
     mapping_job->set_finish_event(fin);
   } else {
     dout(10) << __func__ << " no pools, no mapping job" << dendl;
     mapping_job = nullptr;
   }
+  remapped_since = osdmap.get_epoch();
+  remapped_pgs.clear();
 }
 
 void OSDMonitor::update_msgr_features()
@@ -4334,7 +4356,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	    break;
 	  case HIT_SET_FPP:
 	    {
-	      if (p->hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+	      if (HitSet::is_bloom_type(p->hit_set_params.get_type())) {
 		BloomHitSet::Params *bloomp =
 		  static_cast<BloomHitSet::Params*>(p->hit_set_params.impl.get());
 		f->dump_float("hit_set_fpp", bloomp->get_fpp());
@@ -4479,7 +4501,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	    break;
 	  case HIT_SET_FPP:
 	    {
-	      if (p->hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+	      if (HitSet::is_bloom_type(p->hit_set_params.get_type())) {
 		BloomHitSet::Params *bloomp =
 		  static_cast<BloomHitSet::Params*>(p->hit_set_params.impl.get());
 		ss << "hit_set_fpp: " << bloomp->get_fpp() << "\n";
@@ -6146,6 +6168,14 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
 	BloomHitSet::Params *bsp = new BloomHitSet::Params;
 	bsp->set_fpp(g_conf->get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
 	p.hit_set_params = HitSet::Params(bsp);
+      } else if (val == "blocked_bloom") {
+	if (osdmap.require_osd_release < CEPH_RELEASE_MIMIC) {
+	  ss << "hit_set_type blocked_bloom requires require_osd_release >= mimic";
+	  return -EPERM;
+	}
+	BlockedBloomHitSet::Params *bsp = new BlockedBloomHitSet::Params;
+	bsp->set_fpp(g_conf->get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
+	p.hit_set_params = HitSet::Params(bsp);
       } else if (val == "explicit_hash")
 	p.hit_set_params = HitSet::Params(new ExplicitHashHitSet::Params);
       else if (val == "explicit_object")
@@ -6172,7 +6202,7 @@ int OSDMonitor::prepare_command_pool_set(map<string,cmd_vartype> &cmdmap,
       ss << "error parsing floating point value '" << val << "': " << floaterr;
       return -EINVAL;
     }
-    if (p.hit_set_params.get_type() != HitSet::TYPE_BLOOM) {
+    if (!HitSet::is_bloom_type(p.hit_set_params.get_type())) {
       ss << "hit set is not of type Bloom; invalid to set a false positive rate!";
       return -EINVAL;
     }
@@ -10846,6 +10876,16 @@ bool OSDMonitor::prepare_command_impl(MonOpRequestRef op,
       BloomHitSet::Params *bsp = new BloomHitSet::Params;
       bsp->set_fpp(g_conf->get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
       hsp = HitSet::Params(bsp);
+    } else if (cache_hit_set_type == "blocked_bloom") {
+      if (osdmap.require_osd_release < CEPH_RELEASE_MIMIC) {
+	ss << "osd tier cache default hit set type blocked_bloom requires "
+	   << "require_osd_release >= mimic";
+	err = -EPERM;
+	goto reply;
+      }
+      BlockedBloomHitSet::Params *bsp = new BlockedBloomHitSet::Params;
+      bsp->set_fpp(g_conf->get_val<double>("osd_pool_default_hit_set_bloom_fpp"));
+      hsp = HitSet::Params(bsp);
     } else if (cache_hit_set_type == "explicit_hash") {
       hsp = HitSet::Params(new ExplicitHashHitSet::Params);
     } else if (cache_hit_set_type == "explicit_object") {
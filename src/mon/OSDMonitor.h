@@ -226,6 +226,10 @@ private:
   ParallelPGMapper mapper;                        ///< for background pg work
   OSDMapMapping mapping;                          ///< pg <-> osd mappings
   unique_ptr<ParallelPGMapper::Job> mapping_job;  ///< background mapping job
+  /// pgs whose mapping may have changed since remapped_since, the epoch of
+  /// the last mapping job; remapped_since is 0 if every pg may have moved
+  epoch_t remapped_since = 0;
+  set<pg_t> remapped_pgs;
   void start_mapping();
 
   void update_logger();
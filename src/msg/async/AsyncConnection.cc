@@ -873,6 +873,8 @@ ssize_t AsyncConnection::_process_connection()
 
         SocketOptions opts;
         opts.priority = async_msgr->get_socket_priority();
+        opts.zerocopy_threshold = async_msgr->cct->_conf->get_val<uint64_t>(
+          "ms_tcp_zerocopy_threshold");
         opts.connect_bind_addr = msgr->get_myaddr();
         r = worker->connect(get_peer_addr(), opts, &cs);
         if (r < 0)
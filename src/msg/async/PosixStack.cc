@@ -21,17 +21,23 @@
 #include <errno.h>
 
 #include <algorithm>
+#include <deque>
 
 #include "PosixStack.h"
 
 #include "include/buffer.h"
 #include "include/str_list.h"
+#include "include/stringify.h"
 #include "common/errno.h"
 #include "common/strtol.h"
 #include "common/dout.h"
 #include "msg/Messenger.h"
 #include "include/sock_compat.h"
 
+#ifdef HAVE_SCHED
+#include <sched.h>
+#endif
+
 #define dout_subsys ceph_subsys_ms
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
@@ -42,9 +48,81 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   entity_addr_t sa;
   bool connected;
 
+  /// sends of at least this many bytes use MSG_ZEROCOPY; 0 if off
+  uint64_t zerocopy_threshold;
+  /// buffers passed to the kernel by zerocopy sends, held until it
+  /// reports that it no longer refers to them
+  struct zerocopy_pin_t {
+    uint32_t first, last;  ///< ids of the sendmsg calls, inclusive
+    uint32_t pending;      ///< calls the kernel has yet to complete
+    bufferlist bl;
+  };
+  std::deque<zerocopy_pin_t> zerocopy_pins;
+  uint32_t zerocopy_next_id = 0;  ///< the kernel numbers zerocopy sends
+
+  void release_zerocopy(uint32_t lo, uint32_t hi) {
+    for (auto& p : zerocopy_pins) {
+      // ids wrap, so work with offsets from the start of each pin
+      int32_t from = lo - p.first;
+      int32_t to = hi - p.first;
+      int32_t len = p.last - p.first;
+      if (to < 0)
+        break;
+      from = std::max(from, 0);
+      to = std::min(to, len);
+      if (from <= to)
+        p.pending -= to - from + 1;
+    }
+    while (!zerocopy_pins.empty() && zerocopy_pins.front().pending == 0)
+      zerocopy_pins.pop_front();
+  }
+
+  // collect completions from the error queue
+  void reap_zerocopy() {
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+    while (!zerocopy_pins.empty()) {
+      struct msghdr msg;
+      char control[128];
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(_fd, &msg, MSG_ERRQUEUE) < 0)
+        return;
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+	   cm = CMSG_NXTHDR(&msg, cm)) {
+	if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+	    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+	  continue;
+	struct sock_extended_err ee;
+	memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+	if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	  continue;
+	if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+	  // the kernel copied the data anyway (loopback, or a device
+	  // without scatter-gather), so the completions are pure overhead
+	  zerocopy_threshold = 0;
+	}
+	release_zerocopy(ee.ee_info, ee.ee_data);
+      }
+    }
+#endif
+  }
+
  public:
-  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+  explicit PosixConnectedSocketImpl(NetHandler &h, const entity_addr_t &sa, int f, bool connected,
+                                    uint64_t zerocopy_threshold)
+      : handler(h), _fd(f), sa(sa), connected(connected),
+        zerocopy_threshold(zerocopy_threshold) {
+    if (zerocopy_threshold && handler.set_zerocopy(_fd) < 0)
+      this->zerocopy_threshold = 0;
+  }
+
+  uint64_t get_pinned_bytes() const override {
+    uint64_t bytes = 0;
+    for (auto& p : zerocopy_pins)
+      bytes += p.bl.length();
+    return bytes;
+  }
 
   int is_connected() override {
     if (connected)
@@ -66,6 +144,9 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t read(char *buf, size_t len) override {
+    // completions wake the reader, since they raise EPOLLERR
+    if (!zerocopy_pins.empty())
+      reap_zerocopy();
     ssize_t r = ::read(_fd, buf, len);
     if (r < 0)
       r = -errno;
@@ -74,22 +155,40 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 
   // return the sent length
   // < 0 means error occured
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // bumps *calls for each zerocopy sendmsg that sent something
+  ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+                     int *flags, uint32_t *calls)
   {
     size_t sent = 0;
+    bool reaped = false;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | *flags);
       if (r < 0) {
         if (errno == EINTR) {
           continue;
         } else if (errno == EAGAIN) {
           break;
         }
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+        if (errno == ENOBUFS && (*flags & MSG_ZEROCOPY)) {
+          // out of optmem for completion notifications: reading the
+          // ones queued frees it; if that is not enough, copy the rest
+          if (!reaped && !zerocopy_pins.empty()) {
+            reap_zerocopy();
+            reaped = true;
+          } else {
+            *flags &= ~MSG_ZEROCOPY;
+          }
+          continue;
+        }
+#endif
         return -errno;
       }
 
+      if (*flags)
+        ++*calls;
       sent += r;
       if (len == sent) break;
 
@@ -110,8 +209,19 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t send(bufferlist &bl, bool more) override {
+    if (!zerocopy_pins.empty())
+      reap_zerocopy();
+    int flags = 0;
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+    if (zerocopy_threshold && bl.length() >= zerocopy_threshold)
+      flags = MSG_ZEROCOPY;
+#endif
+    uint32_t first_id = zerocopy_next_id;
+    uint32_t calls = 0;
+    ssize_t err = 0;
+
     size_t sent_bytes = 0;
-    std::list<bufferptr>::const_iterator pb = bl.buffers().begin();
+    auto pb = bl.buffers().begin();
     uint64_t left_pbrs = bl.buffers().size();
     while (left_pbrs) {
       struct msghdr msg;
@@ -128,9 +238,11 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 	msglen += pb->length();
 	++pb;
       }
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
-      if (r < 0)
-        return r;
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more, &flags, &calls);
+      if (r < 0) {
+        err = r;
+        break;
+      }
 
       // "r" is the remaining length
       sent_bytes += r;
@@ -139,6 +251,20 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
       // only "r" == 0 continue
     }
 
+    if (calls) {
+      // the kernel may still be reading from what it took; after an
+      // error we don't know how much that was, so hold on to all of it
+      zerocopy_next_id += calls;
+      zerocopy_pins.push_back(
+	zerocopy_pin_t{first_id, zerocopy_next_id - 1, calls, bufferlist()});
+      if (err)
+	zerocopy_pins.back().bl = bl;
+      else
+	zerocopy_pins.back().bl.substr_of(bl, 0, sent_bytes);
+    }
+    if (err)
+      return err;
+
     if (sent_bytes) {
       bufferlist swapped;
       if (sent_bytes < bl.length()) {
@@ -155,6 +281,16 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     ::shutdown(_fd, SHUT_RDWR);
   }
   void close() override {
+    if (!zerocopy_pins.empty()) {
+      reap_zerocopy();
+      if (!zerocopy_pins.empty()) {
+	// the kernel may still transmit from buffers we are about to
+	// free; reset the connection so it drops them instead
+	struct linger l = {1, 0};
+	::setsockopt(_fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+	zerocopy_pins.clear();
+      }
+    }
     ::close(_fd);
   }
   int fd() const override {
@@ -206,7 +342,8 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true,
+									   opt.zerocopy_threshold));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -274,21 +411,68 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock,
+                                                             opts.zerocopy_threshold)));
   return 0;
 }
 
+// parse a list of cpus such as "0-3,8", as taskset -c and sysfs use
+static void parse_cpu_list(CephContext *cct, const string &s, vector<int> *cpus)
+{
+  vector<string> items;
+  get_str_vec(s, ";, \t\n", items);
+  for (auto &item : items) {
+    string err;
+    auto dash = item.find('-');
+    int first = strict_strtol(item.substr(0, dash).c_str(), 10, &err);
+    int last = first;
+    if (err == "" && dash != string::npos)
+      last = strict_strtol(item.substr(dash + 1).c_str(), 10, &err);
+    if (err != "" || first < 0 || last < first) {
+      lderr(cct) << __func__ << " failed to parse " << item << " in " << s << dendl;
+      continue;
+    }
+    for (int cpu = first; cpu <= last; ++cpu)
+      cpus->push_back(cpu);
+  }
+}
+
 PosixNetworkStack::PosixNetworkStack(CephContext *c, const string &t)
     : NetworkStack(c, t)
 {
-  vector<string> corestrs;
-  get_str_vec(cct->_conf->ms_async_affinity_cores, corestrs);
-  for (auto & corestr : corestrs) {
+  parse_cpu_list(cct, cct->_conf->ms_async_affinity_cores, &coreids);
+  int64_t node = cct->_conf->get_val<int64_t>("ms_async_affinity_numa_node");
+  if (coreids.empty() && node >= 0) {
+    string path = "/sys/devices/system/node/node" + stringify(node) + "/cpulist";
+    bufferlist bl;
     string err;
-    int coreid = strict_strtol(corestr.c_str(), 10, &err);
-    if (err == "")
-      coreids.push_back(coreid);
-    else
-      lderr(cct) << __func__ << " failed to parse " << corestr << " in " << cct->_conf->ms_async_affinity_cores << dendl;
+    if (bl.read_file(path.c_str(), &err) < 0) {
+      lderr(cct) << __func__ << " unable to get cpus of numa node " << node
+		 << ": " << err << dendl;
+    } else {
+      parse_cpu_list(cct, bl.to_str(), &coreids);
+      share_cores = true;
+    }
+  }
+}
+
+void PosixNetworkStack::set_affinity(unsigned i)
+{
+#ifdef HAVE_SCHED
+  if (coreids.empty() || !cct->_conf->ms_async_set_affinity)
+    return;
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (unsigned j = 0; j < coreids.size(); ++j) {
+    if ((share_cores || j == i % coreids.size()) && coreids[j] < CPU_SETSIZE)
+      CPU_SET(coreids[j], &cpuset);
+  }
+  if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+    int r = -errno;
+    lderr(cct) << __func__ << " unable to pin worker " << i << ": "
+	       << cpp_strerror(r) << dendl;
+    return;
   }
+  ldout(cct, 10) << __func__ << " pinned worker " << i << dendl;
+#endif
 }
@@ -37,19 +37,20 @@ class PosixWorker : public Worker {
 
 class PosixNetworkStack : public NetworkStack {
   vector<int> coreids;
+  bool share_cores = false;  ///< workers run on any of coreids, not one each
   vector<std::thread> threads;
 
+  void set_affinity(unsigned i);
+
  public:
   explicit PosixNetworkStack(CephContext *c, const string &t);
 
-  int get_cpuid(int id) const {
-    if (coreids.empty())
-      return -1;
-    return coreids[id % coreids.size()];
-  }
   void spawn_worker(unsigned i, std::function<void ()> &&func) override {
     threads.resize(i+1);
-    threads[i] = std::thread(func);
+    threads[i] = std::thread([this, i, func]() {
+	set_affinity(i);
+	func();
+      });
   }
   void join_worker(unsigned i) override {
     assert(threads.size() > i && threads[i].joinable());
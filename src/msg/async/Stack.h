@@ -33,6 +33,8 @@ class ConnectedSocketImpl {
   virtual void shutdown() = 0;
   virtual void close() = 0;
   virtual int fd() const = 0;
+  /// bytes of earlier sends the kernel may still read from (zerocopy)
+  virtual uint64_t get_pinned_bytes() const { return 0; }
 };
 
 class ConnectedSocket;
@@ -41,6 +43,7 @@ struct SocketOptions {
   bool nodelay = true;
   int rcbuf_size = 0;
   int priority = -1;
+  uint64_t zerocopy_threshold = 0;
   entity_addr_t connect_bind_addr;
 };
 
@@ -126,6 +129,12 @@ class ConnectedSocket {
     return _csi->fd();
   }
 
+  /// Bytes of earlier sends that are pinned until the kernel reports
+  /// it is done with them
+  uint64_t pinned_bytes() const {
+    return _csi->get_pinned_bytes();
+  }
+
   explicit operator bool() const {
     return _csi.get();
   }
@@ -24,6 +24,7 @@
 #include "net_handler.h"
 #include "common/errno.h"
 #include "common/debug.h"
+#include "include/sock_compat.h"
 
 #define dout_subsys ceph_subsys_ms
 #undef dout_prefix
@@ -172,6 +173,22 @@ void NetHandler::set_priority(int sd, int prio, int domain)
 #endif	// SO_PRIORITY
 }
 
+int NetHandler::set_zerocopy(int sd)
+{
+#ifdef CEPH_HAVE_MSG_ZEROCOPY
+  int one = 1;
+  if (::setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+    int r = errno;
+    ldout(cct, 1) << __func__ << " couldn't set SO_ZEROCOPY: "
+		  << cpp_strerror(r) << dendl;
+    return -r;
+  }
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
+
 int NetHandler::generic_connect(const entity_addr_t& addr, const entity_addr_t &bind_addr, bool nonblock)
 {
   int ret;
@@ -680,14 +680,11 @@ public:
       vector<__le32> &cm,
       vector<__le32> &om) {
 
-      list<bufferptr> list = bl.buffers();
-      std::list<bufferptr>::iterator p;
+      for (auto p : bl.buffers()) {
+        assert(p.length() % sizeof(Op) == 0);
 
-      for(p = list.begin(); p != list.end(); ++p) {
-        assert(p->length() % sizeof(Op) == 0);
-
-        char* raw_p = p->c_str();
-        char* raw_end = raw_p + p->length();
+        char* raw_p = p.c_str();
+        char* raw_end = raw_p + p.length();
         while (raw_p < raw_end) {
           _update_op(reinterpret_cast<Op*>(raw_p), cm, om);
           raw_p += sizeof(Op);
@@ -1490,6 +1487,7 @@ public:
   }
 
   virtual void get_db_statistics(Formatter *f) { }
+  virtual void dump_fragmentation(Formatter *f) { }
   virtual void generate_db_histogram(Formatter *f) { }
   virtual void flush_cache() { }
   virtual void dump_perf_counters(Formatter *f) {}
@@ -4,7 +4,11 @@
 #include "Allocator.h"
 #include "StupidAllocator.h"
 #include "BitMapAllocator.h"
+#include "HybridAllocator.h"
 #include "common/debug.h"
+#include "common/Formatter.h"
+
+#include <cmath>
 
 #define dout_subsys ceph_subsys_bluestore
 
@@ -15,8 +19,61 @@ Allocator *Allocator::create(CephContext* cct, string type,
     return new StupidAllocator(cct);
   } else if (type == "bitmap") {
     return new BitMapAllocator(cct, size, block_size);
+  } else if (type == "hybrid") {
+    return new HybridAllocator(cct, size, block_size);
   }
   lderr(cct) << "Allocator::" << __func__ << " unknown alloc type "
 	     << type << dendl;
   return nullptr;
 }
+
+/*
+ * Each free extent of x alloc units is worth x * 1.1^log2(x), i.e. a bit
+ * more than its size, growing with every doubling.  The score compares the
+ * worth of what we have against the worth of all free space in a single
+ * extent: 0 for one extent, close to 1 when everything is alloc_unit sized.
+ */
+static double free_extent_worth(double len, double alloc_unit)
+{
+  double units = std::max(1.0, len / alloc_unit);
+  return len * std::pow(units, std::log2(1.1));
+}
+
+void Allocator::get_free_stats(uint64_t alloc_unit, free_stats_t *stats)
+{
+  *stats = free_stats_t();
+  if (alloc_unit == 0) {
+    alloc_unit = 1;
+  }
+  double worth = 0;
+  dump([&](uint64_t offset, uint64_t length) {
+      if (length == 0) {
+	return;
+      }
+      stats->free += length;
+      ++stats->extents;
+      stats->max_extent = std::max(stats->max_extent, length);
+      ++stats->histogram[1ull << (63 - __builtin_clzll(length))];
+      worth += free_extent_worth(length, alloc_unit);
+    });
+  if (stats->free) {
+    stats->fragmentation =
+      1.0 - worth / free_extent_worth(stats->free, alloc_unit);
+  }
+}
+
+void Allocator::free_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("free", free);
+  f->dump_unsigned("extents", extents);
+  f->dump_unsigned("max_extent", max_extent);
+  f->dump_float("fragmentation_score", fragmentation);
+  f->open_array_section("histogram");
+  for (auto& p : histogram) {
+    f->open_object_section("bucket");
+    f->dump_unsigned("min_length", p.first);
+    f->dump_unsigned("count", p.second);
+    f->close_section();
+  }
+  f->close_section();
+}
@@ -12,12 +12,32 @@
 #ifndef CEPH_OS_BLUESTORE_ALLOCATOR_H
 #define CEPH_OS_BLUESTORE_ALLOCATOR_H
 
+#include <functional>
+#include <map>
 #include <ostream>
 #include "include/assert.h"
 #include "os/bluestore/bluestore_types.h"
 
+namespace ceph {
+  class Formatter;
+}
+
 class Allocator {
 public:
+  /// summary of how the free space is laid out
+  struct free_stats_t {
+    uint64_t free = 0;        ///< total free bytes
+    uint64_t extents = 0;     ///< number of free extents
+    uint64_t max_extent = 0;  ///< largest free extent
+    /// 0 when all free space is one extent, approaching 1 as it splinters
+    /// into alloc_unit sized pieces
+    double fragmentation = 0;
+    /// extent length, rounded down to a power of two -> number of extents
+    std::map<uint64_t,uint64_t> histogram;
+
+    void dump(ceph::Formatter *f) const;
+  };
+
   virtual ~Allocator() {}
 
   virtual int reserve(uint64_t need) = 0;
@@ -47,6 +67,17 @@ public:
 
   virtual void dump() = 0;
 
+  /// enumerate free extents, in no particular order
+  virtual void dump(std::function<void(uint64_t offset, uint64_t length)> notify) = 0;
+
+  /// walk the free extents and summarize them
+  void get_free_stats(uint64_t alloc_unit, free_stats_t *stats);
+  double get_fragmentation_score(uint64_t alloc_unit) {
+    free_stats_t stats;
+    get_free_stats(alloc_unit, &stats);
+    return stats.fragmentation;
+  }
+
   virtual void init_add_free(uint64_t offset, uint64_t length) = 0;
   virtual void init_rm_free(uint64_t offset, uint64_t length) = 0;
 
@@ -536,6 +536,29 @@ void BitMapZone::dump_state(CephContext* const cct, int& count)
   count++;
 }
 
+void BitMapZone::foreach_free(int64_t blk_off,
+    const std::function<void(int64_t, int64_t)>& notify)
+{
+  int64_t run_start = -1;
+  lock_excl();
+  for (int64_t i = 0; i < (int64_t)m_bmap_vec.size(); i++) {
+    bmap_t bits = m_bmap_vec[i].atomic_fetch();
+    int64_t base = blk_off + i * BmapEntry::size();
+    for (int bit = 0; bit < BmapEntry::size(); bit++) {
+      bool used = bits & BmapEntry::bit_mask(bit);
+      if (!used && run_start < 0) {
+        run_start = base + bit;
+      } else if (used && run_start >= 0) {
+        notify(run_start, base + bit - run_start);
+        run_start = -1;
+      }
+    }
+  }
+  unlock();
+  if (run_start >= 0) {
+    notify(run_start, blk_off + size() - run_start);
+  }
+}
 
 /*
  * BitMapArea Leaf and non-Leaf functions.
@@ -925,6 +948,20 @@ void BitMapAreaIN::dump_state(CephContext* const cct, int& count)
   }
 }
 
+void BitMapAreaIN::foreach_free(int64_t blk_off,
+    const std::function<void(int64_t, int64_t)>& notify)
+{
+  BitMapArea *child = NULL;
+
+  BmapEntityListIter iter = BmapEntityListIter(
+        &m_child_list, 0, false);
+
+  while ((child = static_cast<BitMapArea *>(iter.next()))) {
+    child->foreach_free(blk_off + child->get_index() * m_child_size_blocks,
+                        notify);
+  }
+}
+
 /*
  * BitMapArea Leaf
  */
@@ -1418,3 +1455,27 @@ void BitAllocator::dump()
   dump_state(cct, count);
   serial_unlock(); 
 }
+
+void BitAllocator::foreach_free(
+    const std::function<void(int64_t, int64_t)>& notify)
+{
+  // zones report their runs separately; stitch them back together
+  int64_t run_start = -1;
+  int64_t run_len = 0;
+  serial_lock();
+  BitMapAreaIN::foreach_free(0, [&](int64_t start, int64_t len) {
+      if (run_start >= 0 && run_start + run_len == start) {
+        run_len += len;
+        return;
+      }
+      if (run_start >= 0) {
+        notify(run_start, run_len);
+      }
+      run_start = start;
+      run_len = len;
+    });
+  serial_unlock();
+  if (run_start >= 0) {
+    notify(run_start, run_len);
+  }
+}
@@ -15,6 +15,7 @@
 #include <mutex>
 #include <atomic>
 #include <vector>
+#include <functional>
 #include "include/intarith.h"
 #include "os/bluestore/bluestore_types.h"
 
@@ -246,6 +247,9 @@ public:
   int64_t get_index();
   int64_t get_level();
   virtual void dump_state(CephContext* cct, int& count) = 0;
+  /// report free runs (start block, length) within this area
+  virtual void foreach_free(int64_t blk_off,
+      const std::function<void(int64_t, int64_t)>& notify) = 0;
   BitMapArea(CephContext*) { }
   virtual ~BitMapArea() { }
 };
@@ -380,6 +384,8 @@ public:
 
   void free_blocks(int64_t start_block, int64_t num_blocks) override;
   void dump_state(CephContext* cct, int& count) override;
+  void foreach_free(int64_t blk_off,
+      const std::function<void(int64_t, int64_t)>& notify) override;
 };
 
 class BitMapAreaIN: public BitMapArea{
@@ -457,6 +463,8 @@ public:
   virtual void free_blocks_int(int64_t start_block, int64_t num_blocks);
   void free_blocks(int64_t start_block, int64_t num_blocks) override;
   void dump_state(CephContext* cct, int& count) override;
+  void foreach_free(int64_t blk_off,
+      const std::function<void(int64_t, int64_t)>& notify) override;
 };
 
 class BitMapAreaLeaf: public BitMapAreaIN{
@@ -564,6 +572,8 @@ public:
       return m_stats;
   }
   void dump();
+  /// report maximal free runs (start block, length)
+  void foreach_free(const std::function<void(int64_t, int64_t)>& notify);
 };
 
 #endif //End of file
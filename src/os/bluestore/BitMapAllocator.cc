@@ -174,6 +174,14 @@ void BitMapAllocator::dump()
   m_bit_alloc->dump();
 }
 
+void BitMapAllocator::dump(std::function<void(uint64_t offset,
+					       uint64_t length)> notify)
+{
+  m_bit_alloc->foreach_free([&](int64_t start, int64_t len) {
+      notify(start * m_block_size, len * m_block_size);
+    });
+}
+
 void BitMapAllocator::init_add_free(uint64_t offset, uint64_t length)
 {
   dout(10) << __func__ << " instance " << (uint64_t) this
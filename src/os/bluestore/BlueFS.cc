@@ -95,6 +95,16 @@ void BlueFS::_init_logger()
   b.add_u64_counter(l_bluefs_bytes_written_sst, "bytes_written_sst",
 		    "Bytes written to SSTs", "sst",
 		    PerfCountersBuilder::PRIO_CRITICAL);
+  b.add_time_avg(l_bluefs_lock_wait_lat, "lock_wait_lat",
+		 "Average wait for the global metadata lock");
+  b.add_time_avg(l_bluefs_file_lock_wait_lat, "file_lock_wait_lat",
+		 "Average wait for per-file and per-writer locks");
+  b.add_time_avg(l_bluefs_log_wait_lat, "log_wait_lat",
+		 "Average wait for an in-progress metadata log flush");
+  b.add_u64_counter(l_bluefs_bdev_flushes, "bdev_flushes",
+		    "Device cache flushes issued");
+  b.add_u64_counter(l_bluefs_bdev_flushes_grouped, "bdev_flushes_grouped",
+		    "Device cache flush requests covered by a concurrent flush");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -103,6 +113,58 @@ void BlueFS::_shutdown_logger()
 {
   cct->get_perfcounters_collection()->remove(logger);
   delete logger;
+  logger = nullptr;
+}
+
+std::unique_lock<std::mutex> BlueFS::_lock_global()
+{
+  std::unique_lock<std::mutex> l(lock, std::try_to_lock);
+  if (!l.owns_lock()) {
+    auto start = ceph::mono_clock::now();
+    l.lock();
+    if (logger)
+      logger->tinc(l_bluefs_lock_wait_lat, ceph::mono_clock::now() - start);
+  }
+  return l;
+}
+
+std::unique_lock<std::mutex> BlueFS::_lock_writer(FileWriter *h)
+{
+  std::unique_lock<std::mutex> l(h->lock, std::try_to_lock);
+  if (!l.owns_lock()) {
+    auto start = ceph::mono_clock::now();
+    l.lock();
+    if (logger)
+      logger->tinc(l_bluefs_file_lock_wait_lat,
+		   ceph::mono_clock::now() - start);
+  }
+  return l;
+}
+
+std::unique_lock<std::shared_mutex> BlueFS::_lock_file(File *f)
+{
+  std::unique_lock<std::shared_mutex> l(f->lock, std::try_to_lock);
+  if (!l.owns_lock()) {
+    auto start = ceph::mono_clock::now();
+    l.lock();
+    if (logger)
+      logger->tinc(l_bluefs_file_lock_wait_lat,
+		   ceph::mono_clock::now() - start);
+  }
+  return l;
+}
+
+std::shared_lock<std::shared_mutex> BlueFS::_lock_file_shared(File *f)
+{
+  std::shared_lock<std::shared_mutex> l(f->lock, std::try_to_lock);
+  if (!l.owns_lock()) {
+    auto start = ceph::mono_clock::now();
+    l.lock();
+    if (logger)
+      logger->tinc(l_bluefs_file_lock_wait_lat,
+		   ceph::mono_clock::now() - start);
+  }
+  return l;
 }
 
 void BlueFS::_update_logger_stats()
@@ -162,7 +224,7 @@ uint64_t BlueFS::get_block_device_size(unsigned id)
 
 void BlueFS::add_block_extent(unsigned id, uint64_t offset, uint64_t length)
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(1) << __func__ << " bdev " << id
           << " 0x" << std::hex << offset << "~" << length << std::dec
 	  << dendl;
@@ -186,7 +248,7 @@ void BlueFS::add_block_extent(unsigned id, uint64_t offset, uint64_t length)
 int BlueFS::reclaim_blocks(unsigned id, uint64_t want,
 			   AllocExtentVector *extents)
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(1) << __func__ << " bdev " << id
           << " want 0x" << std::hex << want << std::dec << dendl;
   assert(id < alloc.size());
@@ -224,7 +286,7 @@ int BlueFS::reclaim_blocks(unsigned id, uint64_t want,
 
 uint64_t BlueFS::get_fs_usage()
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   uint64_t total_bytes = 0;
   for (auto& p : file_map) {
     total_bytes += p.second->fnode.get_allocated();
@@ -234,14 +296,14 @@ uint64_t BlueFS::get_fs_usage()
 
 uint64_t BlueFS::get_total(unsigned id)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   assert(id < block_all.size());
   return block_all[id].size();
 }
 
 uint64_t BlueFS::get_free(unsigned id)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   assert(id < alloc.size());
   return alloc[id]->get_free();
 }
@@ -266,7 +328,7 @@ void BlueFS::dump_block_extents(ostream& out)
 
 void BlueFS::get_usage(vector<pair<uint64_t,uint64_t>> *usage)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   usage->resize(bdev.size());
   for (unsigned id = 0; id < bdev.size(); ++id) {
     if (!bdev[id]) {
@@ -289,7 +351,7 @@ void BlueFS::get_usage(vector<pair<uint64_t,uint64_t>> *usage)
 
 int BlueFS::get_block_extents(unsigned id, interval_set<uint64_t> *extents)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " bdev " << id << dendl;
   if (id >= block_all.size())
     return -EINVAL;
@@ -299,7 +361,7 @@ int BlueFS::get_block_extents(unsigned id, interval_set<uint64_t> *extents)
 
 int BlueFS::mkfs(uuid_d osd_uuid)
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(1) << __func__
 	  << " osd_uuid " << osd_uuid
 	  << dendl;
@@ -469,7 +531,7 @@ void BlueFS::get_devices(set<string> *ls)
 
 int BlueFS::fsck()
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(1) << __func__ << dendl;
   // hrm, i think we check everything on mount...
   return 0;
@@ -1144,7 +1206,7 @@ uint64_t BlueFS::_estimate_log_size()
 
 void BlueFS::compact_log()
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   if (cct->_conf->bluefs_compact_log_sync) {
      _compact_log_sync();
   } else {
@@ -1445,7 +1507,7 @@ void BlueFS::_pad_bl(bufferlist& bl)
 
 void BlueFS::flush_log()
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   flush_bdev();
   _flush_and_sync_log(l);
 }
@@ -1454,11 +1516,15 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
 				uint64_t want_seq,
 				uint64_t jump_to)
 {
-  while (log_flushing) {
-    dout(10) << __func__ << " want_seq " << want_seq
-	     << " log is currently flushing, waiting" << dendl;
-    assert(!jump_to);
-    log_cond.wait(l);
+  if (log_flushing) {
+    auto start = ceph::mono_clock::now();
+    while (log_flushing) {
+      dout(10) << __func__ << " want_seq " << want_seq
+	       << " log is currently flushing, waiting" << dendl;
+      assert(!jump_to);
+      log_cond.wait(l);
+    }
+    logger->tinc(l_bluefs_log_wait_lat, ceph::mono_clock::now() - start);
   }
   if (want_seq && want_seq <= log_seq_stable) {
     dout(10) << __func__ << " want_seq " << want_seq << " <= log_seq_stable "
@@ -1583,6 +1649,24 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
 
 int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
 {
+  int r = _flush_range_prepare(h, &offset, &length);
+  if (r < 0)
+    return r;
+  if (length)
+    _flush_range_data(h, offset, length);
+  return 0;
+}
+
+/*
+ * Allocate space for and dirty the metadata of the given range; this
+ * is the only part of a flush that needs the global lock.  *length is
+ * set to 0 if there is nothing left to write.
+ */
+int BlueFS::_flush_range_prepare(FileWriter *h,
+				 uint64_t *poffset, uint64_t *plength)
+{
+  uint64_t offset = *poffset;
+  uint64_t length = *plength;
   dout(10) << __func__ << " " << h << " pos 0x" << std::hex << h->pos
 	   << " 0x" << offset << "~" << length << std::dec
 	   << " to " << h->file->fnode << dendl;
@@ -1591,14 +1675,10 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
 
   h->buffer_appender.flush();
 
-  bool buffered;
-  if (h->file->fnode.ino == 1)
-    buffered = false;
-  else
-    buffered = cct->_conf->bluefs_buffered_io;
-
-  if (offset + length <= h->pos)
+  if (offset + length <= h->pos) {
+    *plength = 0;
     return 0;
+  }
   if (offset < h->pos) {
     length -= h->pos - offset;
     offset = h->pos;
@@ -1607,7 +1687,10 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
              << dendl;
   }
   assert(offset <= h->file->fnode.size);
+  *poffset = offset;
+  *plength = length;
 
+  auto fl = _lock_file(h->file.get());
   uint64_t allocated = h->file->fnode.get_allocated();
 
   // do not bother to dirty the file if we are overwriting
@@ -1617,9 +1700,17 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
     // we should never run out of log space here; see the min runway check
     // in _flush_and_sync_log.
     assert(h->file->fnode.ino != 1);
-    int r = _allocate(h->file->fnode.prefer_bdev,
-		      offset + length - allocated,
-		      &h->file->fnode);
+    uint64_t want = offset + length - allocated;
+    bool preextend = cct->_conf->bluefs_preextend_wal_files &&
+      h->writer_type == WRITER_WAL;
+    if (preextend) {
+      // grab WAL space in big chunks so that (together with rocksdb
+      // recycling its log files) appends almost never need to touch
+      // our metadata log.
+      want = std::max<uint64_t>(
+	want, cct->_conf->get_val<uint64_t>("bluefs_wal_prealloc_size"));
+    }
+    int r = _allocate(h->file->fnode.prefer_bdev, want, &h->file->fnode);
     if (r < 0) {
       derr << __func__ << " allocated: 0x" << std::hex << allocated
            << " offset: 0x" << offset << " length: 0x" << length << std::dec
@@ -1627,8 +1718,7 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
       assert(0 == "bluefs enospc");
       return r;
     }
-    if (cct->_conf->bluefs_preextend_wal_files &&
-	h->writer_type == WRITER_WAL) {
+    if (preextend) {
       // NOTE: this *requires* that rocksdb also has log recycling
       // enabled and is therefore doing robust CRCs on the log
       // records.  otherwise, we will fail to reply the rocksdb log
@@ -1674,6 +1764,20 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
     }
   }
   dout(20) << __func__ << " file now " << h->file->fnode << dendl;
+  return 0;
+}
+
+/*
+ * Write out the given (already prepared) range.  Only touches h and
+ * the file extents, which cannot change under us while h->lock is held.
+ */
+void BlueFS::_flush_range_data(FileWriter *h, uint64_t offset, uint64_t length)
+{
+  bool buffered;
+  if (h->file->fnode.ino == 1)
+    buffered = false;
+  else
+    buffered = cct->_conf->bluefs_buffered_io;
 
   uint64_t x_off = 0;
   auto p = h->file->fnode.seek(offset, &x_off);
@@ -1777,7 +1881,6 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
   }
   dout(20) << __func__ << " h " << h << " pos now 0x"
            << std::hex << h->pos << std::dec << dendl;
-  return 0;
 }
 
 #ifdef HAVE_LIBAIO
@@ -1808,23 +1911,30 @@ void BlueFS::wait_for_aio(FileWriter *h)
 }
 #endif
 
-int BlueFS::_flush(FileWriter *h, bool force)
+bool BlueFS::_want_flush(FileWriter *h, bool force)
 {
   h->buffer_appender.flush();
   uint64_t length = h->buffer.length();
-  uint64_t offset = h->pos;
   if (!force &&
       length < cct->_conf->bluefs_min_flush_size) {
     dout(10) << __func__ << " " << h << " ignoring, length " << length
 	     << " < min_flush_size " << cct->_conf->bluefs_min_flush_size
 	     << dendl;
-    return 0;
+    return false;
   }
   if (length == 0) {
-    dout(10) << __func__ << " " << h << " no dirty data on "
-	     << h->file->fnode << dendl;
-    return 0;
+    dout(10) << __func__ << " " << h << " no dirty data" << dendl;
+    return false;
   }
+  return true;
+}
+
+int BlueFS::_flush(FileWriter *h, bool force)
+{
+  if (!_want_flush(h, force))
+    return 0;
+  uint64_t length = h->buffer.length();
+  uint64_t offset = h->pos;
   dout(10) << __func__ << " " << h << " 0x"
            << std::hex << offset << "~" << length << std::dec
 	   << " to " << h->file->fnode << dendl;
@@ -1832,6 +1942,33 @@ int BlueFS::_flush(FileWriter *h, bool force)
   return _flush_range(h, offset, length);
 }
 
+int BlueFS::_flush_writer_range(FileWriter *h, uint64_t offset,
+				uint64_t length)
+{
+  {
+    auto l = _lock_global();
+    int r = _flush_range_prepare(h, &offset, &length);
+    if (r < 0)
+      return r;
+  }
+  if (length) {
+    auto fl = _lock_file_shared(h->file.get());
+    _flush_range_data(h, offset, length);
+  }
+  return 0;
+}
+
+int BlueFS::_flush_writer(FileWriter *h, bool force)
+{
+  if (!_want_flush(h, force))
+    return 0;
+  uint64_t length = h->buffer.length();
+  uint64_t offset = h->pos;
+  dout(10) << __func__ << " " << h << " 0x"
+           << std::hex << offset << "~" << length << std::dec << dendl;
+  return _flush_writer_range(h, offset, length);
+}
+
 int BlueFS::_truncate(FileWriter *h, uint64_t offset)
 {
   dout(10) << __func__ << " 0x" << std::hex << offset << std::dec
@@ -1844,6 +1981,9 @@ int BlueFS::_truncate(FileWriter *h, uint64_t offset)
   // we never truncate internal log files
   assert(h->file->fnode.ino > 1);
 
+  // NOTE: caller holds both h->lock and the global lock, so the
+  // locked _flush path is fine here.
+
   h->buffer_appender.flush();
 
   // truncate off unflushed data?
@@ -1868,22 +2008,34 @@ int BlueFS::_truncate(FileWriter *h, uint64_t offset)
     assert(0 == "truncate up not supported");
   }
   assert(h->file->fnode.size >= offset);
-  h->file->fnode.size = offset;
+  {
+    auto fl = _lock_file(h->file.get());
+    h->file->fnode.size = offset;
+  }
   log_t.op_file_update(h->file->fnode);
   return 0;
 }
 
-int BlueFS::_fsync(FileWriter *h, std::unique_lock<std::mutex>& l)
+int BlueFS::fsync(FileWriter *h)
 {
-  dout(10) << __func__ << " " << h << " " << h->file->fnode << dendl;
-  int r = _flush(h, true);
+  auto hl = _lock_writer(h);
+  dout(10) << __func__ << " " << h << dendl;
+  int r = _flush_writer(h, true);
   if (r < 0)
      return r;
-  uint64_t old_dirty_seq = h->file->dirty_seq;
 
-  _flush_bdev_safely(h);
+  // only we (holding h->lock) can dirty this file, so it is enough to
+  // sample dirty_seq once the data has been prepared.
+  uint64_t old_dirty_seq;
+  {
+    auto l = _lock_global();
+    old_dirty_seq = h->file->dirty_seq;
+  }
+
+  _flush_bdev_writer(h);
 
   if (old_dirty_seq) {
+    auto l = _lock_global();
     uint64_t s = log_seq;
     dout(20) << __func__ << " file metadata was dirty (" << old_dirty_seq
 	     << ") on " << h->file->fnode << ", flushing log" << dendl;
@@ -1914,13 +2066,55 @@ void BlueFS::_flush_bdev_safely(FileWriter *h)
   }
 }
 
+void BlueFS::_flush_bdev_writer(FileWriter *h)
+{
+#ifdef HAVE_LIBAIO
+  if (!cct->_conf->bluefs_sync_write) {
+    list<aio_t> completed_ios;
+    _claim_completed_aios(h, &completed_ios);
+    wait_for_aio(h);
+    completed_ios.clear();
+  }
+#endif
+  flush_bdev();
+}
+
+/*
+ * Group commit: everything written before we got here is covered by
+ * any device flush that starts after we arrive, so concurrent callers
+ * (e.g., several rocksdb WAL syncs) share a single flush.
+ */
 void BlueFS::flush_bdev()
 {
   // NOTE: this is safe to call without a lock.
-  dout(20) << __func__ << dendl;
-  for (auto p : bdev) {
-    if (p)
-      p->flush();
+  std::unique_lock<std::mutex> l(flush_lock);
+  uint64_t seq = ++flush_seq_queued;
+  while (flush_seq_done < seq) {
+    if (flush_in_progress) {
+      flush_cond.wait(l);
+      continue;
+    }
+    flush_in_progress = true;
+    uint64_t from = flush_seq_done;
+    uint64_t upto = flush_seq_queued;
+    l.unlock();
+    dout(20) << __func__ << " flushing through " << upto << dendl;
+    for (auto p : bdev) {
+      if (p)
+	p->flush();
+    }
+    if (logger) {
+      logger->inc(l_bluefs_bdev_flushes);
+      // every request in (from, upto] is covered, including ones that
+      // queued before us and were still waiting for the previous flush
+      if (upto - from > 1) {
+	logger->inc(l_bluefs_bdev_flushes_grouped, upto - from - 1);
+      }
+    }
+    l.lock();
+    flush_seq_done = upto;
+    flush_in_progress = false;
+    flush_cond.notify_all();
   }
 }
 
@@ -1996,6 +2190,7 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
     return 0;
   }
   assert(f->fnode.ino > 1);
+  auto fl = _lock_file(f.get());
   uint64_t allocated = f->fnode.get_allocated();
   if (off + len > allocated) {
     uint64_t want = off + len - allocated;
@@ -2009,7 +2204,7 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
 
 void BlueFS::sync_metadata()
 {
-  std::unique_lock<std::mutex> l(lock);
+  auto l = _lock_global();
   if (log_t.empty()) {
     dout(10) << __func__ << " - no pending log events" << dendl;
   } else {
@@ -2035,7 +2230,7 @@ int BlueFS::open_for_write(
   FileWriter **h,
   bool overwrite)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << "/" << filename << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   DirRef dir;
@@ -2155,7 +2350,7 @@ int BlueFS::open_for_read(
   FileReader **h,
   bool random)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << "/" << filename
 	   << (random ? " (random)":" (sequential)") << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
@@ -2184,7 +2379,7 @@ int BlueFS::rename(
   const string& old_dirname, const string& old_filename,
   const string& new_dirname, const string& new_filename)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << old_dirname << "/" << old_filename
 	   << " -> " << new_dirname << "/" << new_filename << dendl;
   map<string,DirRef>::iterator p = dir_map.find(old_dirname);
@@ -2231,7 +2426,7 @@ int BlueFS::rename(
 
 int BlueFS::mkdir(const string& dirname)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   if (p != dir_map.end()) {
@@ -2245,7 +2440,7 @@ int BlueFS::mkdir(const string& dirname)
 
 int BlueFS::rmdir(const string& dirname)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   if (p == dir_map.end()) {
@@ -2264,7 +2459,7 @@ int BlueFS::rmdir(const string& dirname)
 
 bool BlueFS::dir_exists(const string& dirname)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   bool exists = p != dir_map.end();
   dout(10) << __func__ << " " << dirname << " = " << (int)exists << dendl;
@@ -2274,7 +2469,7 @@ bool BlueFS::dir_exists(const string& dirname)
 int BlueFS::stat(const string& dirname, const string& filename,
 		 uint64_t *size, utime_t *mtime)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << "/" << filename << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   if (p == dir_map.end()) {
@@ -2302,7 +2497,7 @@ int BlueFS::stat(const string& dirname, const string& filename,
 int BlueFS::lock_file(const string& dirname, const string& filename,
 		      FileLock **plock)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << "/" << filename << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   if (p == dir_map.end()) {
@@ -2340,7 +2535,7 @@ int BlueFS::lock_file(const string& dirname, const string& filename,
 
 int BlueFS::unlock_file(FileLock *fl)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << fl << " on " << fl->file->fnode << dendl;
   assert(fl->file->locked);
   fl->file->locked = false;
@@ -2350,7 +2545,7 @@ int BlueFS::unlock_file(FileLock *fl)
 
 int BlueFS::readdir(const string& dirname, vector<string> *ls)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << dendl;
   if (dirname.empty()) {
     // list dirs
@@ -2378,7 +2573,7 @@ int BlueFS::readdir(const string& dirname, vector<string> *ls)
 
 int BlueFS::unlink(const string& dirname, const string& filename)
 {
-  std::lock_guard<std::mutex> l(lock);
+  auto l = _lock_global();
   dout(10) << __func__ << " " << dirname << "/" << filename << dendl;
   map<string,DirRef>::iterator p = dir_map.find(dirname);
   if (p == dir_map.end()) {
@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <mutex>
+#include <shared_mutex>
 
 #include "bluefs_types.h"
 #include "common/RefCountedObj.h"
@@ -35,6 +36,11 @@ enum {
   l_bluefs_files_written_sst,
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
+  l_bluefs_lock_wait_lat,
+  l_bluefs_file_lock_wait_lat,
+  l_bluefs_log_wait_lat,
+  l_bluefs_bdev_flushes,
+  l_bluefs_bdev_flushes_grouped,
   l_bluefs_last,
 };
 
@@ -65,6 +71,11 @@ public:
     std::atomic_int num_readers, num_writers;
     std::atomic_int num_reading;
 
+    /// protects fnode extents and size for paths that do not hold the
+    /// global lock (writer data submission, cache invalidation).  it
+    /// is taken exclusively, under the global lock, whenever they change.
+    std::shared_mutex lock;
+
     File()
       : RefCountedObject(NULL, 0),
 	refs(0),
@@ -124,7 +135,7 @@ public:
     bufferlist::page_aligned_appender buffer_appender;  //< for const char* only
     int writer_type = 0;    ///< WRITER_*
 
-    std::mutex lock;
+    std::mutex lock;        ///< serializes flush/fsync/truncate; before global lock
     std::array<IOContext*,MAX_BDEV> iocv; ///< for each bdev
 
     FileWriter(FileRef f)
@@ -236,6 +247,13 @@ private:
   bool log_flushing = false;   ///< true while flushing the log
   std::condition_variable log_cond;
 
+  // device flush group commit
+  std::mutex flush_lock;
+  std::condition_variable flush_cond;
+  uint64_t flush_seq_queued = 0;  ///< last flush request
+  uint64_t flush_seq_done = 0;    ///< last request covered by a flush
+  bool flush_in_progress = false;
+
   uint64_t new_log_jump_to = 0;
   uint64_t old_log_jump_to = 0;
   FileRef new_log = nullptr;
@@ -268,9 +286,20 @@ private:
 
   int _allocate(uint8_t bdev, uint64_t len,
 		bluefs_fnode_t* node);
+  std::unique_lock<std::mutex> _lock_global();
+  std::unique_lock<std::mutex> _lock_writer(FileWriter *h);
+  std::unique_lock<std::shared_mutex> _lock_file(File *f);
+  std::shared_lock<std::shared_mutex> _lock_file_shared(File *f);
+
+  bool _want_flush(FileWriter *h, bool force);
+  int _flush_range_prepare(FileWriter *h, uint64_t *offset, uint64_t *length);
+  void _flush_range_data(FileWriter *h, uint64_t offset, uint64_t length);
   int _flush_range(FileWriter *h, uint64_t offset, uint64_t length);
   int _flush(FileWriter *h, bool force);
-  int _fsync(FileWriter *h, std::unique_lock<std::mutex>& l);
+
+  // these expect h->lock to be held, but not the global lock
+  int _flush_writer_range(FileWriter *h, uint64_t offset, uint64_t length);
+  int _flush_writer(FileWriter *h, bool force);
 
 #ifdef HAVE_LIBAIO
   void _claim_completed_aios(FileWriter *h, list<aio_t> *ls);
@@ -289,6 +318,7 @@ private:
   //void _aio_finish(void *priv);
 
   void _flush_bdev_safely(FileWriter *h);
+  void _flush_bdev_writer(FileWriter *h);  // caller holds h->lock only
   void flush_bdev();  // this is safe to call without a lock
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
@@ -341,6 +371,9 @@ public:
 
   void collect_metadata(map<string,string> *pm, unsigned skip_bdev_id);
   void get_devices(set<string> *ls);
+  const PerfCounters* get_perf_counters() const {
+    return logger;
+  }
   int fsck();
 
   uint64_t get_fs_usage();
@@ -367,7 +400,7 @@ public:
     bool random = false);
 
   void close_writer(FileWriter *h) {
-    std::lock_guard<std::mutex> l(lock);
+    auto l = _lock_global();
     _close_writer(h);
   }
 
@@ -405,18 +438,17 @@ public:
   int reclaim_blocks(unsigned bdev, uint64_t want,
 		     AllocExtentVector *extents);
 
+  // writers only take the global lock to allocate space and dirty the
+  // file metadata; data is submitted (and waited for) under h->lock.
   void flush(FileWriter *h) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush(h, false);
+    auto hl = _lock_writer(h);
+    _flush_writer(h, false);
   }
   void flush_range(FileWriter *h, uint64_t offset, uint64_t length) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush_range(h, offset, length);
-  }
-  int fsync(FileWriter *h) {
-    std::unique_lock<std::mutex> l(lock);
-    return _fsync(h, l);
+    auto hl = _lock_writer(h);
+    _flush_writer_range(h, offset, length);
   }
+  int fsync(FileWriter *h);
   int read(FileReader *h, FileReaderBuffer *buf, uint64_t offset, size_t len,
 	   bufferlist *outbl, char *out) {
     // no need to hold the global lock here; we only touch h and
@@ -432,15 +464,17 @@ public:
     return _read_random(h, offset, len, out);
   }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len) {
-    std::lock_guard<std::mutex> l(lock);
+    // only needs a stable view of the extents, not the global lock
+    auto fl = _lock_file_shared(f.get());
     _invalidate_cache(f, offset, len);
   }
   int preallocate(FileRef f, uint64_t offset, uint64_t len) {
-    std::lock_guard<std::mutex> l(lock);
+    auto l = _lock_global();
     return _preallocate(f, offset, len);
   }
   int truncate(FileWriter *h, uint64_t offset) {
-    std::lock_guard<std::mutex> l(lock);
+    auto hl = _lock_writer(h);
+    auto l = _lock_global();
     return _truncate(h, offset);
   }
 
@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <thread>
 
 #include "include/cpp-btree/btree_set.h"
 
@@ -33,6 +34,7 @@
 #include "BlueRocksEnv.h"
 #include "auth/Crypto.h"
 #include "common/EventTrace.h"
+#include "common/MemoryModel.h"
 
 #define dout_context cct
 #define dout_subsys ceph_subsys_bluestore
@@ -762,6 +764,55 @@ int64_t BlueStore::GarbageCollector::estimate(
   return expected_for_release - expected_allocations;
 }
 
+uint64_t BlueStore::GarbageCollector::estimate_fragmented(
+  const BlueStore::ExtentMap& extent_map,
+  uint32_t min_pextents,
+  uint64_t max_bytes,
+  uint64_t min_alloc_size)
+{
+  affected_blobs.clear();
+  extents_to_collect.clear();
+  uint64_t total = 0;
+
+  for (auto& e : extent_map.extent_map) {
+    if (total >= max_bytes) {
+      break;
+    }
+    const bluestore_blob_t& b = e.blob->get_blob();
+    if (b.is_compressed() || b.is_shared()) {
+      // compressed blobs are the regular GC's business, and rewriting a
+      // shared blob would unshare it
+      continue;
+    }
+    uint32_t pextents = 0;
+    for (auto& p : b.get_extents()) {
+      if (p.is_valid()) {
+	++pextents;
+      }
+    }
+    if (pextents < min_pextents) {
+      continue;
+    }
+    // only whole allocation units, so that the rewrite takes the big
+    // write path and lands in freshly allocated space
+    uint64_t start = p2roundup<uint64_t>(e.logical_offset, min_alloc_size);
+    uint64_t end = p2align<uint64_t>(e.logical_end(), min_alloc_size);
+    if (start >= end) {
+      continue;
+    }
+    dout(20) << __func__ << " " << *e.blob << " 0x" << std::hex << start
+	     << "~" << (end - start) << std::dec << dendl;
+    if (!extents_to_collect.empty() &&
+	extents_to_collect.back().end() == start) {
+      extents_to_collect.back().length += end - start;
+    } else {
+      extents_to_collect.emplace_back(start, end - start);
+    }
+    total += end - start;
+  }
+  return total;
+}
+
 // Cache
 
 BlueStore::Cache *BlueStore::Cache::create(CephContext* cct, string type,
@@ -3225,6 +3276,7 @@ BlueStore::Collection::Collection(BlueStore *ns, Cache *c, coll_t cid)
     onode_map(c)
 {
   osr->shard = cid.hash_to_shard(ns->m_finisher_num);
+  osr->kv_shard = cid.hash_to_shard(ns->kv_shard_num);
 }
 
 bool BlueStore::Collection::flush_commit(Context *c)
@@ -3457,35 +3509,72 @@ void BlueStore::Collection::split_cache(
 
 // =======================================================
 
+// MempoolThread
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.MempoolThread(" << this << ") "
+
 void *BlueStore::MempoolThread::entry()
 {
   Mutex::Locker l(lock);
-  while (!stop) {
-    uint64_t meta_bytes =
-      mempool::bluestore_cache_other::allocated_bytes() +
-      mempool::bluestore_cache_onode::allocated_bytes();
-    uint64_t onode_num =
-      mempool::bluestore_cache_onode::allocated_items();
 
-    if (onode_num < 2) {
-      onode_num = 2;
-    }
+  std::list<PriorityCache::PriCache *> caches;
+  caches.push_back(&meta_cache);
+  caches.push_back(&data_cache);
+  kv_cache.db = store->db;
+  if (store->db && store->db->get_cache_usage() >= 0) {
+    caches.push_back(&kv_cache);
+  }
+  meta_cache.set_cache_ratio(store->cache_meta_ratio);
+  data_cache.set_cache_ratio(store->cache_data_ratio);
+  kv_cache.set_cache_ratio(store->cache_kv_ratio);
+  autotune_cache_size = store->cache_size;
 
-    float bytes_per_onode = (float)meta_bytes / (float)onode_num;
-    size_t num_shards = store->cache_shards.size();
-    float target_ratio = store->cache_meta_ratio + store->cache_data_ratio;
-    // A little sloppy but should be close enough
-    uint64_t shard_target = target_ratio * (store->cache_size / num_shards);
+  utime_t next_balance;
+  utime_t next_resize;
+  bool was_autotune = false;
 
-    for (auto i : store->cache_shards) {
-      i->trim(shard_target,
-	      store->cache_meta_ratio,
-	      store->cache_data_ratio,
-	      bytes_per_onode);
-    }
+  while (!stop) {
+    bool autotune =
+      store->cct->_conf->get_val<bool>("bluestore_cache_autotune");
+    if (autotune) {
+      utime_t now = ceph_clock_now();
+      bool resized = false;
+      if (now >= next_resize) {
+	resized = _tune_cache_size();
+	next_resize = now;
+	next_resize += store->cct->_conf->get_val<double>(
+	  "osd_memory_cache_resize_interval");
+      }
+      if (resized || now >= next_balance) {
+	_balance_cache(caches);
+	next_balance = now;
+	next_balance += store->cct->_conf->get_val<double>(
+	  "bluestore_cache_autotune_interval");
+      }
+    } else if (was_autotune) {
+      // fall back to the static split
+      if (kv_cache.db) {
+	kv_cache.db->set_cache_capacity(
+	  store->cache_size * store->cache_kv_ratio);
+      }
+      next_balance = utime_t();
+      next_resize = utime_t();
+    }
+    was_autotune = autotune;
+
+    _trim_shards(autotune);
+    store->logger->set(l_bluestore_cache_size,
+		       autotune ? autotune_cache_size : store->cache_size);
 
     store->_update_cache_logger();
 
+    // nothing else kicks an idle deferred queue; honor
+    // bluestore_deferred_max_age from here.
+    if (!store->_kv_only) {
+      store->deferred_try_submit(false);
+    }
+
     utime_t wait;
     wait += store->cct->_conf->bluestore_cache_trim_interval;
     cond.WaitInterval(lock, wait);
@@ -3494,6 +3583,154 @@ void *BlueStore::MempoolThread::entry()
   return NULL;
 }
 
+void BlueStore::MempoolThread::_trim_shards(bool autotune)
+{
+  uint64_t meta_target;
+  uint64_t data_target;
+  if (autotune) {
+    meta_target = meta_cache.get_committed_size();
+    data_target = data_cache.get_committed_size();
+  } else {
+    meta_target = store->cache_size * store->cache_meta_ratio;
+    data_target = store->cache_size * store->cache_data_ratio;
+  }
+  uint64_t target = meta_target + data_target;
+  float meta_ratio = target ? (double)meta_target / (double)target : 0;
+  float data_ratio = target ? (double)data_target / (double)target : 0;
+  size_t num_shards = store->cache_shards.size();
+  // A little sloppy but should be close enough
+  uint64_t shard_target = target / num_shards;
+  float bytes_per_onode = meta_cache.get_bytes_per_onode();
+
+  for (auto i : store->cache_shards) {
+    i->trim(shard_target, meta_ratio, data_ratio, bytes_per_onode);
+  }
+}
+
+bool BlueStore::MempoolThread::_tune_cache_size()
+{
+  CephContext *cct = store->cct;
+  uint64_t target = cct->_conf->get_val<uint64_t>("osd_memory_target");
+  uint64_t base = cct->_conf->get_val<uint64_t>("osd_memory_base");
+  double fragmentation =
+    cct->_conf->get_val<double>("osd_memory_expected_fragmentation");
+  uint64_t cache_min = cct->_conf->get_val<uint64_t>("osd_memory_cache_min");
+  uint64_t cache_max = cache_min;
+  uint64_t limited_target = (1.0 - fragmentation) * target;
+  if (limited_target > base + cache_min) {
+    cache_max = limited_target - base;
+  }
+
+  MemoryModel mm(cct);
+  MemoryModel::snap last;
+  mm.sample(&last);
+  uint64_t rss = (uint64_t)last.get_rss() << 10;
+  if (rss == 0) {
+    dout(5) << __func__ << " unable to sample process rss" << dendl;
+    return false;
+  }
+
+  uint64_t new_size = autotune_cache_size;
+  new_size = std::min(new_size, cache_max);
+  new_size = std::max(new_size, cache_min);
+
+  // approach the target slowly, but back off quickly
+  if (rss < target) {
+    double ratio = 1 - ((double)rss / target);
+    new_size += ratio * (cache_max - new_size);
+  } else {
+    double ratio = 1 - ((double)target / rss);
+    new_size -= ratio * (new_size - cache_min);
+  }
+  dout(10) << __func__
+	   << " target: " << target
+	   << " rss: " << rss
+	   << " cache_min: " << cache_min
+	   << " cache_max: " << cache_max
+	   << " old cache_size: " << autotune_cache_size
+	   << " new cache size: " << new_size << dendl;
+
+  bool changed = new_size != autotune_cache_size;
+  autotune_cache_size = new_size;
+  return changed;
+}
+
+void BlueStore::MempoolThread::_balance_cache(
+  const std::list<PriorityCache::PriCache *>& caches)
+{
+  uint64_t chunk_bytes = store->cct->_conf->get_val<uint64_t>(
+    "bluestore_cache_autotune_chunk_size");
+  PriorityCache::balance(autotune_cache_size, chunk_bytes, caches);
+
+  for (auto c : caches) {
+    c->commit_cache_size(autotune_cache_size);
+    ldout(store->cct, 5) << __func__ << " " << c->get_cache_name()
+	    << " pri0: " << c->get_cache_bytes(PriorityCache::Priority::PRI0)
+	    << " pri1: " << c->get_cache_bytes(PriorityCache::Priority::PRI1)
+	    << " pri2: " << c->get_cache_bytes(PriorityCache::Priority::PRI2)
+	    << " pri3: " << c->get_cache_bytes(PriorityCache::Priority::PRI3)
+	    << " committed: " << c->get_committed_size() << dendl;
+  }
+}
+
+int64_t BlueStore::MempoolThread::MetaCache::request_cache_bytes(
+  PriorityCache::Priority pri, uint64_t chunk_bytes) const
+{
+  int64_t assigned = get_cache_bytes(pri);
+
+  switch (pri) {
+  // onode misses cost a kv lookup plus a decode; keep what we have
+  case PriorityCache::Priority::PRI1:
+    return PriorityCache::get_chunk(_get_used_bytes(), chunk_bytes) - assigned;
+  default:
+    break;
+  }
+  return 0;
+}
+
+int64_t BlueStore::MempoolThread::DataCache::request_cache_bytes(
+  PriorityCache::Priority pri, uint64_t chunk_bytes) const
+{
+  int64_t assigned = get_cache_bytes(pri);
+
+  switch (pri) {
+  case PriorityCache::Priority::PRI2:
+    return PriorityCache::get_chunk(_get_used_bytes(), chunk_bytes) - assigned;
+  default:
+    break;
+  }
+  return 0;
+}
+
+int64_t BlueStore::MempoolThread::KVCache::request_cache_bytes(
+  PriorityCache::Priority pri, uint64_t chunk_bytes) const
+{
+  int64_t assigned = get_cache_bytes(pri);
+  int64_t pinned = std::max<int64_t>(db->get_cache_pinned_usage(), 0);
+
+  switch (pri) {
+  // blocks that are in use can't be evicted anyway
+  case PriorityCache::Priority::PRI0:
+    return pinned - assigned;
+  case PriorityCache::Priority::PRI2:
+    {
+      int64_t usage = std::max<int64_t>(db->get_cache_usage(), 0);
+      return PriorityCache::get_chunk(usage - pinned, chunk_bytes) - assigned;
+    }
+  default:
+    break;
+  }
+  return 0;
+}
+
+int64_t BlueStore::MempoolThread::KVCache::commit_cache_size(
+  uint64_t total_cache)
+{
+  committed_bytes = std::min<int64_t>(get_cache_bytes(), total_cache);
+  db->set_cache_capacity(committed_bytes);
+  return committed_bytes;
+}
+
 // =======================================================
 
 // OmapIteratorImpl
@@ -3617,8 +3854,7 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
-    kv_sync_thread(this),
-    kv_finalize_thread(this),
+    defrag_thread(this),
     mempool_thread(this)
 {
   _init_logger();
@@ -3636,8 +3872,7 @@ BlueStore::BlueStore(CephContext *cct,
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
-    kv_sync_thread(this),
-    kv_finalize_thread(this),
+    defrag_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
     mempool_thread(this)
@@ -3687,6 +3922,9 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_batch_bytes",
+    "bluestore_deferred_batch_bytes_hdd",
+    "bluestore_deferred_batch_bytes_ssd",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -3728,7 +3966,10 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_batch_bytes") ||
+      changed.count("bluestore_deferred_batch_bytes_hdd") ||
+      changed.count("bluestore_deferred_batch_bytes_ssd")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -4013,6 +4254,9 @@ void BlueStore::_init_logger()
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def");
+  b.add_u64_counter(l_bluestore_deferred_write_batches,
+		    "deferred_write_batches",
+		    "Sum for per-sequencer deferred write batches");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4085,6 +4329,18 @@ void BlueStore::_init_logger()
 		    "collection");
   b.add_u64_counter(l_bluestore_read_eio, "bluestore_read_eio",
                     "Read EIO errors propagated to high level callers");
+  b.add_u64(l_bluestore_fragmentation, "bluestore_fragmentation",
+	    "Free space fragmentation score (0-1000)");
+  b.add_u64(l_bluestore_free_extents, "bluestore_free_extents",
+	    "Number of free extents");
+  b.add_u64(l_bluestore_free_max_extent, "bluestore_free_max_extent",
+	    "Largest free extent");
+  b.add_u64_counter(l_bluestore_defrag_blobs, "bluestore_defrag_blobs",
+		    "Fragmented extents rewritten by background defragmentation");
+  b.add_u64_counter(l_bluestore_defrag_bytes, "bluestore_defrag_bytes",
+		    "Bytes rewritten by background defragmentation");
+  b.add_u64(l_bluestore_cache_size, "bluestore_cache_size",
+	    "Total size of onode, data and kv caches");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -4283,12 +4539,27 @@ void BlueStore::_set_alloc_sizes(void)
     }
   }
 
+  deferred_batch_bytes =
+    cct->_conf->get_val<uint64_t>("bluestore_deferred_batch_bytes");
+  if (!deferred_batch_bytes) {
+    assert(bdev);
+    if (bdev->is_rotational()) {
+      deferred_batch_bytes =
+	cct->_conf->get_val<uint64_t>("bluestore_deferred_batch_bytes_hdd");
+    } else {
+      deferred_batch_bytes =
+	cct->_conf->get_val<uint64_t>("bluestore_deferred_batch_bytes_ssd");
+    }
+  }
+
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
 	   << " max_alloc_size 0x" << std::hex << max_alloc_size
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " deferred_batch_bytes 0x" << std::hex << deferred_batch_bytes
+	   << std::dec
 	   << dendl;
 }
 
@@ -4908,6 +5179,12 @@ int BlueStore::_open_db(bool create, bool to_repair_db)
 
   if (kv_backend == "rocksdb") {
     options = cct->_conf->bluestore_rocksdb_options;
+    if (kv_shard_num > 1 &&
+	options.find("enable_pipelined_write") == string::npos) {
+      // several kv sync threads write (and sync) concurrently; let
+      // rocksdb overlap their wal writes with the memtable inserts.
+      options += ",enable_pipelined_write=true";
+    }
 
     map<string,string> cf_map;
     cct->_conf->with_val<string>("bluestore_rocksdb_cfs",
@@ -5530,6 +5807,7 @@ int BlueStore::_mount(bool kv_only, bool open_db)
   dout(1) << __func__ << " path " << path << dendl;
 
   _kv_only = kv_only;
+  kv_shard_num = cct->_conf->get_val<uint64_t>("bluestore_kv_sync_shards");
 
   {
     string type;
@@ -5615,7 +5893,7 @@ int BlueStore::_mount(bool kv_only, bool open_db)
     goto out_stop;
 
   mempool_thread.init();
-
+  _defrag_start();
 
   mounted = true;
   return 0;
@@ -5644,6 +5922,9 @@ int BlueStore::umount()
   assert(_kv_only || mounted);
   dout(1) << __func__ << dendl;
 
+  if (!_kv_only) {
+    _defrag_stop();
+  }
   _osr_drain_all();
 
   mounted = false;
@@ -5729,6 +6010,204 @@ int BlueStore::_fsck_check_extents(
   return errors;
 }
 
+void BlueStore::_fsck_check_object(
+  CollectionRef c,
+  const ghobject_t& oid,
+  uint64_t seq,
+  bool deep,
+  mempool_dynamic_bitset &used_blocks,
+  std::mutex &used_blocks_lock,
+  fsck_result_t *res)
+{
+  int& errors = res->errors;
+  store_statfs_t& expected_statfs = res->expected_statfs;
+
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o) {
+    derr << "fsck error: " << oid << " vanished while checking" << dendl;
+    ++errors;
+    return;
+  }
+  res->num_spanning_blobs += o->extent_map.spanning_blob_map.size();
+  o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+  _dump_onode(o, 30);
+  // lextents
+  map<BlobRef,bluestore_blob_t::unused_t> referenced;
+  uint64_t pos = 0;
+  mempool::bluestore_fsck::map<BlobRef,
+			       bluestore_blob_use_tracker_t> ref_map;
+  for (auto& l : o->extent_map.extent_map) {
+    dout(20) << __func__ << "    " << l << dendl;
+    if (l.logical_offset < pos) {
+      derr << "fsck error: " << oid << " lextent at 0x"
+	   << std::hex << l.logical_offset
+	   << " overlaps with the previous, which ends at 0x" << pos
+	   << std::dec << dendl;
+      ++errors;
+    }
+    if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
+      derr << "fsck error: " << oid << " lextent at 0x"
+	   << std::hex << l.logical_offset << "~" << l.length
+	   << " spans a shard boundary"
+	   << std::dec << dendl;
+      ++errors;
+    }
+    pos = l.logical_offset + l.length;
+    expected_statfs.stored += l.length;
+    assert(l.blob);
+    const bluestore_blob_t& blob = l.blob->get_blob();
+
+    auto& ref = ref_map[l.blob];
+    if (ref.is_empty()) {
+      uint32_t min_release_size = blob.get_release_size(min_alloc_size);
+      uint32_t l = blob.get_logical_length();
+      ref.init(l, min_release_size);
+    }
+    ref.get(
+      l.blob_offset, 
+      l.length);
+    ++res->num_extents;
+    if (blob.has_unused()) {
+      auto p = referenced.find(l.blob);
+      bluestore_blob_t::unused_t *pu;
+      if (p == referenced.end()) {
+	pu = &referenced[l.blob];
+      } else {
+	pu = &p->second;
+      }
+      uint64_t blob_len = blob.get_logical_length();
+      assert((blob_len % (sizeof(*pu)*8)) == 0);
+      assert(l.blob_offset + l.length <= blob_len);
+      uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
+      uint64_t start = l.blob_offset / chunk_size;
+      uint64_t end =
+	round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
+      for (auto i = start; i < end; ++i) {
+	(*pu) |= (1u << i);
+      }
+    }
+  }
+  for (auto &i : referenced) {
+    dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
+	     << std::dec << " for " << *i.first << dendl;
+    const bluestore_blob_t& blob = i.first->get_blob();
+    if (i.second & blob.unused) {
+      derr << "fsck error: " << oid << " blob claims unused 0x"
+	   << std::hex << blob.unused
+	   << " but extents reference 0x" << i.second
+	   << " on blob " << *i.first << dendl;
+      ++errors;
+    }
+    if (blob.has_csum()) {
+      uint64_t blob_len = blob.get_logical_length();
+      uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
+      unsigned csum_count = blob.get_csum_count();
+      unsigned csum_chunk_size = blob.get_csum_chunk_size();
+      for (unsigned p = 0; p < csum_count; ++p) {
+	unsigned pos = p * csum_chunk_size;
+	unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
+	unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
+	unsigned mask = 1u << firstbit;
+	for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
+	  mask |= 1u << b;
+	}
+	if ((blob.unused & mask) == mask) {
+	  // this csum chunk region is marked unused
+	  if (blob.get_csum_item(p) != 0) {
+	    derr << "fsck error: " << oid
+		 << " blob claims csum chunk 0x" << std::hex << pos
+		 << "~" << csum_chunk_size
+		 << " is unused (mask 0x" << mask << " of unused 0x"
+		 << blob.unused << ") but csum is non-zero 0x"
+		 << blob.get_csum_item(p) << std::dec << " on blob "
+		 << *i.first << dendl;
+	    ++errors;
+	  }
+	}
+      }
+    }
+  }
+  for (auto &i : ref_map) {
+    ++res->num_blobs;
+    const bluestore_blob_t& blob = i.first->get_blob();
+    bool equal = i.first->get_blob_use_tracker().equal(i.second);
+    if (!equal) {
+      derr << "fsck error: " << oid << " blob " << *i.first
+	   << " doesn't match expected ref_map " << i.second << dendl;
+      ++errors;
+    }
+    if (blob.is_compressed()) {
+      expected_statfs.compressed += blob.get_compressed_payload_length();
+      expected_statfs.compressed_original += 
+	i.first->get_referenced_bytes();
+    }
+    if (blob.is_shared()) {
+      if (i.first->shared_blob->get_sbid() > blobid_max) {
+	derr << "fsck error: " << oid << " blob " << blob
+	     << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
+	     << blobid_max << dendl;
+	++errors;
+      } else if (i.first->shared_blob->get_sbid() == 0) {
+	derr << "fsck error: " << oid << " blob " << blob
+	     << " marked as shared but has uninitialized sbid"
+	     << dendl;
+	++errors;
+      }
+      res->sb_refs.push_back(fsck_sb_ref_t());
+      fsck_sb_ref_t& ref = res->sb_refs.back();
+      ref.seq = seq;
+      ref.sbid = i.first->shared_blob->get_sbid();
+      ref.oid = oid;
+      ref.sb = i.first->shared_blob;
+      ref.compressed = blob.is_compressed();
+      for (auto e : blob.get_extents()) {
+	if (e.is_valid()) {
+	  ref.extents.push_back(e);
+	}
+      }
+    } else {
+      std::lock_guard<std::mutex> ul(used_blocks_lock);
+      errors += _fsck_check_extents(oid, blob.get_extents(),
+				    blob.is_compressed(),
+				    used_blocks,
+				    fm->get_alloc_size(),
+				    expected_statfs);
+    }
+  }
+  if (deep) {
+    bufferlist bl;
+    int r = _do_read(c.get(), o, 0, o->onode.size, bl, 0);
+    if (r < 0) {
+      ++errors;
+      derr << "fsck error: " << oid << " error during read: "
+	   << cpp_strerror(r) << dendl;
+    }
+  }
+}
+
+void BlueStore::_fsck_worker(fsck_queue_t *queue, fsck_result_t *res)
+{
+  std::unique_lock<std::mutex> l(queue->lock);
+  while (true) {
+    if (queue->q.empty()) {
+      if (queue->done) {
+	break;
+      }
+      queue->cond.wait(l);
+      continue;
+    }
+    auto item = std::move(queue->q.front());
+    uint64_t seq = queue->seq++;
+    queue->q.pop_front();
+    queue->cond.notify_all();
+    l.unlock();
+    _fsck_check_object(item.first, item.second, seq, queue->deep,
+		       *queue->used_blocks, queue->used_blocks_lock, res);
+    l.lock();
+  }
+}
+
 int BlueStore::_fsck(bool deep, bool repair)
 {
   dout(1) << __func__
@@ -5851,12 +6330,47 @@ int BlueStore::_fsck(bool deep, bool repair)
   dout(1) << __func__ << " walking object keyspace" << dendl;
   it = db->get_iterator(PREFIX_OBJ);
   if (it) {
+    // This thread walks the keys in order and does the checks that depend
+    // on that order (nids, shard keys, omap heads).  Loading each object's
+    // extent map and blobs, and reading its data in deep mode, is farmed
+    // out to the fsck workers.
+    unsigned num_threads = std::max<uint64_t>(
+      1, cct->_conf->get_val<uint64_t>("bluestore_fsck_threads"));
+    fsck_queue_t queue;
+    queue.deep = deep;
+    queue.used_blocks = &used_blocks;
+    uint64_t next_seq = 0;
+    vector<fsck_result_t> results(num_threads);
+    vector<std::unique_ptr<FsckThread>> workers;
+    if (num_threads > 1) {
+      dout(1) << __func__ << " using " << num_threads << " threads" << dendl;
+      for (unsigned i = 0; i < num_threads; ++i) {
+	workers.emplace_back(new FsckThread(this, &queue, &results[i]));
+	workers.back()->create("bstore_fsck");
+      }
+    }
+    auto queue_object = [&](CollectionRef& c, const ghobject_t& oid) {
+      if (workers.empty()) {
+	_fsck_check_object(c, oid, next_seq++, deep,
+			   used_blocks, queue.used_blocks_lock, &results[0]);
+	return;
+      }
+      std::unique_lock<std::mutex> l(queue.lock);
+      while (queue.q.size() >= num_threads * 16) {
+	queue.cond.wait(l);
+      }
+      queue.q.emplace_back(c, oid);
+      queue.cond.notify_all();
+    };
+
+    bool aborted = false;
     CollectionRef c;
     spg_t pgid;
     mempool::bluestore_fsck::list<string> expecting_shards;
     for (it->lower_bound(string()); it->valid(); it->next()) {
       if (g_conf->bluestore_debug_fsck_abort) {
-	goto out_scan;
+	aborted = true;
+	break;
       }
       dout(30) << __func__ << " key "
                << pretty_binary_string(it->key()) << dendl;
@@ -5943,204 +6457,106 @@ int BlueStore::_fsck(bool deep, bool repair)
       }
 
       dout(10) << __func__ << "  " << oid << dendl;
-      RWLock::RLocker l(c->lock);
-      OnodeRef o = c->get_onode(oid, false);
-      if (o->onode.nid) {
-	if (o->onode.nid > nid_max) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
+      bluestore_onode_t onode;
+      {
+	bufferlist v = it->value();
+	bufferptr bp = v.length() ? bufferptr(v.c_str(), v.length()) :
+	  bufferptr();
+	bufferptr::iterator p = bp.begin_deep();
+	onode.decode(p);
+      }
+      if (onode.nid) {
+	if (onode.nid > nid_max) {
+	  derr << "fsck error: " << oid << " nid " << onode.nid
 	       << " > nid_max " << nid_max << dendl;
 	  ++errors;
 	}
-	if (used_nids.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
+	if (used_nids.count(onode.nid)) {
+	  derr << "fsck error: " << oid << " nid " << onode.nid
 	       << " already in use" << dendl;
 	  ++errors;
 	  continue; // go for next object
 	}
-	used_nids.insert(o->onode.nid);
+	used_nids.insert(onode.nid);
       }
       ++num_objects;
-      num_spanning_blobs += o->extent_map.spanning_blob_map.size();
-      o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
-      _dump_onode(o, 30);
       // shards
-      if (!o->extent_map.shards.empty()) {
+      if (!onode.extent_map_shards.empty()) {
 	++num_sharded_objects;
-	num_object_shards += o->extent_map.shards.size();
+	num_object_shards += onode.extent_map_shards.size();
       }
-      for (auto& s : o->extent_map.shards) {
-	dout(20) << __func__ << "    shard " << *s.shard_info << dendl;
+      for (auto& s : onode.extent_map_shards) {
+	dout(20) << __func__ << "    shard " << s << dendl;
 	expecting_shards.push_back(string());
-	get_extent_shard_key(o->key, s.shard_info->offset,
-			     &expecting_shards.back());
-	if (s.shard_info->offset >= o->onode.size) {
+	get_extent_shard_key(it->key(), s.offset, &expecting_shards.back());
+	if (s.offset >= onode.size) {
 	  derr << "fsck error: " << oid << " shard 0x" << std::hex
-	       << s.shard_info->offset << " past EOF at 0x" << o->onode.size
-	       << std::dec << dendl;
-	  ++errors;
-	}
-      }
-      // lextents
-      map<BlobRef,bluestore_blob_t::unused_t> referenced;
-      uint64_t pos = 0;
-      mempool::bluestore_fsck::map<BlobRef,
-				   bluestore_blob_use_tracker_t> ref_map;
-      for (auto& l : o->extent_map.extent_map) {
-	dout(20) << __func__ << "    " << l << dendl;
-	if (l.logical_offset < pos) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset
-	       << " overlaps with the previous, which ends at 0x" << pos
+	       << s.offset << " past EOF at 0x" << onode.size
 	       << std::dec << dendl;
 	  ++errors;
 	}
-	if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset << "~" << l.length
-	       << " spans a shard boundary"
-	       << std::dec << dendl;
-	  ++errors;
-	}
-	pos = l.logical_offset + l.length;
-	expected_statfs.stored += l.length;
-	assert(l.blob);
-	const bluestore_blob_t& blob = l.blob->get_blob();
-
-        auto& ref = ref_map[l.blob];
-        if (ref.is_empty()) {
-          uint32_t min_release_size = blob.get_release_size(min_alloc_size);
-          uint32_t l = blob.get_logical_length();
-          ref.init(l, min_release_size);
-        }
-	ref.get(
-	  l.blob_offset, 
-	  l.length);
-	++num_extents;
-	if (blob.has_unused()) {
-	  auto p = referenced.find(l.blob);
-	  bluestore_blob_t::unused_t *pu;
-	  if (p == referenced.end()) {
-	    pu = &referenced[l.blob];
-	  } else {
-	    pu = &p->second;
-	  }
-	  uint64_t blob_len = blob.get_logical_length();
-	  assert((blob_len % (sizeof(*pu)*8)) == 0);
-	  assert(l.blob_offset + l.length <= blob_len);
-	  uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
-	  uint64_t start = l.blob_offset / chunk_size;
-	  uint64_t end =
-	    round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
-	  for (auto i = start; i < end; ++i) {
-	    (*pu) |= (1u << i);
-	  }
-	}
-      }
-      for (auto &i : referenced) {
-	dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
-		 << std::dec << " for " << *i.first << dendl;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	if (i.second & blob.unused) {
-	  derr << "fsck error: " << oid << " blob claims unused 0x"
-	       << std::hex << blob.unused
-	       << " but extents reference 0x" << i.second
-	       << " on blob " << *i.first << dendl;
-	  ++errors;
-	}
-	if (blob.has_csum()) {
-	  uint64_t blob_len = blob.get_logical_length();
-	  uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
-	  unsigned csum_count = blob.get_csum_count();
-	  unsigned csum_chunk_size = blob.get_csum_chunk_size();
-	  for (unsigned p = 0; p < csum_count; ++p) {
-	    unsigned pos = p * csum_chunk_size;
-	    unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
-	    unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
-	    unsigned mask = 1u << firstbit;
-	    for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
-	      mask |= 1u << b;
-	    }
-	    if ((blob.unused & mask) == mask) {
-	      // this csum chunk region is marked unused
-	      if (blob.get_csum_item(p) != 0) {
-		derr << "fsck error: " << oid
-		     << " blob claims csum chunk 0x" << std::hex << pos
-		     << "~" << csum_chunk_size
-		     << " is unused (mask 0x" << mask << " of unused 0x"
-		     << blob.unused << ") but csum is non-zero 0x"
-		     << blob.get_csum_item(p) << std::dec << " on blob "
-		     << *i.first << dendl;
-		++errors;
-	      }
-	    }
-	  }
-	}
-      }
-      for (auto &i : ref_map) {
-	++num_blobs;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	bool equal = i.first->get_blob_use_tracker().equal(i.second);
-	if (!equal) {
-	  derr << "fsck error: " << oid << " blob " << *i.first
-	       << " doesn't match expected ref_map " << i.second << dendl;
-	  ++errors;
-	}
-	if (blob.is_compressed()) {
-	  expected_statfs.compressed += blob.get_compressed_payload_length();
-	  expected_statfs.compressed_original += 
-	    i.first->get_referenced_bytes();
-	}
-	if (blob.is_shared()) {
-	  if (i.first->shared_blob->get_sbid() > blobid_max) {
-	    derr << "fsck error: " << oid << " blob " << blob
-		 << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
-		 << blobid_max << dendl;
-	    ++errors;
-	  } else if (i.first->shared_blob->get_sbid() == 0) {
-            derr << "fsck error: " << oid << " blob " << blob
-                 << " marked as shared but has uninitialized sbid"
-                 << dendl;
-            ++errors;
-          }
-	  sb_info_t& sbi = sb_info[i.first->shared_blob->get_sbid()];
-	  sbi.sb = i.first->shared_blob;
-	  sbi.oids.push_back(oid);
-	  sbi.compressed = blob.is_compressed();
-	  for (auto e : blob.get_extents()) {
-	    if (e.is_valid()) {
-	      sbi.ref_map.get(e.offset, e.length);
-	    }
-	  }
-	} else {
-	  errors += _fsck_check_extents(oid, blob.get_extents(),
-					blob.is_compressed(),
-					used_blocks,
-					fm->get_alloc_size(),
-					expected_statfs);
-        }
-      }
-      if (deep) {
-	bufferlist bl;
-	int r = _do_read(c.get(), o, 0, o->onode.size, bl, 0);
-	if (r < 0) {
-	  ++errors;
-	  derr << "fsck error: " << oid << " error during read: "
-	       << cpp_strerror(r) << dendl;
-	}
       }
+      queue_object(c, oid);
       // omap
-      if (o->onode.has_omap()) {
+      if (onode.has_omap()) {
 	auto& m =
-	  o->onode.is_pgmeta_omap() ? used_pgmeta_omap_head : used_omap_head;
-	if (m.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " omap_head " << o->onode.nid
+	  onode.is_pgmeta_omap() ? used_pgmeta_omap_head : used_omap_head;
+	if (m.count(onode.nid)) {
+	  derr << "fsck error: " << oid << " omap_head " << onode.nid
 	       << " already in use" << dendl;
 	  ++errors;
 	} else {
-	  m.insert(o->onode.nid);
+	  m.insert(onode.nid);
 	}
       }
     }
+
+    if (!workers.empty()) {
+      {
+	std::lock_guard<std::mutex> l(queue.lock);
+	queue.done = true;
+	queue.cond.notify_all();
+      }
+      for (auto& t : workers) {
+	t->join();
+      }
+    }
+    if (aborted) {
+      goto out_scan;
+    }
+
+    // merge what the workers found; replay shared blob references in walk
+    // order so the expected ref_maps come out as a single thread builds them
+    vector<fsck_sb_ref_t*> sb_refs;
+    for (auto& res : results) {
+      errors += res.errors;
+      expected_statfs.allocated += res.expected_statfs.allocated;
+      expected_statfs.stored += res.expected_statfs.stored;
+      expected_statfs.compressed += res.expected_statfs.compressed;
+      expected_statfs.compressed_allocated +=
+	res.expected_statfs.compressed_allocated;
+      expected_statfs.compressed_original +=
+	res.expected_statfs.compressed_original;
+      num_extents += res.num_extents;
+      num_blobs += res.num_blobs;
+      num_spanning_blobs += res.num_spanning_blobs;
+      for (auto& ref : res.sb_refs) {
+	sb_refs.push_back(&ref);
+      }
+    }
+    std::stable_sort(sb_refs.begin(), sb_refs.end(),
+		     [](const fsck_sb_ref_t *a, const fsck_sb_ref_t *b) {
+		       return a->seq < b->seq;
+		     });
+    for (auto ref : sb_refs) {
+      sb_info_t& sbi = sb_info[ref->sbid];
+      sbi.sb = ref->sb;
+      sbi.oids.push_back(ref->oid);
+      sbi.compressed = ref->compressed;
+      for (auto& e : ref->extents) {
+	sbi.ref_map.get(e.offset, e.length);
+      }
+    }
   }
   dout(1) << __func__ << " checking shared_blobs" << dendl;
   it = db->get_iterator(PREFIX_SHARED_BLOB);
@@ -6364,6 +6780,95 @@ int BlueStore::_fsck(bool deep, bool repair)
   return errors - repaired;
 }
 
+void BlueStore::inject_leaked(uint64_t len)
+{
+  KeyValueDB::Transaction txn = db->get_transaction();
+
+  AllocExtentVector exts;
+  int64_t alloc_len = alloc->allocate(len, min_alloc_size,
+				      min_alloc_size * 256, 0, &exts);
+  assert(alloc_len >= (int64_t)len);
+  for (auto& p : exts) {
+    dout(20) << __func__ << " leak 0x" << std::hex << p.offset
+	     << "~" << p.length << std::dec << dendl;
+    fm->allocate(p.offset, p.length, txn);
+  }
+  db->submit_transaction_sync(txn);
+}
+
+void BlueStore::inject_false_free(coll_t cid, ghobject_t oid)
+{
+  CollectionRef c = _get_collection(cid);
+  assert(c);
+  OnodeRef o;
+  {
+    RWLock::WLocker l(c->lock);
+    o = c->get_onode(oid, false);
+    assert(o);
+    o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+  }
+
+  // release the first valid pextent of the object's first blob
+  KeyValueDB::Transaction txn = db->get_transaction();
+  bool injected = false;
+  auto& em = o->extent_map.extent_map;
+  assert(!em.empty());
+  for (auto& p : em.begin()->blob->get_blob().get_extents()) {
+    if (p.is_valid()) {
+      dout(20) << __func__ << " release 0x" << std::hex << p.offset
+	       << "~" << p.length << std::dec << dendl;
+      fm->release(p.offset, p.length, txn);
+      injected = true;
+      break;
+    }
+  }
+  assert(injected);
+  db->submit_transaction_sync(txn);
+}
+
+void BlueStore::inject_misreference(coll_t cid1, ghobject_t oid1,
+				    coll_t cid2, ghobject_t oid2,
+				    uint64_t offset)
+{
+  CollectionRef c1 = _get_collection(cid1);
+  assert(c1);
+  OnodeRef o1;
+  {
+    RWLock::WLocker l(c1->lock);
+    o1 = c1->get_onode(oid1, false);
+    assert(o1);
+    o1->extent_map.fault_range(db, offset, OBJECT_MAX_SIZE);
+  }
+  CollectionRef c2 = _get_collection(cid2);
+  assert(c2);
+  OnodeRef o2;
+  {
+    RWLock::WLocker l(c2->lock);
+    o2 = c2->get_onode(oid2, false);
+    assert(o2);
+    o2->extent_map.fault_range(db, offset, OBJECT_MAX_SIZE);
+  }
+  Extent& e1 = *o1->extent_map.seek_lextent(offset);
+  Extent& e2 = *o2->extent_map.seek_lextent(offset);
+
+  // only handle the simple case of two unsharded objects laid out alike
+  assert(o1->onode.extent_map_shards.empty());
+  assert(o2->onode.extent_map_shards.empty());
+  assert(o1->extent_map.spanning_blob_map.empty());
+  assert(o2->extent_map.spanning_blob_map.empty());
+  assert(e1.logical_offset == e2.logical_offset);
+  assert(e1.length == e2.length);
+  assert(e1.blob_offset == e2.blob_offset);
+
+  // o2 now shares o1's space and leaks its own
+  KeyValueDB::Transaction txn = db->get_transaction();
+  e2.blob->dirty_blob() = e1.blob->get_blob();
+  o2->extent_map.dirty_range(offset, e2.length);
+  o2->extent_map.update(txn, false);
+  _record_onode(o2, txn);
+  db->submit_transaction_sync(txn);
+}
+
 void BlueStore::collect_metadata(map<string,string> *pm)
 {
   dout(10) << __func__ << dendl;
@@ -6433,8 +6938,9 @@ BlueStore::CollectionRef BlueStore::_get_collection(const coll_t& cid)
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c << " " << c->cid << dendl;
-  // _reap_collections and this in the same thread,
-  // so no need a lock.
+  // with several kv finalize threads this may race with
+  // _reap_collections from another one.
+  std::lock_guard<std::mutex> l(reap_lock);
   removed_collections.push_back(c);
 }
 
@@ -6443,8 +6949,7 @@ void BlueStore::_reap_collections()
 
   list<CollectionRef> removed_colls;
   {
-    // _queue_reap_collection and this in the same thread.
-    // So no need a lock.
+    std::lock_guard<std::mutex> l(reap_lock);
     if (!removed_collections.empty())
       removed_colls.swap(removed_collections);
     else
@@ -6474,6 +6979,7 @@ void BlueStore::_reap_collections()
   if (removed_colls.empty()) {
     dout(10) << __func__ << " all reaped" << dendl;
   } else {
+    std::lock_guard<std::mutex> l(reap_lock);
     removed_collections.splice(removed_collections.begin(), removed_colls);
   }
 }
@@ -7844,6 +8350,23 @@ void BlueStore::get_db_statistics(Formatter *f)
   db->get_statistics(f);
 }
 
+void BlueStore::_sample_free_stats(Allocator::free_stats_t *stats)
+{
+  alloc->get_free_stats(min_alloc_size, stats);
+  logger->set(l_bluestore_fragmentation, stats->fragmentation * 1000);
+  logger->set(l_bluestore_free_extents, stats->extents);
+  logger->set(l_bluestore_free_max_extent, stats->max_extent);
+}
+
+void BlueStore::dump_fragmentation(Formatter *f)
+{
+  Allocator::free_stats_t stats;
+  _sample_free_stats(&stats);
+  f->open_object_section("fragmentation");
+  stats.dump(f);
+  f->close_section();
+}
+
 BlueStore::TransContext *BlueStore::_txc_create(
   Collection *c, OpSequencer *osr)
 {
@@ -7855,6 +8378,36 @@ BlueStore::TransContext *BlueStore::_txc_create(
   return txc;
 }
 
+void BlueStore::_txc_journal_deferred(TransContext *txc)
+{
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist bl;
+    encode(*txc->deferred_txn, bl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, bl);
+  }
+}
+
+void BlueStore::_txc_throttle(TransContext *txc)
+{
+  throttle_bytes.get(txc->cost);
+  if (txc->deferred_txn) {
+    // ensure we do not block here because of deferred writes
+    if (!throttle_deferred_bytes.get_or_fail(txc->cost)) {
+      dout(10) << __func__ << " failed get throttle_deferred_bytes, aggressive"
+	       << dendl;
+      ++deferred_aggressive;
+      deferred_try_submit();
+      // wake up any previously finished deferred events
+      _kv_wake_deferred();
+      throttle_deferred_bytes.get(txc->cost);
+      --deferred_aggressive;
+   }
+  }
+}
+
 void BlueStore::_txc_calc_cost(TransContext *txc)
 {
   // one "io" for the kv commit
@@ -7946,16 +8499,17 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	}
       }
       {
-	std::lock_guard<std::mutex> l(kv_lock);
-	kv_queue.push_back(txc);
-	kv_cond.notify_one();
+	KVShard *ks = kv_shards[txc->osr->kv_shard];
+	std::lock_guard<std::mutex> l(ks->kv_lock);
+	ks->kv_queue.push_back(txc);
+	ks->kv_cond.notify_one();
 	if (txc->state != TransContext::STATE_KV_SUBMITTED) {
-	  kv_queue_unsubmitted.push_back(txc);
+	  ks->kv_queue_unsubmitted.push_back(txc);
 	  ++txc->osr->kv_committing_serially;
 	}
 	if (txc->had_ios)
-	  kv_ios++;
-	kv_throttle_costs += txc->cost;
+	  ks->kv_ios++;
+	ks->kv_throttle_costs += txc->cost;
       }
       return;
     case TransContext::STATE_KV_SUBMITTED:
@@ -8030,6 +8584,39 @@ void BlueStore::_txc_finish_io(TransContext *txc)
   }
 }
 
+void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
+{
+  // bound encode
+  size_t bound = 0;
+  denc(o->onode, bound);
+  o->extent_map.bound_encode_spanning_blobs(bound);
+  if (o->onode.extent_map_shards.empty()) {
+    denc(o->extent_map.inline_bl, bound);
+  }
+
+  // encode
+  bufferlist bl;
+  unsigned onode_part, blob_part, extent_part;
+  {
+    auto p = bl.get_contiguous_appender(bound, true);
+    denc(o->onode, p);
+    onode_part = p.get_logical_offset();
+    o->extent_map.encode_spanning_blobs(p);
+    blob_part = p.get_logical_offset() - onode_part;
+    if (o->onode.extent_map_shards.empty()) {
+      denc(o->extent_map.inline_bl, p);
+    }
+    extent_part = p.get_logical_offset() - onode_part - blob_part;
+  }
+
+  dout(20) << __func__  << " onode " << o->oid << " is " << bl.length()
+	   << " (" << onode_part << " bytes onode + "
+	   << blob_part << " bytes spanning blobs + "
+	   << extent_part << " bytes inline extents)"
+	   << dendl;
+  txn->set(PREFIX_OBJ, o->key.c_str(), o->key.size(), bl);
+}
+
 void BlueStore::_txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t)
 {
   dout(20) << __func__ << " txc " << txc
@@ -8052,35 +8639,7 @@ void BlueStore::_txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t)
       logger->inc(l_bluestore_onode_reshard);
     }
 
-    // bound encode
-    size_t bound = 0;
-    denc(o->onode, bound);
-    o->extent_map.bound_encode_spanning_blobs(bound);
-    if (o->onode.extent_map_shards.empty()) {
-      denc(o->extent_map.inline_bl, bound);
-    }
-
-    // encode
-    bufferlist bl;
-    unsigned onode_part, blob_part, extent_part;
-    {
-      auto p = bl.get_contiguous_appender(bound, true);
-      denc(o->onode, p);
-      onode_part = p.get_logical_offset();
-      o->extent_map.encode_spanning_blobs(p);
-      blob_part = p.get_logical_offset() - onode_part;
-      if (o->onode.extent_map_shards.empty()) {
-	denc(o->extent_map.inline_bl, p);
-      }
-      extent_part = p.get_logical_offset() - onode_part - blob_part;
-    }
-
-    dout(20) << __func__  << " onode " << o->oid << " is " << bl.length()
-	     << " (" << onode_part << " bytes onode + "
-	     << blob_part << " bytes spanning blobs + "
-	     << extent_part << " bytes inline extents)"
-	     << dendl;
-    t->set(PREFIX_OBJ, o->key.c_str(), o->key.size(), bl);
+    _record_onode(o, t);
     o->flushing_count++;
   }
 
@@ -8311,11 +8870,8 @@ void BlueStore::_osr_drain_preceding(TransContext *txc)
       deferred_lock.unlock();
     }
   }
-  {
-    // wake up any previously finished deferred events
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
-  }
+  // wake up any previously finished deferred events
+  _kv_wake_deferred();
   osr->drain_preceding(txc);
   --deferred_aggressive;
   dout(10) << __func__ << " " << osr << " done" << dendl;
@@ -8347,14 +8903,11 @@ void BlueStore::_osr_drain_all()
     // submit anything pending
     deferred_try_submit();
   }
-  {
-    // wake up any previously finished deferred events
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
-  }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_cond.notify_one();
+  // wake up any previously finished deferred events
+  _kv_wake_deferred();
+  for (auto ks : kv_shards) {
+    std::lock_guard<std::mutex> l(ks->kv_finalize_lock);
+    ks->kv_finalize_cond.notify_one();
   }
   for (auto osr : s) {
     dout(20) << __func__ << " drain " << osr << dendl;
@@ -8410,40 +8963,56 @@ void BlueStore::_kv_start()
   for (auto f : finishers) {
     f->start();
   }
-  kv_sync_thread.create("bstore_kv_sync");
-  kv_finalize_thread.create("bstore_kv_final");
+  assert(kv_shards.empty());
+  for (unsigned i = 0; i < kv_shard_num; ++i) {
+    kv_shards.push_back(new KVShard(this, i));
+  }
+  for (auto ks : kv_shards) {
+    if (ks->id == 0) {
+      ks->kv_sync_thread.create("bstore_kv_sync");
+      ks->kv_finalize_thread.create("bstore_kv_final");
+    } else {
+      char name[16];
+      snprintf(name, sizeof(name), "bstore_kvsync%u", ks->id);
+      ks->kv_sync_thread.create(name);
+      snprintf(name, sizeof(name), "bstore_kvfin%u", ks->id);
+      ks->kv_finalize_thread.create(name);
+    }
+  }
 }
 
 void BlueStore::_kv_stop()
 {
   dout(10) << __func__ << dendl;
-  {
-    std::unique_lock<std::mutex> l(kv_lock);
-    while (!kv_sync_started) {
-      kv_cond.wait(l);
+  // stop the sync threads first: shard 0 may still hand deferred
+  // cleanup to any of the finalize threads.
+  for (auto ks : kv_shards) {
+    std::unique_lock<std::mutex> l(ks->kv_lock);
+    while (!ks->kv_sync_started) {
+      ks->kv_cond.wait(l);
     }
-    kv_stop = true;
-    kv_cond.notify_all();
+    ks->kv_stop = true;
+    ks->kv_cond.notify_all();
   }
-  {
-    std::unique_lock<std::mutex> l(kv_finalize_lock);
-    while (!kv_finalize_started) {
-      kv_finalize_cond.wait(l);
+  for (auto ks : kv_shards) {
+    ks->kv_sync_thread.join();
+  }
+  for (auto ks : kv_shards) {
+    std::unique_lock<std::mutex> l(ks->kv_finalize_lock);
+    while (!ks->kv_finalize_started) {
+      ks->kv_finalize_cond.wait(l);
     }
-    kv_finalize_stop = true;
-    kv_finalize_cond.notify_all();
+    ks->kv_finalize_stop = true;
+    ks->kv_finalize_cond.notify_all();
   }
-  kv_sync_thread.join();
-  kv_finalize_thread.join();
-  assert(removed_collections.empty());
-  {
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_stop = false;
+  for (auto ks : kv_shards) {
+    ks->kv_finalize_thread.join();
   }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_stop = false;
+  assert(removed_collections.empty());
+  for (auto ks : kv_shards) {
+    delete ks;
   }
+  kv_shards.clear();
   dout(10) << __func__ << " stopping finishers" << dendl;
   deferred_finisher.wait_for_empty();
   deferred_finisher.stop();
@@ -8454,41 +9023,60 @@ void BlueStore::_kv_stop()
   dout(10) << __func__ << " stopped" << dendl;
 }
 
-void BlueStore::_kv_sync_thread()
+void BlueStore::_kv_wake_deferred()
 {
-  dout(10) << __func__ << " start" << dendl;
-  std::unique_lock<std::mutex> l(kv_lock);
-  assert(!kv_sync_started);
-  kv_sync_started = true;
-  kv_cond.notify_all();
+  // deferred io cleanup is driven by the first kv shard
+  if (kv_shards.empty())
+    return;
+  std::lock_guard<std::mutex> l(kv_shards[0]->kv_lock);
+  kv_shards[0]->kv_cond.notify_one();
+}
+
+void BlueStore::_kv_sync_thread(KVShard *ks)
+{
+  dout(10) << __func__ << " " << ks->id << " start" << dendl;
+  // only the first shard deals with deferred ios and bluefs
+  const bool primary = ks->id == 0;
+  std::unique_lock<std::mutex> l(ks->kv_lock);
+  assert(!ks->kv_sync_started);
+  ks->kv_sync_started = true;
+  ks->kv_cond.notify_all();
+  deque<TransContext*>& kv_committing = ks->kv_committing;
   while (true) {
     assert(kv_committing.empty());
-    if (kv_queue.empty() &&
-	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
-	 !deferred_aggressive)) {
-      if (kv_stop)
+    // with a single shard, finished deferred ios normally wait for the
+    // next commit.  with several, the sequencers that issued them may
+    // all sync on other shards, so the first one cleans them up as soon
+    // as they are queued.
+    if (ks->kv_queue.empty() &&
+	(!primary ||
+	 (deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
+	 (!deferred_aggressive && kv_shard_num == 1))) {
+      if (ks->kv_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
-      kv_cond.wait(l);
+      ks->kv_cond.wait(l);
       dout(20) << __func__ << " wake" << dendl;
     } else {
       deque<TransContext*> kv_submitting;
       deque<DeferredBatch*> deferred_done, deferred_stable;
       uint64_t aios = 0, costs = 0;
 
-      dout(20) << __func__ << " committing " << kv_queue.size()
-	       << " submitting " << kv_queue_unsubmitted.size()
-	       << " deferred done " << deferred_done_queue.size()
-	       << " stable " << deferred_stable_queue.size()
+      kv_committing.swap(ks->kv_queue);
+      kv_submitting.swap(ks->kv_queue_unsubmitted);
+      if (primary) {
+	deferred_done.swap(deferred_done_queue);
+	deferred_stable.swap(deferred_stable_queue);
+      }
+      dout(20) << __func__ << " committing " << kv_committing.size()
+	       << " submitting " << kv_submitting.size()
+	       << " deferred done " << deferred_done.size()
+	       << " stable " << deferred_stable.size()
 	       << dendl;
-      kv_committing.swap(kv_queue);
-      kv_submitting.swap(kv_queue_unsubmitted);
-      deferred_done.swap(deferred_done_queue);
-      deferred_stable.swap(deferred_stable_queue);
-      aios = kv_ios;
-      costs = kv_throttle_costs;
-      kv_ios = 0;
-      kv_throttle_costs = 0;
+      aios = ks->kv_ios;
+      costs = ks->kv_throttle_costs;
+      ks->kv_ios = 0;
+      ks->kv_throttle_costs = 0;
       utime_t start = ceph_clock_now();
       l.unlock();
 
@@ -8508,7 +9096,7 @@ void BlueStore::_kv_sync_thread()
 	} else if (kv_committing.empty() && kv_submitting.empty() &&
 		   deferred_stable.empty()) {
 	  force_flush = true;  // there's nothing else to commit!
-	} else if (deferred_aggressive) {
+	} else if (primary && deferred_aggressive) {
 	  force_flush = true;
 	}
       } else {
@@ -8538,26 +9126,40 @@ void BlueStore::_kv_sync_thread()
 
       // increase {nid,blobid}_max?  note that this covers both the
       // case where we are approaching the max and the case we passed
-      // it.  in either case, we increase the max in the earlier txn
-      // we submit.
+      // it.  any txc we are about to submit got its ids before this
+      // point, so as long as the new max reaches the kv store ahead of
+      // them, it is stable whenever they are.  with several shards
+      // syncing in parallel the update has to go in on its own, and
+      // under kv_max_lock, so that the stored max never goes backwards.
       uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
-	bufferlist bl;
-	encode(new_nid_max, bl);
-	t->set(PREFIX_SUPER, "nid_max", bl);
-	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
-      }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
-	bufferlist bl;
-	encode(new_blobid_max, bl);
-	t->set(PREFIX_SUPER, "blobid_max", bl);
-	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
+      {
+	std::lock_guard<std::mutex> ml(kv_max_lock);
+	KeyValueDB::Transaction t;
+	if (nid_last + cct->_conf->bluestore_nid_prealloc/2 >
+	    std::max<uint64_t>(nid_max, nid_max_submitted)) {
+	  t = db->get_transaction();
+	  new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
+	  bufferlist bl;
+	  encode(new_nid_max, bl);
+	  t->set(PREFIX_SUPER, "nid_max", bl);
+	  nid_max_submitted = new_nid_max;
+	  dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
+	}
+	if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 >
+	    std::max<uint64_t>(blobid_max, blobid_max_submitted)) {
+	  if (!t)
+	    t = db->get_transaction();
+	  new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
+	  bufferlist bl;
+	  encode(new_blobid_max, bl);
+	  t->set(PREFIX_SUPER, "blobid_max", bl);
+	  blobid_max_submitted = new_blobid_max;
+	  dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
+	}
+	if (t && !cct->_conf->bluestore_debug_omit_kv_commit) {
+	  int r = db->submit_transaction(t);
+	  assert(r == 0);
+	}
       }
 
       for (auto txc : kv_committing) {
@@ -8593,7 +9195,8 @@ void BlueStore::_kv_sync_thread()
       throttle_bytes.put(costs);
 
       PExtentVector bluefs_gift_extents;
-      if (bluefs &&
+      if (primary &&
+	  bluefs &&
 	  after_flush - bluefs_last_balance >
 	  cct->_conf->bluestore_bluefs_balance_interval) {
 	bluefs_last_balance = after_flush;
@@ -8627,35 +9230,36 @@ void BlueStore::_kv_sync_thread()
       assert(r == 0);
 
       {
-	std::unique_lock<std::mutex> m(kv_finalize_lock);
-	if (kv_committing_to_finalize.empty()) {
-	  kv_committing_to_finalize.swap(kv_committing);
+	std::unique_lock<std::mutex> m(ks->kv_finalize_lock);
+	if (ks->kv_committing_to_finalize.empty()) {
+	  ks->kv_committing_to_finalize.swap(kv_committing);
 	} else {
-	  kv_committing_to_finalize.insert(
-	      kv_committing_to_finalize.end(),
+	  ks->kv_committing_to_finalize.insert(
+	      ks->kv_committing_to_finalize.end(),
 	      kv_committing.begin(),
 	      kv_committing.end());
 	  kv_committing.clear();
 	}
-	if (deferred_stable_to_finalize.empty()) {
-	  deferred_stable_to_finalize.swap(deferred_stable);
-	} else {
-	  deferred_stable_to_finalize.insert(
-	      deferred_stable_to_finalize.end(),
-	      deferred_stable.begin(),
-	      deferred_stable.end());
-	  deferred_stable.clear();
-	}
-	kv_finalize_cond.notify_one();
+	ks->kv_finalize_cond.notify_one();
       }
-
-      if (new_nid_max) {
-	nid_max = new_nid_max;
-	dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+      // deferred txcs are finalized by the shard their sequencer uses
+      for (auto b : deferred_stable) {
+	KVShard *fs = kv_shards[b->osr->kv_shard];
+	std::lock_guard<std::mutex> m(fs->kv_finalize_lock);
+	fs->deferred_stable_to_finalize.push_back(b);
+	fs->kv_finalize_cond.notify_one();
       }
-      if (new_blobid_max) {
-	blobid_max = new_blobid_max;
-	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+
+      if (new_nid_max || new_blobid_max) {
+	std::lock_guard<std::mutex> ml(kv_max_lock);
+	if (new_nid_max > nid_max) {
+	  nid_max = new_nid_max;
+	  dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+	}
+	if (new_blobid_max > blobid_max) {
+	  blobid_max = new_blobid_max;
+	  dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+	}
       }
 
       {
@@ -8672,8 +9276,9 @@ void BlueStore::_kv_sync_thread()
 	logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
 	logger->tinc(l_bluestore_kv_lat, dur);
       }
+      deferred_stable.clear();
 
-      if (bluefs) {
+      if (primary && bluefs) {
 	if (!bluefs_gift_extents.empty()) {
 	  _commit_bluefs_freespace(bluefs_gift_extents);
 	}
@@ -8688,35 +9293,37 @@ void BlueStore::_kv_sync_thread()
       l.lock();
       // previously deferred "done" are now "stable" by virtue of this
       // commit cycle.
-      deferred_stable_queue.swap(deferred_done);
+      if (primary) {
+	deferred_stable_queue.swap(deferred_done);
+      }
     }
   }
-  dout(10) << __func__ << " finish" << dendl;
-  kv_sync_started = false;
+  dout(10) << __func__ << " " << ks->id << " finish" << dendl;
+  ks->kv_sync_started = false;
 }
 
-void BlueStore::_kv_finalize_thread()
+void BlueStore::_kv_finalize_thread(KVShard *ks)
 {
   deque<TransContext*> kv_committed;
   deque<DeferredBatch*> deferred_stable;
-  dout(10) << __func__ << " start" << dendl;
-  std::unique_lock<std::mutex> l(kv_finalize_lock);
-  assert(!kv_finalize_started);
-  kv_finalize_started = true;
-  kv_finalize_cond.notify_all();
+  dout(10) << __func__ << " " << ks->id << " start" << dendl;
+  std::unique_lock<std::mutex> l(ks->kv_finalize_lock);
+  assert(!ks->kv_finalize_started);
+  ks->kv_finalize_started = true;
+  ks->kv_finalize_cond.notify_all();
   while (true) {
     assert(kv_committed.empty());
     assert(deferred_stable.empty());
-    if (kv_committing_to_finalize.empty() &&
-	deferred_stable_to_finalize.empty()) {
-      if (kv_finalize_stop)
+    if (ks->kv_committing_to_finalize.empty() &&
+	ks->deferred_stable_to_finalize.empty()) {
+      if (ks->kv_finalize_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
-      kv_finalize_cond.wait(l);
+      ks->kv_finalize_cond.wait(l);
       dout(20) << __func__ << " wake" << dendl;
     } else {
-      kv_committed.swap(kv_committing_to_finalize);
-      deferred_stable.swap(deferred_stable_to_finalize);
+      kv_committed.swap(ks->kv_committing_to_finalize);
+      deferred_stable.swap(ks->deferred_stable_to_finalize);
       l.unlock();
       dout(20) << __func__ << " kv_committed " << kv_committed << dendl;
       dout(20) << __func__ << " deferred_stable " << deferred_stable << dendl;
@@ -8740,10 +9347,7 @@ void BlueStore::_kv_finalize_thread()
       deferred_stable.clear();
 
       if (!deferred_aggressive) {
-	if (deferred_queue_size >= deferred_batch_ops.load() ||
-	    throttle_deferred_bytes.past_midpoint()) {
-	  deferred_try_submit();
-	}
+	deferred_try_submit(false);
       }
 
       // this is as good a place as any ...
@@ -8752,8 +9356,210 @@ void BlueStore::_kv_finalize_thread()
       l.lock();
     }
   }
+  dout(10) << __func__ << " " << ks->id << " finish" << dendl;
+  ks->kv_finalize_started = false;
+}
+
+void BlueStore::_defrag_start()
+{
+  dout(10) << __func__ << dendl;
+  defrag_stop = false;
+  defrag_thread.create("bstore_defrag");
+}
+
+void BlueStore::_defrag_stop()
+{
+  dout(10) << __func__ << dendl;
+  {
+    std::lock_guard<std::mutex> l(defrag_lock);
+    defrag_stop = true;
+    defrag_cond.notify_all();
+  }
+  defrag_thread.join();
+}
+
+void BlueStore::_defrag_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  {
+    Allocator::free_stats_t stats;
+    _sample_free_stats(&stats);
+  }
+  std::unique_lock<std::mutex> l(defrag_lock);
+  uint64_t last_txc = logger->get(l_bluestore_txc);
+  uint64_t last_defrag_txc = defrag_txc;
+  while (!defrag_stop) {
+    // walking the free extents is not free with a large store, so while
+    // we are only keeping the counters up to date we do it less often
+    double interval = cct->_conf->get_val<double>(
+      cct->_conf->get_val<bool>("bluestore_defrag") ?
+      "bluestore_defrag_interval" : "bluestore_free_stats_interval");
+    defrag_cond.wait_for(l, ceph::make_timespan(interval));
+    if (defrag_stop) {
+      break;
+    }
+    l.unlock();
+
+    // our own rewrites do not make the store busy
+    uint64_t txc = logger->get(l_bluestore_txc);
+    uint64_t client_txc = (txc - last_txc) - (defrag_txc - last_defrag_txc);
+    last_txc = txc;
+    last_defrag_txc = defrag_txc;
+
+    Allocator::free_stats_t stats;
+    _sample_free_stats(&stats);
+    if (!cct->_conf->get_val<bool>("bluestore_defrag")) {
+      l.lock();
+      continue;
+    }
+
+    dout(20) << __func__ << " fragmentation " << stats.fragmentation
+	     << " free extents " << stats.extents
+	     << " client txcs " << client_txc << dendl;
+    if (stats.fragmentation >=
+	  cct->_conf->get_val<double>("bluestore_defrag_threshold") &&
+	client_txc <= cct->_conf->get_val<uint64_t>("bluestore_defrag_idle_txc")) {
+      uint64_t max_bytes =
+	cct->_conf->get_val<uint64_t>("bluestore_defrag_max_bytes");
+      // leave plenty of room: rewritten data needs new space before the
+      // old space is released
+      if (stats.free > max_bytes * 4) {
+	_defrag_pass(max_bytes);
+      }
+    }
+    l.lock();
+  }
   dout(10) << __func__ << " finish" << dendl;
-  kv_finalize_started = false;
+}
+
+void BlueStore::_defrag_pass(uint64_t max_bytes)
+{
+  vector<CollectionRef> colls;
+  {
+    RWLock::RLocker l(coll_lock);
+    for (auto& p : coll_map) {
+      colls.push_back(p.second);
+    }
+  }
+  std::sort(colls.begin(), colls.end(),
+	    [](const CollectionRef& a, const CollectionRef& b) {
+	      return a->cid < b->cid;
+	    });
+
+  // resume where the previous pass ran out of budget
+  auto c = std::lower_bound(colls.begin(), colls.end(), defrag_cid,
+			    [](const CollectionRef& a, const coll_t& cid) {
+			      return a->cid < cid;
+			    });
+  if (c == colls.end() || (*c)->cid != defrag_cid) {
+    defrag_next = ghobject_t();
+  }
+  dout(10) << __func__ << " max_bytes 0x" << std::hex << max_bytes << std::dec
+	   << " from " << defrag_cid << " " << defrag_next << dendl;
+
+  uint64_t done = 0;
+  for (; c != colls.end(); ++c) {
+    ghobject_t pos = defrag_next;
+    defrag_cid = (*c)->cid;
+    while (true) {
+      vector<ghobject_t> ls;
+      ghobject_t next;
+      {
+	RWLock::RLocker l((*c)->lock);
+	if (!(*c)->exists) {
+	  break;
+	}
+	int r = _collection_list(c->get(), pos, ghobject_t::get_max(), 64,
+				 &ls, &next);
+	if (r < 0) {
+	  break;
+	}
+      }
+      for (auto& oid : ls) {
+	if (done >= max_bytes || defrag_stop) {
+	  defrag_next = oid;
+	  dout(10) << __func__ << " rewrote 0x" << std::hex << done << std::dec
+		   << ", stopping at " << defrag_cid << " " << oid << dendl;
+	  return;
+	}
+	done += _defrag_object(*c, oid, max_bytes - done);
+      }
+      if (next.is_max()) {
+	break;
+      }
+      pos = next;
+    }
+    defrag_next = ghobject_t();
+  }
+  // wrapped around; start over next time
+  defrag_cid = coll_t();
+  dout(10) << __func__ << " rewrote 0x" << std::hex << done << std::dec
+	   << ", all collections scanned" << dendl;
+}
+
+uint64_t BlueStore::_defrag_object(CollectionRef& c, const ghobject_t& oid,
+				   uint64_t max_bytes)
+{
+  GarbageCollector gc(cct);
+  OpSequencer *osr = c->osr.get();
+  TransContext *txc = nullptr;
+  uint64_t bytes = 0;
+  {
+    RWLock::WLocker l(c->lock);
+    if (!c->exists) {
+      return 0;
+    }
+    OnodeRef o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return 0;
+    }
+    o->extent_map.fault_range(db, 0, o->onode.size);
+    bytes = gc.estimate_fragmented(
+      o->extent_map,
+      cct->_conf->get_val<uint64_t>("bluestore_defrag_min_pextents"),
+      max_bytes,
+      min_alloc_size);
+    if (bytes == 0) {
+      return 0;
+    }
+
+    // Our changes must be applied in the same order as the sequencer will
+    // commit them.  Holding c->lock, nobody can start preparing after us,
+    // but a txc queued ahead of us might still be mid-prepare; if so, back
+    // off and submit an empty txc.
+    txc = _txc_create(c.get(), osr);
+    if (osr->is_only_preparing(txc)) {
+      dout(10) << __func__ << " " << c->cid << " " << oid << " rewriting 0x"
+	       << std::hex << bytes << std::dec << dendl;
+      WriteContext wctx;
+      _choose_write_options(c, o, 0, &wctx);
+      uint64_t dirty_start = o->onode.size;
+      uint64_t dirty_end = 0;
+      int r = _do_gc(txc, c, o, gc, wctx, &dirty_start, &dirty_end);
+      if (r < 0) {
+	derr << __func__ << " " << c->cid << " " << oid
+	     << " rewrite failed with " << cpp_strerror(r) << dendl;
+	assert(0 == "unexpected error during defrag");
+      }
+      o->extent_map.compress_extent_map(dirty_start, dirty_end - dirty_start);
+      o->extent_map.dirty_range(dirty_start, dirty_end - dirty_start);
+      txc->write_onode(o);
+      txc->bytes += bytes;
+      logger->inc(l_bluestore_defrag_blobs, gc.get_extents_to_collect().size());
+      logger->inc(l_bluestore_defrag_bytes, bytes);
+    } else {
+      bytes = 0;
+    }
+    _txc_write_nodes(txc, txc->t);
+  }
+  _txc_calc_cost(txc);
+  _txc_journal_deferred(txc);
+  _txc_finalize_kv(txc, txc->t);
+  _txc_throttle(txc);
+  ++defrag_txc;
+  logger->inc(l_bluestore_txc);
+  _txc_state_proc(txc);
+  return bytes;
 }
 
 bluestore_deferred_op_t *BlueStore::_get_deferred_op(
@@ -8775,7 +9581,7 @@ void BlueStore::_deferred_queue(TransContext *txc)
     deferred_queue.push_back(*txc->osr);
   }
   if (!txc->osr->deferred_pending) {
-    txc->osr->deferred_pending = new DeferredBatch(cct, txc->osr.get());
+    txc->osr->deferred_pending = new DeferredBatch(txc->osr.get());
   }
   ++deferred_queue_size;
   txc->osr->deferred_pending->txcs.push_back(*txc);
@@ -8787,6 +9593,8 @@ void BlueStore::_deferred_queue(TransContext *txc)
     for (auto e : op.extents) {
       txc->osr->deferred_pending->prepare_write(
 	cct, wt.seq, e.offset, e.length, p);
+      txc->osr->deferred_pending->bytes += e.length;
+      deferred_queue_bytes += e.length;
     }
   }
   if (deferred_aggressive &&
@@ -8797,56 +9605,132 @@ void BlueStore::_deferred_queue(TransContext *txc)
   }
 }
 
-void BlueStore::deferred_try_submit()
+/*
+ * Flush policy for the deferred queue: submit once enough txcs or
+ * bytes have piled up, the oldest pending batch is too old, or the
+ * deferred throttle is half full; but (unless the throttle is filling
+ * up) hold back while too many deferred ios are still in flight, so
+ * that what we queue meanwhile gets merged into the next submission.
+ */
+bool BlueStore::_deferred_want_submit()
 {
+  if (throttle_deferred_bytes.past_midpoint()) {
+    return true;
+  }
+  uint64_t max_inflight =
+    cct->_conf->get_val<uint64_t>("bluestore_deferred_max_inflight_ios");
+  if (max_inflight && deferred_inflight_ios >= max_inflight) {
+    return false;
+  }
+  std::lock_guard<std::mutex> l(deferred_lock);
+  if (deferred_queue_size == 0) {
+    return false;
+  }
+  if (deferred_queue_size >= deferred_batch_ops.load()) {
+    return true;
+  }
+  if (deferred_batch_bytes && deferred_queue_bytes >= deferred_batch_bytes) {
+    return true;
+  }
+  double max_age = cct->_conf->get_val<double>("bluestore_deferred_max_age");
+  if (max_age > 0) {
+    auto cutoff = ceph::mono_clock::now() -
+      ceph::make_timespan(max_age);
+    for (auto& osr : deferred_queue) {
+      if (osr.deferred_pending && osr.deferred_pending->start < cutoff) {
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+void BlueStore::deferred_try_submit(bool force)
+{
+  if (!force && !_deferred_want_submit()) {
+    return;
+  }
   dout(20) << __func__ << " " << deferred_queue.size() << " osrs, "
 	   << deferred_queue_size << " txcs" << dendl;
-  std::lock_guard<std::mutex> l(deferred_lock);
-  vector<OpSequencerRef> osrs;
+  deferred_lock.lock();
+  vector<OpSequencer*> osrs;
   osrs.reserve(deferred_queue.size());
   for (auto& osr : deferred_queue) {
-    osrs.push_back(&osr);
-  }
-  for (auto& osr : osrs) {
-    if (osr->deferred_pending) {
-      if (!osr->deferred_running) {
-	_deferred_submit_unlock(osr.get());
-	deferred_lock.lock();
+    if (osr.deferred_pending) {
+      if (!osr.deferred_running) {
+	osrs.push_back(&osr);
       } else {
-	dout(20) << __func__ << "  osr " << osr << " already has running"
+	dout(20) << __func__ << "  osr " << &osr << " already has running"
 		 << dendl;
       }
     } else {
-      dout(20) << __func__ << "  osr " << osr << " has no pending" << dendl;
+      dout(20) << __func__ << "  osr " << &osr << " has no pending" << dendl;
     }
   }
+  if (osrs.empty()) {
+    deferred_lock.unlock();
+    return;
+  }
+  _deferred_submit_unlock(osrs);
 }
 
 void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
 {
-  dout(10) << __func__ << " osr " << osr
-	   << " " << osr->deferred_pending->iomap.size() << " ios pending "
-	   << dendl;
-  assert(osr->deferred_pending);
-  assert(!osr->deferred_running);
+  _deferred_submit_unlock(vector<OpSequencer*>{osr});
+}
+
+void BlueStore::_deferred_submit_unlock(const vector<OpSequencer*>& osrs)
+{
+  DeferredGroup *g = new DeferredGroup(cct);
+  g->batches.reserve(osrs.size());
+  size_t num_ios = 0;
+  for (auto osr : osrs) {
+    dout(10) << __func__ << " osr " << osr
+	     << " " << osr->deferred_pending->iomap.size() << " ios pending "
+	     << dendl;
+    assert(osr->deferred_pending);
+    assert(!osr->deferred_running);
 
-  auto b = osr->deferred_pending;
-  deferred_queue_size -= b->seq_bytes.size();
-  assert(deferred_queue_size >= 0);
+    auto b = osr->deferred_pending;
+    deferred_queue_size -= b->seq_bytes.size();
+    assert(deferred_queue_size >= 0);
+    assert(deferred_queue_bytes >= b->bytes);
+    deferred_queue_bytes -= b->bytes;
 
-  osr->deferred_running = osr->deferred_pending;
-  osr->deferred_pending = nullptr;
+    osr->deferred_running = osr->deferred_pending;
+    osr->deferred_pending = nullptr;
+    g->batches.push_back(b);
+    num_ios += b->iomap.size();
+  }
 
   deferred_lock.unlock();
 
-  for (auto& txc : b->txcs) {
-    txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+  // sort the ios of all batches by offset so the device sees one
+  // ascending sweep, and coalesce anything that ends up contiguous.
+  // batches from different sequencers never overlap (an extent is not
+  // released, and cannot be reused, until its deferred io completes).
+  vector<pair<uint64_t,bufferlist*>> ios;
+  ios.reserve(num_ios);
+  for (auto b : g->batches) {
+    for (auto& txc : b->txcs) {
+      txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+    }
+    for (auto& i : b->iomap) {
+      ios.emplace_back(i.first, &i.second.bl);
+    }
+  }
+  if (g->batches.size() > 1) {
+    std::sort(ios.begin(), ios.end(),
+	      [](const pair<uint64_t,bufferlist*>& a,
+		 const pair<uint64_t,bufferlist*>& b) {
+		return a.first < b.first;
+	      });
   }
   uint64_t start = 0, pos = 0;
   bufferlist bl;
-  auto i = b->iomap.begin();
+  auto i = ios.begin();
   while (true) {
-    if (i == b->iomap.end() || i->first != pos) {
+    if (i == ios.end() || i->first != pos) {
       if (bl.length()) {
 	dout(20) << __func__ << " write 0x" << std::hex
 		 << start << "~" << bl.length()
@@ -8854,29 +9738,32 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
 	if (!g_conf->bluestore_debug_omit_block_device_write) {
 	  logger->inc(l_bluestore_deferred_write_ops);
 	  logger->inc(l_bluestore_deferred_write_bytes, bl.length());
-	  int r = bdev->aio_write(start, bl, &b->ioc, false);
+	  int r = bdev->aio_write(start, bl, &g->ioc, false);
 	  assert(r == 0);
+	  ++g->num_ios;
 	}
       }
-      if (i == b->iomap.end()) {
+      if (i == ios.end()) {
 	break;
       }
       start = 0;
       pos = i->first;
       bl.clear();
     }
-    dout(20) << __func__ << "   seq " << i->second.seq << " 0x"
-	     << std::hex << pos << "~" << i->second.bl.length() << std::dec
+    dout(20) << __func__ << "   0x"
+	     << std::hex << pos << "~" << i->second->length() << std::dec
 	     << dendl;
     if (!bl.length()) {
       start = pos;
     }
-    pos += i->second.bl.length();
-    bl.claim_append(i->second.bl);
+    pos += i->second->length();
+    bl.claim_append(*i->second);
     ++i;
   }
 
-  bdev->aio_submit(&b->ioc);
+  logger->inc(l_bluestore_deferred_write_batches, g->batches.size());
+  deferred_inflight_ios += g->num_ios;
+  bdev->aio_submit(&g->ioc);
 }
 
 struct C_DeferredTrySubmit : public Context {
@@ -8887,21 +9774,32 @@ struct C_DeferredTrySubmit : public Context {
   }
 };
 
-void BlueStore::_deferred_aio_finish(OpSequencer *osr)
+void BlueStore::_deferred_aio_finish(DeferredGroup *g)
 {
-  dout(10) << __func__ << " osr " << osr << dendl;
-  assert(osr->deferred_running);
-  DeferredBatch *b = osr->deferred_running;
+  dout(10) << __func__ << " group " << g << " " << g->batches.size()
+	   << " batches" << dendl;
+  assert(deferred_inflight_ios >= g->num_ios);
+  deferred_inflight_ios -= g->num_ios;
 
+  bool more_pending = false;
   {
     std::lock_guard<std::mutex> l(deferred_lock);
-    assert(osr->deferred_running == b);
-    osr->deferred_running = nullptr;
-    if (!osr->deferred_pending) {
-      dout(20) << __func__ << " dequeueing" << dendl;
-      auto q = deferred_queue.iterator_to(*osr);
-      deferred_queue.erase(q);
-    } else if (deferred_aggressive) {
+    for (auto b : g->batches) {
+      OpSequencer *osr = b->osr;
+      assert(osr->deferred_running == b);
+      osr->deferred_running = nullptr;
+      if (!osr->deferred_pending) {
+	dout(20) << __func__ << " osr " << osr << " dequeueing" << dendl;
+	auto q = deferred_queue.iterator_to(*osr);
+	deferred_queue.erase(q);
+      } else {
+	more_pending = true;
+      }
+    }
+  }
+  if (more_pending) {
+    // we may have been holding back behind the inflight limit
+    if (deferred_aggressive || _deferred_want_submit()) {
       dout(20) << __func__ << " queuing async deferred_try_submit" << dendl;
       deferred_finisher.queue(new C_DeferredTrySubmit(this));
     } else {
@@ -8909,7 +9807,9 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
     }
   }
 
-  {
+  bool wake = false;
+  for (auto b : g->batches) {
+    OpSequencer *osr = b->osr;
     uint64_t costs = 0;
     std::lock_guard<std::mutex> l2(osr->qlock);
     for (auto& i : b->txcs) {
@@ -8920,15 +9820,19 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
     }
     osr->qcond.notify_all();
     throttle_deferred_bytes.put(costs);
-    std::lock_guard<std::mutex> l(kv_lock);
+    std::lock_guard<std::mutex> l(kv_shards[0]->kv_lock);
+    if (deferred_done_queue.empty() && kv_shard_num > 1) {
+      wake = true;
+    }
     deferred_done_queue.emplace_back(b);
   }
+  delete g;
 
-  // in the normal case, do not bother waking up the kv thread; it will
-  // catch us on the next commit anyway.
-  if (deferred_aggressive) {
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
+  // in the normal case, with a single kv shard, do not bother waking up
+  // the kv thread; it will catch us on the next commit anyway.  with
+  // several, the first shard may not commit again until we do.
+  if (deferred_aggressive || wake) {
+    _kv_wake_deferred();
   }
 }
 
@@ -9019,39 +9923,13 @@ int BlueStore::queue_transactions(
   _txc_calc_cost(txc);
 
   _txc_write_nodes(txc, txc->t);
-
-  // journal deferred items
-  if (txc->deferred_txn) {
-    txc->deferred_txn->seq = ++deferred_seq;
-    bufferlist bl;
-    encode(*txc->deferred_txn, bl);
-    string key;
-    get_deferred_key(txc->deferred_txn->seq, &key);
-    txc->t->set(PREFIX_DEFERRED, key, bl);
-  }
-
+  _txc_journal_deferred(txc);
   _txc_finalize_kv(txc, txc->t);
   if (handle)
     handle->suspend_tp_timeout();
 
   utime_t tstart = ceph_clock_now();
-  throttle_bytes.get(txc->cost);
-  if (txc->deferred_txn) {
-    // ensure we do not block here because of deferred writes
-    if (!throttle_deferred_bytes.get_or_fail(txc->cost)) {
-      dout(10) << __func__ << " failed get throttle_deferred_bytes, aggressive"
-	       << dendl;
-      ++deferred_aggressive;
-      deferred_try_submit();
-      {
-	// wake up any previously finished deferred events
-	std::lock_guard<std::mutex> l(kv_lock);
-	kv_cond.notify_one();
-      }
-      throttle_deferred_bytes.get(txc->cost);
-      --deferred_aggressive;
-   }
-  }
+  _txc_throttle(txc);
   utime_t tend = ceph_clock_now();
 
   if (handle)
@@ -9551,7 +10429,9 @@ void BlueStore::_pad_zeros(
     assert(back_pad == 0);
     back_pad = chunk_size - back_copy;
     assert(back_copy <= length);
-    bufferptr tail(chunk_size);
+    // page aligned, like the front pad, so the device need not copy it
+    // again to meet O_DIRECT alignment
+    bufferptr tail = buffer::create_page_aligned(chunk_size);
     bl->copy(length - back_copy, back_copy, tail.c_str());
     tail.zero(back_copy, back_pad, false);
     bufferlist old;
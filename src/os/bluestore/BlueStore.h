@@ -35,14 +35,15 @@
 #include "include/mempool.h"
 #include "common/Finisher.h"
 #include "common/perf_counters.h"
+#include "common/PriorityCache.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
 #include "bluestore_types.h"
+#include "Allocator.h"
 #include "BlockDevice.h"
 #include "common/EventTrace.h"
 
-class Allocator;
 class FreelistManager;
 class BlueFS;
 
@@ -85,6 +86,7 @@ enum {
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_write_batches,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -117,6 +119,12 @@ enum {
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
   l_bluestore_read_eio,
+  l_bluestore_fragmentation,
+  l_bluestore_free_extents,
+  l_bluestore_free_max_extent,
+  l_bluestore_defrag_blobs,
+  l_bluestore_defrag_bytes,
+  l_bluestore_cache_size,
   l_bluestore_last
 };
 
@@ -936,6 +944,15 @@ public:
       const old_extent_map_t& old_extents,
       uint64_t min_alloc_size);
 
+    /// collect logical ranges backed by uncompressed blobs that are
+    /// scattered over at least min_pextents physical extents; return the
+    /// number of bytes to rewrite
+    uint64_t estimate_fragmented(
+      const ExtentMap& extent_map,
+      uint32_t min_pextents,
+      uint64_t max_bytes,
+      uint64_t min_alloc_size);
+
     /// return a collection of extents to perform GC on
     const vector<AllocExtent>& get_extents_to_collect() const {
       return extents_to_collect;
@@ -1620,7 +1637,7 @@ public:
       boost::intrusive::list_member_hook<>,
       &TransContext::deferred_queue_item> > deferred_queue_t;
 
-  struct DeferredBatch : public AioContext {
+  struct DeferredBatch {
     OpSequencer *osr;
     struct deferred_io {
       bufferlist bl;    ///< data
@@ -1628,23 +1645,34 @@ public:
     };
     map<uint64_t,deferred_io> iomap; ///< map of ios in this batch
     deferred_queue_t txcs;           ///< txcs in this batch
-    IOContext ioc;                   ///< our aios
     /// bytes of pending io for each deferred seq (may be 0)
     map<uint64_t,int> seq_bytes;
+    uint64_t bytes = 0;              ///< bytes queued (before overlaps)
+    ceph::mono_time start;           ///< when the first txc was queued
 
     void _discard(CephContext *cct, uint64_t offset, uint64_t length);
     void _audit(CephContext *cct);
 
-    DeferredBatch(CephContext *cct, OpSequencer *osr)
-      : osr(osr), ioc(cct, this) {}
+    explicit DeferredBatch(OpSequencer *osr)
+      : osr(osr), start(ceph::mono_clock::now()) {}
 
     /// prepare a write
     void prepare_write(CephContext *cct,
 		       uint64_t seq, uint64_t offset, uint64_t length,
 		       bufferlist::const_iterator& p);
+  };
+
+  /// pending batches of several sequencers, written out together in
+  /// offset order
+  struct DeferredGroup : public AioContext {
+    vector<DeferredBatch*> batches;
+    IOContext ioc;                   ///< our aios
+    unsigned num_ios = 0;
+
+    explicit DeferredGroup(CephContext *cct) : ioc(cct, this) {}
 
     void aio_finish(BlueStore *store) override {
-      store->_deferred_aio_finish(osr);
+      store->_deferred_aio_finish(this);
     }
   };
 
@@ -1668,6 +1696,7 @@ public:
     BlueStore *store;
 
     size_t shard;
+    size_t kv_shard = 0;  ///< which kv sync/finalize pipeline we use
 
     uint64_t last_seq = 0;
 
@@ -1705,6 +1734,17 @@ public:
 	qcond.wait(l);
     }
 
+    /// true if no txc other than this one is still being prepared
+    bool is_only_preparing(TransContext *txc) {
+      std::lock_guard<std::mutex> l(qlock);
+      for (auto& i : q) {
+	if (&i != txc && i.state == TransContext::STATE_PREPARE) {
+	  return false;
+	}
+      }
+      return true;
+    }
+
     bool _is_all_kv_submitted() {
       // caller must hold qlock & q.empty() must not empty
       assert(!q.empty());
@@ -1752,19 +1792,62 @@ public:
       boost::intrusive::list_member_hook<>,
       &OpSequencer::deferred_osr_queue_item> > deferred_osr_queue_t;
 
+  struct KVShard;
   struct KVSyncThread : public Thread {
     BlueStore *store;
-    explicit KVSyncThread(BlueStore *s) : store(s) {}
+    KVShard *shard;
+    KVSyncThread(BlueStore *s, KVShard *ks) : store(s), shard(ks) {}
     void *entry() override {
-      store->_kv_sync_thread();
+      store->_kv_sync_thread(shard);
       return NULL;
     }
   };
   struct KVFinalizeThread : public Thread {
     BlueStore *store;
-    explicit KVFinalizeThread(BlueStore *s) : store(s) {}
+    KVShard *shard;
+    KVFinalizeThread(BlueStore *s, KVShard *ks) : store(s), shard(ks) {}
     void *entry() {
-      store->_kv_finalize_thread();
+      store->_kv_finalize_thread(shard);
+      return NULL;
+    }
+  };
+
+  /// a kv submit/sync + finalize pipeline.  each OpSequencer is bound to
+  /// one shard, which preserves its ordering; shard 0 additionally owns
+  /// deferred io cleanup and bluefs balancing.
+  struct KVShard {
+    unsigned id;
+
+    KVSyncThread kv_sync_thread;
+    std::mutex kv_lock;
+    std::condition_variable kv_cond;
+    bool kv_sync_started = false;
+    bool kv_stop = false;
+    deque<TransContext*> kv_queue;             ///< ready, already submitted
+    deque<TransContext*> kv_queue_unsubmitted; ///< ready, need submit by kv thread
+    deque<TransContext*> kv_committing;        ///< currently syncing
+    uint64_t kv_ios = 0;
+    uint64_t kv_throttle_costs = 0;
+
+    KVFinalizeThread kv_finalize_thread;
+    std::mutex kv_finalize_lock;
+    std::condition_variable kv_finalize_cond;
+    bool kv_finalize_started = false;
+    bool kv_finalize_stop = false;
+    deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
+    deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+
+    KVShard(BlueStore *s, unsigned i)
+      : id(i),
+	kv_sync_thread(s, this),
+	kv_finalize_thread(s, this) {}
+  };
+
+  struct DefragThread : public Thread {
+    BlueStore *store;
+    explicit DefragThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_defrag_thread();
       return NULL;
     }
   };
@@ -1834,34 +1917,36 @@ private:
   std::atomic<uint64_t> deferred_seq = {0};
   deferred_osr_queue_t deferred_queue; ///< osr's with deferred io pending
   int deferred_queue_size = 0;         ///< num txc's queued across all osrs
+  uint64_t deferred_queue_bytes = 0;   ///< bytes queued across all osrs
+  std::atomic<uint64_t> deferred_inflight_ios = {0}; ///< submitted, not done
   atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
   Finisher deferred_finisher;
 
   int m_finisher_num = 1;
   vector<Finisher*> finishers;
 
-  KVSyncThread kv_sync_thread;
-  std::mutex kv_lock;
-  std::condition_variable kv_cond;
   bool _kv_only = false;
-  bool kv_sync_started = false;
-  bool kv_stop = false;
-  bool kv_finalize_started = false;
-  bool kv_finalize_stop = false;
-  deque<TransContext*> kv_queue;             ///< ready, already submitted
-  deque<TransContext*> kv_queue_unsubmitted; ///< ready, need submit by kv thread
-  deque<TransContext*> kv_committing;        ///< currently syncing
+  unsigned kv_shard_num = 1;  ///< number of kv shards for this mount
+  vector<KVShard*> kv_shards;
+  // protected by kv_shards[0]->kv_lock
   deque<DeferredBatch*> deferred_done_queue;   ///< deferred ios done
   deque<DeferredBatch*> deferred_stable_queue; ///< deferred ios done + stable
 
-  KVFinalizeThread kv_finalize_thread;
-  std::mutex kv_finalize_lock;
-  std::condition_variable kv_finalize_cond;
-  deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
-  deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+  std::mutex kv_max_lock;  ///< serializes {nid,blobid}_max updates
+  uint64_t nid_max_submitted = 0;
+  uint64_t blobid_max_submitted = 0;
+
+  DefragThread defrag_thread;
+  std::mutex defrag_lock;
+  std::condition_variable defrag_cond;
+  std::atomic_bool defrag_stop = {false};
+  std::atomic<uint64_t> defrag_txc = {0};  ///< txcs submitted by defrag
+  coll_t defrag_cid;                       ///< where the last pass stopped
+  ghobject_t defrag_next;
 
   PerfCounters *logger = nullptr;
 
+  std::mutex reap_lock;  ///< protects removed_collections
   list<CollectionRef> removed_collections;
 
   RWLock debug_read_error_lock = {"BlueStore::debug_read_error_lock"};
@@ -1887,6 +1972,9 @@ private:
   ///< number threshold for forced deferred writes
   std::atomic<int> deferred_batch_ops = {0};
 
+  ///< size threshold for forced deferred writes
+  std::atomic<uint64_t> deferred_batch_bytes = {0};
+
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
@@ -1901,9 +1989,6 @@ private:
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
 
-  uint64_t kv_ios = 0;
-  uint64_t kv_throttle_costs = 0;
-
   // cache trim control
   uint64_t cache_size = 0;      ///< total cache size
   float cache_meta_ratio = 0;   ///< cache ratio dedicated to metadata
@@ -1914,11 +1999,67 @@ private:
   volatile_statfs vstatfs;
 
   struct MempoolThread : public Thread {
+  public:
     BlueStore *store;
     Cond cond;
     Mutex lock;
     bool stop = false;
-  public:
+    uint64_t autotune_cache_size = 0;
+
+    /// a cache tier whose usage is measured through its mempools
+    struct MempoolCache : public PriorityCache::BasePriCache {
+      virtual uint64_t _get_used_bytes() const = 0;
+
+      int64_t commit_cache_size(uint64_t total_cache) override {
+	committed_bytes = std::min<int64_t>(get_cache_bytes(), total_cache);
+	return committed_bytes;
+      }
+    };
+
+    /// onodes and the rest of the metadata hanging off them
+    struct MetaCache : public MempoolCache {
+      uint64_t _get_used_bytes() const override {
+	return mempool::bluestore_cache_other::allocated_bytes() +
+	  mempool::bluestore_cache_onode::allocated_bytes();
+      }
+      int64_t request_cache_bytes(
+	PriorityCache::Priority pri, uint64_t chunk_bytes) const override;
+      std::string get_cache_name() const override {
+	return "BlueStore Meta Cache";
+      }
+      uint64_t _get_num_onodes() const {
+	uint64_t onode_num =
+	  mempool::bluestore_cache_onode::allocated_items();
+	return (2 > onode_num) ? 2 : onode_num;
+      }
+      double get_bytes_per_onode() const {
+	return (double)_get_used_bytes() / (double)_get_num_onodes();
+      }
+    } meta_cache;
+
+    /// cached object data buffers
+    struct DataCache : public MempoolCache {
+      uint64_t _get_used_bytes() const override {
+	return mempool::bluestore_cache_data::allocated_bytes();
+      }
+      int64_t request_cache_bytes(
+	PriorityCache::Priority pri, uint64_t chunk_bytes) const override;
+      std::string get_cache_name() const override {
+	return "BlueStore Data Cache";
+      }
+    } data_cache;
+
+    /// the kv store's block cache (e.g., rocksdb)
+    struct KVCache : public PriorityCache::BasePriCache {
+      KeyValueDB *db = nullptr;
+      int64_t request_cache_bytes(
+	PriorityCache::Priority pri, uint64_t chunk_bytes) const override;
+      int64_t commit_cache_size(uint64_t total_cache) override;
+      std::string get_cache_name() const override {
+	return "RocksDB Block Cache";
+      }
+    } kv_cache;
+
     explicit MempoolThread(BlueStore *s)
       : store(s),
 	lock("BlueStore::MempoolThread::lock") {}
@@ -1934,6 +2075,11 @@ private:
       lock.Unlock();
       join();
     }
+
+  private:
+    void _trim_shards(bool autotune);
+    bool _tune_cache_size();
+    void _balance_cache(const std::list<PriorityCache::PriCache *>& caches);
   } mempool_thread;
 
   // --------------------------------------------------------
@@ -2004,6 +2150,9 @@ private:
   void _txc_update_store_statfs(TransContext *txc);
   void _txc_add_transaction(TransContext *txc, Transaction *t);
   void _txc_calc_cost(TransContext *txc);
+  void _txc_journal_deferred(TransContext *txc);
+  void _txc_throttle(TransContext *txc);
+  void _record_onode(OnodeRef &o, KeyValueDB::Transaction &txn);
   void _txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t);
   void _txc_state_proc(TransContext *txc);
   void _txc_aio_submit(TransContext *txc);
@@ -2025,16 +2174,27 @@ private:
 
   void _kv_start();
   void _kv_stop();
-  void _kv_sync_thread();
-  void _kv_finalize_thread();
+  void _kv_sync_thread(KVShard *ks);
+  void _kv_finalize_thread(KVShard *ks);
+  void _kv_wake_deferred();
+
+  void _sample_free_stats(Allocator::free_stats_t *stats);
+  void _defrag_start();
+  void _defrag_stop();
+  void _defrag_thread();
+  void _defrag_pass(uint64_t max_bytes);
+  uint64_t _defrag_object(CollectionRef& c, const ghobject_t& oid,
+			  uint64_t max_bytes);
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, OnodeRef o);
   void _deferred_queue(TransContext *txc);
 public:
-  void deferred_try_submit();
+  void deferred_try_submit(bool force = true);
 private:
+  bool _deferred_want_submit();
   void _deferred_submit_unlock(OpSequencer *osr);
-  void _deferred_aio_finish(OpSequencer *osr);
+  void _deferred_submit_unlock(const vector<OpSequencer*>& osrs);
+  void _deferred_aio_finish(DeferredGroup *g);
   int _deferred_replay();
 
 public:
@@ -2051,6 +2211,60 @@ private:
     uint64_t granularity,
     store_statfs_t& expected_statfs);
 
+  /// a reference to a shared blob seen by an fsck worker
+  struct fsck_sb_ref_t {
+    uint64_t seq;          ///< position of the referencing object in the walk
+    uint64_t sbid;
+    ghobject_t oid;
+    SharedBlobRef sb;
+    bool compressed;
+    PExtentVector extents;
+  };
+
+  /// what an fsck worker found in the objects it checked
+  struct fsck_result_t {
+    int errors = 0;
+    store_statfs_t expected_statfs;
+    uint64_t num_extents = 0;
+    uint64_t num_blobs = 0;
+    uint64_t num_spanning_blobs = 0;
+    mempool::bluestore_fsck::list<fsck_sb_ref_t> sb_refs;
+  };
+
+  /// objects handed from the fsck key walk to the fsck workers
+  struct fsck_queue_t {
+    std::mutex lock;
+    std::condition_variable cond;
+    deque<pair<CollectionRef,ghobject_t>> q;
+    uint64_t seq = 0;    ///< position of q.front() in the walk
+    bool done = false;   ///< the walk has queued everything
+    bool deep = false;
+    mempool_dynamic_bitset *used_blocks = nullptr;
+    std::mutex used_blocks_lock;
+  };
+
+  struct FsckThread : public Thread {
+    BlueStore *store;
+    fsck_queue_t *queue;
+    fsck_result_t *res;
+    FsckThread(BlueStore *s, fsck_queue_t *q, fsck_result_t *r)
+      : store(s), queue(q), res(r) {}
+    void *entry() override {
+      store->_fsck_worker(queue, res);
+      return NULL;
+    }
+  };
+
+  void _fsck_check_object(
+    CollectionRef c,
+    const ghobject_t& oid,
+    uint64_t seq,
+    bool deep,
+    mempool_dynamic_bitset &used_blocks,
+    std::mutex &used_blocks_lock,
+    fsck_result_t *res);
+  void _fsck_worker(fsck_queue_t *queue, fsck_result_t *res);
+
   void _buffer_cache_write(
     TransContext *txc,
     BlobRef b,
@@ -2170,6 +2384,7 @@ public:
   }
 
   void get_db_statistics(Formatter *f) override;
+  void dump_fragmentation(Formatter *f) override;
   void generate_db_histogram(Formatter *f) override;
   void _flush_cache();
   void flush_cache() override;
@@ -2330,6 +2545,13 @@ public:
     RWLock::WLocker l(debug_read_error_lock);
     debug_mdata_error_objects.insert(o);
   }
+
+  // damage the store behind fsck's back, for testing
+  void inject_leaked(uint64_t len);
+  void inject_false_free(coll_t cid, ghobject_t oid);
+  void inject_misreference(coll_t cid1, ghobject_t oid1,
+			   coll_t cid2, ghobject_t oid2,
+			   uint64_t offset);
   void compact() override {
     assert(db);
     db->compact();
@@ -0,0 +1,546 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "HybridAllocator.h"
+#include "bluestore_types.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "hybridalloc 0x" << this << " "
+
+HybridAllocator::HybridAllocator(CephContext* cct,
+				 int64_t device_size,
+				 int64_t block_size)
+  : cct(cct),
+    device_size(device_size),
+    block_size(block_size > 0 ? block_size : 1)
+{
+  bitmap_max_len = this->block_size *
+    cct->_conf->get_val<uint64_t>("bluestore_hybrid_alloc_bitmap_max_blocks");
+  range_max_entries = std::max<uint64_t>(
+    1,
+    cct->_conf->get_val<uint64_t>("bluestore_hybrid_alloc_mem_cap") /
+      range_entry_bytes);
+  ff_max_search = std::max<uint64_t>(
+    1, cct->_conf->get_val<uint64_t>("bluestore_hybrid_alloc_ff_max_search"));
+}
+
+HybridAllocator::~HybridAllocator()
+{
+}
+
+// range tree
+
+void HybridAllocator::_range_add(uint64_t start, uint64_t end)
+{
+  range_tree[start] = end;
+  range_size_tree.insert(std::make_pair(end - start, start));
+}
+
+void HybridAllocator::_range_rm(range_tree_t::iterator p)
+{
+  range_size_tree.erase(std::make_pair(p->second - p->first, p->first));
+  range_tree.erase(p);
+}
+
+void HybridAllocator::_range_carve(range_tree_t::iterator p,
+				   uint64_t off, uint64_t len)
+{
+  uint64_t start = p->first;
+  uint64_t end = p->second;
+  assert(off >= start && off + len <= end);
+  _range_rm(p);
+  if (start < off) {
+    _insert_run(start, off);
+  }
+  if (off + len < end) {
+    _insert_run(off + len, end);
+  }
+}
+
+void HybridAllocator::_range_spill()
+{
+  auto p = range_size_tree.begin();
+  while (range_tree.size() > range_max_entries &&
+	 p != range_size_tree.end()) {
+    uint64_t start = p->second;
+    uint64_t len = p->first;
+    if (!_is_aligned(start) || !_is_aligned(len)) {
+      ++p;
+      continue;
+    }
+    ldout(cct, 20) << __func__ << " 0x" << std::hex << start << "~" << len
+		   << std::dec << " to bitmap" << dendl;
+    _range_rm(range_tree.find(start));
+    _bitmap_set(start / block_size, (start + len) / block_size);
+    bitmap_spilled = true;
+    // erasing from a btree invalidates its iterators; carry on from the
+    // entry after the one just removed
+    p = range_size_tree.upper_bound(std::make_pair(len, start));
+  }
+}
+
+// bitmap
+
+bool HybridAllocator::_bitmap_test(uint64_t b)
+{
+  auto p = bitmap.find(b / REGION_BLOCKS);
+  if (p == bitmap.end()) {
+    return false;
+  }
+  unsigned bit = b % REGION_BLOCKS;
+  return p->second.words[bit / 64] & (1ull << (bit % 64));
+}
+
+void HybridAllocator::_bitmap_set(uint64_t bstart, uint64_t bend)
+{
+  bitmap_free += (bend - bstart) * block_size;
+  while (bstart < bend) {
+    uint64_t ri = bstart / REGION_BLOCKS;
+    uint64_t base = ri * REGION_BLOCKS;
+    uint64_t rend = std::min(bend, base + REGION_BLOCKS);
+    region_t& r = bitmap[ri];
+    while (bstart < rend) {
+      unsigned bit = bstart - base;
+      unsigned off = bit % 64;
+      unsigned n = std::min<uint64_t>(64 - off, rend - bstart);
+      uint64_t mask = (n == 64) ? ~0ull : (((1ull << n) - 1) << off);
+      assert((r.words[bit / 64] & mask) == 0);
+      r.words[bit / 64] |= mask;
+      r.num_set += n;
+      bstart += n;
+    }
+  }
+}
+
+void HybridAllocator::_bitmap_clear(uint64_t bstart, uint64_t bend)
+{
+  assert(bitmap_free >= (bend - bstart) * block_size);
+  bitmap_free -= (bend - bstart) * block_size;
+  while (bstart < bend) {
+    uint64_t ri = bstart / REGION_BLOCKS;
+    uint64_t base = ri * REGION_BLOCKS;
+    uint64_t rend = std::min(bend, base + REGION_BLOCKS);
+    auto p = bitmap.find(ri);
+    assert(p != bitmap.end());
+    region_t& r = p->second;
+    while (bstart < rend) {
+      unsigned bit = bstart - base;
+      unsigned off = bit % 64;
+      unsigned n = std::min<uint64_t>(64 - off, rend - bstart);
+      uint64_t mask = (n == 64) ? ~0ull : (((1ull << n) - 1) << off);
+      assert((r.words[bit / 64] & mask) == mask);
+      r.words[bit / 64] &= ~mask;
+      r.num_set -= n;
+      bstart += n;
+    }
+    if (r.num_set == 0) {
+      bitmap.erase(p);
+    }
+  }
+  if (bitmap.empty()) {
+    bitmap_spilled = false;
+  }
+}
+
+/// first free block at or after b, or NO_BLOCK
+uint64_t HybridAllocator::_bitmap_find_set(uint64_t b)
+{
+  for (auto p = bitmap.lower_bound(b / REGION_BLOCKS);
+       p != bitmap.end();
+       ++p) {
+    uint64_t base = p->first * REGION_BLOCKS;
+    unsigned start = b > base ? b - base : 0;
+    for (unsigned w = start / 64; w < REGION_WORDS; ++w) {
+      uint64_t word = p->second.words[w];
+      if (w == start / 64) {
+	word &= ~0ull << (start % 64);
+      }
+      if (word) {
+	return base + w * 64 + __builtin_ctzll(word);
+      }
+    }
+  }
+  return NO_BLOCK;
+}
+
+/// first used block at or after b
+uint64_t HybridAllocator::_bitmap_find_clear(uint64_t b)
+{
+  while (true) {
+    auto p = bitmap.find(b / REGION_BLOCKS);
+    if (p == bitmap.end()) {
+      return b;
+    }
+    uint64_t base = p->first * REGION_BLOCKS;
+    unsigned start = b - base;
+    for (unsigned w = start / 64; w < REGION_WORDS; ++w) {
+      uint64_t word = ~p->second.words[w];
+      if (w == start / 64) {
+	word &= ~0ull << (start % 64);
+      }
+      if (word) {
+	return base + w * 64 + __builtin_ctzll(word);
+      }
+    }
+    b = base + REGION_BLOCKS;
+  }
+}
+
+/// start of the free run that ends right before block b
+uint64_t HybridAllocator::_bitmap_run_start(uint64_t b)
+{
+  while (b > 0) {
+    uint64_t prev = b - 1;
+    auto p = bitmap.find(prev / REGION_BLOCKS);
+    if (p == bitmap.end()) {
+      break;
+    }
+    unsigned bit = prev % REGION_BLOCKS;
+    unsigned off = bit % 64;
+    uint64_t mask = (off == 63) ? ~0ull : ((1ull << (off + 1)) - 1);
+    uint64_t used = ~p->second.words[bit / 64] & mask;
+    if (used) {
+      unsigned hi = 63 - __builtin_clzll(used);
+      return prev - (off - hi) + 1;
+    }
+    b = prev - off;
+  }
+  return b;
+}
+
+// free space
+
+void HybridAllocator::_insert_run(uint64_t start, uint64_t end)
+{
+  uint64_t len = end - start;
+  if (len < bitmap_max_len && _is_aligned(start) && _is_aligned(len)) {
+    _bitmap_set(start / block_size, end / block_size);
+  } else {
+    _range_add(start, end);
+    if (range_tree.size() > range_max_entries) {
+      _range_spill();
+    }
+  }
+}
+
+void HybridAllocator::_add_free(uint64_t offset, uint64_t length)
+{
+  uint64_t start = offset;
+  uint64_t end = offset + length;
+
+  // coalesce with neighbours in the range tree
+  auto n = range_tree.lower_bound(start);
+  if (n != range_tree.begin()) {
+    auto p = n;
+    --p;
+    assert(p->second <= start);
+    if (p->second == start) {
+      start = p->first;
+      _range_rm(p);
+    }
+  }
+  n = range_tree.find(end);
+  if (n != range_tree.end()) {
+    end = n->second;
+    _range_rm(n);
+  }
+
+  // ... and in the bitmap
+  if (_is_aligned(start) && start > 0 &&
+      _bitmap_test(start / block_size - 1)) {
+    uint64_t b = _bitmap_run_start(start / block_size);
+    _bitmap_clear(b, start / block_size);
+    start = b * block_size;
+  }
+  if (_is_aligned(end) && _bitmap_test(end / block_size)) {
+    uint64_t b = _bitmap_find_clear(end / block_size);
+    _bitmap_clear(end / block_size, b);
+    end = b * block_size;
+  }
+
+  _insert_run(start, end);
+  num_free += length;
+}
+
+void HybridAllocator::_rm_free(uint64_t offset, uint64_t length)
+{
+  uint64_t end = offset + length;
+  uint64_t off = offset;
+  while (off < end) {
+    auto p = range_tree.upper_bound(off);
+    if (p != range_tree.begin()) {
+      --p;
+      if (p->first <= off && p->second > off) {
+	uint64_t e = std::min(end, p->second);
+	_range_carve(p, off, e - off);
+	off = e;
+	continue;
+      }
+    }
+    assert(_is_aligned(off));
+    uint64_t b = off / block_size;
+    assert(_bitmap_test(b));
+    uint64_t e = std::min(end, _bitmap_find_clear(b) * block_size);
+    assert(_is_aligned(e));
+    _bitmap_clear(b, e / block_size);
+    off = e;
+  }
+  num_free -= length;
+  assert(num_free >= 0);
+}
+
+// allocation
+
+bool HybridAllocator::_allocate_range(
+  uint64_t want, uint64_t alloc_unit, int64_t hint,
+  uint64_t *offset, uint64_t *length)
+{
+  uint64_t need = std::max(alloc_unit, want);
+  uint64_t cursor = hint > 0 ? hint : last_alloc;
+
+  // first-fit from the cursor keeps consecutive allocations contiguous
+  auto p = range_tree.upper_bound(cursor);
+  if (p != range_tree.begin()) {
+    auto q = p;
+    --q;
+    if (q->second > cursor) {
+      uint64_t start = p2roundup(cursor, alloc_unit);
+      if (start >= q->first && start + need <= q->second) {
+	*offset = start;
+	*length = need;
+	_range_carve(q, *offset, *length);
+	return true;
+      }
+    }
+  }
+  for (uint64_t i = 0; p != range_tree.end() && i < ff_max_search; ++p, ++i) {
+    if (_aligned_len(p->first, p->second, alloc_unit) >= need) {
+      *offset = p2roundup(p->first, alloc_unit);
+      *length = need;
+      _range_carve(p, *offset, *length);
+      return true;
+    }
+  }
+
+  // best-fit; an extent of need + alloc_unit always fits once aligned
+  auto s = range_size_tree.lower_bound(std::make_pair(need, 0));
+  for (uint64_t i = 0; s != range_size_tree.end(); ++s, ++i) {
+    if (i == ff_max_search) {
+      s = range_size_tree.lower_bound(std::make_pair(need + alloc_unit - 1, 0));
+      if (s == range_size_tree.end()) {
+	break;
+      }
+    }
+    uint64_t start = s->second;
+    if (_aligned_len(start, start + s->first, alloc_unit) >= need) {
+      *offset = p2roundup(start, alloc_unit);
+      *length = need;
+      _range_carve(range_tree.find(start), *offset, *length);
+      return true;
+    }
+  }
+
+  // nothing fits; take what we can from the largest extent
+  if (!range_size_tree.empty()) {
+    auto l = range_size_tree.end();
+    --l;
+    uint64_t start = l->second;
+    uint64_t len = p2align(_aligned_len(start, start + l->first, alloc_unit),
+			   alloc_unit);
+    if (len >= alloc_unit) {
+      *offset = p2roundup(start, alloc_unit);
+      *length = len;
+      _range_carve(range_tree.find(start), *offset, *length);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HybridAllocator::_allocate_bitmap(
+  uint64_t want, uint64_t alloc_unit, int64_t hint,
+  uint64_t *offset, uint64_t *length)
+{
+  if (bitmap.empty() || alloc_unit % block_size) {
+    return false;
+  }
+  if (alloc_unit >= bitmap_max_len && !bitmap_spilled) {
+    // every run in the bitmap is shorter than one allocation unit
+    return false;
+  }
+  uint64_t need = std::max(alloc_unit, want);
+  uint64_t hint_block = (hint > 0 && (uint64_t)hint < device_size) ?
+    hint / block_size : 0;
+
+  // scan from the hint to the end, then wrap around once
+  for (int pass = 0; pass < 2; ++pass) {
+    uint64_t b = pass == 0 ? hint_block : 0;
+    uint64_t stop = pass == 0 ? NO_BLOCK : hint_block;
+    while (b < stop) {
+      b = _bitmap_find_set(b);
+      if (b == NO_BLOCK || b >= stop) {
+	break;
+      }
+      uint64_t e = _bitmap_find_clear(b);
+      uint64_t len = p2align(_aligned_len(b * block_size, e * block_size,
+					  alloc_unit), alloc_unit);
+      if (len >= alloc_unit) {
+	*offset = p2roundup(b * block_size, alloc_unit);
+	*length = std::min(need, len);
+	_bitmap_clear(*offset / block_size, (*offset + *length) / block_size);
+	return true;
+      }
+      b = e;
+    }
+    if (hint_block == 0) {
+      break;
+    }
+  }
+  return false;
+}
+
+int HybridAllocator::reserve(uint64_t need)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " need 0x" << std::hex << need
+		 << " num_free 0x" << num_free
+		 << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  if ((int64_t)need > num_free - num_reserved)
+    return -ENOSPC;
+  num_reserved += need;
+  return 0;
+}
+
+void HybridAllocator::unreserve(uint64_t unused)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " unused 0x" << std::hex << unused
+		 << " num_free 0x" << num_free
+		 << " num_reserved 0x" << num_reserved << std::dec << dendl;
+  assert(num_reserved >= (int64_t)unused);
+  num_reserved -= unused;
+}
+
+int64_t HybridAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  mempool::bluestore_alloc::vector<AllocExtent> *extents)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " want_size 0x" << std::hex << want_size
+		 << " alloc_unit 0x" << alloc_unit
+		 << " max_alloc_size 0x" << max_alloc_size
+		 << " hint 0x" << hint << std::dec
+		 << dendl;
+  uint64_t allocated_size = 0;
+
+  if (max_alloc_size == 0) {
+    max_alloc_size = want_size;
+  }
+
+  ExtentList block_list = ExtentList(extents, 1, max_alloc_size);
+
+  while (allocated_size < want_size) {
+    uint64_t want = std::min(max_alloc_size, want_size - allocated_size);
+    uint64_t offset = 0, length = 0;
+    if (!_allocate_range(want, alloc_unit, hint, &offset, &length) &&
+	!_allocate_bitmap(want, alloc_unit, hint, &offset, &length)) {
+      break;
+    }
+    ldout(cct, 20) << __func__ << " got 0x" << std::hex << offset << "~"
+		   << length << std::dec << dendl;
+    block_list.add_extents(offset, length);
+    allocated_size += length;
+    num_free -= length;
+    num_reserved -= length;
+    assert(num_free >= 0);
+    assert(num_reserved >= 0);
+    hint = last_alloc = offset + length;
+  }
+
+  if (allocated_size == 0) {
+    return -ENOSPC;
+  }
+  return allocated_size;
+}
+
+void HybridAllocator::release(
+  const interval_set<uint64_t>& release_set)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (interval_set<uint64_t>::const_iterator p = release_set.begin();
+       p != release_set.end();
+       ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		   << std::dec << dendl;
+    _add_free(offset, length);
+  }
+}
+
+uint64_t HybridAllocator::get_free()
+{
+  std::lock_guard<std::mutex> l(lock);
+  return num_free;
+}
+
+void HybridAllocator::dump()
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 0) << __func__ << " range tree: " << range_tree.size()
+		<< " extents, bitmap: " << bitmap.size() << " regions 0x"
+		<< std::hex << bitmap_free << std::dec << " bytes" << dendl;
+  for (auto& p : range_tree) {
+    ldout(cct, 0) << __func__ << "  0x" << std::hex << p.first << "~"
+		  << (p.second - p.first) << std::dec << dendl;
+  }
+  uint64_t b = 0;
+  while ((b = _bitmap_find_set(b)) != NO_BLOCK) {
+    uint64_t e = _bitmap_find_clear(b);
+    ldout(cct, 0) << __func__ << "  bitmap 0x" << std::hex << b * block_size
+		  << "~" << (e - b) * block_size << std::dec << dendl;
+    b = e;
+  }
+}
+
+void HybridAllocator::dump(std::function<void(uint64_t offset,
+					       uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& p : range_tree) {
+    notify(p.first, p.second - p.first);
+  }
+  uint64_t b = 0;
+  while ((b = _bitmap_find_set(b)) != NO_BLOCK) {
+    uint64_t e = _bitmap_find_clear(b);
+    notify(b * block_size, (e - b) * block_size);
+    b = e;
+  }
+}
+
+void HybridAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _add_free(offset, length);
+}
+
+void HybridAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _rm_free(offset, length);
+}
+
+void HybridAllocator::shutdown()
+{
+  ldout(cct, 1) << __func__ << dendl;
+}
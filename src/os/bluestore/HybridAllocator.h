@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_HYBRIDALLOCATOR_H
+#define CEPH_OS_BLUESTORE_HYBRIDALLOCATOR_H
+
+#include <mutex>
+
+#include "Allocator.h"
+#include "include/btree_map.h"
+#include "include/cpp-btree/btree_set.h"
+#include "os/bluestore/bluestore_types.h"
+#include "include/mempool.h"
+
+/**
+ * HybridAllocator
+ *
+ * Large free extents live in a range tree that is indexed both by offset
+ * (for first-fit near the previous allocation and for coalescing on
+ * release) and by size (for best-fit once first-fit gives up).  Small
+ * fragments, which are what make a range tree expensive on an aged
+ * device, are kept in a sparse bitmap instead: one bit per block, and only
+ * for regions of the device that actually hold such fragments.
+ *
+ * The range tree is bounded by bluestore_hybrid_alloc_mem_cap; once it
+ * grows past that the smallest extents are spilled into the bitmap.  Every
+ * maximal free run is tracked by exactly one of the two structures.
+ */
+class HybridAllocator : public Allocator {
+  CephContext* cct;
+  std::mutex lock;
+
+  const uint64_t device_size;
+  const uint64_t block_size;  ///< bitmap granularity
+
+  int64_t num_free = 0;       ///< total bytes free (tree + bitmap)
+  int64_t num_reserved = 0;   ///< reserved bytes
+  uint64_t bitmap_free = 0;   ///< bytes free in the bitmap
+  bool bitmap_spilled = false;///< bitmap may hold runs >= bitmap_max_len
+
+  uint64_t last_alloc = 0;    ///< first-fit cursor
+
+  // tunables
+  uint64_t bitmap_max_len;    ///< runs shorter than this go to the bitmap
+  uint64_t range_max_entries; ///< bound on range tree entries
+  uint64_t ff_max_search;     ///< first-fit candidates to try before best-fit
+
+  /// rough cost of one free extent in both range trees
+  static constexpr uint64_t range_entry_bytes = 64;
+
+  typedef mempool::bluestore_alloc::pool_allocator<
+    pair<const uint64_t,uint64_t>> range_allocator_t;
+  typedef btree::btree_map<uint64_t,uint64_t,std::less<uint64_t>,
+			   range_allocator_t> range_tree_t;
+  typedef mempool::bluestore_alloc::pool_allocator<
+    pair<uint64_t,uint64_t>> size_allocator_t;
+  typedef btree::btree_set<pair<uint64_t,uint64_t>,
+			   std::less<pair<uint64_t,uint64_t>>,
+			   size_allocator_t> range_size_tree_t;
+
+  range_tree_t range_tree;            ///< start -> end
+  range_size_tree_t range_size_tree;  ///< (length, start)
+
+  static constexpr unsigned REGION_BLOCKS = 1024;
+  static constexpr unsigned REGION_WORDS = REGION_BLOCKS / 64;
+  static constexpr uint64_t NO_BLOCK = ~0ull;
+
+  struct region_t {
+    uint64_t words[REGION_WORDS] = {0};
+    unsigned num_set = 0;
+  };
+  /// region index -> free bits, for regions holding at least one free block
+  mempool::bluestore_alloc::map<uint64_t, region_t> bitmap;
+
+  bool _is_aligned(uint64_t v) const {
+    return v % block_size == 0;
+  }
+  uint64_t _aligned_len(uint64_t start, uint64_t end, uint64_t alloc_unit) {
+    uint64_t skew = start % alloc_unit;
+    if (skew)
+      skew = alloc_unit - skew;
+    if (start + skew > end)
+      return 0;
+    return end - start - skew;
+  }
+
+  // range tree
+  void _range_add(uint64_t start, uint64_t end);
+  void _range_rm(range_tree_t::iterator p);
+  void _range_carve(range_tree_t::iterator p, uint64_t off, uint64_t len);
+  void _range_spill();
+
+  // bitmap
+  bool _bitmap_test(uint64_t b);
+  void _bitmap_set(uint64_t bstart, uint64_t bend);
+  void _bitmap_clear(uint64_t bstart, uint64_t bend);
+  uint64_t _bitmap_find_set(uint64_t b);
+  uint64_t _bitmap_find_clear(uint64_t b);
+  uint64_t _bitmap_run_start(uint64_t b);
+
+  void _insert_run(uint64_t start, uint64_t end);
+  void _add_free(uint64_t offset, uint64_t length);
+  void _rm_free(uint64_t offset, uint64_t length);
+
+  bool _allocate_range(uint64_t want, uint64_t alloc_unit, int64_t hint,
+		       uint64_t *offset, uint64_t *length);
+  bool _allocate_bitmap(uint64_t want, uint64_t alloc_unit, int64_t hint,
+			uint64_t *offset, uint64_t *length);
+
+public:
+  HybridAllocator(CephContext* cct, int64_t device_size, int64_t block_size);
+  ~HybridAllocator() override;
+
+  int reserve(uint64_t need) override;
+  void unreserve(uint64_t unused) override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, mempool::bluestore_alloc::vector<AllocExtent> *extents) override;
+
+  void release(
+    const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+
+  void dump() override;
+  void dump(std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+};
+
+#endif
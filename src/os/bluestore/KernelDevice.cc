@@ -38,11 +38,26 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv)
     fd_buffered(-1),
     fs(NULL), aio(false), dio(false),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     aio_stop(false),
     aio_thread(this),
     injecting_crash(0)
 {
+  unsigned iodepth = cct->_conf->bdev_aio_max_queue_depth;
+  if (cct->_conf->get_val<bool>("bdev_ioring")) {
+    if (ioring_queue_t::supported()) {
+      io_queue = std::unique_ptr<io_queue_t>(
+	new ioring_queue_t(
+	  iodepth,
+	  cct->_conf->get_val<bool>("bdev_ioring_hipri"),
+	  cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll")));
+    } else {
+      derr << __func__ << " bdev_ioring is set but io_uring is not supported"
+	   << " by this build or kernel; falling back to libaio" << dendl;
+    }
+  }
+  if (!io_queue) {
+    io_queue = std::unique_ptr<io_queue_t>(new aio_queue_t(iodepth));
+  }
 }
 
 int KernelDevice::_lock()
@@ -316,7 +331,8 @@ int KernelDevice::_aio_start()
 {
   if (aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
+    std::vector<int> fds = { fd_direct, fd_buffered };
+    int r = io_queue->init(fds);
     if (r < 0) {
       if (r == -EAGAIN) {
 	derr << __func__ << " io_setup(2) failed with EAGAIN; "
@@ -326,6 +342,13 @@ int KernelDevice::_aio_start()
       }
       return r;
     }
+    auto ioring = dynamic_cast<ioring_queue_t*>(io_queue.get());
+    if (ioring && !ioring->sq_thread &&
+	cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll")) {
+      derr << __func__ << " bdev_ioring_sqthread_poll is set but the kernel"
+	   << " cannot poll this device's io_uring (needs CAP_SYS_ADMIN and"
+	   << " registered files before 5.11); submitting without it" << dendl;
+    }
     aio_thread.create("bstore_aio");
   }
   return 0;
@@ -338,7 +361,7 @@ void KernelDevice::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
   }
 }
 
@@ -350,7 +373,7 @@ void KernelDevice::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -530,7 +553,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e, 
 			     pending, priv, &retries);
   
   if (retries)
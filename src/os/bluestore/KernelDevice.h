@@ -21,6 +21,7 @@
 #include "include/interval_set.h"
 
 #include "aio.h"
+#include "ioring.h"
 #include "BlockDevice.h"
 
 class KernelDevice : public BlockDevice {
@@ -37,7 +38,7 @@ class KernelDevice : public BlockDevice {
   std::atomic<bool> io_since_flush = {false};
   std::mutex flush_mutex;
 
-  aio_queue_t aio_queue;
+  std::unique_ptr<io_queue_t> io_queue;
   bool aio_stop;
 
   struct AioCompletionThread : public Thread {
@@ -5,6 +5,8 @@
 #include "bluestore_types.h"
 #include "common/debug.h"
 
+#include <queue>
+
 #define dout_context cct
 #define dout_subsys ceph_subsys_bluestore
 #undef dout_prefix
@@ -278,6 +280,47 @@ void StupidAllocator::dump()
   }
 }
 
+void StupidAllocator::dump(std::function<void(uint64_t offset,
+					       uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  // an extent is only merged with its neighbours in the same bin, so
+  // walk all bins together in offset order and report neighbours that
+  // ended up in different bins as one extent
+  typedef pair<uint64_t,unsigned> pos_t;  // offset, bin
+  std::priority_queue<pos_t, vector<pos_t>, std::greater<pos_t>> next;
+  vector<interval_set_t::iterator> pos;
+  pos.reserve(free.size());
+  for (unsigned bin = 0; bin < free.size(); ++bin) {
+    pos.push_back(free[bin].begin());
+    if (pos[bin] != free[bin].end()) {
+      next.push(make_pair(pos[bin].get_start(), bin));
+    }
+  }
+  uint64_t start = 0, len = 0;
+  while (!next.empty()) {
+    unsigned bin = next.top().second;
+    next.pop();
+    auto& p = pos[bin];
+    if (len && start + len == p.get_start()) {
+      len += p.get_len();
+    } else {
+      if (len) {
+	notify(start, len);
+      }
+      start = p.get_start();
+      len = p.get_len();
+    }
+    ++p;
+    if (p != free[bin].end()) {
+      next.push(make_pair(p.get_start(), bin));
+    }
+  }
+  if (len) {
+    notify(start, len);
+  }
+}
+
 void StupidAllocator::init_add_free(uint64_t offset, uint64_t length)
 {
   std::lock_guard<std::mutex> l(lock);
@@ -4,6 +4,8 @@
 #pragma once
 # include <libaio.h>
 
+#include <vector>
+
 #include <boost/intrusive/list.hpp>
 #include <boost/container/small_vector.hpp>
 
@@ -17,23 +19,28 @@ struct aio_t {
   boost::container::small_vector<iovec,4> iov;
   uint64_t offset, length;
   int rval;
+  bool write;     ///< false for reads; lets non-libaio queues prepare the io
   bufferlist bl;  ///< write payload (so that it remains stable for duration)
 
   boost::intrusive::list_member_hook<> queue_item;
 
-  aio_t(void *p, int f) : priv(p), fd(f), offset(0), length(0), rval(-1000) {
+  aio_t(void *p, int f) : priv(p), fd(f), offset(0), length(0), rval(-1000),
+			  write(false) {
   }
 
   void pwritev(uint64_t _offset, uint64_t len) {
     offset = _offset;
     length = len;
+    write = true;
     io_prep_pwritev(&iocb, fd, &iov[0], iov.size(), offset);
   }
   void pread(uint64_t _offset, uint64_t len) {
     offset = _offset;
     length = len;
+    write = false;
     bufferptr p = buffer::create_page_aligned(length);
     io_prep_pread(&iocb, fd, p.c_str(), length, offset);
+    iov.push_back({p.c_str(), length});
     bl.append(std::move(p));
   }
 
@@ -51,21 +58,34 @@ typedef boost::intrusive::list<
     boost::intrusive::list_member_hook<>,
     &aio_t::queue_item> > aio_list_t;
 
-struct aio_queue_t {
+/// interface for the kernel async io mechanism a BlockDevice submits to
+struct io_queue_t {
+  typedef list<aio_t>::iterator aio_iter;
+
+  virtual ~io_queue_t() {}
+
+  /// set up the queue; fds may be registered with the kernel up front
+  virtual int init(std::vector<int> &fds) = 0;
+  virtual void shutdown() = 0;
+  virtual int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+			   void *priv, int *retries) = 0;
+  virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+};
+
+struct aio_queue_t final : public io_queue_t {
   int max_iodepth;
   io_context_t ctx;
 
-  typedef list<aio_t>::iterator aio_iter;
-
   explicit aio_queue_t(unsigned max_iodepth)
     : max_iodepth(max_iodepth),
       ctx(0) {
   }
-  ~aio_queue_t() {
+  ~aio_queue_t() final {
     assert(ctx == 0);
   }
 
-  int init() {
+  int init(std::vector<int> &fds) final {
+    (void)fds;
     assert(ctx == 0);
     int r = io_setup(max_iodepth, &ctx);
     if (r < 0) {
@@ -76,7 +96,7 @@ struct aio_queue_t {
     }
     return r;
   }
-  void shutdown() {
+  void shutdown() final {
     if (ctx) {
       int r = io_destroy(ctx);
       assert(r == 0);
@@ -84,7 +104,7 @@ struct aio_queue_t {
     }
   }
 
-  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size, 
-		   void *priv, int *retries);
-  int get_next_completed(int timeout_ms, aio_t **paio, int max);
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
 };
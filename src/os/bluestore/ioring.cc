@@ -0,0 +1,483 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ioring.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+
+#include "common/Clock.h"
+
+struct ioring_data {
+  int ring_fd = -1;
+  int epoll_fd = -1;
+  struct io_uring_params params;
+
+  // submission ring
+  void *sq_ptr = MAP_FAILED;
+  size_t sq_size = 0;
+  unsigned *sq_head = nullptr;
+  unsigned *sq_tail = nullptr;
+  unsigned *sq_ring_mask = nullptr;
+  unsigned *sq_ring_entries = nullptr;
+  unsigned *sq_flags = nullptr;
+  unsigned *sq_array = nullptr;
+  struct io_uring_sqe *sqes = (struct io_uring_sqe *)MAP_FAILED;
+  size_t sqes_size = 0;
+
+  // completion ring
+  void *cq_ptr = MAP_FAILED;
+  size_t cq_size = 0;
+  unsigned *cq_head = nullptr;
+  unsigned *cq_tail = nullptr;
+  unsigned *cq_ring_mask = nullptr;
+  struct io_uring_cqe *cqes = nullptr;
+
+  /// submitted io whose completion has not been reaped yet
+  std::atomic<unsigned> inflight = {0};
+
+  std::map<int, int> fixed_fds;  ///< fd -> index in the registered file set
+
+  ioring_data() {
+    memset(&params, 0, sizeof(params));
+  }
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  int r = syscall(__NR_io_uring_setup, entries, p);
+  return r < 0 ? -errno : r;
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+  int r = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		  nullptr, 0);
+  return r < 0 ? -errno : r;
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+				 unsigned nr_args)
+{
+  int r = syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+  return r < 0 ? -errno : r;
+}
+
+static int ioring_map_rings(ioring_data *d)
+{
+  struct io_uring_params &p = d->params;
+
+  d->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  d->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    d->sq_size = d->cq_size = std::max(d->sq_size, d->cq_size);
+  }
+
+  d->sq_ptr = mmap(0, d->sq_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, d->ring_fd, IORING_OFF_SQ_RING);
+  if (d->sq_ptr == MAP_FAILED) {
+    return -errno;
+  }
+  if (single_mmap) {
+    d->cq_ptr = d->sq_ptr;
+  } else {
+    d->cq_ptr = mmap(0, d->cq_size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, d->ring_fd, IORING_OFF_CQ_RING);
+    if (d->cq_ptr == MAP_FAILED) {
+      return -errno;
+    }
+  }
+  d->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  d->sqes = (struct io_uring_sqe *)mmap(0, d->sqes_size,
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE,
+					d->ring_fd, IORING_OFF_SQES);
+  if (d->sqes == MAP_FAILED) {
+    return -errno;
+  }
+
+  char *sq = (char *)d->sq_ptr;
+  d->sq_head = (unsigned *)(sq + p.sq_off.head);
+  d->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  d->sq_ring_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  d->sq_ring_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+  d->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+  d->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+  char *cq = (char *)d->cq_ptr;
+  d->cq_head = (unsigned *)(cq + p.cq_off.head);
+  d->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  d->cq_ring_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  d->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+static void ioring_unmap_rings(ioring_data *d)
+{
+  if (d->sqes != MAP_FAILED) {
+    munmap(d->sqes, d->sqes_size);
+    d->sqes = (struct io_uring_sqe *)MAP_FAILED;
+  }
+  if (d->cq_ptr != MAP_FAILED && d->cq_ptr != d->sq_ptr) {
+    munmap(d->cq_ptr, d->cq_size);
+  }
+  d->cq_ptr = MAP_FAILED;
+  if (d->sq_ptr != MAP_FAILED) {
+    munmap(d->sq_ptr, d->sq_size);
+    d->sq_ptr = MAP_FAILED;
+  }
+}
+
+static void ioring_prep_sqe(ioring_data *d, aio_t *aio,
+			    struct io_uring_sqe *sqe)
+{
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = aio->write ? IORING_OP_WRITEV : IORING_OP_READV;
+  auto p = d->fixed_fds.find(aio->fd);
+  if (p != d->fixed_fds.end()) {
+    sqe->fd = p->second;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = aio->fd;
+  }
+  sqe->addr = (unsigned long)aio->iov.data();
+  sqe->len = aio->iov.size();
+  sqe->off = aio->offset;
+  sqe->user_data = (unsigned long)aio;
+}
+
+/// pop up to max completions off the completion ring; never blocks
+static int ioring_reap(ioring_data *d, aio_t **paio, int max)
+{
+  unsigned head = *d->cq_head;
+  unsigned tail = __atomic_load_n(d->cq_tail, __ATOMIC_ACQUIRE);
+  unsigned mask = *d->cq_ring_mask;
+  int n = 0;
+  while (head != tail && n < max) {
+    struct io_uring_cqe *cqe = &d->cqes[head & mask];
+    aio_t *aio = (aio_t *)(unsigned long)cqe->user_data;
+    aio->rval = cqe->res;
+    paio[n++] = aio;
+    ++head;
+  }
+  __atomic_store_n(d->cq_head, head, __ATOMIC_RELEASE);
+  d->inflight -= n;
+  return n;
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_,
+			       bool sq_thread_)
+  : d(new ioring_data),
+    iodepth(iodepth_),
+    hipri(hipri_),
+    sq_thread(sq_thread_)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+  assert(d->ring_fd < 0);
+}
+
+bool ioring_queue_t::supported()
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = sys_io_uring_setup(16, &p);
+  if (fd < 0) {
+    return false;
+  }
+  ::close(fd);
+  return true;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  assert(d->ring_fd < 0);
+  memset(&d->params, 0, sizeof(d->params));
+  if (hipri) {
+    d->params.flags |= IORING_SETUP_IOPOLL;
+  }
+  if (sq_thread) {
+    d->params.flags |= IORING_SETUP_SQPOLL;
+  }
+  int r = sys_io_uring_setup(iodepth, &d->params);
+  if (r == -EPERM && sq_thread) {
+    // before 5.11 only CAP_SYS_ADMIN may have an sq thread
+    sq_thread = false;
+    return init(fds);
+  }
+  if (r < 0) {
+    return r;
+  }
+  d->ring_fd = r;
+
+  r = ioring_map_rings(d.get());
+  if (r < 0) {
+    goto out_fail;
+  }
+
+  // the kernel can skip the fd table lookup for registered files.  this is
+  // only an optimization, so carry on without it if registration fails.
+  if (!fds.empty() &&
+      sys_io_uring_register(d->ring_fd, IORING_REGISTER_FILES,
+			    fds.data(), fds.size()) == 0) {
+    for (unsigned i = 0; i < fds.size(); ++i) {
+      d->fixed_fds[fds[i]] = i;
+    }
+  }
+  if (sq_thread && d->fixed_fds.size() < fds.size()) {
+    bool nonfixed = false;
+#if defined(IORING_FEAT_SQPOLL_NONFIXED)
+    nonfixed = d->params.features & IORING_FEAT_SQPOLL_NONFIXED;
+#endif
+    if (!nonfixed) {
+      // before 5.11 the sq thread fails io on files that are not
+      // registered, so do without it
+      shutdown();
+      sq_thread = false;
+      return init(fds);
+    }
+  }
+
+  // polled rings complete io from within io_uring_enter, so there is
+  // nothing to wait on; otherwise the ring fd signals a non-empty cq.
+  if (!hipri) {
+    d->epoll_fd = epoll_create1(0);
+    if (d->epoll_fd < 0) {
+      r = -errno;
+      goto out_fail;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = d->ring_fd;
+    if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->ring_fd, &ev) < 0) {
+      r = -errno;
+      goto out_fail;
+    }
+  }
+  return 0;
+
+ out_fail:
+  shutdown();
+  return r;
+}
+
+void ioring_queue_t::shutdown()
+{
+  ioring_unmap_rings(d.get());
+  d->fixed_fds.clear();
+  if (d->epoll_fd >= 0) {
+    ::close(d->epoll_fd);
+    d->epoll_fd = -1;
+  }
+  if (d->ring_fd >= 0) {
+    ::close(d->ring_fd);
+    d->ring_fd = -1;
+  }
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  (void)aios_size;
+  // 2^16 * 125us = ~8 seconds, so max sleep is ~16 seconds
+  int attempts = 16;
+  int delay = 125;
+
+  std::lock_guard<std::mutex> l(sq_mutex);
+  unsigned mask = *d->sq_ring_mask;
+  unsigned entries = *d->sq_ring_entries;
+  unsigned tail = *d->sq_tail;
+  unsigned to_submit = 0;
+  int done = 0;
+
+  // kernels without IORING_FEAT_NODROP drop completions that do not fit
+  // in the completion ring, so never have more io in flight than that.
+  unsigned max_inflight = d->params.cq_entries;
+  int cq_attempts = 16;
+  int cq_delay = 125;
+
+  aio_iter cur = begin;
+  while (cur != end || to_submit > 0) {
+    // fill as much of the submission ring as we can
+    unsigned head = __atomic_load_n(d->sq_head, __ATOMIC_ACQUIRE);
+    unsigned queued = 0;
+    while (cur != end && tail - head < entries &&
+	   d->inflight < max_inflight) {
+      cur->priv = priv;
+      unsigned index = tail & mask;
+      ioring_prep_sqe(d.get(), &*cur, &d->sqes[index]);
+      d->sq_array[index] = index;
+      ++d->inflight;
+      ++tail;
+      ++to_submit;
+      ++queued;
+      ++cur;
+    }
+    __atomic_store_n(d->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (queued) {
+      cq_attempts = 16;
+      cq_delay = 125;
+    } else if (to_submit == 0 && cur != end &&
+	       d->inflight >= max_inflight) {
+      // wait for the completion thread to make room in the cq
+      if (cq_attempts-- == 0) {
+	return -EAGAIN;
+      }
+      usleep(cq_delay);
+      cq_delay *= 2;
+      (*retries)++;
+      continue;
+    }
+
+    if (sq_thread) {
+      // the kernel thread consumes the ring on its own; we only need to
+      // kick it if it went to sleep.
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(d->sq_flags, __ATOMIC_RELAXED) &
+	  IORING_SQ_NEED_WAKEUP) {
+	sys_io_uring_enter(d->ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+      }
+      done += to_submit;
+      to_submit = 0;
+      if (cur != end) {
+	// the ring is full.  the sq thread only falls behind when the
+	// device is, so wait for some io to complete (or for the sq thread
+	// to make room, where the kernel can tell us), backing off like the
+	// non-polled path and giving up after as many attempts.
+	if (attempts-- == 0) {
+	  return -EAGAIN;
+	}
+#if defined(IORING_ENTER_SQ_WAIT)
+	sys_io_uring_enter(d->ring_fd, 0, 0, IORING_ENTER_SQ_WAIT);
+#else
+	sys_io_uring_enter(d->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+#endif
+	if (__atomic_load_n(d->sq_head, __ATOMIC_ACQUIRE) == head) {
+	  usleep(delay);
+	  delay *= 2;
+	}
+	(*retries)++;
+      }
+      continue;
+    }
+
+    int r = sys_io_uring_enter(d->ring_fd, to_submit, 0, 0);
+    if (r < 0) {
+      if ((r == -EAGAIN || r == -EBUSY || r == -EINTR) && attempts-- > 0) {
+	usleep(delay);
+	delay *= 2;
+	(*retries)++;
+	continue;
+      }
+      return r;
+    }
+    done += r;
+    to_submit -= r;
+  }
+  return done;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  std::lock_guard<std::mutex> l(cq_mutex);
+  int r = ioring_reap(d.get(), paio, max);
+  if (r > 0) {
+    return r;
+  }
+
+#if defined(IORING_SQ_CQ_OVERFLOW)
+  // submit_batch keeps the cq from overflowing, but if it ever does,
+  // completions that did not fit are held back by the kernel until we ask
+  // for events explicitly.
+  if (__atomic_load_n(d->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+    sys_io_uring_enter(d->ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    r = ioring_reap(d.get(), paio, max);
+    if (r > 0) {
+      return r;
+    }
+  }
+#endif
+
+  if (hipri) {
+    // busy-poll the device until something completes or we time out
+    utime_t until = ceph_clock_now();
+    until += (double)timeout_ms / 1000.0;
+    do {
+      r = sys_io_uring_enter(d->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+      if (r < 0 && r != -EINTR && r != -EAGAIN) {
+	return r;
+      }
+      r = ioring_reap(d.get(), paio, max);
+    } while (r == 0 && ceph_clock_now() < until);
+    return r;
+  }
+
+  struct epoll_event ev;
+  r = epoll_wait(d->epoll_fd, &ev, 1, timeout_ms);
+  if (r < 0) {
+    return errno == EINTR ? 0 : -errno;
+  }
+  if (r == 0) {
+    return 0;
+  }
+  return ioring_reap(d.get(), paio, max);
+}
+
+#else // #if defined(HAVE_IO_URING)
+
+struct ioring_data {};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_,
+			       bool sq_thread_)
+{
+  ceph_abort();
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+  ceph_abort();
+}
+
+bool ioring_queue_t::supported()
+{
+  return false;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  ceph_abort();
+}
+
+void ioring_queue_t::shutdown()
+{
+  ceph_abort();
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  ceph_abort();
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  ceph_abort();
+}
+
+#endif // #if defined(HAVE_IO_URING)
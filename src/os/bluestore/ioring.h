@@ -0,0 +1,50 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include "acconfig.h"
+
+#include <memory>
+#include <mutex>
+
+#include "aio.h"
+
+struct ioring_data;
+
+/**
+ * io_queue_t on top of linux io_uring
+ *
+ * Submissions from all threads are batched into the shared submission
+ * ring and handed to the kernel with a single io_uring_enter(2).  The
+ * devices' fds are registered with the ring at init time so the kernel
+ * does not need to look them up for every io.  Completions are reaped
+ * straight from the mmap'ed completion ring; we only block (in epoll)
+ * when the ring is empty.  No more io is kept in flight than the
+ * completion ring can hold.
+ *
+ * sq_thread is cleared by init() if the kernel cannot give us a polling
+ * thread for the ring.
+ */
+struct ioring_queue_t final : public io_queue_t {
+  std::unique_ptr<ioring_data> d;
+  unsigned iodepth = 0;
+  bool hipri = false;
+  bool sq_thread = false;
+
+  std::mutex sq_mutex;
+  std::mutex cq_mutex;
+
+  ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_);
+  ~ioring_queue_t() final;
+
+  /// true if the running kernel lets us set up a ring
+  static bool supported();
+
+  int init(std::vector<int> &fds) final;
+  void shutdown() final;
+
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+};
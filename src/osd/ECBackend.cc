@@ -197,6 +197,7 @@ ECBackend::ECBackend(
   ErasureCodeInterfaceRef ec_impl,
   uint64_t stripe_width)
   : PGBackend(cct, pg, store, coll, ch),
+    stripe_cache(stripe_width),
     ec_impl(ec_impl),
     sinfo(ec_impl->get_data_chunk_count(), stripe_width) {
   assert((ec_impl->get_data_chunk_count() *
@@ -411,8 +412,30 @@ void ECBackend::handle_recovery_read_complete(
     from[i->first.shard].claim(i->second);
   }
   dout(10) << __func__ << ": " << from << dendl;
+  if (ec_impl->get_sub_chunk_count() > 1 &&
+      !from.empty() &&
+      from.begin()->second.length() ==
+        sinfo.aligned_logical_offset_to_chunk_offset(to_read.get<1>())) {
+    // whole chunks were read, either because the plugin asked for them
+    // or because a sub-chunk read failed and was retried: make sure the
+    // decode does not take them for the sub-chunks of a repair.
+    set<int> want, minimum;
+    map<int, int> avail;
+    for (auto &&i : target)
+      want.insert(i.first);
+    for (auto &&i : from)
+      avail[i.first] = 0;
+    int r = ec_impl->minimum_to_decode_with_cost(want, avail, &minimum);
+    assert(r == 0);
+    for (auto i = from.begin(); i != from.end(); ) {
+      if (minimum.count(i->first))
+	++i;
+      else
+	from.erase(i++);
+    }
+  }
   int r;
-  r = ECUtil::decode(sinfo, ec_impl, from, target);
+  r = ECUtil::decode(sinfo, ec_impl, from, target, cct);
   assert(r == 0);
   if (attrs) {
     op.xattrs.swap(*attrs);
@@ -1023,7 +1046,8 @@ void ECBackend::handle_sub_read(
 	  bl, j->get<2>()); // Allow EIO return
       } else {
         dout(25) << __func__ << " case2: going to do fragmented read." << dendl;
-        for (int m = 0; m < (int)j->get<1>(); m += sinfo.get_chunk_size()) {
+        for (int m = 0; m < (int)j->get<1>() && r >= 0;
+	     m += sinfo.get_chunk_size()) {
           for (auto &&k:op.subchunks.find(i->first)->second) {
             bufferlist bl0;
             r = store->read(
@@ -1032,6 +1056,11 @@ void ECBackend::handle_sub_read(
                 j->get<0>() + m + (k.first)*subchunk_size,
                 (k.second)*subchunk_size,
                 bl0, j->get<2>());
+            if (r < 0) {
+              // stop at the first failed range: the reply must carry the
+              // error, not whatever a later range returned
+              break;
+            }
             bl.claim_append(bl0);
           }
         }
@@ -1231,6 +1260,24 @@ void ECBackend::handle_sub_read_reply(
       map<int, vector<pair<int, int>>> dummy_minimum;
       get_want_to_read_shards(&want_to_read);
       int err;
+      auto req = rop.to_read.find(iter->first);
+      if (!iter->second.errors.empty() &&
+	  req != rop.to_read.end() &&
+	  read_used_subchunks(req->second)) {
+	// the helpers that did answer only sent the sub-chunks for the
+	// repair they were picked for, which is of no use for any other
+	// decode: read whole chunks from every other shard instead.
+	dout(10) << __func__ << " sub-chunk read of " << iter->first
+		 << " failed on " << iter->second.errors << dendl;
+	if (rop.in_progress.empty()) {
+	  int r = send_all_remaining_reads(iter->first, rop);
+	  if (r == 0)
+	    continue;
+	  rop.complete[iter->first].r = -EIO;
+	  ++is_complete;
+	}
+	continue;
+      }
       if ((err = ec_impl->minimum_to_decode(want_to_read, have, &dummy_minimum)) < 0) {
 	dout(20) << __func__ << " minimum_to_decode failed" << dendl;
         if (rop.in_progress.empty()) {
@@ -1411,6 +1458,8 @@ void ECBackend::on_change()
     cache.release_write_pin(op.second.pin);
   }
   tid_to_op_map.clear();
+  // writes may be rolled back from here on
+  stripe_cache.clear();
 
   for (map<ceph_tid_t, ReadOp>::iterator i = tid_to_read_map.begin();
        i != tid_to_read_map.end();
@@ -1832,6 +1881,13 @@ bool ECBackend::try_state_to_reads()
   waiting_state.pop_front();
   waiting_reads.push_back(*op);
 
+  if (get_parent()->get_pool().allows_ecoverwrites()) {
+    for (auto &&i: op->plan.will_write) {
+      if (!op->using_cache || op->plan.resets.count(i.first))
+	stripe_cache.forget(i.first, op->tid);
+    }
+  }
+
   if (op->using_cache) {
     cache.open_write_pin(op->pin);
 
@@ -1852,6 +1908,18 @@ bool ECBackend::try_state_to_reads()
       extent_set pending_read = to_read_plan;
       pending_read.subtract(remote_read);
 
+      // nothing in flight writes to the extents left to read: if they
+      // were read or written recently enough, they are in stripe_cache
+      if (!remote_read.empty()) {
+	extent_map cached;
+	remote_read = stripe_cache.lookup(hpair.first, remote_read, &cached);
+	if (!cached.empty()) {
+	  dout(20) << __func__ << ": " << hpair.first << " "
+		   << cached.get_interval_set() << " in stripe cache" << dendl;
+	  op->stripe_cache_result[hpair.first] = std::move(cached);
+	}
+      }
+
       if (!remote_read.empty()) {
 	op->remote_read[hpair.first] = std::move(remote_read);
       }
@@ -1906,6 +1974,10 @@ bool ECBackend::try_reads_to_commit()
 	  hpair.second));
     }
     op->pending_read.clear();
+    for (auto &&hpair: op->stripe_cache_result) {
+      op->remote_read_result[hpair.first].insert(hpair.second);
+    }
+    op->stripe_cache_result.clear();
   } else {
     assert(op->pending_read.empty());
   }
@@ -1963,6 +2035,25 @@ bool ECBackend::try_reads_to_commit()
       cache.present_rmw_update(hpair.first, op->pin, hpair.second);
     }
   }
+  if (get_parent()->get_pool().allows_ecoverwrites()) {
+    // keep the stripes that were read-modify-written: a partial write
+    // is likely to be followed by another one nearby
+    stripe_cache.set_max_bytes(
+      cct->_conf->get_val<uint64_t>("osd_ec_stripe_cache_size"));
+    extent_map none;
+    extent_set empty;
+    for (auto &&i: op->plan.will_write) {
+      auto w = written.find(i.first);
+      auto to_read = op->plan.to_read.find(i.first);
+      stripe_cache.update(
+	i.first,
+	op->tid,
+	w == written.end() ? none : w->second,
+	!op->using_cache || to_read == op->plan.to_read.end() ?
+	  empty : to_read->second);
+    }
+    dout(20) << __func__ << ": " << stripe_cache << dendl;
+  }
   op->remote_read.clear();
   op->remote_read_result.clear();
 
@@ -2260,7 +2351,8 @@ struct CallClientContexts :
 	ec->sinfo,
 	ec->ec_impl,
 	to_decode,
-	&bl);
+	&bl,
+	ec->cct);
       if (r < 0) {
         res.r = r;
         goto out;
@@ -2333,14 +2425,34 @@ void ECBackend::objects_read_and_reconstruct(
 }
 
 
+bool ECBackend::read_used_subchunks(const read_request_t &req) const
+{
+  for (auto &&i : req.need) {
+    if (i.second.size() != 1 ||
+	i.second.front() != make_pair(0, ec_impl->get_sub_chunk_count()))
+      return true;
+  }
+  return false;
+}
+
 int ECBackend::send_all_remaining_reads(
   const hobject_t &hoid,
   ReadOp &rop)
 {
   set<int> already_read;
-  const set<pg_shard_t>& ots = rop.obj_to_source[hoid];
-  for (set<pg_shard_t>::iterator i = ots.begin(); i != ots.end(); ++i)
-    already_read.insert(i->shard);
+  if (read_used_subchunks(rop.to_read.find(hoid)->second)) {
+    // what the other shards returned is only good for the repair that
+    // failed: drop it and read them again in full, skipping the ones
+    // in error
+    for (auto &&i : rop.complete[hoid].errors)
+      already_read.insert(i.first.shard);
+    for (auto &&i : rop.complete[hoid].returned)
+      i.get<2>().clear();
+  } else {
+    const set<pg_shard_t>& ots = rop.obj_to_source[hoid];
+    for (set<pg_shard_t>::iterator i = ots.begin(); i != ots.end(); ++i)
+      already_read.insert(i->shard);
+  }
   dout(10) << __func__ << " have/error shards=" << already_read << dendl;
   map<pg_shard_t, vector<pair<int, int>>> shards;
   int r = get_remaining_shards(hoid, already_read, &shards, rop.for_recovery);
@@ -2457,6 +2569,7 @@ int ECBackend::be_deep_scrub(
     pos.data_hash << bl;
   }
   pos.data_pos += r;
+  pos.bytes_read += r;
   if (r == (int)stride) {
     return -EINPROGRESS;
   }
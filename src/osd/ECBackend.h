@@ -433,6 +433,8 @@ public:
     bool do_redundant_reads, bool for_recovery);
 
   void do_read_op(ReadOp &rop);
+  /// true if some shard was asked for less than its whole chunk
+  bool read_used_subchunks(const read_request_t &req) const;
   int send_all_remaining_reads(
     const hobject_t &hoid,
     ReadOp &rop);
@@ -486,6 +488,7 @@ public:
     map<hobject_t,extent_set> pending_read; // subset already being read
     map<hobject_t,extent_set> remote_read;  // subset we must read
     map<hobject_t,extent_map> remote_read_result;
+    map<hobject_t,extent_map> stripe_cache_result; // subset in stripe_cache
     bool read_in_progress() const {
       return !remote_read.empty() && remote_read_result.empty();
     }
@@ -517,6 +520,7 @@ public:
   friend ostream &operator<<(ostream &lhs, const Op &rhs);
 
   ExtentCache cache;
+  StripeCache stripe_cache;
   map<ceph_tid_t, Op> tid_to_op_map; /// Owns Op structure
 
   /**
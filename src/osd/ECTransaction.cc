@@ -43,7 +43,7 @@ void encode_and_write(
 
   map<int, bufferlist> buffers;
   int r = ECUtil::encode(
-    sinfo, ecimpl, bl, want, &buffers);
+    sinfo, ecimpl, bl, want, &buffers, dpp ? dpp->get_cct() : nullptr);
   assert(r == 0);
 
   written.insert(offset, bl.length(), bl);
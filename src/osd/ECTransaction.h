@@ -28,6 +28,7 @@ namespace ECTransaction {
     bool invalidates_cache = false; // Yes, both are possible
     map<hobject_t,extent_set> to_read;
     map<hobject_t,extent_set> will_write; // superset of to_read
+    set<hobject_t> resets; // deleted, truncated or cloned into
 
     map<hobject_t,ECUtil::HashInfoRef> hash_infos;
   };
@@ -55,11 +56,13 @@ namespace ECTransaction {
 	  ldpp_dout(dpp, 20) << __func__ << ": delete, setting projected size"
 			     << " to 0" << dendl;
 	  projected_size = 0;
+	  plan.resets.insert(i.first);
 	}
 
 	hobject_t source;
 	if (i.second.has_source(&source)) {
 	  plan.invalidates_cache = true;
+	  plan.resets.insert(i.first);
 
 	  ECUtil::HashInfoRef shinfo = get_hinfo(source);
 	  projected_size = shinfo->get_projected_total_logical_size(sinfo);
@@ -69,6 +72,7 @@ namespace ECTransaction {
 	auto &will_write = plan.will_write[i.first];
 	if (i.second.truncate &&
 	    i.second.truncate->first < projected_size) {
+	  plan.resets.insert(i.first);
 	  if (!(sinfo.logical_offset_is_stripe_aligned(
 		  i.second.truncate->first))) {
 	    plan.to_read[i.first].union_insert(
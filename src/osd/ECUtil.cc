@@ -1,16 +1,174 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 
 #include <errno.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "include/compat.h"
 #include "include/encoding.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
 #include "ECUtil.h"
 
 using namespace std;
 
+namespace {
+
+/**
+ * Process-wide pool of threads coding runs of stripes for encode()
+ * and decode(), sized by osd_ec_parallel_threads when first used.
+ */
+class StripeCoderPool {
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+
+  void worker() {
+    std::unique_lock<std::mutex> l(lock);
+    while (true) {
+      if (!jobs.empty()) {
+	auto job = std::move(jobs.front());
+	jobs.pop_front();
+	l.unlock();
+	job();
+	l.lock();
+	continue;
+      }
+      if (stopping)
+	break;
+      cond.wait(l);
+    }
+  }
+
+public:
+  explicit StripeCoderPool(CephContext *cct) {
+    uint64_t n = cct->_conf->get_val<uint64_t>("osd_ec_parallel_threads");
+    for (uint64_t i = 0; i < n; ++i) {
+      threads.emplace_back([this] {
+	  ceph_pthread_setname(pthread_self(), "ec_coder");
+	  worker();
+	});
+    }
+  }
+  ~StripeCoderPool() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      stopping = true;
+    }
+    cond.notify_all();
+    for (auto &t : threads)
+      t.join();
+  }
+
+  unsigned size() const {
+    return threads.size();
+  }
+
+  void queue(std::function<void()> &&job) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      jobs.push_back(std::move(job));
+    }
+    cond.notify_one();
+  }
+};
+
+/**
+ * Splits count stripes (bytes in total) into runs: a single one unless
+ * the input is large enough to be worth handing to the coder pool.
+ */
+class StripeRuns {
+  StripeCoderPool *pool = nullptr;
+  uint64_t count;
+  unsigned runs = 1;
+
+public:
+  StripeRuns(CephContext *cct, uint64_t count, uint64_t bytes)
+    : count(count) {
+    if (!cct || count < 2 ||
+	bytes < cct->_conf->get_val<uint64_t>("osd_ec_parallel_min_bytes"))
+      return;
+    cct->lookup_or_create_singleton_object<StripeCoderPool>(
+      pool, "ECUtil::StripeCoderPool");
+    runs = std::min<uint64_t>(pool->size() + 1, count);
+  }
+
+  unsigned size() const {
+    return runs;
+  }
+
+  /**
+   * call f(run, first, last) for the stripes [first, last) of each run
+   *
+   * A token is queued to the pool for each run past the first, but
+   * runs are claimed in order by whoever gets there first: once the
+   * caller is done with run 0 it goes on to claim whatever runs the
+   * pool has not started yet, so a saturated pool never leaves it
+   * blocked behind other callers' work.  It only waits for runs a
+   * coder thread is already in the middle of.  Tokens which find
+   * nothing left to claim return at once; they share the batch state
+   * so that it outlives the call.
+   */
+  template <typename F>
+  void run(F &&f) {
+    auto first = [this](unsigned r) {
+      return count * r / runs;
+    };
+    if (runs == 1) {
+      f(0, first(0), first(1));
+      return;
+    }
+    struct Batch {
+      std::atomic<unsigned> next = {1};
+      unsigned runs;
+      std::function<void(unsigned)> fn;
+      std::mutex lock;
+      std::condition_variable cond;
+      unsigned done = 0;
+
+      // claim and code the next run; false once all have been claimed
+      bool claim() {
+	unsigned r = next++;
+	if (r >= runs)
+	  return false;
+	fn(r);
+	std::lock_guard<std::mutex> l(lock);
+	if (++done == runs - 1)
+	  cond.notify_one();
+	return true;
+      }
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->runs = runs;
+    batch->fn = [&](unsigned r) {
+      f(r, first(r), first(r + 1));
+    };
+    for (unsigned r = 1; r < runs; ++r) {
+      pool->queue([batch] {
+	  batch->claim();
+	});
+    }
+    f(0, first(0), first(1));
+    while (batch->claim()) ;
+    std::unique_lock<std::mutex> l(batch->lock);
+    batch->cond.wait(l, [&] { return batch->done == runs - 1; });
+  }
+};
+
+} // anonymous namespace
+
 int ECUtil::decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
   map<int, bufferlist> &to_decode,
-  bufferlist *out) {
+  bufferlist *out,
+  CephContext *cct) {
   assert(to_decode.size());
 
   uint64_t total_data_size = to_decode.begin()->second.length();
@@ -28,19 +186,27 @@ int ECUtil::decode(
   if (total_data_size == 0)
     return 0;
 
-  for (uint64_t i = 0; i < total_data_size; i += sinfo.get_chunk_size()) {
-    map<int, bufferlist> chunks;
-    for (map<int, bufferlist>::iterator j = to_decode.begin();
-	 j != to_decode.end();
-	 ++j) {
-      chunks[j->first].substr_of(j->second, i, sinfo.get_chunk_size());
-    }
-    bufferlist bl;
-    int r = ec_impl->decode_concat(chunks, &bl);
-    assert(r == 0);
-    assert(bl.length() == sinfo.get_stripe_width());
+  uint64_t stripes = total_data_size / sinfo.get_chunk_size();
+  StripeRuns runs(cct, stripes, stripes * sinfo.get_stripe_width());
+  vector<bufferlist> decoded(runs.size());
+  runs.run([&](unsigned run, uint64_t first, uint64_t last) {
+      for (uint64_t s = first; s < last; ++s) {
+	map<int, bufferlist> chunks;
+	for (map<int, bufferlist>::iterator j = to_decode.begin();
+	     j != to_decode.end();
+	     ++j) {
+	  chunks[j->first].substr_of(j->second, s * sinfo.get_chunk_size(),
+				     sinfo.get_chunk_size());
+	}
+	bufferlist bl;
+	int r = ec_impl->decode_concat(chunks, &bl);
+	assert(r == 0);
+	assert(bl.length() == sinfo.get_stripe_width());
+	decoded[run].claim_append(bl);
+      }
+    });
+  for (auto &bl : decoded)
     out->claim_append(bl);
-  }
   return 0;
 }
 
@@ -48,7 +214,8 @@ int ECUtil::decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
   map<int, bufferlist> &to_decode,
-  map<int, bufferlist*> &out) {
+  map<int, bufferlist*> &out,
+  CephContext *cct) {
 
   assert(to_decode.size());
 
@@ -93,23 +260,32 @@ int ECUtil::decode(
     }
   }
 
-  for (int i = 0; i < chunks_count; i++) {
-    map<int, bufferlist> chunks;
-    for (auto j = to_decode.begin();
-	 j != to_decode.end();
-	 ++j) {
-      chunks[j->first].substr_of(j->second, 
-                                 i*repair_data_per_chunk, 
-                                 repair_data_per_chunk);
-    }
-    map<int, bufferlist> out_bls;
-    r = ec_impl->decode(need, chunks, &out_bls, sinfo.get_chunk_size());
-    assert(r == 0);
-    for (auto j = out.begin(); j != out.end(); ++j) {
-      assert(out_bls.count(j->first));
-      assert(out_bls[j->first].length() == sinfo.get_chunk_size());
-      j->second->claim_append(out_bls[j->first]);
-    }
+  StripeRuns runs(cct, chunks_count,
+		  (uint64_t)chunks_count * sinfo.get_stripe_width());
+  vector<map<int, bufferlist>> decoded(runs.size());
+  runs.run([&](unsigned run, uint64_t first, uint64_t last) {
+      for (uint64_t i = first; i < last; i++) {
+	map<int, bufferlist> chunks;
+	for (auto j = to_decode.begin();
+	     j != to_decode.end();
+	     ++j) {
+	  chunks[j->first].substr_of(j->second,
+				     i*repair_data_per_chunk,
+				     repair_data_per_chunk);
+	}
+	map<int, bufferlist> out_bls;
+	int r = ec_impl->decode(need, chunks, &out_bls, sinfo.get_chunk_size());
+	assert(r == 0);
+	for (auto j = out.begin(); j != out.end(); ++j) {
+	  assert(out_bls.count(j->first));
+	  assert(out_bls[j->first].length() == sinfo.get_chunk_size());
+	  decoded[run][j->first].claim_append(out_bls[j->first]);
+	}
+      }
+    });
+  for (auto &part : decoded) {
+    for (auto j = out.begin(); j != out.end(); ++j)
+      j->second->claim_append(part[j->first]);
   }
   for (auto &&i : out) {
     assert(i.second->length() == chunks_count * sinfo.get_chunk_size());
@@ -122,7 +298,8 @@ int ECUtil::encode(
   ErasureCodeInterfaceRef &ec_impl,
   bufferlist &in,
   const set<int> &want,
-  map<int, bufferlist> *out) {
+  map<int, bufferlist> *out,
+  CephContext *cct) {
 
   uint64_t logical_size = in.length();
 
@@ -133,18 +310,27 @@ int ECUtil::encode(
   if (logical_size == 0)
     return 0;
 
-  for (uint64_t i = 0; i < logical_size; i += sinfo.get_stripe_width()) {
-    map<int, bufferlist> encoded;
-    bufferlist buf;
-    buf.substr_of(in, i, sinfo.get_stripe_width());
-    int r = ec_impl->encode(want, buf, &encoded);
-    assert(r == 0);
-    for (map<int, bufferlist>::iterator i = encoded.begin();
-	 i != encoded.end();
-	 ++i) {
-      assert(i->second.length() == sinfo.get_chunk_size());
-      (*out)[i->first].claim_append(i->second);
-    }
+  StripeRuns runs(cct, logical_size / sinfo.get_stripe_width(), logical_size);
+  vector<map<int, bufferlist>> encoded_runs(runs.size());
+  runs.run([&](unsigned run, uint64_t first, uint64_t last) {
+      for (uint64_t s = first; s < last; ++s) {
+	map<int, bufferlist> encoded;
+	bufferlist buf;
+	buf.substr_of(in, s * sinfo.get_stripe_width(),
+		      sinfo.get_stripe_width());
+	int r = ec_impl->encode(want, buf, &encoded);
+	assert(r == 0);
+	for (map<int, bufferlist>::iterator i = encoded.begin();
+	     i != encoded.end();
+	     ++i) {
+	  assert(i->second.length() == sinfo.get_chunk_size());
+	  encoded_runs[run][i->first].claim_append(i->second);
+	}
+      }
+    });
+  for (auto &part : encoded_runs) {
+    for (auto &i : part)
+      (*out)[i.first].claim_append(i.second);
   }
 
   for (map<int, bufferlist>::iterator i = out->begin();
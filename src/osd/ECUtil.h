@@ -21,6 +21,8 @@
 #include "include/encoding.h"
 #include "common/Formatter.h"
 
+class CephContext;
+
 namespace ECUtil {
 
 class stripe_info_t {
@@ -78,24 +80,38 @@ public:
   }
 };
 
+/*
+ * encode() and decode() work one stripe at a time.  When given a cct,
+ * inputs of at least osd_ec_parallel_min_bytes are split into runs of
+ * stripes that are handed to the process-wide pool of
+ * osd_ec_parallel_threads coder threads, the calling thread taking the
+ * first run itself and then any the pool has not yet started.  Each
+ * run codes into its own bufferlists, which are then claim_append()ed
+ * to the output in stripe order, so the result is the same as the
+ * serial loop without copying any data.
+ * The erasure code plugin must tolerate concurrent calls.
+ */
 int decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
   std::map<int, bufferlist> &to_decode,
-  bufferlist *out);
+  bufferlist *out,
+  CephContext *cct = nullptr);
 
 int decode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
   std::map<int, bufferlist> &to_decode,
-  std::map<int, bufferlist*> &out);
+  std::map<int, bufferlist*> &out,
+  CephContext *cct = nullptr);
 
 int encode(
   const stripe_info_t &sinfo,
   ErasureCodeInterfaceRef &ec_impl,
   bufferlist &in,
   const std::set<int> &want,
-  std::map<int, bufferlist> *out);
+  std::map<int, bufferlist> *out,
+  CephContext *cct = nullptr);
 
 class HashInfo {
   uint64_t total_chunk_size = 0;
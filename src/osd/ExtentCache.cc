@@ -239,3 +239,131 @@ ostream &operator<<(ostream &lhs, const ExtentCache &cache)
 {
   return cache.print(lhs);
 }
+
+void StripeCache::erase(
+  std::map<hobject_t, stripe_map>::iterator obj,
+  stripe_map::iterator p)
+{
+  lru.erase(lru.iterator_to(p->second));
+  bytes -= p->second.bl.length();
+  obj->second.erase(p);
+  if (obj->second.empty())
+    objects.erase(obj);
+}
+
+void StripeCache::trim()
+{
+  while (bytes > max_bytes) {
+    assert(!lru.empty());
+    stripe &victim = lru.back();
+    auto obj = objects.find(victim.oid);
+    assert(obj != objects.end());
+    erase(obj, obj->second.find(victim.offset));
+  }
+}
+
+extent_set StripeCache::lookup(
+  const hobject_t &oid,
+  const extent_set &to_read,
+  extent_map *found)
+{
+  auto obj = objects.find(oid);
+  if (obj == objects.end())
+    return to_read;
+
+  extent_set missing;
+  for (auto &&extent: to_read) {
+    assert(extent.first % stripe_width == 0);
+    assert(extent.second % stripe_width == 0);
+    for (uint64_t off = extent.first;
+	 off < extent.first + extent.second;
+	 off += stripe_width) {
+      auto p = obj->second.find(off);
+      if (p == obj->second.end()) {
+	missing.union_insert(off, stripe_width);
+	continue;
+      }
+      lru.erase(lru.iterator_to(p->second));
+      lru.push_front(p->second);
+      found->insert(off, stripe_width, p->second.bl);
+    }
+  }
+  return missing;
+}
+
+void StripeCache::update(
+  const hobject_t &oid,
+  uint64_t seq,
+  const extent_map &written,
+  const extent_set &keep)
+{
+  auto reset = resets.find(oid);
+  if (reset != resets.end()) {
+    if (seq < reset->second)
+      return;	// written before the object was reset
+    if (seq == reset->second)
+      resets.erase(reset);
+  }
+  for (auto &&extent: written) {
+    assert(extent.get_off() % stripe_width == 0);
+    assert(extent.get_len() % stripe_width == 0);
+    for (uint64_t off = extent.get_off();
+	 off < extent.get_off() + extent.get_len();
+	 off += stripe_width) {
+      auto obj = objects.find(oid);
+      if (obj != objects.end()) {
+	auto p = obj->second.find(off);
+	if (p != obj->second.end())
+	  erase(obj, p);
+      }
+      if (max_bytes < stripe_width || !keep.contains(off, stripe_width))
+	continue;
+
+      // copy rather than share: the stripe must not pin the whole write
+      // buffer it came from
+      bufferlist bl;
+      bl.substr_of(extent.get_val(), off - extent.get_off(), stripe_width);
+      bl.rebuild();
+      auto &s = objects[oid].emplace(
+	std::piecewise_construct,
+	std::forward_as_tuple(off),
+	std::forward_as_tuple(oid, off)).first->second;
+      s.bl.claim(bl);
+      lru.push_front(s);
+      bytes += stripe_width;
+    }
+  }
+  trim();
+}
+
+void StripeCache::forget(const hobject_t &oid, uint64_t seq)
+{
+  resets[oid] = seq;
+  auto obj = objects.find(oid);
+  if (obj == objects.end())
+    return;
+  for (auto &&p: obj->second) {
+    lru.erase(lru.iterator_to(p.second));
+    bytes -= p.second.bl.length();
+  }
+  objects.erase(obj);
+}
+
+void StripeCache::clear()
+{
+  lru.clear();
+  objects.clear();
+  resets.clear();
+  bytes = 0;
+}
+
+ostream &StripeCache::print(ostream &out) const
+{
+  return out << "StripeCache(" << objects.size() << " objects, "
+	     << bytes << "/" << max_bytes << " bytes)";
+}
+
+ostream &operator<<(ostream &lhs, const StripeCache &cache)
+{
+  return cache.print(lhs);
+}
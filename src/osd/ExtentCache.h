@@ -488,4 +488,104 @@ public:
 
 ostream &operator<<(ostream &lhs, const ExtentCache &cache);
 
+/**
+   StripeCache
+
+   ExtentCache only holds an extent while some in-flight write pins
+   it, so a partial overwrite of a stripe written just before still has
+   to read that stripe back from the shards once the earlier write has
+   completed.  StripeCache keeps the logical content of recently
+   read-modify-written stripes across operations, up to max_bytes,
+   evicting the least recently used first.
+
+   It is only as good as its owner keeps it: every write has to update
+   the stripes it wrote, in the order the writes complete, and a write
+   that changes more than that (delete, truncate, clone) has to forget
+   the object when it is queued, before any later write looks it up.
+   Writes queued before it may complete afterwards: their updates are
+   ignored until the write that forgot the object completes.  Lookups
+   must only be made for stripes that no in-flight write has pinned in
+   the ExtentCache.
+ */
+class StripeCache {
+  struct stripe {
+    boost::intrusive::list_member_hook<> lru_member;
+    const hobject_t oid;
+    const uint64_t offset;
+    bufferlist bl;
+    stripe(const hobject_t &oid, uint64_t offset)
+      : oid(oid), offset(offset) {}
+  };
+  using stripe_map = std::map<uint64_t, stripe>;
+  using lru_list = boost::intrusive::list<
+    stripe,
+    boost::intrusive::member_hook<
+      stripe,
+      boost::intrusive::list_member_hook<>,
+      &stripe::lru_member> >;
+
+  const uint64_t stripe_width;
+  uint64_t max_bytes = 0;
+  uint64_t bytes = 0;
+  std::map<hobject_t, stripe_map> objects;
+  lru_list lru;	///< most recently used first
+  std::map<hobject_t, uint64_t> resets; ///< oid -> seq of pending forget
+
+  void erase(std::map<hobject_t, stripe_map>::iterator obj,
+	     stripe_map::iterator p);
+  void trim();
+
+public:
+  explicit StripeCache(uint64_t stripe_width) : stripe_width(stripe_width) {}
+  ~StripeCache() {
+    clear();
+  }
+
+  void set_max_bytes(uint64_t max) {
+    max_bytes = max;
+    trim();
+  }
+  uint64_t get_bytes() const {
+    return bytes;
+  }
+
+  /**
+   * Looks up stripes to read
+   *
+   * @param oid [in] object
+   * @param to_read [in] stripe aligned extents
+   * @param found [out] the cached stripes of to_read
+   * @return the part of to_read that is not cached
+   */
+  extent_set lookup(
+    const hobject_t &oid,
+    const extent_set &to_read,
+    extent_map *found);
+
+  /**
+   * Updates the cache with a completed write
+   *
+   * Stripes of written within keep are cached, the others are dropped
+   * so that the cache never returns stale data.
+   *
+   * @param oid [in] object
+   * @param seq [in] order of the write, as passed to forget
+   * @param written [in] stripe aligned extents written
+   * @param keep [in] extents worth caching
+   */
+  void update(
+    const hobject_t &oid,
+    uint64_t seq,
+    const extent_map &written,
+    const extent_set &keep);
+
+  /// drop all the stripes of oid, on behalf of write seq
+  void forget(const hobject_t &oid, uint64_t seq);
+  void clear();
+
+  ostream &print(ostream &out) const;
+};
+
+ostream &operator<<(ostream &lhs, const StripeCache &cache);
+
 #endif
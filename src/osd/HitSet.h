@@ -20,6 +20,7 @@
 #include "include/encoding.h"
 #include "include/unordered_set.h"
 #include "common/bloom_filter.hpp"
+#include "common/blocked_bloom_filter.h"
 #include "common/hobject.h"
 
 /**
@@ -36,7 +37,8 @@ public:
     TYPE_NONE = 0,
     TYPE_EXPLICIT_HASH = 1,
     TYPE_EXPLICIT_OBJECT = 2,
-    TYPE_BLOOM = 3
+    TYPE_BLOOM = 3,
+    TYPE_BLOCKED_BLOOM = 4
   } impl_type_t;
 
   static const char *get_type_name(impl_type_t t) {
@@ -45,9 +47,15 @@ public:
     case TYPE_EXPLICIT_HASH: return "explicit_hash";
     case TYPE_EXPLICIT_OBJECT: return "explicit_object";
     case TYPE_BLOOM: return "bloom";
+    case TYPE_BLOCKED_BLOOM: return "blocked_bloom";
     default: return "???";
     }
   }
+  /// true for the types configured with a BloomHitSet::Params (fpp,
+  /// target size and seed)
+  static bool is_bloom_type(impl_type_t t) {
+    return t == TYPE_BLOOM || t == TYPE_BLOCKED_BLOOM;
+  }
   const char *get_type_name() const {
     if (impl)
       return get_type_name(impl->get_type());
@@ -450,4 +458,91 @@ public:
 };
 WRITE_CLASS_ENCODER(BloomHitSet)
 
+/**
+ * like BloomHitSet, but with a blocked_bloom_filter: inserts and lookups
+ * touch a single cache line, and sealing folds the table down to the
+ * size the insertions actually needed.
+ */
+class BlockedBloomHitSet : public HitSet::Impl {
+  blocked_bloom_filter bloom;
+
+public:
+  HitSet::impl_type_t get_type() const override {
+    return HitSet::TYPE_BLOCKED_BLOOM;
+  }
+
+  /// same parameters, and encoding, as BloomHitSet
+  class Params : public BloomHitSet::Params {
+  public:
+    HitSet::impl_type_t get_type() const override {
+      return HitSet::TYPE_BLOCKED_BLOOM;
+    }
+    HitSet::Impl *get_new_impl() const override {
+      return new BlockedBloomHitSet;
+    }
+
+    Params() {}
+    Params(double fpp, uint64_t t, uint64_t s)
+      : BloomHitSet::Params(fpp, t, s) {}
+
+    static void generate_test_instances(list<Params*>& o) {
+      o.push_back(new Params);
+      o.push_back(new Params(.123456, 300, 99));
+    }
+  };
+
+  BlockedBloomHitSet() {}
+  BlockedBloomHitSet(unsigned inserts, double fpp, int seed)
+    : bloom(inserts, fpp, seed)
+  {}
+  explicit BlockedBloomHitSet(const BlockedBloomHitSet::Params *p)
+    : bloom(p->target_size, p->get_fpp(), p->seed)
+  {}
+
+  HitSet::Impl *clone() const override {
+    return new BlockedBloomHitSet(*this);
+  }
+
+  bool is_full() const override {
+    return bloom.is_full();
+  }
+
+  void insert(const hobject_t& o) override {
+    bloom.insert(o.get_hash());
+  }
+  bool contains(const hobject_t& o) const override {
+    return bloom.contains(o.get_hash());
+  }
+  unsigned insert_count() const override {
+    return bloom.element_count();
+  }
+  unsigned approx_unique_insert_count() const override {
+    return bloom.approx_unique_element_count();
+  }
+  void seal() override {
+    // aim for a density of .5 (50% of bits set)
+    bloom.compress(.5);
+  }
+
+  void encode(bufferlist &bl) const override {
+    ENCODE_START(1, 1, bl);
+    encode(bloom, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator &bl) override {
+    DECODE_START(1, bl);
+    decode(bloom, bl);
+    DECODE_FINISH(bl);
+  }
+  void dump(Formatter *f) const override;
+  static void generate_test_instances(list<BlockedBloomHitSet*>& o) {
+    o.push_back(new BlockedBloomHitSet);
+    o.push_back(new BlockedBloomHitSet(10, .1, 1));
+    o.back()->insert(hobject_t());
+    o.back()->insert(hobject_t("asdf", "", CEPH_NOSNAP, 123, 1, ""));
+    o.back()->insert(hobject_t("qwer", "", CEPH_NOSNAP, 456, 1, ""));
+  }
+};
+WRITE_CLASS_ENCODER(BlockedBloomHitSet)
+
 #endif
@@ -21,6 +21,10 @@
 #include <signal.h>
 #include <ctype.h>
 #include <boost/scoped_ptr.hpp>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
@@ -255,9 +259,12 @@ OSDService::OSDService(OSD *osd) :
   scrub_sleep_lock("OSDService::scrub_sleep_lock"),
   scrub_sleep_timer(
     osd->client_messenger->cct, scrub_sleep_lock, false /* relax locking */),
+  scrub_governor(cct),
   snap_reserver(cct, &reserver_finisher,
 		cct->_conf->osd_max_trimming_pgs),
   recovery_lock("OSDService::recovery_lock"),
+  recovery_op_shares(
+    cct->_conf->get_val<uint64_t>("osd_recovery_batch_max_objects")),
   recovery_ops_active(0),
   recovery_ops_reserved(0),
   recovery_paused(false),
@@ -2354,6 +2361,8 @@ will start to track new ops received afterwards.";
     f->close_section();
   } else if (admin_command == "dump_objectstore_kv_stats") {
     store->get_db_statistics(f);
+  } else if (admin_command == "dump_objectstore_fragmentation") {
+    store->dump_fragmentation(f);
   } else if (admin_command == "dump_scrubs") {
     service.dumps_scrub(f);
   } else if (admin_command == "calc_objectstore_db_histogram") {
@@ -2913,6 +2922,12 @@ void OSD::final_init()
 				     "print statistics of kvdb which used by bluestore");
   assert(r == 0);
 
+  r = admin_socket->register_command("dump_objectstore_fragmentation",
+				     "dump_objectstore_fragmentation",
+				     asok_hook,
+				     "print free space fragmentation score and free extent histogram");
+  assert(r == 0);
+
   r = admin_socket->register_command("dump_scrubs",
 				     "dump_scrubs",
 				     asok_hook,
@@ -3425,6 +3440,7 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("set_heap_property");
   cct->get_admin_socket()->unregister_command("get_heap_property");
   cct->get_admin_socket()->unregister_command("dump_objectstore_kv_stats");
+  cct->get_admin_socket()->unregister_command("dump_objectstore_fragmentation");
   cct->get_admin_socket()->unregister_command("dump_scrubs");
   cct->get_admin_socket()->unregister_command("calc_objectstore_db_histogram");
   cct->get_admin_socket()->unregister_command("flush_store_cache");
@@ -7151,6 +7167,122 @@ void OSD::trim_maps(epoch_t oldest, int nreceived, bool skip_maps)
   assert(min <= service.map_cache.cached_key_lower_bound());
 }
 
+namespace {
+
+/**
+ * Decodes the full and incremental maps carried by an MOSDMap on a few
+ * helper threads, ahead of the serial loop in handle_osd_map() that
+ * applies, checks and stores them in epoch order.  The caller helps out
+ * with whatever has not been picked up yet when it waits for an epoch,
+ * so with no helper threads everything is simply decoded in line.
+ */
+class OSDMapDecoder {
+  struct Item {
+    bool full = false;
+    bufferlist bl;      ///< our own reference to the encoded map
+    std::unique_ptr<OSDMap> map;
+    OSDMap::Incremental inc;
+    std::exception_ptr error;
+    bool done = false;
+  };
+
+  epoch_t first;
+  std::vector<Item> items;
+  std::atomic<unsigned> next = {0};
+  std::mutex lock;
+  std::condition_variable cond;
+  std::vector<std::thread> threads;
+
+  /// decode the next unclaimed item; false if there are none left
+  bool decode_next() {
+    unsigned i = next++;
+    if (i >= items.size())
+      return false;
+    Item& item = items[i];
+    try {
+      if (item.full) {
+	item.map.reset(new OSDMap);
+	item.map->decode(item.bl);
+      } else {
+	bufferlist::iterator p = item.bl.begin();
+	item.inc.decode(p);
+      }
+    } catch (...) {
+      item.error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> l(lock);
+    item.done = true;
+    cond.notify_all();
+    return true;
+  }
+
+  Item& wait(epoch_t e) {
+    assert(e >= first && e - first < items.size());
+    unsigned i = e - first;
+    while (next <= i && decode_next())
+      ;
+    Item& item = items[i];
+    {
+      std::unique_lock<std::mutex> l(lock);
+      cond.wait(l, [&item] { return item.done; });
+    }
+    if (item.error)
+      std::rethrow_exception(item.error);
+    return item;
+  }
+
+public:
+  /// queue the maps for epochs [first, last] found in m
+  OSDMapDecoder(MOSDMap *m, epoch_t first, epoch_t last, unsigned nthreads)
+    : first(first) {
+    for (epoch_t e = first; e <= last; ++e) {
+      auto p = m->maps.find(e);
+      bool full = p != m->maps.end();
+      if (!full) {
+	p = m->incremental_maps.find(e);
+	if (p == m->incremental_maps.end())
+	  break;
+      }
+      items.emplace_back();
+      items.back().full = full;
+      items.back().bl = p->second;
+    }
+    if (items.size() < 2)
+      return;
+    // the caller starts on the first epoch right away
+    nthreads = std::min<unsigned>(nthreads, items.size() - 1);
+    for (unsigned i = 0; i < nthreads; ++i) {
+      threads.emplace_back([this] {
+	  ceph_pthread_setname(pthread_self(), "osdmap_decode");
+	  while (decode_next())
+	    ;
+	});
+    }
+  }
+  ~OSDMapDecoder() {
+    // maps past an epoch the caller gave up on are not needed
+    next = items.size();
+    for (auto& t : threads)
+      t.join();
+  }
+
+  /// the decoded full map for epoch e; the caller takes ownership
+  OSDMap *get_full(epoch_t e) {
+    Item& item = wait(e);
+    assert(item.full);
+    return item.map.release();
+  }
+
+  /// the decoded incremental for epoch e
+  const OSDMap::Incremental& get_incremental(epoch_t e) {
+    Item& item = wait(e);
+    assert(!item.full);
+    return item.inc;
+  }
+};
+
+} // anonymous namespace
+
 void OSD::handle_osd_map(MOSDMap *m)
 {
   assert(osd_lock.is_locked());
@@ -7264,6 +7396,9 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   // store new maps: queue for disk and put in the osdmap cache
   epoch_t start = std::max(superblock.newest_map + 1, first);
+  OSDMapDecoder decoder(
+    m, start, last,
+    cct->_conf->get_val<uint64_t>("osd_map_decode_threads"));
   for (epoch_t e = start; e <= last; e++) {
     if (txn_size >= t.get_num_bytes()) {
       derr << __func__ << " transaction size overflowed" << dendl;
@@ -7274,11 +7409,9 @@ void OSD::handle_osd_map(MOSDMap *m)
     p = m->maps.find(e);
     if (p != m->maps.end()) {
       dout(10) << "handle_osd_map  got full map for epoch " << e << dendl;
-      OSDMap *o = new OSDMap;
+      OSDMap *o = decoder.get_full(e);
       bufferlist& bl = p->second;
 
-      o->decode(bl);
-
       ghobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::meta(), fulloid, 0, bl.length(), bl);
       pin_map_bl(e, bl);
@@ -7296,17 +7429,17 @@ void OSD::handle_osd_map(MOSDMap *m)
       t.write(coll_t::meta(), oid, 0, bl.length(), bl);
       pin_map_inc_bl(e, bl);
 
+      // start from a copy of the previous map rather than decoding it
+      // again; it is almost always the one we just added, or the current
+      // map, both of which are in memory
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
-        bool got = get_map_bl(e - 1, obl);
-        assert(got);
-	o->decode(obl);
+	auto q = pinned_maps.find(e - 1);
+	OSDMapRef prev = q != pinned_maps.end() ? q->second : get_map(e - 1);
+	o->deepish_copy_from(*prev);
       }
 
-      OSDMap::Incremental inc;
-      bufferlist::iterator p = bl.begin();
-      inc.decode(p);
+      const OSDMap::Incremental& inc = decoder.get_incremental(e);
       if (o->apply_incremental(inc) < 0) {
 	derr << "ERROR: bad fsid?  i have " << osdmap->get_fsid() << " and inc has " << inc.fsid << dendl;
 	assert(0 == "bad fsid");
@@ -8819,7 +8952,7 @@ void OSDService::_maybe_queue_recovery() {
 	 _recover_now(&available_pushes)) {
     uint64_t to_start = std::min(
       available_pushes,
-      cct->_conf->osd_recovery_max_single_start);
+      cct->_conf->osd_recovery_max_single_start * recovery_op_shares);
     _queue_for_recovery(awaiting_throttle.front(), to_start);
     awaiting_throttle.pop_front();
     recovery_ops_reserved += to_start;
@@ -8841,7 +8974,7 @@ bool OSDService::_recover_now(uint64_t *available_pushes)
     return false;
   }
 
-  uint64_t max = cct->_conf->osd_recovery_max_active;
+  uint64_t max = cct->_conf->osd_recovery_max_active * recovery_op_shares;
   if (max <= recovery_ops_active + recovery_ops_reserved) {
     dout(15) << __func__ << " active " << recovery_ops_active
 	     << " + reserved " << recovery_ops_reserved
@@ -8956,18 +9089,39 @@ void OSD::do_recovery(
   }
 
  out:
-  assert(started <= reserved_pushes);
+  // the last object a PG starts may cost more shares than it had left,
+  // so started can exceed reserved_pushes by less than one op
+  assert(started < reserved_pushes + service.get_recovery_op_shares());
   service.release_reserved_pushes(reserved_pushes);
 }
 
-void OSDService::start_recovery_op(PG *pg, const hobject_t& soid)
+/*
+ * Small objects are charged a fraction of a recovery op, so that up to
+ * osd_recovery_batch_max_objects of them totalling
+ * osd_recovery_batch_max_bytes are recovered for the price of one large
+ * object.  They are then started, pushed and applied together.
+ */
+uint64_t OSDService::get_recovery_op_cost(uint64_t bytes, bool omap) const
+{
+  uint64_t max_bytes = cct->_conf->get_val<uint64_t>(
+    "osd_recovery_batch_max_bytes");
+  if (recovery_op_shares == 1 || omap || bytes >= max_bytes) {
+    return recovery_op_shares;
+  }
+  return std::max<uint64_t>(
+    1, (bytes * recovery_op_shares + max_bytes - 1) / max_bytes);
+}
+
+void OSDService::start_recovery_op(PG *pg, const hobject_t& soid,
+				   uint64_t cost)
 {
   Mutex::Locker l(recovery_lock);
   dout(10) << "start_recovery_op " << *pg << " " << soid
+	   << " cost " << cost << "/" << recovery_op_shares
 	   << " (" << recovery_ops_active << "/"
-	   << cct->_conf->osd_recovery_max_active << " rops)"
-	   << dendl;
-  recovery_ops_active++;
+	   << cct->_conf->osd_recovery_max_active * recovery_op_shares
+	   << " shares)" << dendl;
+  recovery_ops_active += cost;
 
 #ifdef DEBUG_RECOVERY_OIDS
   dout(20) << "  active was " << recovery_oids[pg->pg_id] << dendl;
@@ -8976,17 +9130,20 @@ void OSDService::start_recovery_op(PG *pg, const hobject_t& soid)
 #endif
 }
 
-void OSDService::finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue)
+void OSDService::finish_recovery_op(PG *pg, const hobject_t& soid,
+				    uint64_t cost, bool dequeue)
 {
   Mutex::Locker l(recovery_lock);
   dout(10) << "finish_recovery_op " << *pg << " " << soid
+	   << " cost " << cost << "/" << recovery_op_shares
 	   << " dequeue=" << dequeue
-	   << " (" << recovery_ops_active << "/" << cct->_conf->osd_recovery_max_active << " rops)"
-	   << dendl;
+	   << " (" << recovery_ops_active << "/"
+	   << cct->_conf->osd_recovery_max_active * recovery_op_shares
+	   << " shares)" << dendl;
 
   // adjust count
-  assert(recovery_ops_active > 0);
-  recovery_ops_active--;
+  assert(recovery_ops_active >= cost);
+  recovery_ops_active -= cost;
 
 #ifdef DEBUG_RECOVERY_OIDS
   dout(20) << "  active oids was " << recovery_oids[pg->pg_id] << dendl;
@@ -9617,6 +9774,7 @@ void OSD::ShardedOpWQ::prune_pg_waiters(OSDMapRef osdmap, int whoami)
       }
       if (slot.to_process.empty() &&
 	  slot.num_running == 0 &&
+	  slot.num_in_run == 0 &&
 	  !slot.pg) {
 	dout(20) << __func__ << "  " << p->first << " empty, pruning" << dendl;
 	p = sdata->pg_slots.erase(p);
@@ -9665,6 +9823,14 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   assert(sdata);
   // peek at spg_t
   sdata->sdata_op_ordering_lock.Lock();
+  if (sdata->pqueue->empty() && work_stealing) {
+    // nothing of our own; help out a busier shard before going idle
+    sdata->sdata_op_ordering_lock.Unlock();
+    if (_steal(shard_index, hb)) {
+      return;
+    }
+    sdata->sdata_op_ordering_lock.Lock();
+  }
   if (sdata->pqueue->empty()) {
     sdata->sdata_lock.Lock();
     if (!sdata->stop_waiting) {
@@ -9687,7 +9853,61 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       return;
     }
   }
-  OpQueueItem item = sdata->pqueue->dequeue();
+  _process_item(shard_index, sdata, sdata->pqueue->dequeue(), hb);
+}
+
+bool OSD::ShardedOpWQ::_steal(uint32_t shard_index, heartbeat_handle_d *hb)
+{
+  for (uint32_t i = 1; i < num_shards; ++i) {
+    uint32_t victim_index = (shard_index + i) % num_shards;
+    auto victim = shard_list[victim_index];
+    // don't queue up behind a shard's own threads
+    if (!victim->sdata_op_ordering_lock.TryLock()) {
+      continue;
+    }
+    if (victim->pqueue->empty()) {
+      victim->sdata_op_ordering_lock.Unlock();
+      continue;
+    }
+    OpQueueItem item = victim->pqueue->dequeue();
+    auto p = victim->pg_slots.find(item.get_ordering_token());
+    if (p != victim->pg_slots.end() &&
+	(p->second.num_running > 0 || p->second.num_in_run > 0)) {
+      // one of the victim's threads has the pg; we would only queue up
+      // behind it for the pg lock
+      dout(30) << __func__ << " " << item.get_ordering_token()
+	       << " busy on shard " << victim_index << dendl;
+      victim->_enqueue_front(std::move(item), osd->op_prio_cutoff);
+      victim->sdata_op_ordering_lock.Unlock();
+      continue;
+    }
+    dout(20) << __func__ << " taking an item of shard " << victim_index
+	     << dendl;
+    // the item goes through the victim's pg_slots and takes the pg
+    // lock exactly as if one of the victim's threads ran it, so the
+    // pg's ops stay in order
+    _process_item(victim_index, victim, std::move(item), hb);
+    return true;
+  }
+  return false;
+}
+
+void OSD::ShardedOpWQ::_wake_thief(uint32_t shard_index)
+{
+  uint32_t thief_index =
+    (shard_index + 1 + next_thief++ % (num_shards - 1)) % num_shards;
+  auto thief = shard_list[thief_index];
+  thief->sdata_lock.Lock();
+  thief->sdata_cond.SignalOne();
+  thief->sdata_lock.Unlock();
+}
+
+void OSD::ShardedOpWQ::_process_item(
+  uint32_t shard_index,
+  ShardData *sdata,
+  OpQueueItem&& item,
+  heartbeat_handle_d *hb)
+{
   if (osd->is_stopping()) {
     sdata->sdata_op_ordering_lock.Unlock();
     return;    // OSD shutdown, discard.
@@ -9830,6 +10050,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     sdata->sdata_op_ordering_lock.Unlock();
     return;
   }
+  if (work_stealing) {
+    ++slot.num_in_run;
+  }
   sdata->sdata_op_ordering_lock.Unlock();
 
 
@@ -9869,6 +10092,14 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     tracepoint(osd, opwq_process_finish, reqid.name._type,
         reqid.name._num, reqid.tid, reqid.inc);
   }
+
+  if (work_stealing) {
+    Mutex::Locker l(sdata->sdata_op_ordering_lock);
+    auto p = sdata->pg_slots.find(token);
+    if (p != sdata->pg_slots.end()) {  // unless cleared for shutdown
+      --p->second.num_in_run;
+    }
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue(OpQueueItem&& item) {
@@ -9882,6 +10113,8 @@ void OSD::ShardedOpWQ::_enqueue(OpQueueItem&& item) {
   sdata->sdata_op_ordering_lock.Lock();
 
   dout(20) << __func__ << " " << item << dendl;
+  // our threads have not caught up with what was already queued
+  bool backlogged = !sdata->pqueue->empty();
   if (priority >= osd->op_prio_cutoff)
     sdata->pqueue->enqueue_strict(
       item.get_owner(), priority, std::move(item));
@@ -9894,6 +10127,9 @@ void OSD::ShardedOpWQ::_enqueue(OpQueueItem&& item) {
   sdata->sdata_cond.SignalOne();
   sdata->sdata_lock.Unlock();
 
+  if (backlogged && work_stealing) {
+    _wake_thief(shard_index);
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(OpQueueItem&& item)
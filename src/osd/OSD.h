@@ -41,6 +41,7 @@
 #include "Session.h"
 
 #include "osd/OpQueueItem.h"
+#include "osd/ScrubGovernor.h"
 
 #include <atomic>
 #include <map>
@@ -774,6 +775,7 @@ public:
 
   Mutex scrub_sleep_lock;
   SafeTimer scrub_sleep_timer;
+  ScrubGovernor scrub_governor;  ///< paces deep scrub reads
 
   AsyncReserver<spg_t> snap_reserver;
   void queue_for_snap_trim(PG *pg);
@@ -787,8 +789,11 @@ private:
   list<pair<epoch_t, PGRef> > awaiting_throttle;
 
   utime_t defer_recovery_until;
-  uint64_t recovery_ops_active;
-  uint64_t recovery_ops_reserved;
+  /// recovery is throttled in shares of an op: an object costs this many
+  /// shares, or fewer if it is small (see get_recovery_op_cost())
+  const uint64_t recovery_op_shares;
+  uint64_t recovery_ops_active;    ///< in shares
+  uint64_t recovery_ops_reserved;  ///< in shares
   bool recovery_paused;
 #ifdef DEBUG_RECOVERY_OIDS
   map<spg_t, set<hobject_t> > recovery_oids;
@@ -798,8 +803,13 @@ private:
   void _queue_for_recovery(
     pair<epoch_t, PGRef> p, uint64_t reserved_pushes);
 public:
-  void start_recovery_op(PG *pg, const hobject_t& soid);
-  void finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue);
+  uint64_t get_recovery_op_shares() const {
+    return recovery_op_shares;
+  }
+  uint64_t get_recovery_op_cost(uint64_t bytes, bool omap) const;
+  void start_recovery_op(PG *pg, const hobject_t& soid, uint64_t cost);
+  void finish_recovery_op(PG *pg, const hobject_t& soid, uint64_t cost,
+			  bool dequeue);
   bool is_recovery_active();
   void release_reserved_pushes(uint64_t pushes) {
     Mutex::Locker l(recovery_lock);
@@ -1545,7 +1555,12 @@ private:
    * The pqueue is per-shard, and to_process is per pg_slot.  Items can be
    * pushed back up into to_process and/or pqueue while order is preserved.
    *
-   * Multiple worker threads can operate on each shard.
+   * Multiple worker threads can operate on each shard.  With
+   * osd_op_queue_work_stealing, a thread whose own shard has nothing
+   * queued may also take the pqueue front of another shard and run it
+   * through that shard's pg_slot, so ordering is kept the same way.  It
+   * puts the item back if the pg is already being run or locked for, as
+   * it would only wait for the pg lock.
    *
    * Under normal circumstances, num_running == to_process.size().  There are
    * two times when that is not true: (1) when waiting_for_pg == true and
@@ -1573,6 +1588,9 @@ private:
 	PGRef pg;                     ///< cached pg reference [optional]
 	deque<OpQueueItem> to_process; ///< order items for this slot
 	int num_running = 0;          ///< _process threads doing pg lookup/lock
+	/// threads running an item of this pg; only kept with work stealing,
+	/// so that thieves leave pgs alone that they would wait for
+	int num_in_run = 0;
 
 	/// true if pg does/did not exist. if so all new items go directly to
 	/// to_process.  cleared by prune_pg_waiters.
@@ -1632,6 +1650,18 @@ private:
     vector<ShardData*> shard_list;
     OSD *osd;
     uint32_t num_shards;
+    /// idle shard threads take items queued on other shards
+    bool work_stealing;
+    std::atomic<uint32_t> next_thief = {0};
+
+    /// run item, just dequeued from the pqueue of a shard; called with
+    /// its sdata_op_ordering_lock held
+    void _process_item(uint32_t shard_index, ShardData *sdata,
+		       OpQueueItem&& item, heartbeat_handle_d *hb);
+    /// run one item queued on another shard, if any
+    bool _steal(uint32_t shard_index, heartbeat_handle_d *hb);
+    /// wake an idle thread of some other shard to help shard_index
+    void _wake_thief(uint32_t shard_index);
 
   public:
     ShardedOpWQ(uint32_t pnum_shards,
@@ -1641,7 +1671,9 @@ private:
 		ShardedThreadPool* tp)
       : ShardedThreadPool::ShardedWQ<OpQueueItem>(ti, si, tp),
         osd(o),
-        num_shards(pnum_shards) {
+        num_shards(pnum_shards),
+        work_stealing(pnum_shards > 1 &&
+		      o->cct->_conf->get_val<bool>("osd_op_queue_work_stealing")) {
       for (uint32_t i = 0; i < num_shards; i++) {
 	char lock_name[32] = {0};
 	snprintf(lock_name, sizeof(lock_name), "%s.%d", "OSD:ShardedOpWQ:", i);
@@ -1876,6 +1876,52 @@ int OSDMap::apply_incremental(const Incremental &inc)
   return 0;
 }
 
+bool OSDMap::get_pgs_remapped_by(const Incremental &inc,
+				 set<pg_t> *pgs) const
+{
+  if (inc.fullmap.length() ||
+      inc.crush.length() ||
+      inc.new_max_osd >= 0 ||
+      !inc.new_state.empty() ||
+      !inc.new_weight.empty() ||
+      !inc.new_up_client.empty() ||
+      !inc.new_primary_affinity.empty()) {
+    return false;
+  }
+
+  for (auto& p : inc.new_pools) {
+    const pg_pool_t& pi = p.second;
+    auto q = pools.find(p.first);
+    if (q != pools.end() &&
+	q->second.get_type() == pi.get_type() &&
+	q->second.get_size() == pi.get_size() &&
+	q->second.get_pg_num() == pi.get_pg_num() &&
+	q->second.get_pgp_num() == pi.get_pgp_num() &&
+	q->second.get_crush_rule() == pi.get_crush_rule() &&
+	q->second.has_flag(pg_pool_t::FLAG_HASHPSPOOL) ==
+	  pi.has_flag(pg_pool_t::FLAG_HASHPSPOOL)) {
+      continue;
+    }
+    // a new pool, or one whose pgs are placed differently
+    for (unsigned ps = 0; ps < pi.get_pg_num(); ++ps) {
+      pgs->insert(pg_t(ps, p.first));
+    }
+  }
+  for (auto& p : inc.new_pg_temp)
+    pgs->insert(p.first);
+  for (auto& p : inc.new_primary_temp)
+    pgs->insert(p.first);
+  for (auto& p : inc.new_pg_upmap)
+    pgs->insert(p.first);
+  for (auto& pg : inc.old_pg_upmap)
+    pgs->insert(pg);
+  for (auto& p : inc.new_pg_upmap_items)
+    pgs->insert(p.first);
+  for (auto& pg : inc.old_pg_upmap_items)
+    pgs->insert(pg);
+  return true;
+}
+
 // mapping
 int OSDMap::map_to_pg(
   int64_t poolid,
@@ -990,6 +990,15 @@ public:
 
   int apply_incremental(const Incremental &inc);
 
+  /**
+   * collect the pgs whose up or acting set may change when inc is
+   * applied to this map.
+   *
+   * @return false if inc may move any pg (crush, osd state, weight or
+   *         primary affinity changes), in which case pgs is untouched
+   */
+  bool get_pgs_remapped_by(const Incremental &inc, set<pg_t> *pgs) const;
+
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
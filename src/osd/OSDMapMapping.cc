@@ -170,3 +170,34 @@ void ParallelPGMapper::queue(
   }
   assert(any);
 }
+
+bool ParallelPGMapper::queue(
+  Job *job,
+  unsigned pgs_per_item,
+  const std::set<pg_t>& pgs)
+{
+  bool any = false;
+  auto p = pgs.begin();
+  while (p != pgs.end()) {
+    const pg_pool_t *pi = job->osdmap->get_pg_pool(p->pool());
+    if (!pi || p->ps() >= pi->get_pg_num()) {
+      ++p;
+      continue;
+    }
+    int64_t pool = p->pool();
+    unsigned ps = p->ps();
+    unsigned ps_end = ps + 1;
+    for (++p;
+	 p != pgs.end() && p->pool() == (uint64_t)pool && p->ps() == ps_end &&
+	   ps_end - ps < pgs_per_item && ps_end < pi->get_pg_num();
+	 ++p) {
+      ++ps_end;
+    }
+    job->start_one();
+    wq.queue(new Item(job, pool, ps, ps_end));
+    ldout(cct, 20) << __func__ << " " << job << " " << pool << " [" << ps
+		   << "," << ps_end << ")" << dendl;
+    any = true;
+  }
+  return any;
+}
@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
 #include "osd/osd_types.h"
 #include "common/WorkQueue.h"
@@ -159,6 +160,13 @@ public:
     Job *job,
     unsigned pgs_per_item);
 
+  /// queue only the given pgs, in runs of adjacent ones; pgs that no
+  /// longer exist are skipped.  false if nothing was queued.
+  bool queue(
+    Job *job,
+    unsigned pgs_per_item,
+    const std::set<pg_t>& pgs);
+
   void drain() {
     wq.drain();
   }
@@ -312,6 +320,22 @@ public:
     return job;
   }
 
+  /// bring a mapping that is current for the previous map up to date
+  /// with map by recalculating just the pgs it changed.  the caller must
+  /// make sure pgs covers every pg that may map differently, including
+  /// all of those in pools that were created or resized.
+  std::unique_ptr<MappingJob> start_update(
+    const OSDMap& map,
+    ParallelPGMapper& mapper,
+    unsigned pgs_per_item,
+    const std::set<pg_t>& pgs) {
+    std::unique_ptr<MappingJob> job(new MappingJob(&map, this));
+    if (!mapper.queue(job.get(), pgs_per_item, pgs)) {
+      job->complete();
+    }
+    return job;
+  }
+
   epoch_t get_epoch() const {
     return epoch;
   }
@@ -56,14 +56,7 @@ void OpRequest::_dump(Formatter *f) const
     f->dump_unsigned("tid", m->get_tid());
     f->close_section(); // client_info
   }
-  {
-    f->open_array_section("events");
-    Mutex::Locker l(lock);
-    for (auto& i : events) {
-      f->dump_object("event", i);
-    }
-    f->close_section();
-  }
+  dump_events(f);
 }
 
 void OpRequest::_dump_op_descriptor_unlocked(ostream& stream) const
@@ -83,6 +83,7 @@ const string info_key("_info");
 const string biginfo_key("_biginfo");
 const string epoch_key("_epoch");
 const string fastinfo_key("_fastinfo");
+const string deep_scrub_checkpoint_key("_deep_scrub_ckpt");
 
 template <class T>
 static ostream& _prefix(std::ostream *_dout, T *t)
@@ -2267,7 +2268,7 @@ void PG::_finish_recovery(Context *c)
   unlock();
 }
 
-void PG::start_recovery_op(const hobject_t& soid)
+uint64_t PG::start_recovery_op(const hobject_t& soid, const object_info_t *oi)
 {
   dout(10) << "start_recovery_op " << soid
 #ifdef DEBUG_RECOVERY_OIDS
@@ -2279,7 +2280,17 @@ void PG::start_recovery_op(const hobject_t& soid)
 #ifdef DEBUG_RECOVERY_OIDS
   recovering_oids.insert(soid);
 #endif
-  osd->start_recovery_op(this, soid);
+  uint64_t cost = osd->get_recovery_op_shares();
+  if (oi) {
+    cost = osd->get_recovery_op_cost(oi->size, oi->is_omap());
+  }
+  if (cost < osd->get_recovery_op_shares()) {
+    assert(!recovery_op_costs.count(soid));
+    recovery_op_costs[soid] = cost;
+  }
+  osd->logger->inc(l_osd_rop);
+  osd->start_recovery_op(this, soid, cost);
+  return cost;
 }
 
 void PG::finish_recovery_op(const hobject_t& soid, bool dequeue)
@@ -2295,7 +2306,13 @@ void PG::finish_recovery_op(const hobject_t& soid, bool dequeue)
   assert(recovering_oids.count(soid));
   recovering_oids.erase(recovering_oids.find(soid));
 #endif
-  osd->finish_recovery_op(this, soid, dequeue);
+  uint64_t cost = osd->get_recovery_op_shares();
+  auto p = recovery_op_costs.find(soid);
+  if (p != recovery_op_costs.end()) {
+    cost = p->second;
+    recovery_op_costs.erase(p);
+  }
+  osd->finish_recovery_op(this, soid, cost, dequeue);
 
   if (!dequeue) {
     queue_recovery();
@@ -2548,6 +2565,10 @@ void PG::clear_recovery_state()
   pg_log.reset_recovery_pointers();
   finish_sync_event = 0;
 
+  // release the cheaper ops by name first; the rest all cost the same
+  while (!recovery_op_costs.empty()) {
+    finish_recovery_op(recovery_op_costs.begin()->first, true);
+  }
   hobject_t soid;
   while (recovery_ops_active > 0) {
 #ifdef DEBUG_RECOVERY_OIDS
@@ -3482,6 +3503,22 @@ void PG::read_state(ObjectStore *store)
 
   last_written_info = info;
 
+  {
+    set<string> keys = { deep_scrub_checkpoint_key };
+    map<string,bufferlist> values;
+    if (store->omap_get_values(ch, pgmeta_oid, keys, &values) == 0 &&
+	!values.empty()) {
+      try {
+	bufferlist::iterator p = values.begin()->second.begin();
+	deep_scrub_checkpoint.decode(p);
+      } catch (buffer::error& e) {
+	derr << __func__ << " unable to decode deep scrub checkpoint: "
+	     << e.what() << dendl;
+	deep_scrub_checkpoint.clear();
+      }
+    }
+  }
+
   ostringstream oss;
   pg_log.read_log_and_missing(
     store,
@@ -4279,7 +4316,12 @@ int PG::build_scrub_map_chunk(
 
   // scan objects
   while (!pos.done()) {
+    uint64_t bytes_read = pos.bytes_read;
     int r = get_pgbackend()->be_scan_list(map, pos);
+    if (pos.bytes_read > bytes_read) {
+      osd->scrub_governor.charge(pos.bytes_read - bytes_read,
+				 ceph_clock_now());
+    }
     if (r == -EINPROGRESS) {
       return r;
     }
@@ -4418,12 +4460,23 @@ void PG::replica_scrub(
  */
 void PG::scrub(epoch_t queued, ThreadPool::TPHandle &handle)
 {
-  if (cct->_conf->osd_scrub_sleep > 0 &&
+  utime_t sleep_time;
+  if (scrubber.needs_sleep &&
       (scrubber.state == PG::Scrubber::NEW_CHUNK ||
-       scrubber.state == PG::Scrubber::INACTIVE) &&
-       scrubber.needs_sleep) {
+       scrubber.state == PG::Scrubber::INACTIVE)) {
+    sleep_time.set_from_double(cct->_conf->osd_scrub_sleep);
+    // pay off the OSD's deep scrub read debt here, before the next chunk
+    // blocks writes, never while [start, end) is blocked
+    if (state_test(PG_STATE_DEEP_SCRUB)) {
+      sleep_time = std::max(sleep_time,
+			    osd->scrub_governor.get_delay(ceph_clock_now()));
+    }
+  }
+  if (sleep_time > utime_t()) {
     ceph_assert(!scrubber.sleeping);
-    dout(20) << __func__ << " state is INACTIVE|NEW_CHUNK, sleeping" << dendl;
+    dout(20) << __func__ << " state is "
+	     << Scrubber::state_string(scrubber.state)
+	     << ", sleeping " << sleep_time << dendl;
 
     // Do an async sleep so we don't block the op queue
     OSDService *osds = osd;
@@ -4451,7 +4504,7 @@ void PG::scrub(epoch_t queued, ThreadPool::TPHandle &handle)
           pg->unlock();
         });
     Mutex::Locker l(osd->scrub_sleep_lock);
-    osd->scrub_sleep_timer.add_event_after(cct->_conf->osd_scrub_sleep,
+    osd->scrub_sleep_timer.add_event_after((double)sleep_time,
                                            scrub_requeue_callback);
     scrubber.sleeping = true;
     scrubber.sleep_start = ceph_clock_now();
@@ -4618,9 +4671,11 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
 	{
 	  bool repair = state_test(PG_STATE_REPAIR);
 	  bool deep_scrub = state_test(PG_STATE_DEEP_SCRUB);
+	  bool resumed = deep_scrub && !repair && scrub_resume_deep();
 	  const char *mode = (repair ? "repair": (deep_scrub ? "deep-scrub" : "scrub"));
 	  stringstream oss;
-	  oss << info.pgid.pgid << " " << mode << " starts" << std::endl;
+	  oss << info.pgid.pgid << " " << mode
+	      << (resumed ? " resumes" : " starts") << std::endl;
 	  osd->clog->debug(oss);
 	}
 
@@ -4835,6 +4890,10 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
         scrub_compare_maps();
 	scrubber.start = scrubber.end;
 	scrubber.run_callbacks();
+	if (scrubber.deep && !state_test(PG_STATE_REPAIR) &&
+	    !scrubber.end.is_max()) {
+	  scrub_checkpoint_deep();
+	}
 
         // requeue the writes from the chunk that just finished
         requeue_ops(waiting_for_scrub);
@@ -5146,6 +5205,106 @@ bool PG::ops_blocked_by_scrub() const {
 }
 
 // the part that actually finalizes a scrub
+void PG::DeepScrubCheckpoint::encode(bufferlist &bl) const
+{
+  using ceph::encode;
+  ENCODE_START(1, 1, bl);
+  encode(start, bl);
+  encode(stamp, bl);
+  encode(shallow_errors, bl);
+  encode(deep_errors, bl);
+  encode(large_omap_objects, bl);
+  ENCODE_FINISH(bl);
+}
+
+void PG::DeepScrubCheckpoint::decode(bufferlist::iterator &p)
+{
+  using ceph::decode;
+  DECODE_START(1, p);
+  decode(start, p);
+  decode(stamp, p);
+  decode(shallow_errors, p);
+  decode(deep_errors, p);
+  decode(large_omap_objects, p);
+  DECODE_FINISH(p);
+}
+
+void PG::write_deep_scrub_checkpoint(ObjectStore::Transaction *t)
+{
+  if (deep_scrub_checkpoint.empty()) {
+    t->omap_rmkeys(coll, pgmeta_oid, { deep_scrub_checkpoint_key });
+  } else {
+    map<string,bufferlist> km;
+    deep_scrub_checkpoint.encode(km[deep_scrub_checkpoint_key]);
+    t->omap_setkeys(coll, pgmeta_oid, km);
+  }
+}
+
+/*
+ * Set up a deep scrub that is about to start to continue from the
+ * checkpoint left by an interrupted one, if there is a usable one.
+ * Otherwise start a new checkpoint.  Return true if resuming.
+ */
+bool PG::scrub_resume_deep()
+{
+  double deep_scrub_interval = 0;
+  pool.info.opts.get(pool_opts_t::DEEP_SCRUB_INTERVAL, &deep_scrub_interval);
+  if (deep_scrub_interval <= 0) {
+    deep_scrub_interval = cct->_conf->osd_deep_scrub_interval;
+  }
+  utime_t now = ceph_clock_now();
+  const DeepScrubCheckpoint& ckpt = deep_scrub_checkpoint;
+  // the checkpoint is only good if no deep scrub has completed since it
+  // began (perhaps with another primary) and it is recent enough that
+  // the objects it covers are not overdue
+  if (cct->_conf->get_val<bool>("osd_deep_scrub_resume") &&
+      !ckpt.empty() &&
+      !scrubber.must_deep_scrub &&
+      ckpt.stamp > info.history.last_deep_scrub_stamp &&
+      now < ckpt.stamp + deep_scrub_interval) {
+    dout(10) << __func__ << " resuming deep scrub begun " << ckpt.stamp
+	     << " at " << ckpt.start << dendl;
+    scrubber.start = std::max(scrubber.start, ckpt.start);
+    scrubber.shallow_errors = ckpt.shallow_errors;
+    scrubber.deep_errors = ckpt.deep_errors;
+    scrubber.large_omap_objects = ckpt.large_omap_objects;
+    scrubber.resumed_stamp = ckpt.stamp;
+    return true;
+  }
+  deep_scrub_checkpoint.clear();
+  deep_scrub_checkpoint.stamp = now;
+  return false;
+}
+
+/*
+ * Record that the deep scrub has compared everything before
+ * scrubber.end.
+ */
+void PG::scrub_checkpoint_deep()
+{
+  if (!cct->_conf->get_val<bool>("osd_deep_scrub_resume") ||
+      deep_scrub_checkpoint.empty()) {
+    return;
+  }
+  DeepScrubCheckpoint& ckpt = deep_scrub_checkpoint;
+  ckpt.start = scrubber.end;
+  if (!scrubber.cleaned_meta_map.objects.empty()) {
+    // the last head and its clones are held back for the next chunk's
+    // snapshot checks; resume from them so those are not skipped (their
+    // object errors, if any, are then counted a second time)
+    ckpt.start =
+      scrubber.cleaned_meta_map.objects.begin()->first.get_object_boundary();
+  }
+  ckpt.shallow_errors = scrubber.shallow_errors;
+  ckpt.deep_errors = scrubber.deep_errors;
+  ckpt.large_omap_objects = scrubber.large_omap_objects;
+  dout(20) << __func__ << " " << ckpt.start << dendl;
+
+  ObjectStore::Transaction t;
+  write_deep_scrub_checkpoint(&t);
+  osd->store->queue_transaction(ch, std::move(t), nullptr);
+}
+
 void PG::scrub_finish() 
 {
   bool repair = state_test(PG_STATE_REPAIR);
@@ -5190,7 +5349,10 @@ void PG::scrub_finish()
   info.history.last_scrub_stamp = now;
   if (scrubber.deep) {
     info.history.last_deep_scrub = info.last_update;
-    info.history.last_deep_scrub_stamp = now;
+    // a resumed deep scrub compared the objects before its checkpoint
+    // when the interrupted one began, so only vouches for them since then
+    info.history.last_deep_scrub_stamp =
+      scrubber.resumed_stamp != utime_t() ? scrubber.resumed_stamp : now;
   }
   // Since we don't know which errors were fixed, we can only clear them
   // when every one has been fixed.
@@ -5225,6 +5387,10 @@ void PG::scrub_finish()
     ObjectStore::Transaction t;
     dirty_info = true;
     write_if_dirty(t);
+    if (scrubber.deep) {
+      deep_scrub_checkpoint.clear();
+      write_deep_scrub_checkpoint(&t);
+    }
     int tr = osd->store->queue_transaction(ch, std::move(t), NULL);
     assert(tr == 0);
   }
@@ -424,7 +424,8 @@ public:
   void handle_pg_trim(epoch_t epoch, int from, shard_id_t shard, eversion_t trim_to);
 
   /**
-   * @param ops_begun returns how many recovery ops the function started
+   * @param max shares of recovery ops (see OSDService) to start
+   * @param ops_begun returns how many shares the function started
    * @returns true if any useful work was accomplished; false otherwise
    */
   virtual bool start_recovery_ops(
@@ -813,6 +814,8 @@ protected:
   bool recovery_queued;
 
   int recovery_ops_active;
+  /// objects in recovery that were charged less than a full op
+  map<hobject_t, uint64_t> recovery_op_costs;
   set<pg_shard_t> waiting_on_backfill;
 #ifdef DEBUG_RECOVERY_OIDS
   multiset<hobject_t> recovering_oids;
@@ -1411,7 +1414,10 @@ protected:
   void clear_recovery_state();
   virtual void _clear_recovery_state() = 0;
   virtual void check_recovery_sources(const OSDMapRef& newmap) = 0;
-  void start_recovery_op(const hobject_t& soid);
+  /// charge a full recovery op, or less if oi is a small object; return
+  /// the shares charged
+  uint64_t start_recovery_op(const hobject_t& soid,
+			     const object_info_t *oi = nullptr);
   void finish_recovery_op(const hobject_t& soid, bool dequeue=false);
 
   virtual void _split_into(pg_t child_pgid, PG *child, unsigned split_bits) = 0;
@@ -1517,6 +1523,7 @@ public:
     std::unique_ptr<Scrub::Store> store;
     // deep scrub
     bool deep;
+    utime_t resumed_stamp;  ///< when the deep scrub this one resumes began
     int preempt_left;
     int preempt_divisor;
 
@@ -1578,6 +1585,7 @@ public:
       large_omap_objects = 0;
       fixed = 0;
       deep = false;
+      resumed_stamp = utime_t();
       run_callbacks();
       inconsistent.clear();
       missing.clear();
@@ -1597,6 +1605,28 @@ public:
     void cleanup_store(ObjectStore::Transaction *t);
   } scrubber;
 
+  /**
+   * How far the last deep scrub of this PG got before it was
+   * interrupted.  Kept in the pgmeta object so that the next deep scrub
+   * on this OSD can pick up where it stopped instead of starting over.
+   */
+  struct DeepScrubCheckpoint {
+    hobject_t start;    ///< first object not yet compared
+    utime_t stamp;      ///< when the interrupted deep scrub began
+    int shallow_errors = 0;
+    int deep_errors = 0;
+    int large_omap_objects = 0;
+
+    bool empty() const {
+      return stamp == utime_t();
+    }
+    void clear() {
+      *this = DeepScrubCheckpoint();
+    }
+    void encode(bufferlist &bl) const;
+    void decode(bufferlist::iterator &p);
+  } deep_scrub_checkpoint;
+
 protected:
   bool scrub_after_recovery;
 
@@ -1623,6 +1653,9 @@ protected:
   bool ops_blocked_by_scrub() const;
   void scrub_finish();
   void scrub_clear_state();
+  bool scrub_resume_deep();
+  void scrub_checkpoint_deep();
+  void write_deep_scrub_checkpoint(ObjectStore::Transaction *t);
   void _scan_snaps(ScrubMap &map);
   void _repair_oinfo_oid(ScrubMap &map);
   void _scan_rollback_obs(
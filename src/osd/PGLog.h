@@ -81,7 +81,13 @@ public:
    * plus some methods to manipulate it all.
    */
   struct IndexedLog : public pg_log_t {
-    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    /// newest entry for each object.  a key refers to the soid of the
+    /// entry it maps to instead of holding another copy of the hobject.
+    typedef ceph::unordered_map<std::reference_wrapper<const hobject_t>,
+				pg_log_entry_t*,
+				std::hash<hobject_t>,
+				std::equal_to<hobject_t>> object_index_t;
+    mutable object_index_t objects;  // ptrs into log.  be careful!
     mutable ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
     mutable ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
     mutable ceph::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
@@ -146,7 +152,7 @@ public:
       rollback_info_trimmed_to_riter(log.rbegin())
     {
       reset_rollback_info_trimmed_to_riter();
-      index();
+      index(PGLOG_INDEXED_OBJECTS);
     }
 
     IndexedLog(const IndexedLog &rhs) :
@@ -187,7 +193,7 @@ public:
 
     mempool::osd_pglog::list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
       auto divergent = pg_log_t::rewind_from_head(newhead);
-      index();
+      index(indexed_data | PGLOG_INDEXED_OBJECTS);
       reset_rollback_info_trimmed_to_riter();
       return divergent;
     }
@@ -216,7 +222,6 @@ public:
       *this = IndexedLog(o);
 
       skip_can_rollback_to_to_head();
-      index();
     }
 
     void split_out_child(
@@ -375,7 +380,7 @@ public:
 	     ++i) {
 	  if (to_index & PGLOG_INDEXED_OBJECTS) {
 	    if (i->object_is_indexed()) {
-	      objects[i->soid] = const_cast<pg_log_entry_t*>(&(*i));
+	      index_object(const_cast<pg_log_entry_t*>(&(*i)));
 	    }
 	  }
 
@@ -403,6 +408,20 @@ public:
       index(PGLOG_INDEXED_OBJECTS);
     }
 
+    /// point objects[e->soid] at e, keyed by e's own soid
+    void index_object(pg_log_entry_t *e) const {
+      auto p = objects.find(e->soid);
+      if (p == objects.end()) {
+	objects.emplace(e->soid, e);
+      } else {
+	// the key must not outlive the entry it refers to
+	auto node = objects.extract(p);
+	node.key() = std::cref(e->soid);
+	node.mapped() = e;
+	objects.insert(std::move(node));
+      }
+    }
+
     void index_caller_ops() const {
       index(PGLOG_INDEXED_CALLER_OPS);
     }
@@ -417,9 +436,10 @@ public:
 
     void index(pg_log_entry_t& e) {
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        if (objects.count(e.soid) == 0 ||
-            objects[e.soid]->version < e.version)
-          objects[e.soid] = &e;
+	auto p = objects.find(e.soid);
+        if (p == objects.end() ||
+            p->second->version < e.version)
+          index_object(&e);
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
 	// divergent merge_log indexes new before unindexing old
@@ -513,7 +533,7 @@ public:
 
       // to our index
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        objects[e.soid] = &(log.back());
+        index_object(&(log.back()));
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
         if (e.reqid_is_indexed()) {
@@ -909,8 +929,7 @@ protected:
 		       << " last_divergent_update: " << last_divergent_update
 		       << dendl;
 
-    ceph::unordered_map<hobject_t, pg_log_entry_t*>::const_iterator objiter =
-      log.objects.find(hoid);
+    auto objiter = log.objects.find(hoid);
     if (objiter != log.objects.end() &&
 	objiter->second->version >= first_divergent_update) {
       /// Case 1)
@@ -3952,6 +3952,7 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->tinc(l_osd_op_lat, latency);
   osd->logger->tinc(l_osd_op_process_lat, process_latency);
+  osd->scrub_governor.client_op_done(latency);
 
   if (op->may_read() && op->may_write()) {
     osd->logger->inc(l_osd_op_rw);
@@ -12091,7 +12092,6 @@ bool PrimaryLogPG::start_recovery_ops(
   }
 
   dout(10) << " started " << started << dendl;
-  osd->logger->inc(l_osd_rop, started);
 
   if (!recovering.empty() ||
       work_in_progress || recovery_ops_active > 0 || deferred_backfill)
@@ -12303,10 +12303,10 @@ uint64_t PrimaryLogPG::recover_primary(uint64_t max, ThreadPool::TPHandle &handl
 	  soid, need, get_recovery_op_priority(), h);
 	switch (r) {
 	case PULL_YES:
-	  ++started;
+	  started += osd->get_recovery_op_shares();
 	  break;
 	case PULL_HEAD:
-	  ++started;
+	  started += osd->get_recovery_op_shares();
 	case PULL_NONE:
 	  ++skipped;
 	  break;
@@ -12362,12 +12362,12 @@ int PrimaryLogPG::prep_object_replica_deletes(
   assert(is_primary());
   dout(10) << __func__ << ": on " << soid << dendl;
 
-  start_recovery_op(soid);
+  uint64_t cost = start_recovery_op(soid);
   assert(!recovering.count(soid));
   recovering.insert(make_pair(soid, ObjectContextRef()));
 
   pgbackend->recover_delete_object(soid, v, h);
-  return 1;
+  return cost;
 }
 
 int PrimaryLogPG::prep_object_replica_pushes(
@@ -12393,7 +12393,7 @@ int PrimaryLogPG::prep_object_replica_pushes(
 	     << dendl;
   }
 
-  start_recovery_op(soid);
+  uint64_t cost = start_recovery_op(soid, &obc->obs.oi);
   assert(!recovering.count(soid));
   recovering.insert(make_pair(soid, obc));
 
@@ -12416,7 +12416,7 @@ int PrimaryLogPG::prep_object_replica_pushes(
     primary_error(soid, v);
     return 0;
   }
-  return 1;
+  return cost;
 }
 
 uint64_t PrimaryLogPG::recover_replicas(uint64_t max, ThreadPool::TPHandle &handle)
@@ -12676,8 +12676,7 @@ uint64_t PrimaryLogPG::recover_backfill(
 
     // Count simultaneous scans as a single op and let those complete
     if (sent_scan) {
-      ops++;
-      start_recovery_op(hobject_t::get_max()); // XXX: was pbi.end
+      ops += start_recovery_op(hobject_t::get_max()); // XXX: was pbi.end
       break;
     }
 
@@ -12782,7 +12781,7 @@ uint64_t PrimaryLogPG::recover_backfill(
 	    dout(0) << __func__ << " Error " << r << " trying to backfill " << backfill_info.begin << dendl;
 	    break;
 	  }
-	  ops++;
+	  ops += r;
 	} else {
 	  *work_started = true;
 	  dout(20) << "backfill blocking on " << backfill_info.begin
@@ -12956,7 +12955,7 @@ int PrimaryLogPG::prep_backfill_object_push(
 
   assert(!recovering.count(oid));
 
-  start_recovery_op(oid);
+  uint64_t cost = start_recovery_op(oid, &obc->obs.oi);
   recovering.insert(make_pair(oid, obc));
 
   // We need to take the read_lock here in order to flush in-progress writes
@@ -12974,8 +12973,9 @@ int PrimaryLogPG::prep_backfill_object_push(
     primary_error(oid, v);
     backfills_in_flight.erase(oid);
     missing_loc.add_missing(oid, v, eversion_t());
+    return r;
   }
-  return r;
+  return cost;
 }
 
 void PrimaryLogPG::update_range(
@@ -13244,7 +13244,7 @@ void PrimaryLogPG::hit_set_create()
   HitSet::Params params(pool.info.hit_set_params);
 
   dout(20) << __func__ << " " << params << dendl;
-  if (pool.info.hit_set_params.get_type() == HitSet::TYPE_BLOOM) {
+  if (HitSet::is_bloom_type(pool.info.hit_set_params.get_type())) {
     BloomHitSet::Params *p =
       static_cast<BloomHitSet::Params*>(params.impl.get());
 
@@ -1239,7 +1239,7 @@ protected:
   bool all_peer_done() const;
   /**
    * @param work_started will be set to true if recover_backfill got anywhere
-   * @returns the number of operations started
+   * @returns the shares of recovery ops started
    */
   uint64_t recover_backfill(uint64_t max, ThreadPool::TPHandle &handle,
 			    bool *work_started);
@@ -696,6 +696,7 @@ int ReplicatedBackend::be_deep_scrub(
       pos.data_hash << bl;
     }
     pos.data_pos += r;
+    pos.bytes_read += r;
     if (r == cct->_conf->osd_deep_scrub_stride) {
       dout(20) << __func__ << "  " << poid << " more data, digest so far 0x"
 	       << std::hex << pos.data_hash.digest() << std::dec << dendl;
@@ -748,6 +749,7 @@ int ReplicatedBackend::be_deep_scrub(
   int max = g_conf->osd_deep_scrub_keys;
   while (iter->status() == 0 && iter->valid()) {
     pos.omap_bytes += iter->value().length();
+    pos.bytes_read += iter->key().length() + iter->value().length();
     ++pos.omap_keys;
     --max;
     // fixme: we can do this more efficiently.
@@ -1839,6 +1841,10 @@ void ReplicatedBackend::handle_push(
 
 void ReplicatedBackend::send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &pushes)
 {
+  // a batch of small objects started together should go out together
+  uint64_t max_pushes = std::max(
+    cct->_conf->osd_max_push_objects,
+    cct->_conf->get_val<uint64_t>("osd_recovery_batch_max_objects"));
   for (map<pg_shard_t, vector<PushOp> >::iterator i = pushes.begin();
        i != pushes.end();
        ++i) {
@@ -1860,7 +1866,7 @@ void ReplicatedBackend::send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &
       for (;
            (j != i->second.end() &&
 	    cost < cct->_conf->osd_max_push_cost &&
-	    pushes < cct->_conf->osd_max_push_objects) ;
+	    pushes < max_pushes) ;
 	   ++j) {
 	dout(20) << __func__ << ": sending push " << *j
 		 << " to osd." << i->first << dendl;
@@ -0,0 +1,89 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ScrubGovernor.h"
+#include "common/config.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix *_dout << "scrub_governor "
+
+void ScrubGovernor::_refill(utime_t now)
+{
+  assert(lock.is_locked());
+  double max_rate = cct->_conf->get_val<uint64_t>(
+    "osd_scrub_max_bytes_per_sec");
+  if (max_rate <= 0) {
+    rate = 0;
+    tokens = 0;
+    latency_target_ns = 0;
+    return;
+  }
+  double min_rate = std::min<double>(
+    max_rate,
+    cct->_conf->get_val<uint64_t>("osd_scrub_min_bytes_per_sec"));
+  double target = cct->_conf->get_val<double>(
+    "osd_scrub_client_latency_target");
+
+  if (rate == 0) {
+    // first use, or the limit was just turned on
+    rate = max_rate;
+    tokens = 0;
+    last_refill = now;
+    window_start = now;
+  }
+
+  if (now - window_start >= utime_t(1, 0)) {
+    uint64_t ops = client_ops.exchange(0);
+    uint64_t slow = slow_client_ops.exchange(0);
+    double old_rate = rate;
+    if (target > 0 && slow * 100 > ops) {
+      rate /= 2;
+    } else {
+      rate += max_rate / 10;
+    }
+    rate = std::max(min_rate, std::min(max_rate, rate));
+    if (rate != old_rate) {
+      dout(10) << __func__ << " " << slow << "/" << ops
+	       << " client ops over target, rate " << old_rate
+	       << " -> " << rate << dendl;
+    }
+    window_start = now;
+    latency_target_ns = target > 0 ? (uint64_t)(target * 1000000000.0) : 0;
+  }
+  rate = std::max(min_rate, std::min(max_rate, rate));
+
+  if (now > last_refill) {
+    // allow at most a second's worth of burst
+    tokens = std::min(tokens + rate * (double)(now - last_refill), rate);
+    last_refill = now;
+  }
+}
+
+void ScrubGovernor::charge(uint64_t bytes, utime_t now)
+{
+  Mutex::Locker l(lock);
+  _refill(now);
+  if (rate > 0) {
+    tokens -= bytes;
+  }
+}
+
+utime_t ScrubGovernor::get_delay(utime_t now)
+{
+  Mutex::Locker l(lock);
+  _refill(now);
+  utime_t delay;
+  if (rate > 0 && tokens < 0) {
+    delay.set_from_double(-tokens / rate);
+  }
+  return delay;
+}
+
+double ScrubGovernor::get_rate()
+{
+  Mutex::Locker l(lock);
+  return rate;
+}
@@ -0,0 +1,68 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OSD_SCRUB_GOVERNOR_H
+#define CEPH_OSD_SCRUB_GOVERNOR_H
+
+#include <atomic>
+
+#include "common/Mutex.h"
+#include "include/utime.h"
+
+class CephContext;
+
+/**
+ * OSD-wide token bucket for deep scrub reads.
+ *
+ * Scrub charges the bytes it has read after the fact and the bucket
+ * may go into debt; before starting its next chunk, a primary asks for
+ * the delay that pays the debt off and sleeps that long.  The refill rate starts at
+ * osd_scrub_max_bytes_per_sec and, when osd_scrub_client_latency_target
+ * is set, is halved each second in which more than 1% of client ops were
+ * slower than the target and grown back by a tenth of the maximum
+ * otherwise.
+ */
+class ScrubGovernor {
+  CephContext *cct;
+
+  Mutex lock;
+  double rate = 0;      ///< current refill rate, bytes/sec; 0 if unlimited
+  double tokens = 0;    ///< bytes scrub may still read; negative when in debt
+  utime_t last_refill;
+  utime_t window_start; ///< start of the current latency sample window
+
+  /// client ops seen and those slower than the target in this window
+  std::atomic<uint64_t> client_ops = {0};
+  std::atomic<uint64_t> slow_client_ops = {0};
+  /// latency target in ns; 0 while not adapting, so client_op_done()
+  /// costs a single load on an OSD that does not use it
+  std::atomic<uint64_t> latency_target_ns = {0};
+
+  void _refill(utime_t now);
+
+public:
+  explicit ScrubGovernor(CephContext *cct)
+    : cct(cct), lock("ScrubGovernor::lock") {}
+
+  /// record the latency of a completed client op
+  void client_op_done(utime_t latency) {
+    uint64_t target = latency_target_ns.load(std::memory_order_relaxed);
+    if (!target)
+      return;
+    client_ops.fetch_add(1, std::memory_order_relaxed);
+    if ((uint64_t)latency.to_nsec() > target)
+      slow_client_ops.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// charge bytes read by deep scrub
+  void charge(uint64_t bytes, utime_t now);
+
+  /// how long deep scrub should wait before reading more; zero if it
+  /// may go ahead now
+  utime_t get_delay(utime_t now);
+
+  /// current rate in bytes/sec, 0 if unlimited
+  double get_rate();
+};
+
+#endif
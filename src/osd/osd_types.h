@@ -4985,6 +4985,7 @@ struct ScrubMapBuilder {
   bufferhash data_hash, omap_hash;  ///< accumulatinng hash value
   uint64_t omap_keys = 0;
   uint64_t omap_bytes = 0;
+  uint64_t bytes_read = 0;  ///< data and omap read by deep scrub so far
 
   bool empty() {
     return ls.empty();
@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * compare the HitSet implementations: insert and lookup rates, encoded
+ * bytes per element before and after sealing, and the measured false
+ * positive rate.
+ *
+ *   ceph_bench_hitset [objects [fpp]]
+ */
+
+#include <iostream>
+#include <random>
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "osd/HitSet.h"
+
+static void bench(const char *name, HitSet::Params::Impl *pi,
+		  const vector<hobject_t>& in, const vector<hobject_t>& out)
+{
+  HitSet::Params params(pi);
+  HitSet hs(params);
+
+  utime_t start = ceph_clock_now();
+  for (auto& o : in)
+    hs.insert(o);
+  double insert_secs = ceph_clock_now() - start;
+
+  start = ceph_clock_now();
+  uint64_t hits = 0;
+  for (auto& o : in)
+    hits += hs.contains(o);
+  for (auto& o : out)
+    hits += hs.contains(o);
+  double lookup_secs = ceph_clock_now() - start;
+  uint64_t false_positives = hits - in.size();
+
+  bufferlist bl;
+  hs.encode(bl);
+  unsigned unsealed = bl.length();
+  hs.seal();
+  bl.clear();
+  hs.encode(bl);
+
+  cout << name
+       << "\t" << (uint64_t)(in.size() / insert_secs) << " inserts/s"
+       << "\t" << (uint64_t)((in.size() + out.size()) / lookup_secs)
+       << " lookups/s"
+       << "\t" << (double)unsealed / in.size() << " bytes/elem"
+       << "\t" << (double)bl.length() / in.size() << " sealed"
+       << "\tfpp " << (double)false_positives / out.size()
+       << "\tunique ~" << hs.approx_unique_insert_count()
+       << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  auto cct = global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY, 0);
+
+  uint64_t count = args.size() > 0 ? atoll(args[0]) : 1000000;
+  double fpp = args.size() > 1 ? atof(args[1]) : .01;
+  cout << count << " objects, target fpp " << fpp << std::endl;
+
+  // distinct objects; the ones not inserted measure false positives
+  std::mt19937 rng(0);
+  vector<hobject_t> in, out;
+  for (uint64_t i = 0; i < count * 2; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "rbd_data.%llx", (unsigned long long)i);
+    hobject_t o(object_t(buf), "", CEPH_NOSNAP, rng(), 1, "");
+    (i % 2 ? out : in).push_back(o);
+  }
+
+  bench("bloom", new BloomHitSet::Params(fpp, count, 1), in, out);
+  bench("blocked_bloom", new BlockedBloomHitSet::Params(fpp, count, 1),
+	in, out);
+  bench("explicit_hash", new ExplicitHashHitSet::Params, in, out);
+  return 0;
+}
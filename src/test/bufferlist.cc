@@ -1139,6 +1139,26 @@ TEST(BufferListIterator, iterator_crc32c) {
   ASSERT_EQ(0u, it.get_remaining());
 }
 
+TEST(BufferListIterator, valid_after_append) {
+  // the iterator keeps the index of its segment, so appending segments,
+  // even past the inline slots of buffers_t, must not invalidate it
+  bufferlist bl;
+  bl.append("ab", 2);
+  bufferlist::iterator i = bl.begin();
+  i.advance(1);
+  for (char c = 'c'; c <= 'h'; ++c) {
+    bufferptr ptr(&c, 1);
+    bl.push_back(ptr);
+  }
+  EXPECT_EQ(7u, bl.get_num_buffers());
+  EXPECT_EQ(1u, i.get_off());
+  EXPECT_EQ(7u, i.get_remaining());
+  char buf[7];
+  i.copy(sizeof(buf), buf);
+  EXPECT_EQ(0, memcmp("bcdefgh", buf, sizeof(buf)));
+  EXPECT_TRUE(i.end());
+}
+
 TEST(BufferListIterator, seek) {
   bufferlist bl;
   bl.append("ABC", 3);
@@ -1466,6 +1486,53 @@ TEST(BufferList, BenchAlloc) {
   bench_bufferlist_alloc(4, 100000, 16);
 }
 
+// lists of a few segments each, as in messages and encoded structures
+void bench_bufferlist_segments(int per, int num)
+{
+  bufferptr seg(buffer::create(64));
+  memset(seg.c_str(), 1, seg.length());
+
+  utime_t start = ceph_clock_now();
+  for (int i=0; i<num; ++i) {
+    bufferlist bl;
+    for (int j=0; j<per; ++j)
+      bl.append(seg);
+  }
+  utime_t built = ceph_clock_now();
+
+  bufferlist src;
+  for (int j=0; j<per; ++j)
+    src.append(seg);
+  for (int i=0; i<num; ++i) {
+    bufferlist a(src), b(src);
+    a.claim_append(b);
+  }
+  utime_t claimed = ceph_clock_now();
+
+  uint64_t sum = 0;
+  for (int i=0; i<num; ++i) {
+    bufferlist::iterator p = src.begin();
+    while (!p.end()) {
+      uint64_t v;
+      p.copy(sizeof(v), (char*)&v);
+      sum += v;
+    }
+  }
+  utime_t decoded = ceph_clock_now();
+  ASSERT_NE(0u, sum);
+
+  cout << num << " lists of " << per << " segments: build "
+       << (built - start) << " copy+claim " << (claimed - built)
+       << " decode " << (decoded - claimed) << std::endl;
+}
+
+TEST(BufferList, BenchSegments) {
+  bench_bufferlist_segments(1, 1000000);
+  bench_bufferlist_segments(2, 1000000);
+  bench_bufferlist_segments(4, 1000000);
+  bench_bufferlist_segments(16, 100000);
+}
+
 TEST(BufferList, operator_equal) {
   //
   // list& operator= (const list& other)
@@ -1780,6 +1847,49 @@ TEST(BufferList, rebuild_aligned_size_and_memory) {
   EXPECT_EQ(3U, bl.get_num_buffers());
 }
 
+TEST(BufferList, rebuild_aligned_size_and_memory_mixed) {
+  const unsigned SIMD_ALIGN = 32;
+  const unsigned BUFFER_SIZE = 64;
+
+  // alternate aligned and unaligned segments, more of them than the
+  // inline slots of buffers_t, so that runs are merged in the middle of
+  // a heap-allocated vector
+  bufferlist bl;
+  unsigned n = 0;
+  for (unsigned i = 0; i < 9; ++i) {
+    bufferptr ptr;
+    if (i % 3 == 0) {
+      ptr = buffer::create_aligned(BUFFER_SIZE, SIMD_ALIGN);
+    } else {
+      ptr = buffer::create_aligned(BUFFER_SIZE + 1, SIMD_ALIGN);
+      ptr.set_offset(1);
+      ptr.set_length(BUFFER_SIZE / 2);
+    }
+    for (unsigned j = 0; j < ptr.length(); ++j) {
+      ptr[j] = (char)n++;
+    }
+    bl.append(ptr);
+  }
+  EXPECT_EQ(9u, bl.get_num_buffers());
+  EXPECT_EQ(BUFFER_SIZE * 6, bl.length());
+  std::string before, after;
+  bl.copy(0, bl.length(), before);
+  bl.rebuild_aligned_size_and_memory(BUFFER_SIZE, SIMD_ALIGN);
+  EXPECT_TRUE(bl.is_aligned(SIMD_ALIGN));
+  EXPECT_TRUE(bl.is_n_align_sized(BUFFER_SIZE));
+  for (const auto& ptr : bl.buffers()) {
+    EXPECT_TRUE(ptr.is_aligned(SIMD_ALIGN));
+    EXPECT_TRUE(ptr.is_n_align_sized(BUFFER_SIZE));
+  }
+  bl.copy(0, bl.length(), after);
+  EXPECT_EQ(before, after);
+  // the iterators are index based, so the cached one must have been
+  // reset along with the segments
+  char c;
+  bl.copy(BUFFER_SIZE + 1, 1, &c);
+  EXPECT_EQ((char)(BUFFER_SIZE + 1), c);
+}
+
 TEST(BufferList, is_zero) {
   {
     bufferlist bl;
@@ -2128,6 +2238,89 @@ TEST(BufferList, claim_prepend) {
   EXPECT_EQ((unsigned)0, from.length());
 }
 
+/*
+ * copy() starts from a cached iterator (last_p) when asked for the
+ * offset it stopped at.  Prepending shifts every segment's index, so
+ * the cache must be reset or it would read from the wrong segment.
+ */
+TEST(BufferList, prepend_resets_cached_iterator) {
+  for (int how = 0; how < 4; ++how) {
+    bufferlist bl;
+    bl.append("XY", 2);
+    bufferptr z("Z", 1);
+    bl.push_back(z);
+    char c[2];
+    bl.copy(0, 2, c);	// leaves the cache at offset 2, in "Z"
+    switch (how) {
+    case 0:
+      {
+	bufferptr ptr("abc", 3);
+	bl.push_front(ptr);
+      }
+      break;
+    case 1:
+      bl.push_front(bufferptr("abc", 3));
+      break;
+    case 2:
+      {
+	bufferlist other;
+	other.append("abc", 3);
+	bl.claim_prepend(other);
+      }
+      break;
+    case 3:
+      bl.prepend_zero(3);
+      break;
+    }
+    EXPECT_EQ(6u, bl.length());
+    bl.copy(2, 1, c);
+    EXPECT_EQ(how == 3 ? '\0' : 'c', c[0]) << "how " << how;
+    bl.copy(3, 2, c);
+    EXPECT_EQ(0, memcmp("XY", c, 2)) << "how " << how;
+  }
+}
+
+TEST(BufferList, buffers_t) {
+  // insert and erase around and beyond the inline slots
+  bufferlist::buffers_t v;
+  EXPECT_TRUE(v.empty());
+  for (char c = 'a'; c < 'f'; ++c) {
+    v.push_back(bufferptr(&c, 1));
+  }
+  EXPECT_EQ(5u, v.size());
+  v.insert(v.begin() + 1, bufferptr("x", 1));
+  v.erase(v.begin() + 3, v.begin() + 5);
+  std::string s;
+  for (const auto& p : v) {
+    s.append(p.c_str(), p.length());
+  }
+  EXPECT_EQ("axbe", s);
+  EXPECT_EQ('a', v.front()[0]);
+  EXPECT_EQ('e', v.back()[0]);
+
+  bufferlist::buffers_t copy(v);
+  bufferlist::buffers_t moved(std::move(v));
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ(4u, moved.size());
+  v.push_back(bufferptr("q", 1));
+  v.swap(moved);
+  EXPECT_EQ(4u, v.size());
+  EXPECT_EQ(1u, moved.size());
+  EXPECT_EQ('q', moved.front()[0]);
+  for (unsigned i = 0; i < v.size(); ++i) {
+    EXPECT_EQ(copy[i].c_str()[0], v[i].c_str()[0]);
+    // copies share the raw buffers
+    EXPECT_EQ(copy[i].c_str(), v[i].c_str());
+  }
+  v.erase(v.begin());
+  v.erase(v.begin());
+  v.erase(v.begin());
+  EXPECT_EQ(1u, v.size());
+  EXPECT_EQ('e', v.front()[0]);
+  v.clear();
+  EXPECT_TRUE(v.empty());
+}
+
 TEST(BufferList, claim_prepend_misc) {
   bufferlist src_buf;
   bufferlist dest_buf;
@@ -2667,6 +2860,31 @@ TEST(BufferList, crc32c_zeros) {
   }
 }
 
+TEST(BufferList, crc32c_adjacent_ptrs) {
+  bufferptr bp(4096);
+  for (unsigned i = 0; i < bp.length(); ++i)
+    bp[i] = rand();
+  uint32_t expected = ceph_crc32c(1, (unsigned char*)bp.c_str(), bp.length());
+
+  // slices of one raw that were pushed back separately, as re-joining
+  // the pieces of a splice or substr_of does
+  bufferlist bl;
+  for (unsigned off = 0; off < bp.length(); off += 512)
+    bl.push_back(bufferptr(bp, off, 512));
+  ASSERT_EQ(8u, bl.get_num_buffers());
+
+  buffer::track_cached_crc(true);
+  int base_cached = buffer::get_cached_crc();
+  int base_missed = buffer::get_missed_crc();
+  EXPECT_EQ(expected, bl.crc32c(1));
+  EXPECT_EQ(base_missed + 1, buffer::get_missed_crc());
+  // the whole run was cached as one span
+  EXPECT_EQ(expected, bl.crc32c(1));
+  EXPECT_EQ(base_cached + 1, buffer::get_cached_crc());
+  EXPECT_EQ(base_missed + 1, buffer::get_missed_crc());
+  buffer::track_cached_crc(false);
+}
+
 TEST(BufferList, crc32c_append_perf) {
   int len = 256 * 1024 * 1024;
   bufferptr a(len);
@@ -271,6 +271,40 @@ TEST(Crc32c, RangeNull) {
   }
 }
 
+TEST(Crc32c, Zeros) {
+  for (unsigned len = 0; len < 4100; ++len) {
+    uint32_t crc = rand();
+    ASSERT_EQ(ceph_crc32c_sctp(crc, nullptr, len), ceph_crc32c_zeros(crc, len))
+      << "len " << len;
+  }
+  for (unsigned scale = 12; scale < 30; ++scale) {
+    unsigned len = (1u << scale) + rand() % (1u << scale);
+    uint32_t crc = rand();
+    ASSERT_EQ(ceph_crc32c_sctp(crc, nullptr, len), ceph_crc32c_zeros(crc, len))
+      << "len " << len;
+  }
+}
+
+TEST(Crc32c, Combine) {
+  int len = 65536;
+  unsigned char *a = (unsigned char *)malloc(len);
+  for (int i = 0; i < len; i++)
+    a[i] = rand();
+  for (int i = 0; i < 1000; i++) {
+    unsigned l = rand() % len;
+    unsigned split = i < 100 ? i : rand() % (l + 1);
+    if (split > l)
+      split = l;
+    uint32_t seed = rand();
+    uint32_t crc_a = ceph_crc32c(seed, a, split);
+    uint32_t crc_b = ceph_crc32c(0, a + split, l - split);
+    ASSERT_EQ(ceph_crc32c(seed, a, l),
+	      ceph_crc32c_combine(crc_a, crc_b, l - split))
+      << "len " << l << " split " << split;
+  }
+  free(a);
+}
+
 double estimate_clock_resolution()
 {
   volatile char* p = (volatile char*)malloc(1024);
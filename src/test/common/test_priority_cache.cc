@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2018 Red Hat
+ *
+ * LGPL2.1 (see COPYING-LGPL2.1) or later
+ */
+
+#include <gtest/gtest.h>
+
+#include "common/PriorityCache.h"
+
+using namespace PriorityCache;
+
+// a cache that wants a fixed number of bytes at each priority
+struct TestCache : public BasePriCache {
+  int64_t wants[LAST + 1] = {0};
+
+  TestCache(double ratio, int64_t pri0, int64_t pri1, int64_t pri2) {
+    cache_ratio = ratio;
+    wants[PRI0] = pri0;
+    wants[PRI1] = pri1;
+    wants[PRI2] = pri2;
+  }
+  int64_t request_cache_bytes(Priority pri, uint64_t chunk_bytes) const
+    override {
+    return wants[pri] - get_cache_bytes(pri);
+  }
+  int64_t commit_cache_size(uint64_t total_cache) override {
+    committed_bytes = get_cache_bytes();
+    return committed_bytes;
+  }
+  std::string get_cache_name() const override {
+    return "test";
+  }
+};
+
+TEST(PriorityCache, GetChunk) {
+  ASSERT_EQ(100, get_chunk(100, 0));
+  ASSERT_EQ(64, get_chunk(0, 64));
+  ASSERT_EQ(128, get_chunk(1, 64));
+  ASSERT_EQ(128, get_chunk(64, 64));
+  ASSERT_EQ(192, get_chunk(65, 64));
+}
+
+TEST(PriorityCache, AllRequestsMet) {
+  TestCache a(0.75, 100, 200, 300);
+  TestCache b(0.25, 0, 400, 500);
+  std::list<PriCache *> caches = {&a, &b};
+  balance(10000, 0, caches);
+
+  ASSERT_EQ(100, a.get_cache_bytes(PRI0));
+  ASSERT_EQ(200, a.get_cache_bytes(PRI1));
+  ASSERT_EQ(300, a.get_cache_bytes(PRI2));
+  ASSERT_EQ(0, b.get_cache_bytes(PRI0));
+  ASSERT_EQ(400, b.get_cache_bytes(PRI1));
+  ASSERT_EQ(500, b.get_cache_bytes(PRI2));
+
+  // the rest is split by ratio
+  int64_t left = 10000 - 1500;
+  ASSERT_EQ(left * 3 / 4, a.get_cache_bytes(LAST));
+  ASSERT_EQ(left / 4, b.get_cache_bytes(LAST));
+  ASSERT_EQ(10000, a.get_cache_bytes() + b.get_cache_bytes());
+}
+
+TEST(PriorityCache, HigherPriorityFirst) {
+  TestCache a(0.5, 1000, 0, 5000);
+  TestCache b(0.5, 0, 3000, 5000);
+  std::list<PriCache *> caches = {&a, &b};
+  balance(5000, 0, caches);
+
+  // PRI0 and PRI1 are met in full, PRI2 shares what is left
+  ASSERT_EQ(1000, a.get_cache_bytes(PRI0));
+  ASSERT_EQ(3000, b.get_cache_bytes(PRI1));
+  ASSERT_EQ(500, a.get_cache_bytes(PRI2));
+  ASSERT_EQ(500, b.get_cache_bytes(PRI2));
+  ASSERT_EQ(0, a.get_cache_bytes(LAST));
+  ASSERT_EQ(0, b.get_cache_bytes(LAST));
+}
+
+TEST(PriorityCache, UnusedShareGoesToOthers) {
+  // a only wants a little of its 3/4 share; b gets the rest
+  TestCache a(0.75, 0, 100, 0);
+  TestCache b(0.25, 0, 5000, 0);
+  std::list<PriCache *> caches = {&a, &b};
+  balance(1000, 0, caches);
+
+  ASSERT_EQ(100, a.get_cache_bytes(PRI1));
+  ASSERT_EQ(900, b.get_cache_bytes(PRI1));
+  ASSERT_EQ(0, a.get_cache_bytes(LAST));
+  ASSERT_EQ(0, b.get_cache_bytes(LAST));
+}
+
+TEST(PriorityCache, Rebalance) {
+  TestCache a(0.5, 0, 1000, 0);
+  TestCache b(0.5, 0, 1000, 0);
+  std::list<PriCache *> caches = {&a, &b};
+  balance(4000, 0, caches);
+  ASSERT_EQ(2000, a.get_cache_bytes());
+  ASSERT_EQ(2000, b.get_cache_bytes());
+
+  // a smaller budget replaces the earlier assignment
+  balance(1000, 0, caches);
+  ASSERT_EQ(500, a.get_cache_bytes(PRI1));
+  ASSERT_EQ(500, b.get_cache_bytes(PRI1));
+  ASSERT_EQ(500, a.get_cache_bytes());
+  ASSERT_EQ(500, b.get_cache_bytes());
+}
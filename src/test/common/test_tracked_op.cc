@@ -0,0 +1,77 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <chrono>
+#include <thread>
+
+#include "common/TrackedOp.h"
+#include "common/Clock.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+class TestOp : public TrackedOp {
+public:
+  TestOp(OpTracker *tracker, utime_t initiated)
+    : TrackedOp(tracker, initiated) {}
+  using TrackedOp::Event;
+  using TrackedOp::get_events;
+protected:
+  void _dump_op_descriptor_unlocked(ostream& stream) const override {
+    stream << "test_op";
+  }
+};
+
+// how far a recorded stamp may drift from the wall clock
+static const double slack = .05;
+
+TEST(TrackedOp, EventStamps)
+{
+  OpTracker tracker(g_ceph_context, true, 1);
+  utime_t initiated = ceph_clock_now();
+  TrackedOpRef op(new TestOp(&tracker, initiated));
+  op->tracking_start();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  utime_t before = ceph_clock_now();
+  op->mark_event("first");
+  utime_t explicit_stamp = before;
+  explicit_stamp -= 1.0;
+  op->mark_event("explicit", explicit_stamp);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  utime_t done = ceph_clock_now();
+  op->mark_event("done");
+
+  vector<TestOp::Event> events;
+  static_cast<TestOp*>(op.get())->get_events(&events);
+  ASSERT_EQ(4u, events.size());
+  EXPECT_EQ(0, events[0].compare("initiated"));
+  EXPECT_NEAR((double)initiated, (double)events[0].stamp, slack);
+  EXPECT_EQ(0, events[1].compare("first"));
+  EXPECT_NEAR((double)before, (double)events[1].stamp, slack);
+  EXPECT_EQ(0, events[2].compare("explicit"));
+  EXPECT_NEAR((double)explicit_stamp, (double)events[2].stamp, slack);
+  EXPECT_EQ(0, events[3].compare("done"));
+  EXPECT_NEAR((double)done, (double)events[3].stamp, slack);
+
+  // the duration runs from initiation to "done", and stays put after it
+  EXPECT_NEAR((double)(done - initiated), op->get_duration(), slack);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_NEAR((double)(done - initiated), op->get_duration(), slack);
+
+  op.reset();
+  tracker.on_shutdown();
+}
+
+TEST(TrackedOp, DurationInFlight)
+{
+  OpTracker tracker(g_ceph_context, true, 1);
+  utime_t initiated = ceph_clock_now();
+  TrackedOpRef op(new TestOp(&tracker, initiated));
+  op->tracking_start();
+  op->mark_event("started");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_NEAR((double)(ceph_clock_now() - initiated), op->get_duration(),
+	      slack);
+  op.reset();
+  tracker.on_shutdown();
+}
@@ -0,0 +1,262 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph distributed storage system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "crush/CrushWrapper.h"
+#include "include/stringify.h"
+#include "erasure-code/clay/ErasureCodeClay.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "gtest/gtest.h"
+
+
+static void make_payload(unsigned length, bufferlist *in)
+{
+  bufferptr ptr(buffer::create_page_aligned(length));
+  for (unsigned i = 0; i < length; i++)
+    ptr.c_str()[i] = 'A' + (i * 7 + i / 13) % 57;
+  in->push_back(ptr);
+}
+
+TEST(ErasureCodeClay, sanity_check_k)
+{
+  ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+  ErasureCodeProfile profile;
+  profile["k"] = "1";
+  profile["m"] = "1";
+  ostringstream errors;
+  EXPECT_EQ(-EINVAL, clay.init(profile, &errors));
+  EXPECT_NE(std::string::npos, errors.str().find("must be >= 2"));
+}
+
+TEST(ErasureCodeClay, parse)
+{
+  {
+    ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+    ErasureCodeProfile profile;
+    profile["k"] = "4";
+    profile["m"] = "2";
+    EXPECT_EQ(0, clay.init(profile, &cerr));
+    EXPECT_EQ("5", profile["d"]);
+    EXPECT_EQ(2, clay.q);
+    EXPECT_EQ(3, clay.t);
+    EXPECT_EQ(0, clay.nu);
+    EXPECT_EQ(8, clay.get_sub_chunk_count());
+  }
+  {
+    ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+    ErasureCodeProfile profile;
+    profile["k"] = "4";
+    profile["m"] = "3";
+    profile["d"] = "6";
+    EXPECT_EQ(0, clay.init(profile, &cerr));
+    EXPECT_EQ(3, clay.q);
+    EXPECT_EQ(3, clay.t);
+    EXPECT_EQ(2, clay.nu);
+    EXPECT_EQ(27, clay.get_sub_chunk_count());
+  }
+  const char *bad_d[] = { "4", "7" };
+  for (auto d : bad_d) {
+    ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+    ErasureCodeProfile profile;
+    profile["k"] = "4";
+    profile["m"] = "3";
+    profile["d"] = d;
+    EXPECT_EQ(-EINVAL, clay.init(profile, &cerr));
+  }
+  {
+    ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+    ErasureCodeProfile profile;
+    profile["mapping"] = "_DD";
+    EXPECT_EQ(-EINVAL, clay.init(profile, &cerr));
+  }
+}
+
+TEST(ErasureCodeClay, encode_decode)
+{
+  ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = "3";
+  profile["d"] = "5";
+  ASSERT_EQ(0, clay.init(profile, &cerr));
+  unsigned n = clay.get_chunk_count();
+
+  bufferlist in;
+  make_payload(clay.get_chunk_size(1) * 4 * 2 - 100, &in);
+  set<int> want_to_encode;
+  for (unsigned i = 0; i < n; i++)
+    want_to_encode.insert(i);
+  map<int, bufferlist> encoded;
+  ASSERT_EQ(0, clay.encode(want_to_encode, in, &encoded));
+  ASSERT_EQ(n, encoded.size());
+  unsigned length = encoded[0].length();
+  EXPECT_EQ(0u, length % clay.get_sub_chunk_count());
+  for (unsigned i = 0; i < 4; i++) {
+    unsigned off = i * length;
+    unsigned len = std::min(length, in.length() - std::min(off, in.length()));
+    EXPECT_EQ(0, memcmp(encoded[i].c_str(), in.c_str() + off, len));
+  }
+
+  // every combination of up to m erasures
+  for (unsigned mask = 1; mask < (1u << n); mask++) {
+    if (__builtin_popcount(mask) > clay.m)
+      continue;
+    map<int, bufferlist> degraded;
+    set<int> want_to_read;
+    for (unsigned i = 0; i < n; i++) {
+      if (mask & (1 << i))
+	want_to_read.insert(i);
+      else
+	degraded[i] = encoded[i];
+    }
+    map<int, bufferlist> decoded;
+    EXPECT_EQ(0, clay._decode(want_to_read, degraded, &decoded));
+    for (auto i : want_to_read) {
+      EXPECT_EQ(length, decoded[i].length());
+      EXPECT_TRUE(decoded[i].contents_equal(encoded[i])) << "chunk " << i
+	<< " mask " << mask;
+    }
+  }
+}
+
+TEST(ErasureCodeClay, repair)
+{
+  // d < k + m - 1 leaves aloof chunks that neither are lost nor help
+  // and nu > 0 adds virtual chunks: both take part in the repair
+  const char *profiles[][3] = {
+    { "4", "2", "5" },
+    { "4", "3", "5" },
+    { "8", "4", "11" },
+  };
+  for (auto p : profiles) {
+    ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+    ErasureCodeProfile profile;
+    profile["k"] = p[0];
+    profile["m"] = p[1];
+    profile["d"] = p[2];
+    ASSERT_EQ(0, clay.init(profile, &cerr));
+    int n = clay.get_chunk_count();
+
+    bufferlist in;
+    make_payload(clay.get_chunk_size(1) * clay.k, &in);
+    set<int> want_to_encode;
+    for (int i = 0; i < n; i++)
+      want_to_encode.insert(i);
+    map<int, bufferlist> encoded;
+    ASSERT_EQ(0, clay.encode(want_to_encode, in, &encoded));
+    unsigned length = encoded[0].length();
+    unsigned sub_chunk_size = length / clay.get_sub_chunk_count();
+
+    for (int lost = 0; lost < n; lost++) {
+      set<int> want_to_read = { lost };
+      set<int> available;
+      for (int i = 0; i < n; i++) {
+	if (i != lost)
+	  available.insert(i);
+      }
+      map<int, vector<pair<int, int>>> minimum;
+      ASSERT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+      EXPECT_EQ((unsigned)clay.d, minimum.size());
+
+      // each helper sends 1/q of its chunk
+      map<int, bufferlist> helpers;
+      for (auto& h : minimum) {
+	for (auto& r : h.second) {
+	  bufferlist sub;
+	  sub.substr_of(encoded[h.first], r.first * sub_chunk_size,
+			r.second * sub_chunk_size);
+	  helpers[h.first].append(sub);
+	}
+	EXPECT_EQ(length / clay.q, helpers[h.first].length());
+      }
+      map<int, bufferlist> repaired;
+      EXPECT_EQ(0, clay.decode(want_to_read, helpers, &repaired, length));
+      EXPECT_EQ(length, repaired[lost].length());
+      EXPECT_TRUE(repaired[lost].contents_equal(encoded[lost]))
+	<< "k=" << p[0] << " m=" << p[1] << " d=" << p[2] << " lost " << lost;
+    }
+  }
+}
+
+TEST(ErasureCodeClay, minimum_to_decode)
+{
+  ErasureCodeClay clay(g_conf->get_val<std::string>("erasure_code_dir"));
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = "2";
+  ASSERT_EQ(0, clay.init(profile, &cerr));
+
+  // a chunk that is there is read whole
+  {
+    set<int> want_to_read = { 1 };
+    set<int> available = { 0, 1, 2, 3, 4, 5 };
+    map<int, vector<pair<int, int>>> minimum;
+    EXPECT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+    ASSERT_EQ(1u, minimum.size());
+    EXPECT_EQ(make_pair(0, 8), minimum[1].front());
+  }
+  // two chunks lost: plain decoding from k whole chunks
+  {
+    set<int> want_to_read = { 0, 1 };
+    set<int> available = { 2, 3, 4, 5 };
+    map<int, vector<pair<int, int>>> minimum;
+    EXPECT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+    EXPECT_EQ(4u, minimum.size());
+    for (auto& i : minimum)
+      EXPECT_EQ(make_pair(0, 8), i.second.front());
+  }
+  // one chunk lost and its column mate also missing: no repair
+  {
+    set<int> want_to_read = { 0 };
+    set<int> available = { 2, 3, 4, 5 };
+    map<int, vector<pair<int, int>>> minimum;
+    EXPECT_FALSE(clay.is_repair(want_to_read, available));
+    EXPECT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+    EXPECT_EQ(4u, minimum.size());
+  }
+  // chunk 0 is node (0, 0): the planes whose first digit is 0
+  {
+    set<int> want_to_read = { 0 };
+    set<int> available = { 1, 2, 3, 4, 5 };
+    map<int, vector<pair<int, int>>> minimum;
+    EXPECT_TRUE(clay.is_repair(want_to_read, available));
+    EXPECT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+    EXPECT_EQ(5u, minimum.size());
+    vector<pair<int, int>> expected = { make_pair(0, 4) };
+    for (auto& i : minimum)
+      EXPECT_EQ(expected, i.second);
+  }
+  // chunk 5 is node (1, 2): every other plane
+  {
+    set<int> want_to_read = { 5 };
+    set<int> available = { 0, 1, 2, 3, 4 };
+    map<int, vector<pair<int, int>>> minimum;
+    EXPECT_EQ(0, clay.minimum_to_decode(want_to_read, available, &minimum));
+    vector<pair<int, int>> expected = {
+      make_pair(1, 1), make_pair(3, 1), make_pair(5, 1), make_pair(7, 1)
+    };
+    for (auto& i : minimum)
+      EXPECT_EQ(expected, i.second);
+  }
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ; make -j4 &&
+ *   make unittest_erasure_code_clay &&
+ *   valgrind --tool=memcheck ./unittest_erasure_code_clay \
+ *      --gtest_filter=*.* --log-to-stderr=true --debug-osd=20"
+ * End:
+ */
@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph distributed storage system
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include "erasure-code/ErasureCodePlugin.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "gtest/gtest.h"
+
+
+TEST(ErasureCodePlugin, factory)
+{
+  ErasureCodePluginRegistry &instance = ErasureCodePluginRegistry::instance();
+  ErasureCodeProfile profile;
+  {
+    ErasureCodeInterfaceRef erasure_code;
+    EXPECT_FALSE(erasure_code);
+    EXPECT_EQ(0, instance.factory("clay",
+				  g_conf->get_val<std::string>("erasure_code_dir"),
+				  profile, &erasure_code, &cerr));
+    EXPECT_TRUE(erasure_code.get());
+    // 4+2, d=5: q=2, t=3
+    EXPECT_EQ(8, erasure_code->get_sub_chunk_count());
+  }
+  {
+    profile["scalar_mds"] = "jerasure";
+    profile["technique"] = "cauchy_good";
+    ErasureCodeInterfaceRef erasure_code;
+    EXPECT_EQ(0, instance.factory("clay",
+				  g_conf->get_val<std::string>("erasure_code_dir"),
+				  profile, &erasure_code, &cerr));
+    EXPECT_TRUE(erasure_code.get());
+  }
+  {
+    profile["scalar_mds"] = "shec";
+    ErasureCodeInterfaceRef erasure_code;
+    EXPECT_EQ(-EINVAL, instance.factory("clay",
+					g_conf->get_val<std::string>("erasure_code_dir"),
+					profile, &erasure_code, &cerr));
+    EXPECT_FALSE(erasure_code);
+  }
+}
+
+/*
+ * Local Variables:
+ * compile-command: "cd ../.. ; make -j4 &&
+ *   make unittest_erasure_code_plugin_clay &&
+ *   valgrind --tool=memcheck ./unittest_erasure_code_plugin_clay \
+ *      --gtest_filter=*.* --log-to-stderr=true --debug-osd=20"
+ * End:
+ */
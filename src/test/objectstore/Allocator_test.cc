@@ -4,7 +4,9 @@
  * In memory space allocator test cases.
  * Author: Ramesh Chander, Ramesh.Chander@sandisk.com
  */
+#include <chrono>
 #include <iostream>
+#include <random>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -13,8 +15,10 @@
 #include "common/errno.h"
 #include "include/stringify.h"
 #include "include/Context.h"
+#include "include/scope_guard.h"
 #include "os/bluestore/Allocator.h"
 #include "os/bluestore/BitAllocator.h"
+#include "include/interval_set.h"
 
 
 #if GTEST_HAS_PARAM_TEST
@@ -218,7 +222,7 @@ TEST_P(AllocTest, test_alloc_big)
 
 TEST_P(AllocTest, test_alloc_hint_bmap)
 {
-  if (GetParam() == std::string("stupid")) {
+  if (GetParam() != std::string("bitmap")) {
     return;
   }
   int64_t blocks = BitMapArea::get_level_factor(g_ceph_context, 2) * 4;
@@ -290,11 +294,205 @@ TEST_P(AllocTest, test_alloc_non_aligned_len)
   EXPECT_EQ(want_size, alloc->allocate(want_size, alloc_unit, 0, &extents));
 }
 
+TEST_P(AllocTest, test_alloc_fragmented)
+{
+  int64_t block_size = 4096;
+  int64_t blocks = 1 << 16;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+
+  /*
+   * Fill the device one block at a time, then punch holes in every
+   * other block.
+   */
+  EXPECT_EQ(0, alloc->reserve(blocks * block_size));
+  AllocExtentVector extents;
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(blocks * block_size,
+	    alloc->allocate(blocks * block_size, block_size, block_size,
+			    (int64_t) 0, &extents));
+  auto contiguous = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ((size_t)blocks, extents.size());
+  interval_set<uint64_t> holes, rest;
+  for (auto& e : extents) {
+    if ((e.offset / block_size) % 2) {
+      holes.insert(e.offset, e.length);
+    } else {
+      rest.insert(e.offset, e.length);
+    }
+  }
+  alloc->release(holes);
+  EXPECT_EQ((uint64_t)(blocks / 2 * block_size), alloc->get_free());
+
+  // nothing larger than a block is left
+  extents.clear();
+  EXPECT_EQ(0, alloc->reserve(2 * block_size));
+  EXPECT_EQ(-ENOSPC,
+	    alloc->allocate(2 * block_size, 2 * block_size, 0, (int64_t) 0,
+			    &extents));
+  alloc->unreserve(2 * block_size);
+
+  // every hole is still usable at block granularity, and finding half
+  // as many blocks in the holes costs about as much as carving them out
+  // of free space in one piece did.  a search that rescans the free
+  // extents for each block takes orders of magnitude longer.
+  extents.clear();
+  EXPECT_EQ(0, alloc->reserve(blocks / 2 * block_size));
+  start = std::chrono::steady_clock::now();
+  EXPECT_EQ(blocks / 2 * block_size,
+	    alloc->allocate(blocks / 2 * block_size, block_size, 0,
+			    (int64_t) 0, &extents));
+  auto fragmented = std::chrono::steady_clock::now() - start;
+  EXPECT_LT(fragmented, contiguous * 10 + std::chrono::milliseconds(100))
+    << GetParam() << ": " << blocks / 2 << " fragmented blocks took "
+    << std::chrono::duration_cast<std::chrono::microseconds>(
+      fragmented).count() << "us, "
+    << blocks << " contiguous ones "
+    << std::chrono::duration_cast<std::chrono::microseconds>(
+      contiguous).count() << "us";
+  EXPECT_EQ(0u, alloc->get_free());
+
+  // releasing everything coalesces back into a single extent
+  for (auto& e : extents) {
+    rest.insert(e.offset, e.length);
+  }
+  alloc->release(rest);
+  extents.clear();
+  EXPECT_EQ(0, alloc->reserve(blocks * block_size));
+  EXPECT_EQ(blocks * block_size,
+	    alloc->allocate(blocks * block_size, blocks * block_size, 0,
+			    (int64_t) 0, &extents));
+  EXPECT_EQ(1u, extents.size());
+}
+
+TEST_P(AllocTest, test_alloc_fragmentation_score)
+{
+  int64_t block_size = 4096;
+  int64_t blocks = 1 << 14;
+  init_alloc(blocks * block_size, block_size);
+  alloc->init_add_free(0, blocks * block_size);
+
+  Allocator::free_stats_t stats;
+  alloc->get_free_stats(block_size, &stats);
+  EXPECT_EQ((uint64_t)(blocks * block_size), stats.free);
+  EXPECT_EQ(1u, stats.extents);
+  EXPECT_EQ((uint64_t)(blocks * block_size), stats.max_extent);
+  EXPECT_EQ(0.0, stats.fragmentation);
+
+  // leave every fourth block free
+  for (int64_t i = 0; i < blocks; i += 4) {
+    alloc->init_rm_free(i * block_size, 3 * block_size);
+  }
+  alloc->get_free_stats(block_size, &stats);
+  EXPECT_EQ((uint64_t)(blocks / 4 * block_size), stats.free);
+  EXPECT_EQ((uint64_t)(blocks / 4), stats.extents);
+  EXPECT_EQ((uint64_t)block_size, stats.max_extent);
+  ASSERT_EQ(1u, stats.histogram.size());
+  EXPECT_EQ((uint64_t)(blocks / 4), stats.histogram[block_size]);
+  EXPECT_GT(stats.fragmentation, 0.5);
+  EXPECT_LT(stats.fragmentation, 1.0);
+
+  // give half of it back in one piece; that should look better
+  double score = stats.fragmentation;
+  for (int64_t i = 0; i < blocks / 2; i += 4) {
+    alloc->init_add_free(i * block_size, 3 * block_size);
+  }
+  alloc->get_free_stats(block_size, &stats);
+  EXPECT_LT(stats.fragmentation, score);
+  EXPECT_EQ(stats.fragmentation, alloc->get_fragmentation_score(block_size));
+}
+
+TEST_P(AllocTest, test_alloc_free_stats_neighbours)
+{
+  int64_t block_size = 4096;
+  int64_t blocks = 1 << 14;
+  init_alloc(blocks * block_size, block_size);
+
+  // free space handed over in pieces of very different sizes (which the
+  // stupid allocator keeps in different bins) is still one extent
+  alloc->init_add_free(0, block_size);
+  alloc->init_add_free(block_size, (blocks / 2 - 1) * block_size);
+  alloc->init_add_free(blocks / 2 * block_size, 2 * block_size);
+
+  Allocator::free_stats_t stats;
+  alloc->get_free_stats(block_size, &stats);
+  EXPECT_EQ((uint64_t)((blocks / 2 + 2) * block_size), stats.free);
+  EXPECT_EQ(1u, stats.extents);
+  EXPECT_EQ(stats.free, stats.max_extent);
+  EXPECT_EQ(0.0, stats.fragmentation);
+  ASSERT_EQ(1u, stats.histogram.size());
+}
+
+TEST_P(AllocTest, test_alloc_hybrid_spill)
+{
+  if (GetParam() != std::string("hybrid")) {
+    return;
+  }
+  string old_mem_cap =
+    stringify(g_conf->get_val<uint64_t>("bluestore_hybrid_alloc_mem_cap"));
+  string old_max_blocks = stringify(
+    g_conf->get_val<uint64_t>("bluestore_hybrid_alloc_bitmap_max_blocks"));
+  auto restore = make_scope_guard([&] {
+    g_conf->set_val("bluestore_hybrid_alloc_mem_cap", old_mem_cap);
+    g_conf->set_val("bluestore_hybrid_alloc_bitmap_max_blocks",
+		    old_max_blocks);
+  });
+  // room for only a handful of range tree entries
+  g_conf->set_val("bluestore_hybrid_alloc_mem_cap", "1024");
+  g_conf->set_val("bluestore_hybrid_alloc_bitmap_max_blocks", "4");
+
+  int64_t block_size = 4096;
+  int64_t size = 1ull << 30;
+  init_alloc(size, block_size);
+  alloc->init_add_free(0, size);
+
+  interval_set<uint64_t> used;
+  vector<AllocExtent> live;
+  std::mt19937_64 rng(0);
+  for (int i = 0; i < 10000; ++i) {
+    if (live.empty() || rng() % 3) {
+      uint64_t unit = block_size << (rng() % 5);
+      uint64_t want = unit * (1 + rng() % 16);
+      if (alloc->reserve(want) < 0) {
+	continue;
+      }
+      AllocExtentVector extents;
+      int64_t got = alloc->allocate(want, unit, 0, (int64_t)(rng() % size),
+				    &extents);
+      if (got < 0) {
+	alloc->unreserve(want);
+	continue;
+      }
+      alloc->unreserve(want - got);
+      for (auto& e : extents) {
+	ASSERT_EQ(0u, e.offset % unit);
+	ASSERT_EQ(0u, e.length % unit);
+	ASSERT_FALSE(used.intersects(e.offset, e.length));
+	used.insert(e.offset, e.length);
+	live.push_back(e);
+      }
+    } else {
+      size_t k = rng() % live.size();
+      interval_set<uint64_t> release;
+      release.insert(live[k].offset, live[k].length);
+      used.erase(live[k].offset, live[k].length);
+      alloc->release(release);
+      live[k] = live.back();
+      live.pop_back();
+    }
+    ASSERT_EQ(size - used.size(), alloc->get_free());
+  }
+  alloc->release(used);
+  AllocExtentVector extents;
+  EXPECT_EQ(0, alloc->reserve(size));
+  EXPECT_EQ(size, alloc->allocate(size, size, 0, (int64_t) 0, &extents));
+  EXPECT_EQ(1u, extents.size());
+}
 
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "hybrid"));
 
 #else
 
@@ -37,6 +37,7 @@
 #include "common/errno.h"
 #include "include/stringify.h"
 #include "include/coredumpctl.h"
+#include "include/scope_guard.h"
 
 #include "include/unordered_map.h"
 #include "store_test_fixture.h"
@@ -2030,6 +2031,250 @@ TEST_P(StoreTest, AppendDeferredVsTailCache) {
   g_ceph_context->_conf->apply_changes(NULL);
 }
 
+TEST_P(StoreTest, DeferredWritesAcrossCollections) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  g_conf->set_val("bluestore_prefer_deferred_size", "65536");
+  g_conf->set_val("bluestore_deferred_batch_ops", "1000");
+  g_conf->set_val("bluestore_deferred_batch_bytes", "65536");
+  g_conf->set_val("bluestore_deferred_max_age", "0.1");
+  g_ceph_context->_conf->apply_changes(NULL);
+  int r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+
+  const int num_colls = 4;
+  const unsigned obj_size = 65536;
+  ghobject_t hoid(hobject_t(sobject_t("deferred", CEPH_NOSNAP)));
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  vector<bufferlist> expected(num_colls);
+  for (int i = 0; i < num_colls; ++i) {
+    cids.push_back(coll_t(spg_t(pg_t(i, 7), shard_id_t::NO_SHARD)));
+    chs.push_back(store->create_new_collection(cids.back()));
+    bufferptr bp(obj_size);
+    memset(bp.c_str(), 'a' + i, bp.length());
+    expected[i].append(bp);
+    ObjectStore::Transaction t;
+    t.create_collection(cids[i], 0);
+    t.write(cids[i], hoid, 0, expected[i].length(), expected[i]);
+    r = apply_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // small overwrites, interleaved across collections, all deferred
+  for (unsigned n = 0; n < 64; ++n) {
+    int i = n % num_colls;
+    unsigned off = (n * 4096 * 3) % obj_size;
+    bufferptr bp(4096);
+    memset(bp.c_str(), 'A' + n % 26, bp.length());
+    bufferlist bl;
+    bl.append(bp);
+    bufferlist t1, t2;
+    t1.substr_of(expected[i], 0, off);
+    t2.substr_of(expected[i], off + bl.length(),
+		 obj_size - off - bl.length());
+    expected[i].clear();
+    expected[i].append(t1);
+    expected[i].append(bl);
+    expected[i].append(t2);
+    ObjectStore::Transaction t;
+    t.write(cids[i], hoid, off, bl.length(), bl);
+    r = apply_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < num_colls; ++i) {
+    bufferlist bl;
+    ASSERT_EQ((int)obj_size, store->read(chs[i], hoid, 0, obj_size, bl));
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+  }
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (int i = 0; i < num_colls; ++i) {
+    auto ch = store->open_collection(cids[i]);
+    bufferlist bl;
+    ASSERT_EQ((int)obj_size, store->read(ch, hoid, 0, obj_size, bl));
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_prefer_deferred_size", "0");
+  g_conf->set_val("bluestore_deferred_batch_ops", "0");
+  g_conf->set_val("bluestore_deferred_batch_bytes", "0");
+  g_conf->set_val("bluestore_deferred_max_age", "1.0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, ShardedKvSyncCollections) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // leave the shard count alone if the whole run was started with several
+  string old_shards =
+    stringify(g_conf->get_val<uint64_t>("bluestore_kv_sync_shards"));
+  if (g_conf->get_val<uint64_t>("bluestore_kv_sync_shards") < 2) {
+    g_conf->set_val("bluestore_kv_sync_shards", "4");
+  }
+  string old_prefer_deferred = stringify(g_conf->bluestore_prefer_deferred_size);
+  string old_batch_ops = stringify(g_conf->bluestore_deferred_batch_ops);
+  g_conf->set_val("bluestore_prefer_deferred_size", "65536");
+  // submit each deferred write as soon as it is queued
+  g_conf->set_val("bluestore_deferred_batch_ops", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+  int r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+
+  // deferred writes to a collection that syncs on a shard other than the
+  // first: the deferred keys must be cleaned up without any commit on
+  // shard 0, i.e. without waiting for umount to force them out.
+  {
+    unsigned shards = g_conf->get_val<uint64_t>("bluestore_kv_sync_shards");
+    coll_t cid;
+    for (unsigned i = 100; ; ++i) {
+      cid = coll_t(spg_t(pg_t(i, 9), shard_id_t::NO_SHARD));
+      if (cid.hash_to_shard(shards) != 0)
+	break;
+    }
+    ghobject_t hoid(hobject_t(sobject_t("other_shard", CEPH_NOSNAP)));
+    auto ch = store->create_new_collection(cid);
+    {
+      ObjectStore::Transaction t;
+      t.create_collection(cid, 0);
+      bufferlist bl;
+      bl.append_zero(65536);
+      t.write(cid, hoid, 0, bl.length(), bl);
+      r = apply_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    const PerfCounters* logger = store->get_perf_counters();
+    uint64_t cleaned =
+      logger->get_tavg_ms(l_bluestore_state_deferred_cleanup_lat).first;
+    const unsigned num_writes = 8;
+    for (unsigned n = 0; n < num_writes; ++n) {
+      ObjectStore::Transaction t;
+      bufferlist bl;
+      bl.append(string(4096, 'a' + n));
+      t.write(cid, hoid, n * 8192, bl.length(), bl);
+      r = apply_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    for (int i = 0; i < 300; ++i) {
+      if (logger->get_tavg_ms(l_bluestore_state_deferred_cleanup_lat).first >=
+	  cleaned + num_writes)
+	break;
+      usleep(100000);
+    }
+    ASSERT_LE(cleaned + num_writes,
+	      logger->get_tavg_ms(l_bluestore_state_deferred_cleanup_lat).first);
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // enough collections that every shard gets some, all committing at once
+  const int num_colls = 16;
+  const unsigned obj_size = 65536;
+  ghobject_t hoid(hobject_t(sobject_t("sharded", CEPH_NOSNAP)));
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  vector<bufferlist> expected(num_colls);
+  {
+    vector<std::unique_ptr<C_SaferCond>> done;
+    for (int i = 0; i < num_colls; ++i) {
+      cids.push_back(coll_t(spg_t(pg_t(i, 9), shard_id_t::NO_SHARD)));
+      chs.push_back(store->create_new_collection(cids.back()));
+      bufferptr bp(obj_size);
+      memset(bp.c_str(), 'a' + i, bp.length());
+      expected[i].append(bp);
+      ObjectStore::Transaction t;
+      t.create_collection(cids[i], 0);
+      t.write(cids[i], hoid, 0, expected[i].length(), expected[i]);
+      done.emplace_back(new C_SaferCond);
+      vector<ObjectStore::Transaction> v = {t};
+      store->queue_transactions(chs[i], v, nullptr, done.back().get());
+    }
+    // deferred overwrites, queued behind the creates on every shard
+    for (unsigned n = 0; n < 4 * num_colls; ++n) {
+      int i = n % num_colls;
+      unsigned off = (n / num_colls) * 8192;
+      bufferptr bp(4096);
+      memset(bp.c_str(), 'A' + n % 26, bp.length());
+      bufferlist bl;
+      bl.append(bp);
+      bufferlist t1, t2;
+      t1.substr_of(expected[i], 0, off);
+      t2.substr_of(expected[i], off + bl.length(),
+		   obj_size - off - bl.length());
+      expected[i].clear();
+      expected[i].append(t1);
+      expected[i].append(bl);
+      expected[i].append(t2);
+      ObjectStore::Transaction t;
+      t.write(cids[i], hoid, off, bl.length(), bl);
+      done.emplace_back(new C_SaferCond);
+      vector<ObjectStore::Transaction> v = {t};
+      store->queue_transactions(chs[i], v, nullptr, done.back().get());
+    }
+    for (auto& c : done) {
+      ASSERT_EQ(0, c->wait());
+    }
+  }
+  for (int i = 0; i < num_colls; ++i) {
+    bufferlist bl;
+    ASSERT_EQ((int)obj_size, store->read(chs[i], hoid, 0, obj_size, bl));
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+  }
+  {
+    // remove every other collection, again all at once
+    vector<std::unique_ptr<C_SaferCond>> done;
+    for (int i = 0; i < num_colls; i += 2) {
+      ObjectStore::Transaction t;
+      t.remove(cids[i], hoid);
+      t.remove_collection(cids[i]);
+      done.emplace_back(new C_SaferCond);
+      vector<ObjectStore::Transaction> v = {t};
+      store->queue_transactions(chs[i], v, nullptr, done.back().get());
+    }
+    for (auto& c : done) {
+      ASSERT_EQ(0, c->wait());
+    }
+  }
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (int i = 0; i < num_colls; ++i) {
+    ASSERT_EQ(i % 2 == 1, store->collection_exists(cids[i]));
+    if (i % 2 == 0)
+      continue;
+    auto ch = store->open_collection(cids[i]);
+    bufferlist bl;
+    ASSERT_EQ((int)obj_size, store->read(ch, hoid, 0, obj_size, bl));
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  g_conf->set_val("bluestore_kv_sync_shards", old_shards);
+  g_conf->set_val("bluestore_prefer_deferred_size", old_prefer_deferred);
+  g_conf->set_val("bluestore_deferred_batch_ops", old_batch_ops);
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTest, AppendZeroTrailingSharedBlock) {
   int r;
   coll_t cid;
@@ -6588,6 +6833,140 @@ TEST_P(StoreTest, KVDBStatsTest) {
 }
 
 #if defined(WITH_BLUESTORE)
+TEST_P(StoreTest, FsckThreads) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  char old_threads[16];
+  char *p = old_threads;
+  ASSERT_EQ(0, g_conf->get_val("bluestore_fsck_threads", &p,
+			       sizeof(old_threads)));
+  auto restore = make_scope_guard([&old_threads] {
+    g_conf->set_val("bluestore_fsck_threads", old_threads);
+  });
+
+  int NUM_OBJS = 200;
+  int r;
+  coll_t cid;
+  string base("testobj.");
+  bufferlist a;
+  bufferptr ap(0x3000);
+  memset(ap.c_str(), 'a', 0x3000);
+  a.append(ap);
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < NUM_OBJS; ++i) {
+    ObjectStore::Transaction t;
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%d", i);
+    ghobject_t hoid(hobject_t(sobject_t(base + string(buf), CEPH_NOSNAP)));
+    t.write(cid, hoid, 0, a.length(), a);
+    t.write(cid, hoid, 0x10000 * (i % 7), a.length(), a);
+    t.omap_setheader(cid, hoid, a);
+    if (i % 3 == 0) {
+      // clones leave shared blobs behind
+      ghobject_t clone(hobject_t(sobject_t(base + string(buf), 1)));
+      t.clone(cid, hoid, clone);
+    }
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  store->umount();
+  for (auto threads : { "1", "8" }) {
+    g_conf->set_val("bluestore_fsck_threads", threads);
+    ASSERT_EQ(store->fsck(false), 0);
+    ASSERT_EQ(store->fsck(true), 0);
+  }
+
+  // the workers share the used-block map, so whichever of them checks an
+  // object first, a damaged store must be reported the same way
+  ASSERT_EQ(store->mount(), 0);
+  ghobject_t misref1(hobject_t(sobject_t("misref1", CEPH_NOSNAP)));
+  ghobject_t misref2(hobject_t(sobject_t("misref2", CEPH_NOSNAP)));
+  ghobject_t freed(hobject_t(sobject_t("freed", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, misref1, 0, a.length(), a);
+    t.write(cid, misref2, 0, a.length(), a);
+    t.write(cid, freed, 0, a.length(), a);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+  ASSERT_TRUE(bstore);
+  bstore->inject_leaked(0x30000);
+  bstore->inject_false_free(cid, freed);
+  bstore->inject_misreference(cid, misref1, cid, misref2, 0);
+  store->umount();
+
+  for (bool deep : { false, true }) {
+    g_conf->set_val("bluestore_fsck_threads", "1");
+    int errors = store->fsck(deep);
+    ASSERT_GT(errors, 0);
+    g_conf->set_val("bluestore_fsck_threads", "8");
+    ASSERT_EQ(store->fsck(deep), errors) << "deep " << deep;
+  }
+  store->mount();
+}
+
+TEST_P(StoreTest, BluestoreCacheAutotune) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  map<string,string> old;
+  for (auto k : { "bluestore_cache_autotune",
+		  "osd_memory_target",
+		  "osd_memory_base",
+		  "osd_memory_expected_fragmentation",
+		  "osd_memory_cache_min",
+		  "osd_memory_cache_resize_interval" }) {
+    char buf[64];
+    char *p = buf;
+    ASSERT_EQ(0, g_conf->get_val(k, &p, sizeof(buf)));
+    old[k] = buf;
+  }
+  auto restore = make_scope_guard([&old] {
+    for (auto& p : old) {
+      g_conf->set_val(p.first, p.second);
+    }
+    g_conf->apply_changes(NULL);
+  });
+  g_conf->set_val("bluestore_cache_autotune", "true");
+  g_conf->set_val("osd_memory_base", "0");
+  g_conf->set_val("osd_memory_expected_fragmentation", "0");
+  g_conf->set_val("osd_memory_cache_min", "134217728");
+  g_conf->set_val("osd_memory_cache_resize_interval", "0.1");
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto wait_for_size = [&](uint64_t lo, uint64_t hi) {
+    for (int i = 0; i < 100; ++i) {
+      uint64_t size = logger->get(l_bluestore_cache_size);
+      if (size >= lo && size <= hi) {
+	return true;
+      }
+      usleep(100000);
+    }
+    cout << "cache size " << logger->get(l_bluestore_cache_size)
+	 << " not in [" << lo << ", " << hi << "]" << std::endl;
+    return false;
+  };
+
+  // far above what we use: the caches may take almost all of it
+  g_conf->set_val("osd_memory_target", "68719476736");
+  g_conf->apply_changes(NULL);
+  ASSERT_TRUE(wait_for_size(32ull << 30, 64ull << 30));
+
+  // the caches must shrink again, but never below osd_memory_cache_min
+  g_conf->set_val("osd_memory_target", "268435456");
+  g_conf->apply_changes(NULL);
+  ASSERT_TRUE(wait_for_size(128ull << 20, 256ull << 20));
+}
+
 TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   int r;
   coll_t cid;
@@ -6754,6 +7133,130 @@ TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   g_conf->set_val("bluestore_compression_mode", "none");
   g_conf->apply_changes(NULL);
 }
+
+TEST_P(StoreTestSpecificAUSize, BluestoreDefrag) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  map<string,string> old;
+  for (auto k : { "bluestore_defrag",
+		  "bluestore_defrag_interval",
+		  "bluestore_defrag_threshold",
+		  "bluestore_defrag_idle_txc",
+		  "bluestore_defrag_min_pextents",
+		  "bluestore_defrag_max_bytes" }) {
+    char buf[64];
+    char *p = buf;
+    ASSERT_EQ(0, g_conf->get_val(k, &p, sizeof(buf)));
+    old[k] = buf;
+  }
+  auto restore = make_scope_guard([&old] {
+    for (auto& p : old) {
+      g_conf->set_val(p.first, p.second);
+    }
+    g_conf->apply_changes(NULL);
+  });
+  // rewrite every blob we find, however busy the store is
+  g_conf->set_val("bluestore_defrag", "true");
+  g_conf->set_val("bluestore_defrag_interval", "0.1");
+  g_conf->set_val("bluestore_defrag_threshold", "0");
+  g_conf->set_val("bluestore_defrag_idle_txc", stringify(1ull << 32));
+  g_conf->set_val("bluestore_defrag_min_pextents", "1");
+  g_conf->set_val("bluestore_defrag_max_bytes", "1048576");
+  g_conf->apply_changes(NULL);
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // interleave the writes so that the objects' extents are scattered
+  const unsigned num_objs = 4;
+  const unsigned obj_size = 256 * 1024;
+  const unsigned chunk = 4096;
+  vector<ghobject_t> oids;
+  vector<bufferlist> expected(num_objs);
+  for (unsigned i = 0; i < num_objs; ++i) {
+    oids.push_back(ghobject_t(hobject_t(sobject_t(
+      "defrag_" + stringify(i), CEPH_NOSNAP))));
+  }
+  for (unsigned off = 0; off < obj_size; off += chunk) {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_objs; ++i) {
+      bufferptr bp(chunk);
+      memset(bp.c_str(), 'a' + (off / chunk + i) % 26, bp.length());
+      bufferlist bl;
+      bl.append(bp);
+      t.write(cid, oids[i], off, bl.length(), bl);
+      expected[i].append(bl);
+    }
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // keep the sequencer busy while the defrag thread works on the same
+  // collection, so that it has to check that it is the only txc preparing
+  ghobject_t busy(hobject_t(sobject_t("busy", CEPH_NOSNAP)));
+  const PerfCounters* logger = store->get_perf_counters();
+  for (int i = 0; i < 300 && logger->get(l_bluestore_defrag_blobs) == 0; ++i) {
+    for (unsigned n = 0; n < 16; ++n) {
+      ObjectStore::Transaction t;
+      bufferptr bp(chunk);
+      memset(bp.c_str(), 'A' + n, bp.length());
+      bufferlist bl;
+      bl.append(bp);
+      t.write(cid, busy, n * chunk, bl.length(), bl);
+      vector<ObjectStore::Transaction> v = {t};
+      store->queue_transactions(ch, v);
+    }
+    ObjectStore::Transaction t;
+    t.touch(cid, busy);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    usleep(100000);
+  }
+  ASSERT_GT(logger->get(l_bluestore_defrag_blobs), 0u);
+  ASSERT_GT(logger->get(l_bluestore_defrag_bytes), 0u);
+  // sampled by the same thread
+  ASSERT_GT(logger->get(l_bluestore_free_extents), 0u);
+
+  for (unsigned i = 0; i < num_objs; ++i) {
+    bufferlist bl;
+    r = store->read(ch, oids[i], 0, obj_size, bl);
+    ASSERT_EQ(r, (int)obj_size);
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+  }
+
+  // stop rewriting before checking the on-disk state
+  g_conf->set_val("bluestore_defrag", "false");
+  g_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(store->fsck(false), 0);
+  store->mount();
+  ch = store->open_collection(cid);
+  for (unsigned i = 0; i < num_objs; ++i) {
+    bufferlist bl;
+    r = store->read(ch, oids[i], 0, obj_size, bl);
+    ASSERT_EQ(r, (int)obj_size);
+    ASSERT_TRUE(bl_eq(expected[i], bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (auto& oid : oids) {
+      t.remove(cid, oid);
+    }
+    t.remove(cid, busy);
+    t.remove_collection(cid);
+    r = apply_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
 #endif
 
 TEST_P(StoreTestSpecificAUSize, fsckOnUnalignedDevice) {
@@ -13,6 +13,7 @@
 #include "include/stringify.h"
 #include "include/scope_guard.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
@@ -241,6 +242,7 @@ void join_all(std::vector<std::thread>& v)
 }
 
 #define NUM_WRITERS 3
+#define WAL_RECORDS 1000
 #define NUM_SYNC_THREADS 1
 
 #define NUM_SINGLE_FILE_WRITERS 1
@@ -567,6 +569,153 @@ TEST(BlueFS, test_replay) {
   rm_temp_bdev(fn);
 }
 
+void read_file(BlueFS &fs, const string& dir, const string& file,
+	       bufferlist *expected)
+{
+  BlueFS::FileReader *h;
+  ASSERT_EQ(0, fs.open_for_read(dir, file, &h, true));
+  std::unique_ptr<BlueFS::FileReader> hp(h);
+  char buf[ALLOC_SIZE];
+  unsigned n = 0;
+  while (!writes_done || n < 100) {
+    uint64_t off = (n++ * 1031) % (expected->length() - ALLOC_SIZE);
+    ASSERT_EQ(ALLOC_SIZE, fs.read_random(h, off, ALLOC_SIZE, buf));
+    ASSERT_EQ(0, memcmp(buf, expected->c_str() + off, ALLOC_SIZE));
+    fs.invalidate_cache(h->file, off, ALLOC_SIZE);
+  }
+}
+
+TEST(BlueFS, test_read_during_flush) {
+  uint64_t size = 1048576 * 128;
+  string fn = get_temp_bdev(size);
+  g_ceph_context->_conf->set_val(
+    "bluefs_alloc_size",
+    "65536");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  {
+    // readers of an already flushed file must not be held up by (or
+    // interfere with) writers flushing and syncing other files
+    bufferlist expected;
+    std::unique_ptr<char[]> buf = gen_buffer(1048576);
+    expected.append(buf.get(), 1048576);
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir.read"));
+    ASSERT_EQ(0, fs.open_for_write("dir.read", "file", &h, false));
+    h->append(expected.c_str(), expected.length());
+    ASSERT_EQ(0, fs.fsync(h));
+    fs.close_writer(h);
+
+    writes_done = false;
+    std::vector<std::thread> read_threads;
+    for (int i=0; i<NUM_WRITERS; i++) {
+      read_threads.push_back(std::thread(read_file, std::ref(fs),
+					 "dir.read", "file", &expected));
+    }
+    std::vector<std::thread> write_threads;
+    uint64_t effective_size = size - (32 * 1048576);
+    uint64_t per_thread_bytes = (effective_size/(NUM_WRITERS));
+    for (int i=0; i<NUM_WRITERS; i++) {
+      write_threads.push_back(std::thread(write_data, std::ref(fs), per_thread_bytes));
+    }
+    join_all(write_threads);
+    writes_done = true;
+    join_all(read_threads);
+  }
+  fs.umount();
+  rm_temp_bdev(fn);
+}
+
+void write_wal(BlueFS &fs, int n)
+{
+  BlueFS::FileWriter *h;
+  string file = "wal." + to_string(n) + ".log";
+  ASSERT_EQ(0, fs.open_for_write("db", file, &h, false));
+  for (unsigned i = 0; i < WAL_RECORDS; ++i) {
+    string rec = "record." + to_string(n) + "." + to_string(i) + ";";
+    h->append(rec.c_str(), rec.length());
+    ASSERT_EQ(0, fs.fsync(h));
+  }
+  fs.close_writer(h);
+}
+
+TEST(BlueFS, test_wal_group_commit) {
+  uint64_t size = 1048576 * 128;
+  string fn = get_temp_bdev(size);
+  string old_alloc_size = stringify(
+    g_ceph_context->_conf->get_val<uint64_t>("bluefs_alloc_size"));
+  string old_prealloc_size = stringify(
+    g_ceph_context->_conf->get_val<uint64_t>("bluefs_wal_prealloc_size"));
+  bool old_preextend =
+    g_ceph_context->_conf->get_val<bool>("bluefs_preextend_wal_files");
+  g_ceph_context->_conf->set_val("bluefs_alloc_size", "65536");
+  g_ceph_context->_conf->set_val("bluefs_preextend_wal_files", "true");
+  g_ceph_context->_conf->set_val("bluefs_wal_prealloc_size", "4194304");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("db"));
+  {
+    const PerfCounters *logger = fs.get_perf_counters();
+    uint64_t flushes = logger->get(l_bluefs_bdev_flushes);
+    uint64_t grouped = logger->get(l_bluefs_bdev_flushes_grouped);
+    std::vector<std::thread> write_threads;
+    for (int i=0; i<NUM_WRITERS; i++) {
+      write_threads.push_back(std::thread(write_wal, std::ref(fs), i));
+    }
+    join_all(write_threads);
+    // every fsync asks for a device flush, and each request is either
+    // served by a flush of its own or counted as grouped into another
+    // one.  how many get grouped is up to timing.
+    flushes = logger->get(l_bluefs_bdev_flushes) - flushes;
+    grouped = logger->get(l_bluefs_bdev_flushes_grouped) - grouped;
+    cout << flushes << " flushes, " << grouped << " grouped" << std::endl;
+    ASSERT_GT(flushes, 0u);
+    ASSERT_GE(flushes + grouped, (uint64_t)NUM_WRITERS * WAL_RECORDS);
+  }
+  fs.umount();
+  ASSERT_EQ(0, fs.mount());
+  for (int i=0; i<NUM_WRITERS; i++) {
+    // the WAL files are preextended, so their size covers the whole
+    // preallocated chunk; the records must all be there.
+    uint64_t fsize;
+    utime_t mtime;
+    string file = "wal." + to_string(i) + ".log";
+    ASSERT_EQ(0, fs.stat("db", file, &fsize, &mtime));
+    ASSERT_GE(fsize, 4194304u);
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("db", file, &h));
+    std::unique_ptr<BlueFS::FileReader> hp(h);
+    bufferlist bl;
+    BlueFS::FileReaderBuffer buf(4096);
+    string last = "record." + to_string(i) + "." +
+      to_string(WAL_RECORDS - 1) + ";";
+    ASSERT_EQ(65536, fs.read(h, &buf, 0, 65536, &bl, NULL));
+    string got(bl.c_str(), bl.length());
+    ASSERT_EQ(0u, got.find("record." + to_string(i) + ".0;"));
+    ASSERT_NE(string::npos, got.find(last));
+  }
+  fs.umount();
+  g_ceph_context->_conf->set_val("bluefs_alloc_size", old_alloc_size);
+  g_ceph_context->_conf->set_val("bluefs_preextend_wal_files",
+				 old_preextend ? "true" : "false");
+  g_ceph_context->_conf->set_val("bluefs_wal_prealloc_size",
+				 old_prealloc_size);
+  g_ceph_context->_conf->apply_changes(NULL);
+  rm_temp_bdev(fn);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -0,0 +1,245 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <list>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "os/bluestore/aio.h"
+#include "os/bluestore/ioring.h"
+#include "gtest/gtest.h"
+
+static const uint64_t file_size = 16 << 20;
+static const uint64_t block = 4096;
+
+struct io_file {
+  std::string path;
+  int fd = -1;
+
+  io_file() {
+    char fn[] = "/tmp/ceph_test_io_queue.XXXXXX";
+    fd = mkstemp(fn);
+    assert(fd >= 0);
+    path = fn;
+    int r = ::ftruncate(fd, file_size);
+    assert(r == 0);
+  }
+  ~io_file() {
+    ::close(fd);
+    ::unlink(path.c_str());
+  }
+};
+
+/**
+ * submit aios in one batch and wait for all of them to complete.  like
+ * KernelDevice's aio thread, completions are reaped while the batch is
+ * still being submitted, so that a full ring can drain.
+ */
+static void run_batch(io_queue_t *q, std::list<aio_t> &aios)
+{
+  std::atomic<int> reaped = {0};
+  std::thread reaper([&] {
+      aio_t *done[16];
+      while (reaped < (int)aios.size()) {
+	int r = q->get_next_completed(100, done, 16);
+	if (r < 0) {
+	  break;
+	}
+	reaped += r;
+      }
+    });
+  int retries = 0;
+  int r = q->submit_batch(aios.begin(), aios.end(), aios.size(), nullptr,
+			  &retries);
+  reaper.join();
+  ASSERT_EQ((int)aios.size(), r);
+  ASSERT_EQ((int)aios.size(), reaped);
+}
+
+static void read_file(int fd, bufferlist *bl)
+{
+  bl->clear();
+  ::lseek(fd, 0, SEEK_SET);
+  ASSERT_EQ((ssize_t)file_size, bl->read_fd(fd, file_size));
+}
+
+/*
+ * Write a random pattern through the (initialized) queue q in batches
+ * of batch aios, then read every block back through q and compare it
+ * both with what was written and with the file contents.
+ */
+static void exercise(io_queue_t *q, int fd, unsigned batch, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  bufferlist expected;
+  expected.append_zero(file_size);
+  expected.rebuild();
+  for (unsigned pass = 0; pass < 8; ++pass) {
+    // the ios of a batch may complete in any order, so give each its
+    // own region of the file
+    uint64_t region = file_size / batch;
+    std::list<aio_t> aios;
+    for (unsigned i = 0; i < batch; ++i) {
+      uint64_t len = block * (1 + rng() % 4);
+      uint64_t off = region * i +
+	(rng() % ((region - len) / block + 1)) * block;
+      bufferptr p = buffer::create_page_aligned(len);
+      for (unsigned j = 0; j < len; ++j) {
+	p.c_str()[j] = (char)rng();
+      }
+      memcpy(expected.c_str() + off, p.c_str(), len);
+      aios.emplace_back(nullptr, fd);
+      aio_t &aio = aios.back();
+      aio.bl.append(p);
+      aio.bl.prepare_iov(&aio.iov);
+      aio.pwritev(off, len);
+    }
+    run_batch(q, aios);
+    for (auto &aio : aios) {
+      ASSERT_EQ((int)aio.length, aio.get_return_value());
+    }
+  }
+
+  for (uint64_t off = 0; off < file_size; off += block * batch) {
+    std::list<aio_t> aios;
+    for (uint64_t o = off; o < off + block * batch && o < file_size;
+	 o += block) {
+      aios.emplace_back(nullptr, fd);
+      aios.back().pread(o, block);
+    }
+    run_batch(q, aios);
+    for (auto &aio : aios) {
+      ASSERT_EQ((int)block, aio.get_return_value());
+      ASSERT_EQ(0, memcmp(aio.bl.c_str(), expected.c_str() + aio.offset,
+			  block)) << "offset " << aio.offset;
+    }
+  }
+
+  bufferlist ondisk;
+  read_file(fd, &ondisk);
+  ASSERT_TRUE(ondisk.contents_equal(expected));
+}
+
+TEST(io_queue, aio)
+{
+  io_file f;
+  aio_queue_t q(128);
+  std::vector<int> fds = {f.fd};
+  ASSERT_EQ(0, q.init(fds));
+  exercise(&q, f.fd, 64, 1);
+  q.shutdown();
+}
+
+/*
+ * The io_uring backend must leave the same bytes on disk and read back
+ * the same bytes as libaio does for the same sequence of ios.  The
+ * ring is smaller than a batch, so submission has to wait for room.
+ */
+TEST(io_queue, ioring_matches_aio)
+{
+  if (!ioring_queue_t::supported()) {
+    std::cerr << "SKIP: io_uring is not available" << std::endl;
+    return;
+  }
+  for (bool sq_thread : {false, true}) {
+    io_file a, b;
+    {
+      ioring_queue_t q(16, false, sq_thread);
+      std::vector<int> fds = {b.fd};
+      if (q.init(fds) < 0) {
+	// SQPOLL may need privileges we do not have
+	std::cerr << "SKIP: cannot set up a ring with sq_thread="
+		  << sq_thread << std::endl;
+	continue;
+      }
+      exercise(&q, b.fd, 64, 2);
+      q.shutdown();
+    }
+    {
+      aio_queue_t q(128);
+      std::vector<int> fds = {a.fd};
+      ASSERT_EQ(0, q.init(fds));
+      exercise(&q, a.fd, 64, 2);
+      q.shutdown();
+    }
+    bufferlist abl, bbl;
+    read_file(a.fd, &abl);
+    read_file(b.fd, &bbl);
+    ASSERT_TRUE(abl.contents_equal(bbl)) << "sq_thread " << sq_thread;
+  }
+}
+
+/*
+ * Nothing is reaped until well after the batch has been handed over, so
+ * submission must stop at the size of the completion ring and wait
+ * rather than overrun it.
+ */
+TEST(io_queue, ioring_cq_full)
+{
+  if (!ioring_queue_t::supported()) {
+    std::cerr << "SKIP: io_uring is not available" << std::endl;
+    return;
+  }
+  io_file f;
+  ioring_queue_t q(4, false, false);
+  std::vector<int> fds = {f.fd};
+  ASSERT_EQ(0, q.init(fds));
+  const int num = 256;
+  std::list<aio_t> aios;
+  for (int i = 0; i < num; ++i) {
+    aios.emplace_back(nullptr, f.fd);
+    aios.back().pread(i * block, block);
+  }
+  std::atomic<bool> submitted = {false};
+  std::atomic<int> reaped = {0};
+  std::thread reaper([&] {
+      usleep(100000);
+      EXPECT_FALSE(submitted);
+      aio_t *done[16];
+      while (reaped < num) {
+	int r = q.get_next_completed(100, done, 16);
+	if (r < 0) {
+	  break;
+	}
+	reaped += r;
+      }
+    });
+  int retries = 0;
+  int r = q.submit_batch(aios.begin(), aios.end(), aios.size(), nullptr,
+			 &retries);
+  submitted = true;
+  reaper.join();
+  ASSERT_EQ(num, r);
+  ASSERT_EQ(num, reaped);
+  ASSERT_GT(retries, 0);
+  for (auto &aio : aios) {
+    ASSERT_EQ((int)block, aio.get_return_value());
+  }
+  q.shutdown();
+}
+
+/*
+ * Before 5.11 the sq thread only works on registered files; with none
+ * registered the queue has to do without it.
+ */
+TEST(io_queue, ioring_sq_thread_unregistered)
+{
+  if (!ioring_queue_t::supported()) {
+    std::cerr << "SKIP: io_uring is not available" << std::endl;
+    return;
+  }
+  io_file f;
+  ioring_queue_t q(16, false, true);
+  std::vector<int> fds;
+  ASSERT_EQ(0, q.init(fds));
+  exercise(&q, f.fd, 64, 3);
+  q.shutdown();
+}
@@ -417,6 +417,81 @@ TEST_P(KVTest, RocksDBIteratorTest) {
   fini();
 }
 
+TEST_P(KVTest, RocksDBWholeSpaceIteratorTest) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  std::vector<KeyValueDB::ColumnFamily> cfs;
+  cfs.push_back(KeyValueDB::ColumnFamily("M", "cache_ratio=0.2"));
+  cfs.push_back(KeyValueDB::ColumnFamily("O", ""));
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  std::vector<std::pair<string,string>> keys = {
+    {"A", "key1"}, {"A", "key2"}, {"C", "key1"},
+    {"M", "key1"}, {"M", "key2"}, {"M", "key3"},
+    {"O", "key1"}, {"S", "key1"}
+  };
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (auto& k : keys) {
+      bufferlist v;
+      v.append(k.first + k.second);
+      t->set(k.first, k.second, v);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  {
+    cout << "walking all CFs forward and backward" << std::endl;
+    KeyValueDB::WholeSpaceIterator iter = db->get_wholespace_iterator();
+    unsigned n = 0;
+    for (iter->seek_to_first(); iter->valid(); iter->next(), ++n) {
+      ASSERT_LT(n, keys.size());
+      ASSERT_EQ(keys[n], iter->raw_key());
+      ASSERT_EQ(keys[n].first + keys[n].second, _bl_to_str(iter->value()));
+    }
+    ASSERT_EQ(keys.size(), n);
+    for (iter->seek_to_last(); iter->valid(); iter->prev()) {
+      ASSERT_LT(0u, n);
+      ASSERT_EQ(keys[--n], iter->raw_key());
+    }
+    ASSERT_EQ(0u, n);
+  }
+  {
+    cout << "changing direction across CFs" << std::endl;
+    KeyValueDB::WholeSpaceIterator iter = db->get_wholespace_iterator();
+    ASSERT_EQ(0, iter->lower_bound("M", "key2"));
+    ASSERT_EQ(keys[4], iter->raw_key());
+    ASSERT_EQ(0, iter->prev());
+    ASSERT_EQ(0, iter->prev());
+    ASSERT_EQ(keys[2], iter->raw_key());
+    ASSERT_EQ(0, iter->next());
+    ASSERT_EQ(keys[3], iter->raw_key());
+    ASSERT_EQ(0, iter->seek_to_last("M"));
+    ASSERT_EQ(keys[5], iter->raw_key());
+    ASSERT_EQ(0, iter->next());
+    ASSERT_EQ(keys[6], iter->raw_key());
+    ASSERT_EQ(0, iter->upper_bound("O", "key1"));
+    ASSERT_TRUE(iter->raw_key_is_prefixed("S"));
+  }
+  {
+    cout << "prefix iterators over the default CF" << std::endl;
+    KeyValueDB::Iterator iter = db->get_iterator("A");
+    unsigned n = 0;
+    for (iter->seek_to_first(); iter->valid(); iter->next(), ++n) {
+      ASSERT_EQ(keys[n].second, iter->key());
+    }
+    ASSERT_EQ(2u, n);
+  }
+  db->compact_prefix("M");
+  db->compact_range("M", "key1", "key2");
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("M", "key2", &v));
+    ASSERT_EQ("Mkey2", _bl_to_str(v));
+  }
+  fini();
+}
+
 TEST_P(KVTest, RocksDBCFMerge) {
   if(string(GetParam()) != "rocksdb")
     return;
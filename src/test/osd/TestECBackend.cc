@@ -17,6 +17,10 @@
 #include <errno.h>
 #include <signal.h>
 #include "osd/ECBackend.h"
+#include "erasure-code/ErasureCode.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "include/stringify.h"
 #include "gtest/gtest.h"
 
 TEST(ECUtil, stripe_info_t)
@@ -58,3 +62,93 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+
+// k=2 m=1: the coding chunk is the xor of the two data chunks
+class XorCode final : public ceph::ErasureCode {
+public:
+  unsigned int get_chunk_count() const override {
+    return 3;
+  }
+  unsigned int get_data_chunk_count() const override {
+    return 2;
+  }
+  unsigned int get_chunk_size(unsigned int object_size) const override {
+    return object_size / 2;
+  }
+  int encode_chunks(const set<int> &want_to_encode,
+		    map<int, bufferlist> *encoded) override {
+    const char *a = (*encoded)[0].c_str();
+    const char *b = (*encoded)[1].c_str();
+    char *p = (*encoded)[2].c_str();
+    for (unsigned i = 0; i < (*encoded)[2].length(); ++i)
+      p[i] = a[i] ^ b[i];
+    return 0;
+  }
+  int decode_chunks(const set<int> &want_to_read,
+		    const map<int, bufferlist> &chunks,
+		    map<int, bufferlist> *decoded) override {
+    for (int i = 0; i < 3; ++i) {
+      if (chunks.count(i))
+	continue;
+      char *p = (*decoded)[i].c_str();
+      const char *a = (*decoded)[(i + 1) % 3].c_str();
+      const char *b = (*decoded)[(i + 2) % 3].c_str();
+      for (unsigned j = 0; j < (*decoded)[i].length(); ++j)
+	p[j] = a[j] ^ b[j];
+    }
+    return 0;
+  }
+};
+
+TEST(ECUtil, parallel_matches_serial)
+{
+  // code every input in parallel
+  uint64_t min_bytes =
+    g_ceph_context->_conf->get_val<uint64_t>("osd_ec_parallel_min_bytes");
+  g_ceph_context->_conf->set_val("osd_ec_parallel_min_bytes", "1");
+
+  const uint64_t swidth = 8192;
+  const uint64_t stripes = 37;
+  ECUtil::stripe_info_t sinfo(2, swidth);
+  ErasureCodeInterfaceRef ec_impl(new XorCode);
+
+  bufferlist in;
+  bufferptr bp(swidth * stripes);
+  for (unsigned i = 0; i < bp.length(); ++i)
+    bp.c_str()[i] = (char)(i * 2654435761u >> 13);
+  in.append(bp);
+
+  set<int> want = {0, 1, 2};
+  map<int, bufferlist> serial, parallel;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec_impl, in, want, &serial));
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec_impl, in, want, &parallel,
+			      g_ceph_context));
+  ASSERT_EQ(3u, parallel.size());
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE(serial[i].contents_equal(parallel[i])) << "shard " << i;
+
+  // rebuild the data from each pair of shards, both ways
+  for (int lost = 0; lost < 3; ++lost) {
+    map<int, bufferlist> to_decode = serial;
+    to_decode.erase(lost);
+    bufferlist serial_out, parallel_out;
+    ASSERT_EQ(0, ECUtil::decode(sinfo, ec_impl, to_decode, &serial_out));
+    ASSERT_EQ(0, ECUtil::decode(sinfo, ec_impl, to_decode, &parallel_out,
+				g_ceph_context));
+    ASSERT_TRUE(in.contents_equal(serial_out)) << "lost " << lost;
+    ASSERT_TRUE(in.contents_equal(parallel_out)) << "lost " << lost;
+
+    map<int, bufferlist> shard_out;
+    map<int, bufferlist*> serial_shards, parallel_shards;
+    serial_shards[lost] = &shard_out[0];
+    parallel_shards[lost] = &shard_out[1];
+    ASSERT_EQ(0, ECUtil::decode(sinfo, ec_impl, to_decode, serial_shards));
+    ASSERT_EQ(0, ECUtil::decode(sinfo, ec_impl, to_decode, parallel_shards,
+				g_ceph_context));
+    ASSERT_TRUE(serial[lost].contents_equal(shard_out[0])) << "lost " << lost;
+    ASSERT_TRUE(serial[lost].contents_equal(shard_out[1])) << "lost " << lost;
+  }
+
+  g_ceph_context->_conf->set_val("osd_ec_parallel_min_bytes",
+				 stringify(min_bytes));
+}
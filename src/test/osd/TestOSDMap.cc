@@ -368,6 +368,58 @@ TEST_F(OSDMapTest, KeepsNecessaryTemps) {
   EXPECT_FALSE(pending_inc.new_primary_temp.count(pgid));
 }
 
+TEST_F(OSDMapTest, PGsRemappedBy) {
+  set_up_map();
+  mapping.update(osdmap);
+
+  pg_t pgid = osdmap.raw_pg_to_pg(pg_t(0, my_rep_pool));
+  vector<int> up_osds, acting_osds;
+  int up_primary, acting_primary;
+  osdmap.pg_to_up_acting_osds(pgid, &up_osds, &up_primary,
+			      &acting_osds, &acting_primary);
+
+  // a pg_temp only touches its pg
+  OSDMap::Incremental pgtemp_map(osdmap.get_epoch() + 1);
+  pgtemp_map.new_pg_temp[pgid] = mempool::osdmap::vector<int>(
+    up_osds.rbegin(), up_osds.rend());
+  set<pg_t> pgs;
+  ASSERT_TRUE(osdmap.get_pgs_remapped_by(pgtemp_map, &pgs));
+  ASSERT_EQ(1u, pgs.size());
+  ASSERT_EQ(pgid, *pgs.begin());
+  osdmap.apply_incremental(pgtemp_map);
+
+  // and updating just that pg brings the mapping up to date
+  for (auto& pg : pgs) {
+    mapping.update(osdmap, pg);
+  }
+  for (unsigned ps = 0; ps < 64; ++ps) {
+    pg_t pg(ps, my_rep_pool);
+    vector<int> up, acting, up2, acting2;
+    int upp, actingp, upp2, actingp2;
+    osdmap.pg_to_up_acting_osds(pg, &up, &upp, &acting, &actingp);
+    mapping.get(pg, &up2, &upp2, &acting2, &actingp2);
+    ASSERT_EQ(up, up2);
+    ASSERT_EQ(acting, acting2);
+    ASSERT_EQ(actingp, actingp2);
+  }
+
+  // a resized pool touches all of its pgs
+  OSDMap::Incremental resize_map(osdmap.get_epoch() + 1);
+  pg_pool_t *p = resize_map.get_new_pool(
+    my_rep_pool, osdmap.get_pg_pool(my_rep_pool));
+  p->set_pg_num(128);
+  pgs.clear();
+  ASSERT_TRUE(osdmap.get_pgs_remapped_by(resize_map, &pgs));
+  ASSERT_EQ(128u, pgs.size());
+
+  // weight changes may move anything
+  OSDMap::Incremental weight_map(osdmap.get_epoch() + 1);
+  weight_map.new_weight[0] = CEPH_OSD_OUT;
+  pgs.clear();
+  ASSERT_FALSE(osdmap.get_pgs_remapped_by(weight_map, &pgs));
+  ASSERT_TRUE(pgs.empty());
+}
+
 TEST_F(OSDMapTest, PrimaryAffinity) {
   set_up_map();
 
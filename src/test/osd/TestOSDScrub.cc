@@ -142,6 +142,40 @@ TEST(TestOSDScrub, scrub_time_permit) {
 
 }
 
+TEST(TestOSDScrub, scrub_governor) {
+  g_ceph_context->_conf->set_val("osd_scrub_max_bytes_per_sec", "1000000");
+  g_ceph_context->_conf->set_val("osd_scrub_min_bytes_per_sec", "100000");
+  g_ceph_context->_conf->set_val("osd_scrub_client_latency_target", "0.01");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ScrubGovernor governor(g_ceph_context);
+
+  // scrub reads on credit and then sleeps it off at the full rate
+  ASSERT_EQ(utime_t(), governor.get_delay(utime_t(1000, 0)));
+  governor.charge(2000000, utime_t(1000, 0));
+  ASSERT_DOUBLE_EQ(2.0, governor.get_delay(utime_t(1000, 0)));
+  ASSERT_DOUBLE_EQ(1.0, governor.get_delay(utime_t(1001, 0)));
+  ASSERT_DOUBLE_EQ(1000000, governor.get_rate());
+
+  // 2% of client ops over the target halves the rate
+  for (int i = 0; i < 98; ++i)
+    governor.client_op_done(utime_t(0, 1000000));
+  governor.client_op_done(utime_t(0, 20000000));
+  governor.client_op_done(utime_t(0, 20000000));
+  ASSERT_DOUBLE_EQ(1.0, governor.get_delay(utime_t(1002, 0)));
+  ASSERT_DOUBLE_EQ(500000, governor.get_rate());
+
+  // and it grows back by a tenth of the maximum once clients are fine
+  ASSERT_EQ(utime_t(), governor.get_delay(utime_t(1003, 0)));
+  ASSERT_DOUBLE_EQ(600000, governor.get_rate());
+
+  g_ceph_context->_conf->set_val("osd_scrub_max_bytes_per_sec", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  governor.charge(2000000, utime_t(1004, 0));
+  ASSERT_EQ(utime_t(), governor.get_delay(utime_t(1004, 0)));
+  g_ceph_context->_conf->set_val("osd_scrub_client_latency_target", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 // Local Variables:
 // compile-command: "cd ../.. ; make unittest_osdscrub ; ./unittest_osdscrub --log-to-stderr=true  --debug-osd=20 # --gtest_filter=*.* "
 // End:
@@ -2933,6 +2933,36 @@ TEST_F(PGLogTrimTest, TestGetRequest) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(PGLogTrimTest, TestTrimKeepsObjectIndex) {
+  SetUp(1, 2, 20);
+  PGLog::IndexedLog log;
+  log.head = mk_evt(20, 0);
+  log.skip_can_rollback_to_to_head();
+  log.head = mk_evt(9, 0);
+
+  hobject_t obj1 = mk_obj(1);
+  log.add(mk_ple_mod(obj1, mk_evt(10, 100), mk_evt(8, 70)));
+  EXPECT_TRUE(log.logged_object(obj1));
+  log.add(mk_ple_dt(mk_obj(2), mk_evt(15, 150), mk_evt(10, 100)));
+  log.add(mk_ple_mod(obj1, mk_evt(20, 160), mk_evt(10, 100)));
+
+  // the index key of obj1 moves on to the soid of its newest entry ...
+  auto p = log.objects.find(obj1);
+  ASSERT_TRUE(p != log.objects.end());
+  EXPECT_EQ(mk_evt(20, 160), p->second->version);
+  EXPECT_EQ(&p->second->soid, &p->first.get());
+
+  // ... so that trimming the entry it was first added with is safe
+  log.trim(cct, mk_evt(19, 157), nullptr, nullptr, nullptr);
+  EXPECT_EQ(1u, log.log.size());
+  EXPECT_TRUE(log.logged_object(obj1));
+  EXPECT_FALSE(log.logged_object(mk_obj(2)));
+  p = log.objects.find(obj1);
+  ASSERT_TRUE(p != log.objects.end());
+  EXPECT_EQ(&log.log.back(), p->second);
+  EXPECT_EQ(&log.log.back().soid, &p->first.get());
+}
+
 TEST_F(PGLogTest, _merge_object_divergent_entries) {
   {
     // Test for issue 20843
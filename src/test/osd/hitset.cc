@@ -122,6 +122,89 @@ TEST_F(BloomHitSetTest, RejectsNoMatch) {
   EXPECT_LT(matches, 2);
 }
 
+class BlockedBloomHitSetTest : public testing::Test, public HitSetTestStrap {
+public:
+
+  BlockedBloomHitSetTest()
+    : HitSetTestStrap(new HitSet(new BlockedBloomHitSet)) {}
+
+  void rebuild(double fp, uint64_t target, uint64_t seed) {
+    BlockedBloomHitSet::Params *bparams =
+      new BlockedBloomHitSet::Params(fp, target, seed);
+    HitSet::Params param(bparams);
+    HitSet new_set(param);
+    *hitset = new_set;
+  }
+};
+
+TEST_F(BlockedBloomHitSetTest, Params) {
+  HitSet::Params params(new BlockedBloomHitSet::Params(0.01, 100, 5));
+  bufferlist bl;
+  params.encode(bl);
+  HitSet::Params p2;
+  bufferlist::iterator iter = bl.begin();
+  p2.decode(iter);
+  ASSERT_EQ(HitSet::TYPE_BLOCKED_BLOOM, p2.get_type());
+  BloomHitSet::Params *bp = static_cast<BloomHitSet::Params*>(p2.impl.get());
+  EXPECT_EQ(.01, bp->get_fpp());
+  EXPECT_EQ((unsigned)100, bp->target_size);
+  EXPECT_EQ((unsigned)5, bp->seed);
+}
+
+TEST_F(BlockedBloomHitSetTest, InsertsMatch) {
+  rebuild(0.1, 100, 1);
+  ASSERT_EQ(hitset->impl->get_type(), HitSet::TYPE_BLOCKED_BLOOM);
+  fill(50);
+  EXPECT_GE(hitset->approx_unique_insert_count(), 40u);
+  EXPECT_LE(hitset->approx_unique_insert_count(), 50u);
+  verify_fill(50);
+  EXPECT_FALSE(hitset->is_full());
+}
+
+TEST_F(BlockedBloomHitSetTest, FillsUp) {
+  rebuild(0.1, 20, 1);
+  fill(20);
+  verify_fill(20);
+  EXPECT_TRUE(hitset->is_full());
+}
+
+TEST_F(BlockedBloomHitSetTest, RejectsNoMatch) {
+  rebuild(0.001, 1000, 1);
+  fill(1000);
+  verify_fill(1000);
+  EXPECT_TRUE(hitset->is_full());
+
+  char buf[50];
+  int matches = 0;
+  for (int i = 1000; i < 11000; ++i) {
+    sprintf(buf, "hitsettest_%d", i);
+    hobject_t obj(object_t(buf), "", 0, i, 0, "");
+    if (hitset->contains(obj))
+      ++matches;
+  }
+  // 1 in 1000 false positives; allow for some noise
+  EXPECT_LT(matches, 30);
+}
+
+TEST_F(BlockedBloomHitSetTest, SealShrinks) {
+  rebuild(0.01, 10000, 1);
+  fill(100);
+  bufferlist before;
+  hitset->encode(before);
+  hitset->seal();
+  bufferlist after;
+  hitset->encode(after);
+  EXPECT_LT(after.length() * 8, before.length());
+  verify_fill(100);
+
+  HitSet decoded;
+  bufferlist::iterator p = after.begin();
+  decoded.decode(p);
+  ASSERT_EQ(decoded.impl->get_type(), HitSet::TYPE_BLOCKED_BLOOM);
+  EXPECT_EQ(100u, decoded.insert_count());
+  HitSetTestStrap(&decoded).verify_fill(100);
+}
+
 class ExplicitHashHitSetTest : public testing::Test, public HitSetTestStrap {
 public:
 
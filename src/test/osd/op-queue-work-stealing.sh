@@ -0,0 +1,105 @@
+#!/usr/bin/env bash
+#
+# With osd_op_queue_work_stealing, ops of a PG whose shard is backed up
+# may be run by the threads of other shards.  They still go through the
+# PG's own pg_slot, so each PG's ops must complete in the order they
+# were sent: ceph_test_rados fails on any write acked out of order.
+# Threads of idle shards must also pick up the work of a hot shard that
+# holds several busy PGs.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+set -e
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7228" # git grep '\<7228\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    set -e
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+	$func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function TEST_stolen_ops_keep_pg_order() {
+    local dir=$1
+    local osd_args="--osd-op-queue-work-stealing=true"
+    osd_args+=" --osd-op-num-shards=8 --osd-op-num-threads-per-shard=1"
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    for id in 0 1 2 ; do
+        run_osd $dir $id $osd_args || return 1
+    done
+
+    # a single pg keeps one shard of each osd busy and leaves the
+    # other seven idle.  they may only take the pg's next op while none
+    # is running, so how often they do is up to timing;
+    # TEST_hot_shard_is_shared checks that they steal at all
+    create_pool steal 1 1 || return 1
+    wait_for_clean || return 1
+
+    ceph_test_rados --pool steal --max-ops 4000 --objects 20 \
+        --max-in-flight 64 --size 65536 \
+        --op read 100 --op write 100 --op append 50 --op delete 10 \
+        || return 1
+}
+
+function TEST_hot_shard_is_shared() {
+    local dir=$1
+    local osd_args="--osd-op-queue-work-stealing=true"
+    osd_args+=" --osd-op-num-shards=8 --osd-op-num-threads-per-shard=1"
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    for id in 0 1 2 ; do
+        run_osd $dir $id $osd_args || return 1
+    done
+
+    # a pg is on shard ps % 8, so of 32 pgs, 0, 8, 16 and 24 share
+    # shard 0.  keep only that shard busy: a thief never takes an item
+    # of a pg that is already running, so it only has something to do
+    # if the hot shard has more than one pg queued.
+    create_pool hot 32 32 || return 1
+    wait_for_clean || return 1
+    local -a objs
+    local -i i=0
+    while (( ${#objs[*]} < 8 )) ; do
+        local ps=$(get_pg hot obj$i | cut -d. -f2)
+        if (( 0x$ps % 8 == 0 )) ; then
+            objs+=(obj$i)
+        fi
+        i+=1
+    done
+
+    local payload=$dir/payload
+    dd if=/dev/urandom of=$payload bs=64k count=1 2>/dev/null
+    local -a pids
+    for obj in ${objs[*]} ; do
+        ( for n in $(seq 1 50) ; do
+              rados -p hot put $obj $payload || exit 1
+          done ) &
+        pids+=($!)
+    done
+    for pid in ${pids[*]} ; do
+        wait $pid || return 1
+    done
+    for obj in ${objs[*]} ; do
+        rados -p hot get $obj $dir/out || return 1
+        cmp $payload $dir/out || return 1
+    done
+
+    grep -q "_steal taking an item of shard 0" $dir/osd.*.log || return 1
+}
+
+main op-queue-work-stealing "$@"
+
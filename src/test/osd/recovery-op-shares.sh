@@ -0,0 +1,136 @@
+#!/usr/bin/env bash
+#
+# Small objects are charged a fraction of a recovery op (see
+# OSDService::get_recovery_op_cost), and each PG remembers what it was
+# charged in recovery_op_costs.  Whether the pushes complete or are
+# cancelled by an interval change, every share taken by
+# start_recovery_op must be given back by finish_recovery_op.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+set -e
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7233" # git grep '\<7233\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    export objects=200
+    export poolname=test
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+	$func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+# sum the shares an osd took and gave back, as logged by OSDService
+function shares_taken() {
+    local log=$1
+    sed -n -e 's/.* start_recovery_op .* cost \([0-9]*\)\/.*/\1/p' $log |
+        awk '{ s += $1 } END { print s + 0 }'
+}
+
+function shares_returned() {
+    local log=$1
+    local dequeue=${2:-[01]}
+    sed -n -e "s/.* finish_recovery_op .* cost \([0-9]*\)\/[0-9]* dequeue=$dequeue .*/\1/p" $log |
+        awk '{ s += $1 } END { print s + 0 }'
+}
+
+function check_drained() {
+    local dir=$1
+
+    for log in $dir/osd.*.log ; do
+        local taken=$(shares_taken $log)
+        local returned=$(shares_returned $log)
+        echo "$log: $taken shares taken, $returned returned"
+        test $taken = $returned || return 1
+    done
+}
+
+# leave $objects small objects missing on one replica, with recovery
+# held off by norecover; that replica's id is left in $dir/otherosd
+function make_degraded() {
+    local dir=$1
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    for id in 0 1 2 ; do
+        run_osd $dir $id || return 1
+    done
+    create_pool $poolname 1 1 || return 1
+    wait_for_clean || return 1
+
+    local otherosd=$(get_not_primary $poolname obj1)
+    echo $otherosd > $dir/otherosd
+    ceph osd set noout || return 1
+    ceph osd set norecover || return 1
+    kill_daemons $dir TERM osd.$otherosd || return 1
+    ceph osd down osd.$otherosd || return 1
+
+    local payload=$dir/payload
+    dd if=/dev/urandom of=$payload bs=4k count=1 2>/dev/null
+    for i in $(seq 1 $objects) ; do
+        rados -p $poolname put obj$i $payload || return 1
+    done
+
+    activate_osd $dir $otherosd || return 1
+    wait_for_osd up $otherosd || return 1
+}
+
+function TEST_recovery_op_shares_complete() {
+    local dir=$1
+
+    make_degraded $dir || return 1
+    local primary=$(get_primary $poolname obj1)
+
+    ceph osd unset norecover || return 1
+    wait_for_clean || return 1
+
+    # 4k objects cost less than a full op, so some of them were batched
+    sed -n -e 's/.* start_recovery_op .* cost \([0-9]*\)\/\([0-9]*\) .*/\1 \2/p' \
+        $dir/osd.$primary.log | awk '$1 < $2 { found = 1 } END { exit !found }' \
+        || return 1
+    check_drained $dir || return 1
+}
+
+function TEST_recovery_op_shares_cancelled() {
+    local dir=$1
+
+    make_degraded $dir || return 1
+    local otherosd=$(cat $dir/otherosd)
+    local primary=$(get_primary $poolname obj1)
+    local log=$dir/osd.$primary.log
+
+    # the stopped replica never acks its pushes, so they are still in
+    # flight when it is marked down and the primary starts a new interval
+    kill -STOP $(cat $dir/osd.$otherosd.pid)
+    ceph osd unset norecover || return 1
+    local -a delays=($(get_timeout_delays $TIMEOUT .1))
+    local -i loop=0
+    while ! grep -q " start_recovery_op .* cost " $log ; do
+        if (( $loop >= ${#delays[*]} )) ; then
+            kill -CONT $(cat $dir/osd.$otherosd.pid)
+            return 1
+        fi
+        sleep ${delays[$loop]}
+        loop+=1
+    done
+    ceph osd down osd.$otherosd || return 1
+    kill -CONT $(cat $dir/osd.$otherosd.pid)
+    wait_for_osd up $otherosd || return 1
+    wait_for_clean || return 1
+
+    grep -q "clear_recovery_state" $log || return 1
+    test $(shares_returned $log 1) -gt 0 || return 1
+    check_drained $dir || return 1
+}
+
+main recovery-op-shares "$@"
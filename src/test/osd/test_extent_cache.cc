@@ -278,3 +278,85 @@ TEST(extentcache, write_write_overlap2)
 
   c.release_write_pin(pin3);
 }
+
+TEST(stripecache, update_and_lookup)
+{
+  hobject_t oid;
+  StripeCache c(4);
+  c.set_max_bytes(1024);
+
+  auto written = imap_from_iset(iset_from_vector({{0, 16}}));
+  // only the stripes that were read are kept
+  c.update(oid, 1, written, iset_from_vector({{0, 4}, {8, 4}}));
+  ASSERT_EQ(8u, c.get_bytes());
+
+  extent_map found;
+  auto missing = c.lookup(oid, iset_from_vector({{0, 12}}), &found);
+  ASSERT_EQ(iset_from_vector({{4, 4}}), missing);
+  ASSERT_EQ(iset_from_vector({{0, 4}, {8, 4}}), found.get_interval_set());
+
+  // a write that does not keep a stripe drops it
+  c.update(oid, 2, imap_from_iset(iset_from_vector({{8, 4}})), extent_set());
+  ASSERT_EQ(4u, c.get_bytes());
+  found.clear();
+  missing = c.lookup(oid, iset_from_vector({{8, 4}}), &found);
+  ASSERT_EQ(iset_from_vector({{8, 4}}), missing);
+  ASSERT_TRUE(found.empty());
+
+  hobject_t other;
+  other.oid.name = "other";
+  found.clear();
+  missing = c.lookup(other, iset_from_vector({{0, 4}}), &found);
+  ASSERT_EQ(iset_from_vector({{0, 4}}), missing);
+}
+
+TEST(stripecache, lru)
+{
+  hobject_t oid;
+  StripeCache c(4);
+  c.set_max_bytes(8);
+
+  c.update(oid, 1, imap_from_iset(iset_from_vector({{0, 8}})),
+	   iset_from_vector({{0, 8}}));
+  ASSERT_EQ(8u, c.get_bytes());
+
+  // touch 0~4 so that 4~4 is the least recently used
+  extent_map found;
+  c.lookup(oid, iset_from_vector({{0, 4}}), &found);
+  c.update(oid, 2, imap_from_iset(iset_from_vector({{8, 4}})),
+	   iset_from_vector({{8, 4}}));
+  ASSERT_EQ(8u, c.get_bytes());
+  found.clear();
+  auto missing = c.lookup(oid, iset_from_vector({{0, 12}}), &found);
+  ASSERT_EQ(iset_from_vector({{4, 4}}), missing);
+
+  c.set_max_bytes(0);
+  ASSERT_EQ(0u, c.get_bytes());
+  c.update(oid, 3, imap_from_iset(iset_from_vector({{0, 4}})),
+	   iset_from_vector({{0, 4}}));
+  ASSERT_EQ(0u, c.get_bytes());
+}
+
+TEST(stripecache, forget)
+{
+  hobject_t oid;
+  StripeCache c(4);
+  c.set_max_bytes(1024);
+
+  c.update(oid, 1, imap_from_iset(iset_from_vector({{0, 8}})),
+	   iset_from_vector({{0, 8}}));
+  // write 3 truncates the object while write 2, queued before it, is
+  // still in flight
+  c.forget(oid, 3);
+  ASSERT_EQ(0u, c.get_bytes());
+  c.update(oid, 2, imap_from_iset(iset_from_vector({{8, 4}})),
+	   iset_from_vector({{8, 4}}));
+  ASSERT_EQ(0u, c.get_bytes());
+  c.update(oid, 3, extent_map(), extent_set());
+  c.update(oid, 4, imap_from_iset(iset_from_vector({{8, 4}})),
+	   iset_from_vector({{8, 4}}));
+  ASSERT_EQ(4u, c.get_bytes());
+
+  c.clear();
+  ASSERT_EQ(0u, c.get_bytes());
+}